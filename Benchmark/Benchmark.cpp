@@ -0,0 +1,483 @@
+﻿#include "SparseInferenceNetwork.h"
+#include "ConvolutionalLayer.h"
+#include "Sampler.h"
+#include "Platform.h"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+typedef double Floating;
+
+// 計測結果を表します。1 回の反復あたりの処理量と計測時間から各スループットを計算します。
+struct BenchmarkResult
+{
+	std::string Name;
+	unsigned int Threads;
+	double SecondsPerIteration;
+	double SamplesPerIteration;
+	double FlopsPerIteration;
+	double BytesPerIteration;
+
+	double SamplesPerSecond() const { return SamplesPerIteration / SecondsPerIteration; }
+	double GigaFlopsPerSecond() const { return FlopsPerIteration / SecondsPerIteration * 1e-9; }
+	double GigaBytesPerSecond() const { return BytesPerIteration / SecondsPerIteration * 1e-9; }
+};
+
+struct BenchmarkOptions
+{
+	double MinSeconds = 0.2;
+	bool Quick = false;
+	bool ThreadScaling = true;
+	double Threshold = 0.10;
+	std::string BaselinePath;
+	std::string WriteBaselinePath;
+	std::string OutputPath;
+	std::string DataDirectory = "BenchmarkData";
+};
+
+volatile double Sink;
+
+unsigned int MaxThreads() { return Platform::ProcessorCount(); }
+
+void SetThreads(unsigned int threads) { ThreadPool::Configure(ThreadPoolOptions(threads)); }
+
+class BenchmarkRunner final : private boost::noncopyable
+{
+public:
+	explicit BenchmarkRunner(const BenchmarkOptions& options) : options(options), threads(MaxThreads()) { }
+
+	void SetThreadCount(unsigned int count)
+	{
+		threads = count;
+		SetThreads(count);
+	}
+
+	// 最低計測時間に達するまで反復し、反復あたりの時間が最も短いバッチを結果とします。
+	template <class TFunction> const BenchmarkResult& Run(const std::string& name, double samples, double flops, double bytes, TFunction function)
+	{
+		function();
+		double best = std::numeric_limits<double>::infinity();
+		double total = 0;
+		for (size_t batch = 1; total < options.MinSeconds || best == std::numeric_limits<double>::infinity(); batch *= 2)
+		{
+			auto start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < batch; i++)
+				function();
+			auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			total += seconds;
+			best = (std::min)(best, seconds / batch);
+		}
+		results.push_back(BenchmarkResult{ name, threads, best, samples, flops, bytes });
+		Print(results.back());
+		return results.back();
+	}
+
+	const std::vector<BenchmarkResult>& Results() const { return results; }
+
+private:
+	const BenchmarkOptions& options;
+	unsigned int threads;
+	std::vector<BenchmarkResult> results;
+
+	static void Print(const BenchmarkResult& result)
+	{
+		std::cout << boost::format("%-36s %3u thr %12.1f samples/s %9.3f GFLOP/s %9.3f GB/s")
+			% result.Name % result.Threads % result.SamplesPerSecond() % result.GigaFlopsPerSecond() % result.GigaBytesPerSecond() << std::endl;
+	}
+};
+
+std::valarray<Floating> RandomVector(std::mt19937& rng, size_t length)
+{
+	std::uniform_real_distribution<Floating> distribution(0, 1);
+	std::valarray<Floating> result(length);
+	for (size_t i = 0; i < length; i++)
+		result[i] = distribution(rng);
+	return result;
+}
+
+DataSet<Floating> SyntheticDataSet(std::mt19937& rng, size_t length, unsigned int row, unsigned int column, unsigned int components, unsigned int classes)
+{
+	DataSet<Floating> dataset;
+	dataset.Allocate(length, row, column, components);
+	for (size_t i = 0; i < length; i++)
+	{
+		dataset.Labels()[i] = static_cast<unsigned int>(rng() % classes);
+		dataset.Images()[i] = RandomVector(rng, dataset.AllComponents());
+	}
+	return dataset;
+}
+
+void RunKernels(BenchmarkRunner& runner, const BenchmarkOptions& options)
+{
+	std::mt19937 rng(89677);
+	const size_t nIn = FixedDimension::Image28x28;
+	const size_t nOut = options.Quick ? 100 : 500;
+	const double elementSize = sizeof(Floating);
+
+	Matrix<Floating> weight(nOut, nIn);
+	for (size_t i = 0; i < nOut; i++)
+	{
+		for (size_t j = 0; j < nIn; j++)
+			weight(i, j) = std::uniform_real_distribution<Floating>(-0.1, 0.1)(rng);
+	}
+	auto bias = RandomVector(rng, nOut);
+	auto visibleBias = RandomVector(rng, nIn);
+	auto input = RandomVector(rng, nIn);
+	auto latent = RandomVector(rng, nOut);
+
+	runner.Run("NeuronComputer", 1, 2.0 * nOut * nIn, elementSize * (nOut * nIn + nIn + 2 * nOut), [&]
+	{
+		NeuronComputer<Matrix<Floating>, std::valarray<Floating>> computer(weight, bias, input);
+		Floating sum = 0;
+		for (size_t i = 0; i < computer.size(); i++)
+			sum += computer[i];
+		Sink = sum;
+	});
+	runner.Run("TransposedMatrixView", 1, 2.0 * nOut * nIn, elementSize * (nOut * nIn + nOut + 2 * nIn), [&]
+	{
+		auto transposed = TransposedMatrixView<Floating>::From(weight);
+		NeuronComputer<TransposedMatrixView<Floating>, std::valarray<Floating>> computer(transposed, visibleBias, latent);
+		Floating sum = 0;
+		for (size_t i = 0; i < computer.size(); i++)
+			sum += computer[i];
+		Sink = sum;
+	});
+
+	const size_t activationLength = 1 << 16;
+	auto activationInput = RandomVector(rng, activationLength);
+	activationInput -= static_cast<Floating>(0.5);
+	runner.Run("LogisticSigmoid", 1, 4.0 * activationLength, 2 * elementSize * activationLength, [&] { Sink = ActivationFunction::LogisticSigmoid(activationInput)[0]; });
+	runner.Run("SoftMax", 1, 5.0 * activationLength, 4 * elementSize * activationLength, [&] { Sink = ActivationFunction::SoftMax(activationInput)[0]; });
+	auto source = ActivationFunction::LogisticSigmoid(activationInput);
+	auto target = RandomVector(rng, activationLength);
+	runner.Run("BiClassCrossEntropy", 1, 8.0 * activationLength, 2 * elementSize * activationLength, [&] { Sink = CostFunction::BiClassCrossEntropy(source, target); });
+}
+
+void RunTraining(BenchmarkRunner& runner, const BenchmarkOptions& options)
+{
+	std::mt19937 rng(89677);
+	const unsigned int classes = 10;
+	const size_t samples = options.Quick ? 20 : 100;
+	const size_t nOut = options.Quick ? 100 : 500;
+	const double elementSize = sizeof(Floating);
+	auto dataset = SyntheticDataSet(rng, samples, 28, 28, 1, classes);
+	const double nIn = dataset.AllComponents();
+
+	StackedDenoisingAutoEncoder<Floating> sda(89677, dataset.AllComponents());
+	sda.HiddenLayers.Set(0, nOut);
+	sda.HiddenLayers.Set(1, nOut / 5);
+	sda.SetLogisticRegressionLayer(classes);
+
+	auto input = dataset.Images()[0];
+	auto output = sda.HiddenLayers[0].Compute(input);
+	auto upperInfo = RandomVector(rng, nOut);
+	runner.Run("LearnLayer", 1, 5.0 * nOut * nIn, 2 * elementSize * nOut * nIn, [&]
+	{
+		Sink = LearnLayer(sda.HiddenLayers[0], input, output, upperInfo, static_cast<Floating>(1e-6))[0];
+	});
+
+	runner.Run("HiddenLayer::Train", static_cast<double>(samples), 11.0 * samples * nOut * nIn, 5 * elementSize * samples * nOut * nIn, [&]
+	{
+		Sink = sda.HiddenLayers[0].Train(dataset, static_cast<Floating>(1e-6), static_cast<Floating>(0.1));
+	});
+
+	double fineTuneMacs = nOut * nIn + (nOut / 5) * nOut + classes * (nOut / 5);
+	runner.Run("FineTune", static_cast<double>(samples), 7.0 * samples * fineTuneMacs, 3 * elementSize * samples * fineTuneMacs, [&]
+	{
+		sda.FineTune(dataset, static_cast<Floating>(1e-6));
+	});
+
+	runner.Run("FineTune/Pipeline", static_cast<double>(samples), 7.0 * samples * fineTuneMacs, 3 * elementSize * samples * fineTuneMacs, [&]
+	{
+		sda.FineTune(dataset, static_cast<Floating>(1e-6), PipelineOptions(0, 4, 1));
+	});
+
+	runner.Run("Predict/Dense", static_cast<double>(samples), 2.0 * samples * fineTuneMacs, elementSize * samples * fineTuneMacs, [&]
+	{
+		Sink = sda.ComputeErrorRates<Floating>(dataset);
+	});
+
+	const double sparsity = 0.9;
+	sda.Prune(sparsity);
+	SparseInferenceNetwork<Floating> sparse(sda);
+	runner.Run("Predict/Sparse", static_cast<double>(samples), 2.0 * (1 - sparsity) * samples * fineTuneMacs, (elementSize + sizeof(uint32_t)) * (1 - sparsity) * samples * fineTuneMacs, [&]
+	{
+		Sink = sparse.ComputeErrorRates<Floating>(dataset);
+	});
+
+	// 畳み込み層は Cifar-10 と同じ形状の画像に 5 × 5 のフィルタを適用する
+	auto images = SyntheticDataSet(rng, samples, 32, 32, 3, classes);
+	const size_t filters = 16;
+	StackedDenoisingAutoEncoder<Floating, ConvolutionalHiddenLayer<Floating>> cnn(89677, FeatureShape::Of(images));
+	cnn.HiddenLayers.Set(0, filters);
+	const double convolutionMacs = 28.0 * 28.0 * filters * 5 * 5 * 3;
+	auto& convolution = cnn.HiddenLayers[0];
+	runner.Run("ConvolutionalHiddenLayer::Compute", static_cast<double>(samples), 2.0 * samples * convolutionMacs, elementSize * samples * images.AllComponents(), [&]
+	{
+		for (auto& image : images.Images())
+			Sink = convolution.Compute(image)[0];
+	});
+
+	runner.Run("ConvolutionalHiddenLayer::Train", static_cast<double>(samples), 10.0 * samples * convolutionMacs, 3 * elementSize * samples * images.AllComponents(), [&]
+	{
+		Sink = convolution.Train(images, static_cast<Floating>(1e-6), static_cast<Floating>(0.1));
+	});
+
+	DataSetView<Floating> view(dataset);
+	EpochSampler<Floating> sampler(view, 10, 16, 89677);
+	runner.Run("EpochSampler::NextEpoch", static_cast<double>(samples), 0, 2.0 * sizeof(size_t) * samples, [&]
+	{
+		Sink = sampler.Batch(sampler.NextEpoch(), 0).Image(0)[0];
+	});
+}
+
+void WriteBigEndian(std::ofstream& stream, uint32_t value)
+{
+	unsigned char bytes[] = { static_cast<unsigned char>(value >> 24), static_cast<unsigned char>(value >> 16), static_cast<unsigned char>(value >> 8), static_cast<unsigned char>(value) };
+	stream.write(pointer_cast<char>(bytes), sizeof(bytes));
+}
+
+void WriteLittleEndian(std::ofstream& stream, uint32_t value) { stream.write(pointer_cast<char>(&value), sizeof(value)); }
+
+void WriteRandomBytes(std::ofstream& stream, std::mt19937& rng, size_t length, unsigned int modulo)
+{
+	std::vector<char> buffer(length);
+	for (auto& item : buffer)
+		item = static_cast<char>(rng() % modulo);
+	stream.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+}
+
+// 各ローダーの形式で合成データを書き出し、その読み込み時間を計測します。
+void RunLoaders(BenchmarkRunner& runner, const BenchmarkOptions& options)
+{
+	std::mt19937 rng(89677);
+	const uint32_t records = options.Quick ? 500 : 5000;
+	const std::string root = options.DataDirectory;
+	Platform::MakeDirectory(root);
+
+	auto mnist = root + "/MNIST";
+	Platform::MakeDirectory(mnist);
+	for (auto name : { "/train", "/t10k" })
+	{
+		std::ofstream labels(mnist + name + "-labels.idx1-ubyte", std::ios::binary);
+		WriteBigEndian(labels, 0x801);
+		WriteBigEndian(labels, records);
+		WriteRandomBytes(labels, rng, records, 10);
+		std::ofstream images(mnist + name + "-images.idx3-ubyte", std::ios::binary);
+		WriteBigEndian(images, 0x803);
+		WriteBigEndian(images, records);
+		WriteBigEndian(images, 28);
+		WriteBigEndian(images, 28);
+		WriteRandomBytes(images, rng, records * 28 * 28, 256);
+	}
+	runner.Run("MnistLoader", 2.0 * records, 0, 2.0 * records * (1 + 28 * 28), [&] { Sink = MnistLoader<Floating>().Load(mnist).TrainingData().Image(0)[0]; });
+
+	auto cifar = root + "/cifar-10";
+	Platform::MakeDirectory(cifar);
+	const uint32_t cifarRecords = 10000;
+	for (auto name : { "/data_batch_1.bin", "/test_batch.bin" })
+	{
+		std::ofstream file(cifar + name, std::ios::binary);
+		WriteRandomBytes(file, rng, cifarRecords * (1 + 32 * 32 * 3), 256);
+	}
+	runner.Run("Cifar10Loader", 2.0 * cifarRecords, 0, 2.0 * cifarRecords * (1 + 32 * 32 * 3), [&] { Sink = Cifar10Loader<Floating>().Load(cifar).TrainingData().Image(0)[0]; });
+
+	auto caltech = root + "/Caltech101Silhouettes";
+	Platform::MakeDirectory(caltech);
+	for (auto name : { "/train", "/valid", "/test" })
+	{
+		std::ofstream labels(caltech + name + "_labels.bin", std::ios::binary);
+		WriteLittleEndian(labels, records);
+		WriteRandomBytes(labels, rng, records, 101);
+		std::ofstream images(caltech + name + "_images.bin", std::ios::binary);
+		WriteLittleEndian(images, records);
+		WriteLittleEndian(images, 28 * 28);
+		WriteRandomBytes(images, rng, records * 28 * 28, 2);
+	}
+	runner.Run("Caltech101SilhouettesLoader", 3.0 * records, 0, 3.0 * records * (1 + 28 * 28), [&] { Sink = Caltech101SilhouettesLoader<Floating>().Load(caltech).TrainingData().Image(0)[0]; });
+
+	auto pr = root + "/PR";
+	Platform::MakeDirectory(pr);
+	double prBytes = 0;
+	for (auto name : { "/pattern2learn.dat", "/pattern2recog.dat" })
+	{
+		std::ofstream file(pr + name);
+		for (uint32_t i = 0; i < records; i++)
+		{
+			file << rng() % 10;
+			for (unsigned int j = 0; j < 7 * 5; j++)
+				file << "," << rng() % 2;
+			file << "\n";
+		}
+		prBytes += static_cast<double>(file.tellp());
+	}
+	runner.Run("PatternRecognitionLoader", 2.0 * records, 0, prBytes, [&] { Sink = PatternRecognitionLoader<Floating>().Load(pr).TrainingData().Image(0)[0]; });
+}
+
+void RunThreadScaling(BenchmarkRunner& runner, const BenchmarkOptions& options)
+{
+	std::mt19937 rng(89677);
+	const size_t activationLength = 1 << 16;
+	auto activationInput = RandomVector(rng, activationLength);
+	auto dataset = SyntheticDataSet(rng, options.Quick ? 10 : 50, 28, 28, 1, 10);
+	StackedDenoisingAutoEncoder<Floating> sda(89677, dataset.AllComponents());
+	sda.HiddenLayers.Set(0, options.Quick ? 100 : 500);
+	const double nOut = static_cast<double>(sda.HiddenLayers[0].Weight.Row());
+	const double nIn = dataset.AllComponents();
+	const double samples = static_cast<double>(dataset.Images().size());
+
+	std::vector<unsigned int> counts;
+	for (unsigned int threads = 1; threads < MaxThreads(); threads *= 2)
+		counts.push_back(threads);
+	counts.push_back(MaxThreads());
+	for (auto threads : counts)
+	{
+		runner.SetThreadCount(threads);
+		// 基準値の名前がホストのコア数に依存しないように、単一スレッド以外ですべての論理プロセッサを使用する計測は "@all" とする
+		auto suffix = threads > 1 && threads == MaxThreads() ? std::string("@all") : "@" + std::to_string(threads);
+		runner.Run("Scaling/LogisticSigmoid" + suffix, 1, 4.0 * activationLength, 2.0 * sizeof(Floating) * activationLength, [&] { Sink = ActivationFunction::LogisticSigmoid(activationInput)[0]; });
+		runner.Run("Scaling/SoftMax" + suffix, 1, 5.0 * activationLength, 4.0 * sizeof(Floating) * activationLength, [&] { Sink = ActivationFunction::SoftMax(activationInput)[0]; });
+		runner.Run("Scaling/HiddenLayer::Train" + suffix, samples, 11.0 * samples * nOut * nIn, 5.0 * sizeof(Floating) * samples * nOut * nIn, [&]
+		{
+			Sink = sda.HiddenLayers[0].Train(dataset, static_cast<Floating>(1e-6), static_cast<Floating>(0.1));
+		});
+	}
+	runner.SetThreadCount(MaxThreads());
+}
+
+// 計測の規模が異なるため、--quick の結果は別の項目に格納して比較します。
+const char* ResultsKey(const BenchmarkOptions& options) { return options.Quick ? "quick_results" : "results"; }
+
+// 計測名は '.' を含んでも階層として解釈しないようにします。
+boost::property_tree::ptree::path_type ResultPath(const std::string& name) { return boost::property_tree::ptree::path_type(name, '\0'); }
+
+boost::property_tree::ptree ToTree(const std::vector<BenchmarkResult>& results)
+{
+	boost::property_tree::ptree tree;
+	for (auto& result : results)
+	{
+		boost::property_tree::ptree item;
+		item.put("samples_per_second", result.SamplesPerSecond());
+		item.put("gflops_per_second", result.GigaFlopsPerSecond());
+		item.put("gbytes_per_second", result.GigaBytesPerSecond());
+		tree.add_child(ResultPath(result.Name), item);
+	}
+	return tree;
+}
+
+// 基準値と比較し、しきい値を超えてスループットが低下した計測の数を返します。
+// 基準ファイルの各項目は "threshold" で個別のしきい値を指定できます。
+unsigned int CompareWithBaseline(const std::vector<BenchmarkResult>& results, const BenchmarkOptions& options)
+{
+	boost::property_tree::ptree baseline;
+	boost::property_tree::read_json(options.BaselinePath, baseline);
+	auto defaultThreshold = baseline.get<double>("threshold", options.Threshold);
+	unsigned int regressions = 0;
+	std::cout << std::endl << "Comparison with " << options.BaselinePath << " (" << ResultsKey(options) << "):" << std::endl;
+	auto items = baseline.get_child_optional(ResultsKey(options));
+	if (!items)
+	{
+		std::cout << "no baseline for this mode; skipped" << std::endl;
+		return 0;
+	}
+	for (auto& result : results)
+	{
+		auto item = items->get_child_optional(ResultPath(result.Name));
+		if (!item)
+		{
+			std::cout << boost::format("%-40s %9s no baseline") % result.Name % "" << std::endl;
+			continue;
+		}
+		auto expected = item->get<double>("samples_per_second");
+		auto threshold = item->get<double>("threshold", defaultThreshold);
+		auto ratio = result.SamplesPerSecond() / expected;
+		auto regressed = ratio < 1 - threshold;
+		if (regressed)
+			regressions++;
+		std::cout << boost::format("%-40s %8.3fx %s") % result.Name % ratio % (regressed ? "REGRESSION" : "ok") << std::endl;
+	}
+	return regressions;
+}
+
+void ShowUsage()
+{
+	std::cout << "Usage: NeuralNetworkBenchmark [--quick] [--no-scaling] [--min-seconds S] [--threshold T]" << std::endl
+		<< "                              [--baseline FILE] [--write-baseline FILE] [--output FILE] [--data-dir DIR]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	BenchmarkOptions options;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		auto next = [&]() -> std::string
+		{
+			if (i + 1 >= argc)
+				throw std::invalid_argument(arg + " requires a value");
+			return argv[++i];
+		};
+		if (arg == "--quick")
+		{
+			options.Quick = true;
+			options.MinSeconds = 0.02;
+		}
+		else if (arg == "--no-scaling")
+			options.ThreadScaling = false;
+		else if (arg == "--min-seconds")
+			options.MinSeconds = std::stod(next());
+		else if (arg == "--threshold")
+			options.Threshold = std::stod(next());
+		else if (arg == "--baseline")
+			options.BaselinePath = next();
+		else if (arg == "--write-baseline")
+			options.WriteBaselinePath = next();
+		else if (arg == "--output")
+			options.OutputPath = next();
+		else if (arg == "--data-dir")
+			options.DataDirectory = next();
+		else
+		{
+			ShowUsage();
+			return arg == "--help" ? 0 : 2;
+		}
+	}
+
+	BenchmarkRunner runner(options);
+	RunKernels(runner, options);
+	RunTraining(runner, options);
+	RunLoaders(runner, options);
+	if (options.ThreadScaling)
+		RunThreadScaling(runner, options);
+
+	if (!options.OutputPath.empty())
+	{
+		boost::property_tree::ptree tree;
+		tree.add_child(ResultsKey(options), ToTree(runner.Results()));
+		boost::property_tree::write_json(options.OutputPath, tree);
+	}
+	// 既存の基準ファイルは、もう一方のモードの結果と個別のしきい値を残して、このモードの結果のみを置き換える
+	if (!options.WriteBaselinePath.empty())
+	{
+		boost::property_tree::ptree tree;
+		if (std::ifstream(options.WriteBaselinePath))
+			boost::property_tree::read_json(options.WriteBaselinePath, tree);
+		auto results = ToTree(runner.Results());
+		if (auto previous = tree.get_child_optional(ResultsKey(options)))
+		{
+			for (auto& item : results)
+			{
+				auto old = previous->get_child_optional(ResultPath(item.first));
+				if (old && old->get_optional<double>("threshold"))
+					item.second.put("threshold", old->get<double>("threshold"));
+			}
+		}
+		tree.put_child(ResultsKey(options), results);
+		if (!tree.get_optional<double>("threshold"))
+			tree.put("threshold", options.Threshold);
+		boost::property_tree::write_json(options.WriteBaselinePath, tree);
+	}
+	if (!options.BaselinePath.empty() && CompareWithBaseline(runner.Results(), options) > 0)
+		return 1;
+	return 0;
+}
@@ -0,0 +1,180 @@
+﻿#pragma once
+
+#include "LearningSet.h"
+
+/// <summary>学習データの拡張方法を表します。</summary>
+struct AugmentationOptions final
+{
+	AugmentationOptions(bool horizontalFlip = false, unsigned int maxShift = 0, double noiseDeviation = 0, size_t chunkSize = 1024, size_t prefetch = 4, unsigned int workers = 1) :
+		HorizontalFlip(horizontalFlip), MaxShift(maxShift), NoiseDeviation(noiseDeviation), ChunkSize(chunkSize), Prefetch(prefetch), Workers(workers) { }
+
+	/// <summary>1/2 の確率で画像を左右反転するかどうかを示します。</summary>
+	bool HorizontalFlip;
+	/// <summary>画像を垂直および水平方向に平行移動する最大の画素数を示します。はみ出した部分は捨てられ、空いた部分は 0 で埋められます。周囲を埋めてから元の大きさで切り出すことと同じです。</summary>
+	unsigned int MaxShift;
+	/// <summary>各要素に加える正規雑音の標準偏差を示します。雑音を加えた値は [0, 1] に収められます。</summary>
+	double NoiseDeviation;
+	/// <summary>1 つのチャンクに含まれるデータ点の数を示します。</summary>
+	size_t ChunkSize;
+	/// <summary>訓練に渡される前に生成しておくチャンクの最大数を示します。</summary>
+	size_t Prefetch;
+	/// <summary>チャンクを生成する背景のスレッドの数を示します。</summary>
+	unsigned int Workers;
+
+	/// <summary>いずれかの拡張が有効であるかどうかを返します。</summary>
+	bool Enabled() const { return HorizontalFlip || MaxShift > 0 || NoiseDeviation > 0; }
+};
+
+/// <summary>
+/// データセットを順にチャンクに分割し、各データ点を拡張したチャンクを背景のスレッドで生成します。
+/// 拡張されたデータ点は訓練に渡されるまでの間のみ保持されるため、同時に存在するのは <see cref="AugmentationOptions::Prefetch"/> 個のチャンクまでです。
+/// 各チャンクの乱数生成器はシード値とチャンクの番号から初期化されるため、生成される結果はスレッドの数や実行の順序に依存しません。
+/// </summary>
+template <class TValue> class AugmentationPipeline final : private boost::noncopyable
+{
+public:
+	/// <summary><see cref="AugmentationPipeline"/> クラスの新しいインスタンスを初期化し、チャンクの生成を開始します。</summary>
+	/// <param name="dataset">拡張するデータセットを指定します。チャンクはこの順序で生成されます。</param>
+	/// <param name="options">拡張方法を指定します。</param>
+	/// <param name="rngSeed">拡張に使用される乱数生成器のシード値を指定します。</param>
+	AugmentationPipeline(const DataSetView<TValue>& dataset, const AugmentationOptions& options, std::mt19937::result_type rngSeed) :
+		dataset(dataset), options(options), rngSeed(rngSeed), chunkSize((std::max)(options.ChunkSize, static_cast<size_t>(1))), chunks((dataset.Count() + chunkSize - 1) / chunkSize), consumed(0), stopping(false)
+	{
+		for (unsigned int w = 0; w < (std::max)(options.Workers, 1u); w++)
+			workers.emplace_back([this, w] { Work(w); });
+	}
+
+	~AugmentationPipeline()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		changed.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	/// <summary>次のチャンクが生成されるのを待って取り出します。</summary>
+	/// <param name="chunk">取り出したチャンクを格納するビューを指定します。</param>
+	/// <returns>チャンクを取り出した場合は true、すべてのチャンクを取り出し終えている場合は false。</returns>
+	bool Next(DataSetView<TValue>& chunk)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (consumed >= chunks.size())
+			return false;
+		changed.wait(lock, [this] { return error || chunks[consumed].Count() > 0; });
+		if (error)
+			std::rethrow_exception(error);
+		chunk = std::move(chunks[consumed]);
+		chunks[consumed] = DataSetView<TValue>();
+		consumed++;
+		changed.notify_all();
+		return true;
+	}
+
+	/// <summary>指定された画像を拡張した画像を格納します。</summary>
+	/// <param name="image">拡張する画像を画素ごとに要素を並べた形式で指定します。</param>
+	/// <param name="rows">画像の垂直方向の長さを指定します。</param>
+	/// <param name="columns">画像の水平方向の長さを指定します。</param>
+	/// <param name="components">画像の 1 画素を示すのに必要な要素の数を指定します。</param>
+	/// <param name="options">拡張方法を指定します。</param>
+	/// <param name="rng">拡張に使用される乱数生成器を指定します。</param>
+	/// <param name="result">拡張された画像を格納する配列を指定します。<paramref name="image"/> と同じ大きさである必要があります。</param>
+	static void Augment(const std::valarray<TValue>& image, unsigned int rows, unsigned int columns, unsigned int components, const AugmentationOptions& options, std::mt19937& rng, std::valarray<TValue>& result)
+	{
+		auto flip = options.HorizontalFlip && std::bernoulli_distribution(0.5)(rng);
+		auto shift = static_cast<int>(options.MaxShift);
+		std::uniform_int_distribution<int> offset(-shift, shift);
+		auto dy = shift > 0 ? offset(rng) : 0;
+		auto dx = shift > 0 ? offset(rng) : 0;
+		for (unsigned int y = 0; y < rows; y++)
+		{
+			for (unsigned int x = 0; x < columns; x++)
+			{
+				auto sy = static_cast<int>(y) + dy;
+				auto sx = static_cast<int>(flip ? columns - 1 - x : x) + dx;
+				auto inside = sy >= 0 && sy < static_cast<int>(rows) && sx >= 0 && sx < static_cast<int>(columns);
+				for (unsigned int c = 0; c < components; c++)
+					result[(y * columns + x) * components + c] = inside ? image[(sy * columns + sx) * components + c] : static_cast<TValue>(0);
+			}
+		}
+		if (options.NoiseDeviation > 0)
+		{
+			std::normal_distribution<TValue> noise(0, static_cast<TValue>(options.NoiseDeviation));
+			for (auto& value : result)
+				value = (std::min)((std::max)(value + noise(rng), static_cast<TValue>(0)), static_cast<TValue>(1));
+		}
+	}
+
+private:
+	DataSetView<TValue> dataset;
+	AugmentationOptions options;
+	std::mt19937::result_type rngSeed;
+	size_t chunkSize;
+	std::vector<DataSetView<TValue>> chunks;
+	size_t consumed;
+	bool stopping;
+	std::exception_ptr error;
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::vector<std::thread> workers;
+
+	// 各スレッドはチャンクを番号順に分担し、取り出されていないチャンクが Prefetch 個未満になるまで次の生成を待つ
+	void Work(unsigned int worker)
+	{
+		auto workerCount = (std::max)(options.Workers, 1u);
+		auto prefetch = (std::max)(options.Prefetch, static_cast<size_t>(1));
+		for (size_t c = worker; c < chunks.size(); c += workerCount)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&] { return stopping || c < consumed + prefetch; });
+				if (stopping)
+					return;
+			}
+			try
+			{
+				auto chunk = Generate(c);
+				std::lock_guard<std::mutex> lock(mutex);
+				chunks[c] = std::move(chunk);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!error)
+					error = std::current_exception();
+			}
+			changed.notify_all();
+		}
+	}
+
+	DataSetView<TValue> Generate(size_t c) const
+	{
+		std::seed_seq seed { static_cast<std::uint32_t>(rngSeed), static_cast<std::uint32_t>(c) };
+		std::mt19937 rng(seed);
+		auto begin = c * chunkSize;
+		auto count = (std::min)(chunkSize, dataset.Count() - begin);
+		DataSet<TValue> result;
+		result.Allocate(count, dataset.Row(), dataset.Column(), dataset.ComponentsPerPixel());
+		for (size_t i = 0; i < count; i++)
+		{
+			result.Labels()[i] = dataset.Label(begin + i);
+			Augment(dataset.Image(begin + i), dataset.Row(), dataset.Column(), dataset.ComponentsPerPixel(), options, rng, result.Images()[i]);
+		}
+		return DataSetView<TValue>(std::move(result));
+	}
+};
+
+/// <summary>指定されたデータセットを拡張したチャンクを順に指定された関数に渡します。チャンクの生成は関数の実行と並行して背景のスレッドで行われます。</summary>
+/// <param name="dataset">拡張するデータセットを指定します。</param>
+/// <param name="options">拡張方法を指定します。</param>
+/// <param name="rngSeed">拡張に使用される乱数生成器のシード値を指定します。</param>
+/// <param name="body">拡張されたチャンクを受け取る関数を指定します。</param>
+template <class TValue, class TBody> void ForEachAugmentedChunk(const DataSetView<TValue>& dataset, const AugmentationOptions& options, std::mt19937::result_type rngSeed, TBody body)
+{
+	AugmentationPipeline<TValue> pipeline(dataset, options, rngSeed);
+	DataSetView<TValue> chunk;
+	while (pipeline.Next(chunk))
+		body(chunk);
+}
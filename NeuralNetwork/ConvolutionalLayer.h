@@ -0,0 +1,449 @@
+﻿#pragma once
+
+#include "Layers.h"
+
+/// <summary>
+/// 入力画像の局所領域に共有された結合重みを畳み込み、最大値プーリングを適用する隠れ層を表します。
+/// 雑音除去自己符号化器は畳み込みの転置によって入力を再構築します。
+/// </summary>
+/// <remarks>
+/// 各フィルタは <typeparamref name="KernelSize"/> × <typeparamref name="KernelSize"/> × (入力のチャネル数) の結合重みを持ち、ストライド 1 で入力の内側にのみ適用されます。
+/// フィルタの数は <see cref="HiddenLayerCollection::Set"/> に指定される隠れ素子の数として扱われます。
+/// 入力と出力の成分は <see cref="FeatureShape"/> と同じく画素ごとに並べられるため、カーネルの各行は入力の連続した領域に対応します。
+/// これを利用して im2col による展開を行わずに直接畳み込みを計算し、作業領域を特徴マップの大きさに抑えます。
+///
+/// 全結合の隠れ層と比較すると、1 つの入力に対する積和演算の回数は
+/// (入力の次元数 × 隠れ素子の数) から (出力位置の数 × カーネルの要素数 × フィルタの数) になり、結合重みの数はフィルタの数とカーネルの要素数の積になります。
+/// </remarks>
+/// <typeparam name="KernelSize">カーネルの幅と高さを指定します。</typeparam>
+/// <typeparam name="PoolSize">最大値プーリングを行う領域の幅と高さを指定します。1 を指定した場合、プーリングは行われません。</typeparam>
+/// <typeparam name="TActivation">隠れ素子の活性化関数のポリシーを指定します。</typeparam>
+/// <typeparam name="TCost">再構築誤差を計算するコスト関数のポリシーを指定します。</typeparam>
+/// <typeparam name="TDelta">ファインチューニング時に勾配ベクトル (Delta) を計算するポリシーを指定します。</typeparam>
+template <class TValue, size_t KernelSize = 5, size_t PoolSize = 2, class TActivation = ActivationFunction::LogisticSigmoidPolicy, class TCost = CostFunction::BiClassCrossEntropyPolicy, class TDelta = DeltaFunction::BackPropagationPolicy<TActivation>> class ConvolutionalHiddenLayer final : private boost::noncopyable
+{
+public:
+	static_assert(KernelSize > 0 && PoolSize > 0, "KernelSize and PoolSize must be positive");
+
+	/// <summary><see cref="ConvolutionalHiddenLayer"/> クラスを入力の形状、フィルタの数および下層を使用して初期化します。</summary>
+	/// <param name="input">入力の形状を指定します。</param>
+	/// <param name="filters">フィルタの数 (出力のチャネル数) を指定します。</param>
+	/// <param name="hiddenLayers">この隠れ層が所属している Stacked Denoising Auto-Encoder のすべての隠れ層を表すリストを指定します。</param>
+	ConvolutionalHiddenLayer(const FeatureShape& input, size_t filters, HiddenLayerCollectionBase<TValue, ConvolutionalHiddenLayer>* hiddenLayers) :
+		Weight(filters, KernelSize * KernelSize * input.Channels), Bias(static_cast<TValue>(0), filters), VisibleBias(static_cast<TValue>(0), input.Channels), input(input), hiddenLayers(hiddenLayers),
+		memory(MemoryCategory::Weights, (Weight.Row() * Weight.Column() + filters + input.Channels) * sizeof(TValue))
+	{
+		if (!hiddenLayers)
+			throw std::invalid_argument("hiddenLayers must not be null pointer");
+		if (input.Height < KernelSize || input.Width < KernelSize || (input.Height - KernelSize + 1) / PoolSize == 0 || (input.Width - KernelSize + 1) / PoolSize == 0)
+			throw std::invalid_argument("input is smaller than the kernel and the pooling window");
+		// 全結合層と同じ初期化の範囲を、1 つの出力素子に接続される入力と 1 つの入力素子に接続される出力の数から求める
+		auto randMax = nextafter(static_cast<TValue>(1), (std::numeric_limits<TValue>::max)());
+		auto range = 4 * sqrt(static_cast<TValue>(6.0) / (Weight.Column() + KernelSize * KernelSize * filters));
+		for (size_t j = 0; j < Weight.Row(); j++)
+		{
+			for (size_t i = 0; i < Weight.Column(); i++)
+				Weight(j, i) = (2 * hiddenLayers->template GenerateUniformRandomNumber<TValue>(0, randMax) - 1) * range;
+		}
+	}
+
+	/// <summary>指定された入力の形状とフィルタの数で作成される層のパラメータの要素数を返します。</summary>
+	static size_t ParameterCount(const FeatureShape& input, size_t filters) { return filters * KernelSize * KernelSize * input.Channels + filters + input.Channels; }
+
+	/// <summary>この層の活性化関数のポリシーを表します。</summary>
+	typedef TActivation ActivationPolicy;
+
+	/// <summary>この層の結合重みを示します。第 f 行はフィルタ f を表し、位置 (ky, kx) のチャネル c の重みは第 (ky * KernelSize + kx) * (入力のチャネル数) + c 列に格納されます。</summary>
+	Matrix<TValue> Weight;
+	/// <summary>この層のフィルタごとのバイアスを示します。</summary>
+	std::valarray<TValue> Bias;
+	/// <summary>この層から構成された Denoising Auto-Encoder の出力層のチャネルごとのバイアスを示します。</summary>
+	std::valarray<TValue> VisibleBias;
+	/// <summary>枝刈りの後に残っている結合重みを 1、枝刈りされた結合重みを 0 で示します。空の場合はすべての結合重みが残っています。枝刈りされた結合重みは学習によって更新されません。</summary>
+	std::valarray<TValue> WeightMask;
+
+	/// <summary>この層の入力に対する出力を計算します。</summary>
+	/// <param name="input">層に入力するベクトルを指定します。</param>
+	/// <returns>この層の出力を示すベクトル。</returns>
+	std::valarray<TValue> Compute(const std::valarray<TValue>& input) const
+	{
+		auto maps = TActivation::Activate(Correlate(input, &Bias));
+		std::valarray<TValue> output(OutputShape().Size());
+		Pool(maps, [&](size_t o, size_t m) { output[o] = maps[m]; });
+		return std::move(output);
+	}
+
+	/// <summary>列に並べられた複数の入力に対するこの層の出力をまとめて計算します。</summary>
+	/// <param name="input">第 k 成分が input[k * batch + j] に格納された <paramref name="batch"/> 個の入力を指定します。</param>
+	/// <param name="batch">入力の数を指定します。</param>
+	/// <param name="output">第 i 成分が output[i * batch + j] に格納される出力を指定します。</param>
+	/// <remarks>最内ループを入力の番号について回し、1 つの結合重みをすべての入力に続けて適用します。</remarks>
+	void Compute(const std::vector<TValue>& input, size_t batch, std::vector<TValue>& output) const
+	{
+		auto shape = OutputShape();
+		output.resize(shape.Size() * batch);
+		if (batch == 0)
+			return;
+		NN_PROFILE_COUNT(0, 2 * ConnectionCount() * batch, Weight.Row() * Weight.Column() * sizeof(TValue), 1);
+		auto filters = Weight.Row();
+		std::vector<TValue> maps(MapHeight() * MapWidth() * filters * batch);
+		ParallelFor(MapHeight(), 1, [&](size_t begin, size_t end)
+		{
+			for (auto y = begin; y < end; y++)
+			{
+				for (size_t x = 0; x < MapWidth(); x++)
+				{
+					for (size_t f = 0; f < filters; f++)
+					{
+						auto out = &maps[((y * MapWidth() + x) * filters + f) * batch];
+						std::fill_n(out, batch, Bias[f]);
+						for (size_t ky = 0; ky < KernelSize; ky++)
+						{
+							auto offset = ((y + ky) * this->input.Width + x) * this->input.Channels;
+							auto w = &Weight(f, ky * RowLength());
+							for (size_t i = 0; i < RowLength(); i++)
+							{
+								auto in = &input[(offset + i) * batch];
+								auto weight = w[i];
+								for (size_t j = 0; j < batch; j++)
+									out[j] += weight * in[j];
+							}
+						}
+					}
+				}
+			}
+		});
+		ActivationFunction::ActivateColumns<TActivation>(maps.data(), MapHeight() * MapWidth() * filters, batch);
+		// 活性化関数は単調増加であるため、プーリングは活性化後の最大値をとればよい
+		for (size_t py = 0; py < shape.Height; py++)
+		{
+			for (size_t px = 0; px < shape.Width; px++)
+			{
+				for (size_t f = 0; f < filters; f++)
+				{
+					auto out = &output[((py * shape.Width + px) * filters + f) * batch];
+					std::fill_n(out, batch, -(std::numeric_limits<TValue>::max)());
+					for (size_t dy = 0; dy < PoolSize; dy++)
+					{
+						for (size_t dx = 0; dx < PoolSize; dx++)
+						{
+							auto map = &maps[(((py * PoolSize + dy) * MapWidth() + px * PoolSize + dx) * filters + f) * batch];
+							for (size_t j = 0; j < batch; j++)
+								out[j] = (std::max)(out[j], map[j]);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	/// <summary>この層の出力の形状を返します。</summary>
+	FeatureShape OutputShape() const { return FeatureShape(MapHeight() / PoolSize, MapWidth() / PoolSize, Weight.Row()); }
+
+	/// <summary>この層のパラメータを更新するオプティマイザを取得します。オプティマイザは最初の呼び出し時に所属するコレクションの設定から作成されます。</summary>
+	LayerOptimizer<TValue>& Optimizer()
+	{
+		if (!optimizer)
+			optimizer = std::unique_ptr<LayerOptimizer<TValue>>(new LayerOptimizer<TValue>(hiddenLayers->Optimizer(), Weight.Row() * Weight.Column(), Bias.size(), VisibleBias.size()));
+		return *optimizer;
+	}
+
+	/// <summary>オプティマイザの状態を破棄します。次の更新では所属するコレクションの設定から新しいオプティマイザが作成されます。</summary>
+	void ResetOptimizer() { optimizer.reset(); }
+
+	/// <summary>この層から雑音除去自己符号化器を構成し、指定されたデータセットを使用して訓練した結果のコストを返します。</summary>
+	/// <param name="dataset">訓練に使用するデータセットを指定します。</param>
+	/// <param name="learningRate">学習率を指定します。</param>
+	/// <param name="noise">構成された雑音除去自己符号化器の入力を生成する際のデータの欠損率を指定します。</param>
+	/// <returns>構成された雑音除去自己符号化器の入力に対するコスト。</returns>
+	template <class TNoise> TValue Train(const DataSetView<TValue>& dataset, TValue learningRate, TNoise noise)
+	{
+		return ComputeCost(dataset, noise, [&](const std::valarray<TValue>& image, const std::valarray<TValue>& corrupted, const std::valarray<TValue>& latent, const std::valarray<TValue>& reconstructed, Matrix<TValue>& transposed)
+		{
+			auto& optimizer = Optimizer();
+			std::valarray<TValue> visibleDelta = reconstructed - image;
+			// 隠れ素子の Delta は再構築の誤差を同じフィルタで畳み込んだものになる
+			auto delta = Correlate(visibleDelta, nullptr);
+			for (size_t m = 0; m < delta.size(); m++)
+				delta[m] *= TActivation::Differentiate(latent[m]);
+
+			auto filters = Weight.Row();
+			std::valarray<TValue> biasGradient(filters);
+			ParallelFor(filters, 1, [&](size_t begin, size_t end)
+			{
+				std::valarray<TValue> gradient(Weight.Column());
+				for (auto f = begin; f < end; f++)
+				{
+					gradient = 0;
+					TValue biasSum = 0;
+					for (size_t y = 0; y < MapHeight(); y++)
+					{
+						for (size_t x = 0; x < MapWidth(); x++)
+						{
+							auto m = (y * MapWidth() + x) * filters + f;
+							auto h = latent[m];
+							auto d = delta[m];
+							biasSum += d;
+							for (size_t ky = 0; ky < KernelSize; ky++)
+							{
+								auto offset = ((y + ky) * input.Width + x) * input.Channels;
+								auto g = &gradient[ky * RowLength()];
+								for (size_t j = 0; j < RowLength(); j++)
+									g[j] += visibleDelta[offset + j] * h + d * corrupted[offset + j];
+							}
+						}
+					}
+					biasGradient[f] = biasSum;
+					MaskGradients(WeightMask, &gradient[0], f * Weight.Column(), Weight.Column());
+					optimizer.Weight->Update(Weight.Data(), &gradient[0], f * Weight.Column(), Weight.Column(), learningRate);
+					// 次のサンプルの再構築のために、更新したフィルタを転置された結合重みに反映する
+					for (size_t k = 0; k < Weight.Column(); k++)
+						transposed(k, f) = Weight(f, k);
+				}
+			});
+			std::valarray<TValue> visibleBiasGradient(static_cast<TValue>(0), input.Channels);
+			for (size_t p = 0; p < input.Height * input.Width; p++)
+			{
+				for (size_t c = 0; c < input.Channels; c++)
+					visibleBiasGradient[c] += visibleDelta[p * input.Channels + c];
+			}
+			optimizer.Bias->Update(&Bias[0], &biasGradient[0], 0, Bias.size(), learningRate);
+			optimizer.VisibleBias->Update(&VisibleBias[0], &visibleBiasGradient[0], 0, VisibleBias.size(), learningRate);
+			optimizer.Step();
+			NN_PROFILE_COUNT(0, 6 * ConnectionCount(), 3 * Weight.Row() * Weight.Column() * sizeof(TValue), 3);
+		});
+	}
+
+	/// <summary>この層から雑音除去自己符号化器を構成し、指定されたデータセットのコストを計算します。</summary>
+	/// <param name="dataset">コストを計算するデータセットを指定します。</param>
+	/// <param name="noise">構成された雑音除去自己符号化器の入力を生成する際のデータの欠損率を指定します。</param>
+	/// <returns>構成された雑音除去自己符号化器の入力に対するコスト。</returns>
+	template <class TNoise> TValue ComputeCost(const DataSetView<TValue>& dataset, TNoise noise) const { return ComputeCost(dataset, noise, [](const std::valarray<TValue>&, const std::valarray<TValue>&, const std::valarray<TValue>&, const std::valarray<TValue>&, Matrix<TValue>&) { }); }
+
+	/// <summary>指定された入力と出力に対して結合重みとバイアスを更新し、下位層の学習に必要な情報を返します。</summary>
+	/// <param name="input">この層への入力を示すベクトルを指定します。</param>
+	/// <param name="output">この層からの出力を示すベクトルを指定します。</param>
+	/// <param name="upperInfo">上位層から得られた学習に必要な情報を指定します。</param>
+	/// <param name="learningRate">結合重みとバイアスをどれほど更新するかを示す値を指定します。</param>
+	/// <returns>下位層の学習に必要な情報。</returns>
+	/// <remarks>プーリングで選択された位置のみが勾配を受け取ります。</remarks>
+	std::valarray<TValue> Learn(const std::valarray<TValue>& input, const std::valarray<TValue>& output, const std::valarray<TValue>& upperInfo, TValue learningRate)
+	{
+		auto& optimizer = Optimizer();
+		auto filters = Weight.Row();
+		// プーリングで選択された位置を求めるために特徴マップを再計算する
+		auto maps = TActivation::Activate(Correlate(input, &Bias));
+		std::vector<size_t> selected(output.size());
+		std::valarray<TValue> delta(output.size());
+		Pool(maps, [&](size_t o, size_t m)
+		{
+			selected[o] = m;
+			delta[o] = GetDelta(output[o], upperInfo[o]);
+		});
+
+		std::valarray<TValue> lowerInfo(static_cast<TValue>(0), input.size());
+		for (size_t o = 0; o < selected.size(); o++)
+		{
+			auto f = o % filters;
+			auto position = selected[o] / filters;
+			auto y = position / MapWidth(), x = position % MapWidth();
+			for (size_t ky = 0; ky < KernelSize; ky++)
+			{
+				auto offset = ((y + ky) * this->input.Width + x) * this->input.Channels;
+				auto w = &Weight(f, ky * RowLength());
+				for (size_t j = 0; j < RowLength(); j++)
+					lowerInfo[offset + j] += w[j] * delta[o];
+			}
+		}
+
+		std::valarray<TValue> biasGradient(static_cast<TValue>(0), filters);
+		ParallelFor(filters, 1, [&](size_t begin, size_t end)
+		{
+			std::valarray<TValue> gradient(Weight.Column());
+			for (auto f = begin; f < end; f++)
+			{
+				gradient = 0;
+				for (auto o = f; o < selected.size(); o += filters)
+				{
+					auto position = selected[o] / filters;
+					auto y = position / MapWidth(), x = position % MapWidth();
+					biasGradient[f] += delta[o];
+					for (size_t ky = 0; ky < KernelSize; ky++)
+					{
+						auto offset = ((y + ky) * this->input.Width + x) * this->input.Channels;
+						auto g = &gradient[ky * RowLength()];
+						for (size_t j = 0; j < RowLength(); j++)
+							g[j] += delta[o] * input[offset + j];
+					}
+				}
+				MaskGradients(WeightMask, &gradient[0], f * Weight.Column(), Weight.Column());
+				optimizer.Weight->Update(Weight.Data(), &gradient[0], f * Weight.Column(), Weight.Column(), learningRate);
+			}
+		});
+		optimizer.Bias->Update(&Bias[0], &biasGradient[0], 0, Bias.size(), learningRate);
+		optimizer.Step();
+		NN_PROFILE_COUNT(0, 2 * ConnectionCount() + 4 * output.size() * Weight.Column(), 2 * Weight.Row() * Weight.Column() * sizeof(TValue), 3);
+		return std::move(lowerInfo);
+	}
+
+	/// <summary>この層の線形計算の結果に対するニューラルネットワークのコストの勾配ベクトル (Delta) の要素を計算します。</summary>
+	/// <param name="output">この層からの出力を示すベクトルの要素を指定します。</param>
+	/// <param name="upperInfo">上位層から得られた勾配計算に必要な情報を指定します。</param>
+	/// <returns>勾配ベクトルの要素。</returns>
+	static TValue GetDelta(TValue output, TValue upperInfo) { return TDelta::Compute(output, upperInfo); }
+
+private:
+	FeatureShape input;
+	HiddenLayerCollectionBase<TValue, ConvolutionalHiddenLayer>* const hiddenLayers;
+	std::unique_ptr<LayerOptimizer<TValue>> optimizer;
+	MemoryReservation memory;
+
+	size_t MapHeight() const { return input.Height - KernelSize + 1; }
+	size_t MapWidth() const { return input.Width - KernelSize + 1; }
+	// カーネルの 1 行が対応する入力の連続した成分の数
+	size_t RowLength() const { return KernelSize * input.Channels; }
+	// 畳み込み 1 回あたりの積和演算の回数
+	size_t ConnectionCount() const { return MapHeight() * MapWidth() * Weight.Row() * Weight.Column(); }
+
+	// 入力とすべてのフィルタの相互相関を計算する。バイアスが指定されない場合は加算しない
+	std::valarray<TValue> Correlate(const std::valarray<TValue>& source, const std::valarray<TValue>* bias) const
+	{
+		NN_PROFILE_COUNT(0, 2 * ConnectionCount(), Weight.Row() * Weight.Column() * sizeof(TValue), 1);
+		auto filters = Weight.Row();
+		std::valarray<TValue> maps(MapHeight() * MapWidth() * filters);
+		ParallelFor(MapHeight(), 1, [&](size_t begin, size_t end)
+		{
+			for (auto y = begin; y < end; y++)
+			{
+				for (size_t x = 0; x < MapWidth(); x++)
+				{
+					auto out = &maps[(y * MapWidth() + x) * filters];
+					for (size_t f = 0; f < filters; f++)
+					{
+						TValue sum = bias ? (*bias)[f] : 0;
+						for (size_t ky = 0; ky < KernelSize; ky++)
+						{
+							auto in = &source[((y + ky) * input.Width + x) * input.Channels];
+							auto w = &Weight(f, ky * RowLength());
+							for (size_t j = 0; j < RowLength(); j++)
+								sum += w[j] * in[j];
+						}
+						out[f] = sum;
+					}
+				}
+			}
+		});
+		return maps;
+	}
+
+	// 再構築の最内ループでフィルタの番号について連続したメモリを走査するため、結合重みを転置する
+	Matrix<TValue> Transpose() const
+	{
+		Matrix<TValue> transposed(Weight.Column(), Weight.Row());
+		for (size_t f = 0; f < Weight.Row(); f++)
+		{
+			for (size_t k = 0; k < Weight.Column(); k++)
+				transposed(k, f) = Weight(f, k);
+		}
+		return transposed;
+	}
+
+	// 特徴マップから入力を再構築する。各入力成分に寄与する出力位置を集める形で計算し、書き込みの競合を避ける
+	std::valarray<TValue> Reconstruct(const std::valarray<TValue>& maps, const Matrix<TValue>& transposed) const
+	{
+		NN_PROFILE_COUNT(0, 2 * ConnectionCount(), Weight.Row() * Weight.Column() * sizeof(TValue), 1);
+		auto filters = Weight.Row();
+		std::valarray<TValue> result(input.Size());
+		ParallelFor(input.Height, 1, [&](size_t begin, size_t end)
+		{
+			for (auto y = begin; y < end; y++)
+			{
+				for (size_t x = 0; x < input.Width; x++)
+				{
+					auto out = &result[(y * input.Width + x) * input.Channels];
+					for (size_t c = 0; c < input.Channels; c++)
+						out[c] = VisibleBias[c];
+					for (size_t ky = 0; ky < KernelSize && ky <= y; ky++)
+					{
+						if (y - ky >= MapHeight())
+							continue;
+						for (size_t kx = 0; kx < KernelSize && kx <= x; kx++)
+						{
+							if (x - kx >= MapWidth())
+								continue;
+							auto h = &maps[((y - ky) * MapWidth() + (x - kx)) * filters];
+							for (size_t c = 0; c < input.Channels; c++)
+							{
+								auto w = &transposed((ky * KernelSize + kx) * input.Channels + c, 0);
+								TValue sum = 0;
+								for (size_t f = 0; f < filters; f++)
+									sum += w[f] * h[f];
+								out[c] += sum;
+							}
+						}
+					}
+				}
+			}
+		});
+		return ActivationFunction::LogisticSigmoid(result);
+	}
+
+	// 各プーリング領域の最大値を持つ特徴マップの位置を、出力の位置とともに関数に渡す
+	template <class TFunc> void Pool(const std::valarray<TValue>& maps, TFunc func) const
+	{
+		auto filters = Weight.Row();
+		auto shape = OutputShape();
+		for (size_t py = 0; py < shape.Height; py++)
+		{
+			for (size_t px = 0; px < shape.Width; px++)
+			{
+				for (size_t f = 0; f < filters; f++)
+				{
+					auto best = (py * PoolSize * MapWidth() + px * PoolSize) * filters + f;
+					for (size_t dy = 0; dy < PoolSize; dy++)
+					{
+						for (size_t dx = 0; dx < PoolSize; dx++)
+						{
+							auto m = ((py * PoolSize + dy) * MapWidth() + px * PoolSize + dx) * filters + f;
+							if (maps[m] > maps[best])
+								best = m;
+						}
+					}
+					func((py * shape.Width + px) * filters + f, best);
+				}
+			}
+		}
+	}
+
+	template <class T, class TNoise> TValue ComputeCost(const DataSetView<TValue>& dataset, TNoise noise, T update) const
+	{
+		// 転置された結合重みはサンプルごとに作り直さず、更新する場合は update が書き換える
+		auto transposed = Transpose();
+		TValue cost = 0;
+		for (size_t n = 0; n < dataset.Count(); n++)
+		{
+			auto image = hiddenLayers->Compute(dataset.Image(n), this);
+			std::valarray<TValue> corrupted(input.Size());
+			for (size_t i = 0; i < corrupted.size(); i++)
+				corrupted[i] = hiddenLayers->template GenerateUniformRandomNumber<TNoise>(0, 1) < noise ? 0 : image[i];
+			auto latent = TActivation::Activate(Correlate(corrupted, &Bias));
+			auto reconstructed = Reconstruct(latent, transposed);
+			update(image, corrupted, latent, reconstructed, transposed);
+			cost += TCost::Compute(image.target(), reconstructed);
+		}
+		NN_PROFILE_COUNT(dataset.Count(), 0, 0, 0);
+		return cost / dataset.Count();
+	}
+};
+
+/// <summary>指定された畳み込み層の学習を行い、下位層の学習に必要な情報を返します。</summary>
+/// <param name="layer">学習を行う層を指定します。</param>
+/// <param name="input"><paramref name="layer"/> への入力を示すベクトルを指定します。</param>
+/// <param name="output"><paramref name="layer"/> からの出力を示すベクトルを指定します。</param>
+/// <param name="upperInfo">上位層から得られた学習に必要な情報を指定します。</param>
+/// <param name="learningRate">結合重みとバイアスをどれほど更新するかを示す値を指定します。</param>
+/// <returns>下位層の学習に必要な情報。</returns>
+template <class TValue, size_t KernelSize, size_t PoolSize, class TActivation, class TCost, class TDelta> std::valarray<TValue> LearnLayer(ConvolutionalHiddenLayer<TValue, KernelSize, PoolSize, TActivation, TCost, TDelta>& layer, const std::valarray<TValue>& input, const std::valarray<TValue>& output, const std::valarray<TValue>& upperInfo, TValue learningRate)
+{
+	return layer.Learn(input, output, upperInfo, learningRate);
+}
@@ -0,0 +1,130 @@
+﻿#pragma once
+
+#include "StackedDenoisingAutoEncoder.h"
+#include "MemoryAccounting.h"
+
+/// <summary>知識の蒸留の方法を表します。</summary>
+struct DistillationOptions final
+{
+	DistillationOptions(double temperature = 4, double softTargetWeight = 0.9) : Temperature(temperature), SoftTargetWeight(softTargetWeight) { }
+
+	/// <summary>学習中に教師と生徒の出力を和らげる温度を示します。1 の場合は出力をそのまま使用し、大きいほど分布は一様に近づきます。推論は温度 1 で行われます。</summary>
+	double Temperature;
+	/// <summary>損失における和らげられた教師の出力に対する項の重みを示します。残りの重みは正解ラベルに対する項に与えられます。</summary>
+	double SoftTargetWeight;
+};
+
+/// <summary>
+/// 生徒ネットワークの学習に使用する、温度で和らげられた教師ネットワークの出力を提供します。
+/// すべての出力がメモリ予算の残りに収まる場合、教師の順伝播は構築時に 1 回だけ行われ、その結果はデータセットの保存領域での番号ごとに保持されるため、並べ替えられたビューに対しても使用できます。
+/// 収まらない場合は出力を保持せず、要求されるたびに教師の順伝播を行います。このとき教師は <see cref="SoftTargetCache"/> より長く存続する必要があります。
+/// 正解ラベルとの組み合わせと生徒の出力の和らげは <see cref="StackedDenoisingAutoEncoder::FineTune"/> が行います。
+/// </summary>
+template <class TValue> class SoftTargetCache final : private boost::noncopyable
+{
+public:
+	/// <summary>教師の出力を計算して、<see cref="SoftTargetCache"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="teacher">学習済みの教師ネットワークを指定します。</param>
+	/// <param name="dataset">生徒の学習に使用するデータセットを指定します。このビューに含まれるデータ点に対してのみ教師の出力が計算されます。</param>
+	/// <param name="options">教師の出力を和らげる温度を指定します。</param>
+	/// <param name="batchSize">教師の順伝播でまとめて処理するデータ点の数を指定します。</param>
+	template <class TTeacher> SoftTargetCache(const TTeacher& teacher, const DataSetView<TValue>& dataset, const DistillationOptions& options, size_t batchSize = 256) :
+		temperature(options.Temperature), buffer(teacher.OutputLayer().Weight.Row())
+	{
+		auto bytes = dataset.StorageCount() * (teacher.OutputLayer().Weight.Row() * sizeof(TValue) + sizeof(std::valarray<TValue>));
+		if (!MemoryAccountant::Global().Fits(bytes))
+		{
+			compute = [&teacher](const std::valarray<TValue>& image) { return teacher.Compute(std::vector<std::valarray<TValue>>(1, image))[0]; };
+			return;
+		}
+		targets.assign(dataset.StorageCount(), std::valarray<TValue>(static_cast<TValue>(0), teacher.OutputLayer().Weight.Row()));
+		reservation = MemoryReservation(MemoryCategory::Caches, bytes);
+		batchSize = (std::max)(batchSize, static_cast<size_t>(1));
+		std::vector<std::valarray<TValue>> inputs;
+		for (size_t begin = 0; begin < dataset.Count(); begin += batchSize)
+		{
+			auto end = (std::min)(begin + batchSize, dataset.Count());
+			inputs.clear();
+			for (size_t d = begin; d < end; d++)
+				inputs.push_back(dataset.Image(d));
+			auto outputs = teacher.Compute(inputs);
+			for (size_t d = begin; d < end; d++)
+				Soften(outputs[d - begin], options.Temperature, targets[dataset.StorageIndex(d)]);
+		}
+	}
+
+	/// <summary>教師の出力を保持しているかどうかを返します。false の場合、<see cref="Target"/> は呼び出されるたびに教師の順伝播を行います。</summary>
+	bool Cached() const { return !compute; }
+
+	/// <summary>指定されたデータセットの指定された位置のデータ点に対する和らげられた教師の出力を返します。返された参照は次の呼び出しまで有効です。</summary>
+	/// <param name="dataset">構築時に指定されたデータセットと同じ保存領域を参照するビューを指定します。</param>
+	/// <param name="d">データセット内での位置を指定します。</param>
+	/// <remarks>出力を保持している場合、構築時のビューに含まれなかったデータ点の分布はすべて 0 です。</remarks>
+	const std::valarray<TValue>& Target(const DataSetView<TValue>& dataset, size_t d)
+	{
+		if (!compute)
+			return targets[dataset.StorageIndex(d)];
+		Soften(compute(dataset.Image(d)), temperature, buffer);
+		return buffer;
+	}
+
+	/// <summary>ソフトマックスの出力を温度で割った対数から計算し直したソフトマックスを格納します。</summary>
+	/// <param name="probabilities">教師の出力層のソフトマックスの出力を指定します。</param>
+	/// <param name="temperature">和らげる温度を指定します。</param>
+	/// <param name="result">和らげられた分布を格納する配列を指定します。</param>
+	static void Soften(const std::valarray<TValue>& probabilities, double temperature, std::valarray<TValue>& result)
+	{
+		// 対数はロジットと定数の差だけ異なるので、ロジットを温度で割ったソフトマックスと等しい
+		auto inverse = static_cast<TValue>(1 / temperature);
+		for (size_t i = 0; i < probabilities.size(); i++)
+			result[i] = std::log((std::max)(probabilities[i], (std::numeric_limits<TValue>::min)())) * inverse;
+		result = std::exp(result - result.max());
+		result /= result.sum();
+	}
+
+private:
+	double temperature;
+	std::vector<std::valarray<TValue>> targets;
+	std::valarray<TValue> buffer;
+	std::function<std::valarray<TValue>(const std::valarray<TValue>&)> compute;
+	MemoryReservation reservation;
+};
+
+/// <summary>推論の実行時間の計測結果を表します。</summary>
+struct InferenceTiming final
+{
+	/// <summary>データ点を 1 つずつ処理した場合の 1 データ点あたりの平均時間 (秒) を示します。</summary>
+	double Latency;
+	/// <summary>まとめて処理した場合の 1 秒あたりのデータ点の数を示します。</summary>
+	double Throughput;
+};
+
+/// <summary>指定されたネットワークの推論の実行時間をデータセットに対して計測します。</summary>
+/// <param name="network">計測するネットワークを指定します。</param>
+/// <param name="dataset">入力に使用するデータセットを指定します。</param>
+/// <param name="batchSize">スループットの計測でまとめて処理するデータ点の数を指定します。</param>
+/// <param name="latencySamples">レイテンシの計測に使用するデータ点の最大数を指定します。</param>
+template <class TNetwork, class TValue> InferenceTiming MeasureInference(const TNetwork& network, const DataSetView<TValue>& dataset, size_t batchSize, size_t latencySamples = 1000)
+{
+	auto run = [&](size_t count, size_t batch)
+	{
+		std::vector<std::valarray<TValue>> inputs;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t begin = 0; begin < count; begin += batch)
+		{
+			inputs.clear();
+			for (size_t d = begin; d < (std::min)(begin + batch, count); d++)
+				inputs.push_back(dataset.Image(d));
+			network.Compute(inputs);
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+	InferenceTiming timing { 0, 0 };
+	if (dataset.Count() == 0)
+		return timing;
+	auto samples = (std::min)(latencySamples, dataset.Count());
+	timing.Latency = samples > 0 ? run(samples, 1) / samples : 0;
+	auto seconds = run(dataset.Count(), (std::max)(batchSize, static_cast<size_t>(1)));
+	timing.Throughput = seconds > 0 ? dataset.Count() / seconds : 0;
+	return timing;
+}
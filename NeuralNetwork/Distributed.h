@@ -0,0 +1,803 @@
+﻿#pragma once
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+
+/// <summary>プロセス間で送信されるパラメータの差分の圧縮方法を表します。</summary>
+enum class GradientCompression
+{
+	/// <summary>圧縮せずに送信します。</summary>
+	None,
+	/// <summary>各要素を IEEE 754 半精度浮動小数点数に変換して送信します。</summary>
+	Half,
+	/// <summary>絶対値の大きい上位の要素のみをインデックスと共に送信します。</summary>
+	TopK,
+};
+
+/// <summary>分散学習の構成を表します。</summary>
+struct DistributedOptions final
+{
+	DistributedOptions() : Rank(0), WorldSize(1), Address("unix:/tmp/NeuralNetwork.sock"), Compression(GradientCompression::None), TopKRatio(0.01), SyncInterval(1) { }
+
+	/// <summary>このプロセスの番号を示します。0 番のプロセスが他のプロセスからの接続を待ち受け、集約を行います。</summary>
+	unsigned int Rank;
+	/// <summary>学習に参加するプロセスの総数を示します。</summary>
+	unsigned int WorldSize;
+	/// <summary>0 番のプロセスが待ち受けるアドレスを示します。"unix:パス" または "tcp:ホスト:ポート" の形式で指定します。</summary>
+	std::string Address;
+	/// <summary>パラメータの差分の圧縮方法を示します。</summary>
+	GradientCompression Compression;
+	/// <summary><see cref="GradientCompression::TopK"/> で送信する要素の割合を示します。</summary>
+	double TopKRatio;
+	/// <summary>パラメータを同期する間隔のエポック数を示します。</summary>
+	unsigned int SyncInterval;
+
+	/// <summary>複数のプロセスで学習するかどうかを取得します。</summary>
+	bool Enabled() const { return WorldSize > 1; }
+
+	/// <summary>コマンドライン引数から構成を読み取ります。</summary>
+	/// <param name="argc">引数の数を指定します。</param>
+	/// <param name="argv">引数の配列を指定します。</param>
+	static DistributedOptions Parse(int argc, char* argv[])
+	{
+		DistributedOptions options;
+		for (int i = 1; i < argc; i++)
+		{
+			std::string name = argv[i];
+			auto value = [&]() -> std::string
+			{
+				if (i + 1 >= argc)
+					throw std::invalid_argument(name + " requires a value");
+				return argv[++i];
+			};
+			if (name == "--rank")
+				options.Rank = static_cast<unsigned int>(std::stoul(value()));
+			else if (name == "--world-size")
+				options.WorldSize = static_cast<unsigned int>(std::stoul(value()));
+			else if (name == "--address")
+				options.Address = value();
+			else if (name == "--compression")
+			{
+				auto kind = value();
+				if (kind == "none")
+					options.Compression = GradientCompression::None;
+				else if (kind == "fp16")
+					options.Compression = GradientCompression::Half;
+				else if (kind == "topk")
+					options.Compression = GradientCompression::TopK;
+				else
+					throw std::invalid_argument("compression must be none, fp16 or topk");
+			}
+			else if (name == "--top-k-ratio")
+				options.TopKRatio = std::stod(value());
+			else if (name == "--sync-interval")
+				options.SyncInterval = (std::max)(static_cast<unsigned int>(std::stoul(value())), 1u);
+			else
+				throw std::invalid_argument("unknown option: " + name);
+		}
+		if (options.WorldSize == 0 || options.Rank >= options.WorldSize)
+			throw std::invalid_argument("rank must be less than world size");
+		if (options.TopKRatio <= 0 || options.TopKRatio > 1)
+			throw std::invalid_argument("top-k ratio must be in range (0, 1]");
+		return options;
+	}
+
+	/// <summary>圧縮方法の名前を取得します。</summary>
+	const char* CompressionName() const
+	{
+		switch (Compression)
+		{
+		case GradientCompression::Half: return "fp16";
+		case GradientCompression::TopK: return "top-k";
+		default: return "none";
+		}
+	}
+};
+
+/// <summary>IEEE 754 半精度浮動小数点数との変換を提供します。</summary>
+namespace HalfPrecision
+{
+	/// <summary>単精度浮動小数点数を最近接偶数丸めで半精度に変換します。</summary>
+	inline uint16_t FromFloat(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000u);
+		auto biased = (bits >> 23) & 0xFFu;
+		auto mantissa = bits & 0x7FFFFFu;
+		if (biased == 0xFFu)
+			return static_cast<uint16_t>(sign | 0x7C00u | (mantissa != 0 ? 0x200u : 0u));
+		auto exponent = static_cast<int>(biased) - 127 + 15;
+		if (exponent >= 0x1F)
+			return static_cast<uint16_t>(sign | 0x7C00u);
+		if (exponent <= 0)
+		{
+			// 非正規化数
+			if (exponent < -10)
+				return sign;
+			mantissa |= 0x800000u;
+			auto shift = static_cast<uint32_t>(14 - exponent);
+			auto half = mantissa >> shift;
+			auto rest = mantissa & ((1u << shift) - 1);
+			auto halfway = 1u << (shift - 1);
+			if (rest > halfway || (rest == halfway && (half & 1u) != 0))
+				half++;
+			return static_cast<uint16_t>(sign | half);
+		}
+		auto half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+		auto rest = mantissa & 0x1FFFu;
+		// 仮数部からの繰り上がりは指数部に伝播し、最大値を超えた場合は無限大になる
+		if (rest > 0x1000u || (rest == 0x1000u && (half & 1u) != 0))
+			half++;
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	/// <summary>半精度浮動小数点数を単精度に変換します。</summary>
+	inline float ToFloat(uint16_t half)
+	{
+		auto sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+		auto exponent = (half >> 10) & 0x1Fu;
+		auto mantissa = static_cast<uint32_t>(half & 0x3FFu);
+		uint32_t bits;
+		if (exponent == 0x1F)
+			bits = sign | 0x7F800000u | (mantissa << 13);
+		else if (exponent != 0)
+			bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+		else if (mantissa == 0)
+			bits = sign;
+		else
+		{
+			// 非正規化数を正規化する
+			uint32_t shift = 0;
+			while ((mantissa & 0x400u) == 0)
+			{
+				mantissa <<= 1;
+				shift++;
+			}
+			bits = sign | ((127 - 15 + 1 - shift) << 23) | ((mantissa & 0x3FFu) << 13);
+		}
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+};
+
+/// <summary>ソケットライブラリの初期化と終了処理を行います。Windows 以外では何もしません。</summary>
+class SocketLibrary final : private boost::noncopyable
+{
+public:
+	SocketLibrary()
+	{
+#ifdef _WIN32
+		WSADATA data;
+		if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+			throw std::runtime_error("failed to initialize Winsock");
+#endif
+	}
+
+	~SocketLibrary()
+	{
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+};
+
+/// <summary>ストリーム指向のソケット接続を表します。</summary>
+class SocketConnection final : private boost::noncopyable
+{
+public:
+#ifdef _WIN32
+	typedef SOCKET Handle;
+	static Handle InvalidHandle() { return INVALID_SOCKET; }
+#else
+	typedef int Handle;
+	static Handle InvalidHandle() { return -1; }
+#endif
+
+	explicit SocketConnection(Handle handle) : handle(handle) { }
+	~SocketConnection() { Close(handle); }
+
+	/// <summary>ネイティブのソケットハンドルを取得します。</summary>
+	Handle Native() const { return handle; }
+
+	/// <summary>指定されたデータをすべて送信します。</summary>
+	void Send(const void* data, size_t size)
+	{
+		auto bytes = static_cast<const char*>(data);
+		while (size > 0)
+		{
+			auto chunk = static_cast<int>((std::min)(size, static_cast<size_t>(1) << 30));
+#ifdef _WIN32
+			auto sent = send(handle, bytes, chunk, 0);
+#else
+			auto sent = send(handle, bytes, static_cast<size_t>(chunk), MSG_NOSIGNAL);
+#endif
+			if (sent <= 0)
+				throw std::runtime_error("failed to send data to a peer");
+			bytes += sent;
+			size -= static_cast<size_t>(sent);
+		}
+	}
+
+	/// <summary>指定された大きさのデータをすべて受信します。</summary>
+	void Receive(void* data, size_t size)
+	{
+		auto bytes = static_cast<char*>(data);
+		while (size > 0)
+		{
+			auto chunk = static_cast<int>((std::min)(size, static_cast<size_t>(1) << 30));
+#ifdef _WIN32
+			auto received = recv(handle, bytes, chunk, 0);
+#else
+			auto received = recv(handle, bytes, static_cast<size_t>(chunk), 0);
+#endif
+			if (received <= 0)
+				throw std::runtime_error("connection to a peer was closed");
+			bytes += received;
+			size -= static_cast<size_t>(received);
+		}
+	}
+
+	/// <summary>長さを前置したメッセージを送信します。</summary>
+	void SendMessage(const std::vector<char>& message)
+	{
+		uint64_t length = message.size();
+		Send(&length, sizeof(length));
+		if (!message.empty())
+			Send(message.data(), message.size());
+	}
+
+	/// <summary>長さを前置したメッセージを受信します。</summary>
+	std::vector<char> ReceiveMessage(uint64_t limit = (std::numeric_limits<uint64_t>::max)())
+	{
+		uint64_t length;
+		Receive(&length, sizeof(length));
+		if (length > limit)
+			throw std::runtime_error("the received message is too long");
+		std::vector<char> message(static_cast<size_t>(length));
+		if (!message.empty())
+			Receive(message.data(), message.size());
+		return message;
+	}
+
+	static void Close(Handle handle)
+	{
+		if (handle == InvalidHandle())
+			return;
+#ifdef _WIN32
+		closesocket(handle);
+#else
+		close(handle);
+#endif
+	}
+
+	/// <summary>送受信を停止し、この接続で待機している操作を終了させます。</summary>
+	void Shutdown()
+	{
+#ifdef _WIN32
+		shutdown(handle, SD_BOTH);
+#else
+		shutdown(handle, SHUT_RDWR);
+#endif
+	}
+
+	/// <summary>指定されたアドレスで接続の待ち受けを開始し、待ち受け用のソケットを返します。</summary>
+	static Handle Listen(const std::string& address)
+	{
+		Handle handle = InvalidHandle();
+		std::string host, port;
+		if (address.compare(0, 5, "unix:") == 0)
+		{
+#ifdef _WIN32
+			throw std::invalid_argument("unix domain sockets are not supported on this platform");
+#else
+			auto path = address.substr(5);
+			sockaddr_un endpoint;
+			if (path.size() >= sizeof(endpoint.sun_path))
+				throw std::invalid_argument("socket path is too long: " + path);
+			std::memset(&endpoint, 0, sizeof(endpoint));
+			endpoint.sun_family = AF_UNIX;
+			std::memcpy(endpoint.sun_path, path.c_str(), path.size());
+			unlink(path.c_str());
+			handle = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (handle == InvalidHandle() || bind(handle, reinterpret_cast<sockaddr*>(&endpoint), sizeof(endpoint)) != 0)
+			{
+				Close(handle);
+				throw std::runtime_error("failed to bind " + address);
+			}
+#endif
+		}
+		else if (SplitHostPort(address, host, port))
+		{
+			addrinfo hints;
+			std::memset(&hints, 0, sizeof(hints));
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags = AI_PASSIVE;
+			addrinfo* results = nullptr;
+			if (getaddrinfo(host.empty() || host == "*" ? nullptr : host.c_str(), port.c_str(), &hints, &results) != 0)
+				throw std::runtime_error("failed to resolve " + address);
+			for (auto info = results; info != nullptr && handle == InvalidHandle(); info = info->ai_next)
+			{
+				handle = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+				if (handle == InvalidHandle())
+					continue;
+				int reuse = 1;
+				setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+				if (bind(handle, info->ai_addr, static_cast<int>(info->ai_addrlen)) != 0)
+				{
+					Close(handle);
+					handle = InvalidHandle();
+				}
+			}
+			freeaddrinfo(results);
+			if (handle == InvalidHandle())
+				throw std::runtime_error("failed to bind " + address);
+		}
+		else
+			throw std::invalid_argument("address must be unix:<path> or tcp:<host>:<port>");
+		if (listen(handle, SOMAXCONN) != 0)
+		{
+			Close(handle);
+			throw std::runtime_error("failed to listen on " + address);
+		}
+		return handle;
+	}
+
+	/// <summary>待ち受け用のソケットへの接続を 1 つ受け入れます。</summary>
+	static Handle Accept(SocketConnection& listener)
+	{
+		auto handle = accept(listener.Native(), nullptr, nullptr);
+		if (handle == InvalidHandle())
+			throw std::runtime_error("failed to accept a connection");
+		SetNoDelay(handle);
+		return handle;
+	}
+
+	/// <summary>指定された時刻までに待ち受け用のソケットへの接続を 1 つ受け入れます。時刻までに接続されなかった場合は例外をスローします。</summary>
+	static Handle Accept(SocketConnection& listener, std::chrono::steady_clock::time_point deadline)
+	{
+		while (true)
+		{
+			auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+			if (remaining.count() <= 0)
+				throw std::runtime_error("timed out waiting for a connection");
+			fd_set readable;
+			FD_ZERO(&readable);
+			FD_SET(listener.Native(), &readable);
+			timeval wait;
+			wait.tv_sec = static_cast<long>(remaining.count() / 1000000);
+			wait.tv_usec = static_cast<long>(remaining.count() % 1000000);
+			auto ready = select(static_cast<int>(listener.Native() + 1), &readable, nullptr, nullptr, &wait);
+			if (ready > 0)
+				break;
+#ifndef _WIN32
+			if (ready < 0 && errno != EINTR)
+#else
+			if (ready < 0)
+#endif
+				throw std::runtime_error("failed to wait for a connection");
+		}
+		auto handle = accept(listener.Native(), nullptr, nullptr);
+		if (handle == InvalidHandle())
+			throw std::runtime_error("failed to accept a connection");
+		SetNoDelay(handle);
+		return handle;
+	}
+
+	/// <summary>指定されたアドレスに接続します。接続できなかった場合は <see cref="InvalidHandle"/> を返します。</summary>
+	static Handle Connect(const std::string& address)
+	{
+		std::string host, port;
+		if (address.compare(0, 5, "unix:") == 0)
+		{
+#ifdef _WIN32
+			throw std::invalid_argument("unix domain sockets are not supported on this platform");
+#else
+			auto path = address.substr(5);
+			sockaddr_un endpoint;
+			if (path.size() >= sizeof(endpoint.sun_path))
+				throw std::invalid_argument("socket path is too long: " + path);
+			std::memset(&endpoint, 0, sizeof(endpoint));
+			endpoint.sun_family = AF_UNIX;
+			std::memcpy(endpoint.sun_path, path.c_str(), path.size());
+			auto handle = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (handle != InvalidHandle() && connect(handle, reinterpret_cast<sockaddr*>(&endpoint), sizeof(endpoint)) != 0)
+			{
+				Close(handle);
+				handle = InvalidHandle();
+			}
+			return handle;
+#endif
+		}
+		if (!SplitHostPort(address, host, port))
+			throw std::invalid_argument("address must be unix:<path> or tcp:<host>:<port>");
+		addrinfo hints;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* results = nullptr;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &results) != 0)
+			return InvalidHandle();
+		auto handle = InvalidHandle();
+		for (auto info = results; info != nullptr && handle == InvalidHandle(); info = info->ai_next)
+		{
+			handle = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+			if (handle != InvalidHandle() && connect(handle, info->ai_addr, static_cast<int>(info->ai_addrlen)) != 0)
+			{
+				Close(handle);
+				handle = InvalidHandle();
+			}
+		}
+		freeaddrinfo(results);
+		if (handle != InvalidHandle())
+			SetNoDelay(handle);
+		return handle;
+	}
+
+private:
+	Handle handle;
+
+	static bool SplitHostPort(const std::string& address, std::string& host, std::string& port)
+	{
+		auto colon = address.rfind(':');
+		if (address.compare(0, 4, "tcp:") != 0 || colon == std::string::npos || colon < 4)
+			return false;
+		host = address.substr(4, colon - 4);
+		port = address.substr(colon + 1);
+		return true;
+	}
+
+	static void SetNoDelay(Handle handle)
+	{
+		int noDelay = 1;
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+	}
+};
+
+/// <summary>
+/// 0 番のプロセスを中心とするスター型の接続で集団通信を行うコミュニケーターを表します。
+/// すべてのプロセスは同じ順序で同じ集団通信を呼び出す必要があります。バイト順序はすべてのノードで同じであると仮定します。
+/// </summary>
+class Communicator final : private boost::noncopyable
+{
+public:
+	/// <summary>指定された構成で他のプロセスと接続します。</summary>
+	/// <param name="options">自身の番号、プロセス数および接続先のアドレスを指定します。</param>
+	/// <param name="timeout">0 番のプロセスが他のすべてのプロセスの接続を待つ時間、およびそれ以外のプロセスが接続を試行し続ける時間を指定します。</param>
+	explicit Communicator(const DistributedOptions& options, std::chrono::seconds timeout = std::chrono::seconds(60)) : rank(options.Rank), worldSize(options.WorldSize), bytesSent(0), bytesReceived(0)
+	{
+		if (rank == 0)
+		{
+			auto deadline = std::chrono::steady_clock::now() + timeout;
+			SocketConnection listener(SocketConnection::Listen(options.Address));
+			peers.resize(worldSize - 1);
+			for (unsigned int i = 1; i < worldSize; i++)
+			{
+				std::unique_ptr<SocketConnection> peer(new SocketConnection(SocketConnection::Accept(listener, deadline)));
+				uint32_t peerRank;
+				peer->Receive(&peerRank, sizeof(peerRank));
+				if (peerRank == 0 || peerRank >= worldSize || peers[peerRank - 1])
+					throw std::runtime_error("invalid or duplicated rank " + std::to_string(peerRank));
+				peers[peerRank - 1] = std::move(peer);
+			}
+#ifndef _WIN32
+			if (options.Address.compare(0, 5, "unix:") == 0)
+				unlink(options.Address.substr(5).c_str());
+#endif
+		}
+		else
+		{
+			auto deadline = std::chrono::steady_clock::now() + timeout;
+			auto handle = SocketConnection::Connect(options.Address);
+			while (handle == SocketConnection::InvalidHandle())
+			{
+				if (std::chrono::steady_clock::now() > deadline)
+					throw std::runtime_error("failed to connect to " + options.Address);
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				handle = SocketConnection::Connect(options.Address);
+			}
+			root = std::unique_ptr<SocketConnection>(new SocketConnection(handle));
+			uint32_t ownRank = rank;
+			root->Send(&ownRank, sizeof(ownRank));
+		}
+	}
+
+	/// <summary>このプロセスの番号を取得します。</summary>
+	unsigned int Rank() const { return rank; }
+
+	/// <summary>学習に参加するプロセスの総数を取得します。</summary>
+	unsigned int WorldSize() const { return worldSize; }
+
+	/// <summary>このプロセスが送信したバイト数を取得します。</summary>
+	uint64_t BytesSent() const { return bytesSent; }
+
+	/// <summary>このプロセスが受信したバイト数を取得します。</summary>
+	uint64_t BytesReceived() const { return bytesReceived; }
+
+	/// <summary>0 番のプロセスにすべてのプロセスのメッセージを集めます。</summary>
+	/// <param name="message">このプロセスのメッセージを指定します。</param>
+	/// <returns>0 番のプロセスではプロセス番号順に並べられたすべてのメッセージ。それ以外のプロセスでは空の配列。</returns>
+	std::vector<std::vector<char>> Gather(const std::vector<char>& message)
+	{
+		std::vector<std::vector<char>> messages;
+		if (rank != 0)
+		{
+			root->SendMessage(message);
+			bytesSent += message.size();
+			return messages;
+		}
+		messages.push_back(message);
+		for (auto& peer : peers)
+		{
+			messages.push_back(peer->ReceiveMessage());
+			bytesReceived += messages.back().size();
+		}
+		return messages;
+	}
+
+	/// <summary>0 番のプロセスのメッセージをすべてのプロセスに配布します。</summary>
+	/// <param name="message">0 番のプロセスでは配布するメッセージを指定します。それ以外のプロセスでは無視されます。</param>
+	/// <returns>配布されたメッセージ。</returns>
+	std::vector<char> Broadcast(const std::vector<char>& message)
+	{
+		if (rank != 0)
+		{
+			auto received = root->ReceiveMessage();
+			bytesReceived += received.size();
+			return received;
+		}
+		for (auto& peer : peers)
+		{
+			peer->SendMessage(message);
+			bytesSent += message.size();
+		}
+		return message;
+	}
+
+	/// <summary>0 番のプロセスの値をすべてのプロセスに配布します。</summary>
+	template <class T> T Broadcast(T value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+		std::vector<char> message(sizeof(T));
+		std::memcpy(message.data(), &value, sizeof(T));
+		message = Broadcast(message);
+		std::memcpy(&value, message.data(), sizeof(T));
+		return value;
+	}
+
+	/// <summary>すべてのプロセスの値の平均を計算し、すべてのプロセスに返します。</summary>
+	double Average(double value) { return Sum(value) / worldSize; }
+
+	/// <summary>すべてのプロセスの値の合計を計算し、すべてのプロセスに返します。</summary>
+	double Sum(double value)
+	{
+		std::vector<char> message(sizeof(double));
+		std::memcpy(message.data(), &value, sizeof(double));
+		double sum = 0;
+		for (auto& item : Gather(message))
+		{
+			double received;
+			std::memcpy(&received, item.data(), sizeof(double));
+			sum += received;
+		}
+		return Broadcast(sum);
+	}
+
+private:
+	SocketLibrary library;
+	unsigned int rank;
+	unsigned int worldSize;
+	uint64_t bytesSent;
+	uint64_t bytesReceived;
+	std::unique_ptr<SocketConnection> root;
+	std::vector<std::unique_ptr<SocketConnection>> peers;
+};
+
+/// <summary>パラメータの差分を送信用のバイト列に符号化します。</summary>
+template <class TValue> class GradientCodec final
+{
+public:
+	/// <summary>指定された圧縮方法で値を符号化します。</summary>
+	/// <param name="values">符号化する値を指定します。</param>
+	/// <param name="compression">圧縮方法を指定します。</param>
+	/// <param name="topKRatio"><see cref="GradientCompression::TopK"/> で送信する要素の割合を指定します。</param>
+	static std::vector<char> Encode(const std::valarray<TValue>& values, GradientCompression compression, double topKRatio)
+	{
+		if (compression == GradientCompression::Half)
+		{
+			auto message = Header(Format::DenseHalf, values.size(), values.size(), sizeof(uint16_t));
+			for (size_t i = 0; i < values.size(); i++)
+				Append(message, HalfPrecision::FromFloat(static_cast<float>(values[i])));
+			return message;
+		}
+		if (compression == GradientCompression::TopK)
+		{
+			std::vector<uint32_t> indices;
+			indices.reserve(values.size());
+			for (size_t i = 0; i < values.size(); i++)
+			{
+				if (values[i] != 0)
+					indices.push_back(static_cast<uint32_t>(i));
+			}
+			auto k = (std::min)(indices.size(), static_cast<size_t>(std::ceil(topKRatio * values.size())));
+			std::nth_element(indices.begin(), indices.begin() + static_cast<std::ptrdiff_t>(k), indices.end(), [&](uint32_t x, uint32_t y) { return std::abs(values[x]) > std::abs(values[y]); });
+			indices.resize(k);
+			std::sort(indices.begin(), indices.end());
+			return Sparse(values, indices);
+		}
+		auto message = Header(Format::Dense, values.size(), values.size(), sizeof(TValue));
+		for (size_t i = 0; i < values.size(); i++)
+			Append(message, values[i]);
+		return message;
+	}
+
+	/// <summary>0 でない要素のみを符号化します。疎な値の場合は疎な形式、そうでない場合は指定された圧縮方法を使用します。</summary>
+	static std::vector<char> EncodeNonZero(const std::valarray<TValue>& values, GradientCompression compression)
+	{
+		std::vector<uint32_t> indices;
+		for (size_t i = 0; i < values.size(); i++)
+		{
+			if (values[i] != 0)
+				indices.push_back(static_cast<uint32_t>(i));
+		}
+		if (indices.size() * (sizeof(uint32_t) + sizeof(TValue)) < values.size() * (compression == GradientCompression::Half ? sizeof(uint16_t) : sizeof(TValue)))
+			return Sparse(values, indices);
+		return Encode(values, compression == GradientCompression::TopK ? GradientCompression::None : compression, 1);
+	}
+
+	/// <summary>符号化された値に係数を掛けて指定された配列に加算します。</summary>
+	/// <param name="message">符号化された値を指定します。</param>
+	/// <param name="values">加算先の配列を指定します。</param>
+	/// <param name="scale">加算する前に掛ける係数を指定します。</param>
+	static void Accumulate(const std::vector<char>& message, std::valarray<TValue>& values, TValue scale)
+	{
+		size_t position = 0;
+		auto format = Read<uint8_t>(message, position);
+		auto length = Read<uint64_t>(message, position);
+		auto entries = Read<uint64_t>(message, position);
+		if (length != values.size())
+			throw std::runtime_error("received parameters have a different shape");
+		for (uint64_t e = 0; e < entries; e++)
+		{
+			switch (static_cast<Format>(format))
+			{
+			case Format::Dense:
+				values[static_cast<size_t>(e)] += scale * Read<TValue>(message, position);
+				break;
+			case Format::DenseHalf:
+				values[static_cast<size_t>(e)] += scale * static_cast<TValue>(HalfPrecision::ToFloat(Read<uint16_t>(message, position)));
+				break;
+			case Format::Sparse:
+			{
+				auto index = Read<uint32_t>(message, position);
+				if (index >= values.size())
+					throw std::runtime_error("received index is out of range");
+				values[index] += scale * Read<TValue>(message, position);
+				break;
+			}
+			default:
+				throw std::runtime_error("unknown message format");
+			}
+		}
+	}
+
+private:
+	enum class Format : uint8_t
+	{
+		Dense,
+		DenseHalf,
+		Sparse,
+	};
+
+	static std::vector<char> Header(Format format, size_t length, size_t entries, size_t entrySize)
+	{
+		std::vector<char> message;
+		message.reserve(sizeof(uint8_t) + 2 * sizeof(uint64_t) + entries * entrySize);
+		Append(message, static_cast<uint8_t>(format));
+		Append(message, static_cast<uint64_t>(length));
+		Append(message, static_cast<uint64_t>(entries));
+		return message;
+	}
+
+	static std::vector<char> Sparse(const std::valarray<TValue>& values, const std::vector<uint32_t>& indices)
+	{
+		auto message = Header(Format::Sparse, values.size(), indices.size(), sizeof(uint32_t) + sizeof(TValue));
+		for (auto index : indices)
+		{
+			Append(message, index);
+			Append(message, values[index]);
+		}
+		return message;
+	}
+
+	template <class T> static void Append(std::vector<char>& message, T value)
+	{
+		auto position = message.size();
+		message.resize(position + sizeof(T));
+		std::memcpy(&message[position], &value, sizeof(T));
+	}
+
+	template <class T> static T Read(const std::vector<char>& message, size_t& position)
+	{
+		if (position + sizeof(T) > message.size())
+			throw std::runtime_error("received message is truncated");
+		T value;
+		std::memcpy(&value, &message[position], sizeof(T));
+		position += sizeof(T);
+		return value;
+	}
+};
+
+/// <summary>
+/// 各プロセスで独立に学習されたパラメータを平均して同期します。
+/// 前回の同期からの差分を圧縮して送信し、圧縮によって失われた差分は次回の同期に持ち越します。
+/// </summary>
+template <class TValue> class ParameterAverager final : private boost::noncopyable
+{
+public:
+	/// <summary><see cref="ParameterAverager"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="communicator">通信に使用するコミュニケーターを指定します。</param>
+	/// <param name="compression">差分の圧縮方法を指定します。</param>
+	/// <param name="topKRatio"><see cref="GradientCompression::TopK"/> で送信する要素の割合を指定します。</param>
+	ParameterAverager(Communicator& communicator, GradientCompression compression, double topKRatio) : communicator(communicator), compression(compression), topKRatio(topKRatio) { }
+
+	/// <summary>差分の基準を破棄します。モデルの構造が変化した場合に呼び出します。次回の同期ではパラメータそのものが圧縮せずに平均されます。</summary>
+	void Reset()
+	{
+		reference.resize(0);
+		residual.resize(0);
+	}
+
+	/// <summary>すべてのプロセスのパラメータを平均し、指定された配列を平均で置き換えます。</summary>
+	/// <param name="parameters">このプロセスのパラメータを指定します。</param>
+	void Synchronize(std::valarray<TValue>& parameters)
+	{
+		auto world = static_cast<TValue>(communicator.WorldSize());
+		if (reference.size() != parameters.size())
+		{
+			auto gathered = communicator.Gather(GradientCodec<TValue>::Encode(parameters, GradientCompression::None, 1));
+			std::vector<char> message;
+			if (communicator.Rank() == 0)
+			{
+				std::valarray<TValue> sum(static_cast<TValue>(0), parameters.size());
+				for (auto& item : gathered)
+					GradientCodec<TValue>::Accumulate(item, sum, 1 / world);
+				message = GradientCodec<TValue>::Encode(sum, GradientCompression::None, 1);
+			}
+			parameters = 0;
+			GradientCodec<TValue>::Accumulate(communicator.Broadcast(message), parameters, 1);
+			reference = parameters;
+			residual.resize(parameters.size(), static_cast<TValue>(0));
+			return;
+		}
+
+		std::valarray<TValue> delta = parameters - reference + residual;
+		auto encoded = GradientCodec<TValue>::Encode(delta, compression, topKRatio);
+		residual = delta;
+		GradientCodec<TValue>::Accumulate(encoded, residual, -1);
+
+		auto gathered = communicator.Gather(encoded);
+		std::vector<char> message;
+		if (communicator.Rank() == 0)
+		{
+			std::valarray<TValue> average(static_cast<TValue>(0), parameters.size());
+			for (auto& item : gathered)
+				GradientCodec<TValue>::Accumulate(item, average, 1 / world);
+			message = GradientCodec<TValue>::EncodeNonZero(average, compression);
+		}
+		// 0 番のプロセスも符号化された平均を適用することで、すべてのプロセスのパラメータを一致させる
+		parameters = reference;
+		GradientCodec<TValue>::Accumulate(communicator.Broadcast(message), parameters, 1);
+		reference = parameters;
+	}
+
+private:
+	Communicator& communicator;
+	GradientCompression compression;
+	double topKRatio;
+	std::valarray<TValue> reference;
+	std::valarray<TValue> residual;
+};
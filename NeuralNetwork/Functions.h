@@ -1,33 +1,86 @@
 ﻿#pragma once
 
+#include "ThreadPool.h"
+
 namespace ActivationFunction
 {
-	template <class TComputer> static auto LogisticSigmoid(const TComputer& neuronComputer) -> std::valarray<std::decay_t<decltype(neuronComputer[0])>>
+	// 各素子の出力は入力次元数に比例する積和演算を伴うため、この数の素子ごとにタスクを分割する
+	// 活性化関数の grain 引数には、結合重みの形状に対して選択された最小区間長を指定できる
+	const size_t ParallelGrain = 16;
+
+	template <class TComputer> static auto LogisticSigmoid(const TComputer& neuronComputer, size_t grain = ParallelGrain) -> std::valarray<std::decay_t<decltype(neuronComputer[0])>>
 	{
 		std::valarray<std::decay_t<decltype(neuronComputer[0])>> result(neuronComputer.size());
-#pragma omp parallel for
-		for (int i = 0; i < static_cast<int>(result.size()); i++)
-			result[static_cast<size_t>(i)] = 1 / (1 + exp(-neuronComputer[static_cast<size_t>(i)]));
+		ParallelFor(result.size(), grain, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+				result[i] = 1 / (1 + exp(-neuronComputer[i]));
+		});
 		return std::move(result);
 	}
 	template <class T> static T LogisticSigmoidDifferentiated(T y) { return y * (1 - y); }
-	template <class TComputer> static auto SoftMax(const TComputer& neuronComputer) -> std::valarray<std::decay_t<decltype(neuronComputer[0])>>
+	template <class TComputer> static auto SoftMax(const TComputer& neuronComputer, size_t grain = ParallelGrain) -> std::valarray<std::decay_t<decltype(neuronComputer[0])>>
 	{
 		std::valarray<std::decay_t<decltype(neuronComputer[0])>> result(neuronComputer.size());
-#pragma omp parallel for
-		for (int i = 0; i < static_cast<int>(result.size()); i++)
-			result[static_cast<size_t>(i)] = neuronComputer[static_cast<size_t>(i)];
+		ParallelFor(result.size(), grain, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+				result[i] = neuronComputer[i];
+		});
 		std::decay_t<decltype(neuronComputer[0])> max = -std::numeric_limits<std::decay_t<decltype(neuronComputer[0])>>::infinity();
 		for (int i = 0; i < static_cast<int>(result.size()); i++)
 			max = (std::max)(result[static_cast<size_t>(i)], max);
 		std::decay_t<decltype(neuronComputer[0])> sum = 0;
 		for (int i = 0; i < static_cast<int>(result.size()); i++)
 			sum += result[static_cast<size_t>(i)] = exp(result[static_cast<size_t>(i)] - max);
-#pragma omp parallel for
-		for (int i = 0; i < static_cast<int>(result.size()); i++)
-			result[static_cast<size_t>(i)] /= sum;
+		result /= sum;
+		return std::move(result);
+	}
+	template <class TComputer> static auto RectifiedLinear(const TComputer& neuronComputer, size_t grain = ParallelGrain) -> std::valarray<std::decay_t<decltype(neuronComputer[0])>>
+	{
+		std::valarray<std::decay_t<decltype(neuronComputer[0])>> result(neuronComputer.size());
+		ParallelFor(result.size(), grain, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+				result[i] = (std::max)(neuronComputer[i], static_cast<std::decay_t<decltype(neuronComputer[0])>>(0));
+		});
 		return std::move(result);
 	}
+	template <class T> static T RectifiedLinearDifferentiated(T y) { return y > 0 ? static_cast<T>(1) : static_cast<T>(0); }
+
+	/// <summary>ロジスティックシグモイド関数を活性化関数として使用する層のポリシーを表します。</summary>
+	struct LogisticSigmoidPolicy final
+	{
+		template <class TComputer> static auto Activate(const TComputer& neuronComputer, size_t grain = ParallelGrain) -> decltype(LogisticSigmoid(neuronComputer)) { return LogisticSigmoid(neuronComputer, grain); }
+		template <class T> static T Differentiate(T y) { return LogisticSigmoidDifferentiated(y); }
+	};
+
+	/// <summary>正規化線形関数 (ReLU) を活性化関数として使用する層のポリシーを表します。</summary>
+	struct RectifiedLinearPolicy final
+	{
+		template <class TComputer> static auto Activate(const TComputer& neuronComputer, size_t grain = ParallelGrain) -> decltype(RectifiedLinear(neuronComputer)) { return RectifiedLinear(neuronComputer, grain); }
+		template <class T> static T Differentiate(T y) { return RectifiedLinearDifferentiated(y); }
+	};
+
+	/// <summary>ソフトマックス関数を活性化関数として使用する層のポリシーを表します。出力層でのみ使用できます。</summary>
+	struct SoftMaxPolicy final
+	{
+		template <class TComputer> static auto Activate(const TComputer& neuronComputer, size_t grain = ParallelGrain) -> decltype(SoftMax(neuronComputer)) { return SoftMax(neuronComputer, grain); }
+	};
+
+	/// <summary>第 i 成分が values[i * batch + j] に格納された <paramref name="batch"/> 個のベクトルのそれぞれに、指定されたポリシーの活性化関数を適用します。</summary>
+	template <class TPolicy, class T> static void ActivateColumns(T* values, size_t rows, size_t batch)
+	{
+		std::valarray<T> column(rows);
+		for (size_t j = 0; j < batch; j++)
+		{
+			for (size_t i = 0; i < rows; i++)
+				column[i] = values[i * batch + j];
+			auto activated = TPolicy::Activate(column);
+			for (size_t i = 0; i < rows; i++)
+				values[i * batch + j] = activated[i];
+		}
+	}
 };
 
 namespace CostFunction
@@ -48,4 +101,34 @@ namespace CostFunction
 			sum -= target[i] * log(source[i] + eps);
 		return sum;
 	}
+
+	/// <summary>2 クラス交差エントロピーをコスト関数として使用する層のポリシーを表します。</summary>
+	struct BiClassCrossEntropyPolicy final
+	{
+		template <class T> static auto Compute(const T& source, const T& target) -> decltype(BiClassCrossEntropy(source, target)) { return BiClassCrossEntropy(source, target); }
+	};
+
+	/// <summary>多クラス交差エントロピーをコスト関数として使用する層のポリシーを表します。</summary>
+	struct MultiClassCrossEntropyPolicy final
+	{
+		template <class T> static auto Compute(const T& source, const T& target) -> decltype(MultiClassCrossEntropy(source, target)) { return MultiClassCrossEntropy(source, target); }
+	};
+};
+
+namespace DeltaFunction
+{
+	/// <summary>上位層から逆伝播された情報に活性化関数の微分を乗じて勾配ベクトル (Delta) を計算するポリシーを表します。隠れ層で使用されます。</summary>
+	template <class TActivation> struct BackPropagationPolicy final
+	{
+		template <class T> static T Compute(T output, T upperInfo) { return upperInfo * TActivation::Differentiate(output); }
+	};
+
+	/// <summary>
+	/// 出力と教師信号の差を勾配ベクトル (Delta) とするポリシーを表します。
+	/// 活性化関数とコスト関数が正準連結の組 (ソフトマックスと多クラス交差エントロピーなど) になっている出力層で使用されます。
+	/// </summary>
+	struct CanonicalLinkPolicy final
+	{
+		template <class T> static T Compute(T output, T target) { return output - target; }
+	};
 };
\ No newline at end of file
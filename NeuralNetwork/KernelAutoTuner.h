@@ -0,0 +1,123 @@
+﻿#pragma once
+
+#include "Layers.h"
+
+/// <summary>
+/// 結合重みの形状ごとに候補となるカーネルの分割方法を実際に計測し、最も速いものを <see cref="KernelTuningTable::Global"/> に設定します。
+/// 計測には乱数で初期化した同じ形状の隠れ層を使用するため、学習中のネットワークのパラメータは変更されません。
+/// 順伝播のタスク数は列に並べた入力に対する計算で、訓練のタスク数は雑音除去自己符号化器の訓練と <see cref="LearnLayer"/> を合わせた時間で選択します。
+/// </summary>
+template <class TValue> class KernelAutoTuner final : private boost::noncopyable
+{
+public:
+	/// <summary>計測に使用する入力の数と 1 つの候補あたりの計測時間を指定して、<see cref="KernelAutoTuner"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="batch">順伝播でまとめて処理する入力の数を指定します。</param>
+	/// <param name="samples">訓練に使用するデータ点の数を指定します。</param>
+	/// <param name="budget">1 つの候補を繰り返し計測する時間の下限を指定します。</param>
+	KernelAutoTuner(size_t batch = 32, size_t samples = 4, std::chrono::milliseconds budget = std::chrono::milliseconds(10)) : batch(batch), samples(samples), budget(budget) { }
+
+	/// <summary>候補が既存の最良の候補よりこの割合以上速い場合にのみ選択を変更します。計測の揺らぎによって選択が変わり続けることを防ぎます。</summary>
+	static constexpr double RequiredImprovement = 0.03;
+
+	/// <summary>指定された形状に対して分割方法を探索し、その結果を表に設定します。</summary>
+	/// <param name="rows">結合重みの行数 (隠れ素子の数) を指定します。</param>
+	/// <param name="columns">結合重みの列数 (入力の次元数) を指定します。</param>
+	/// <returns>選択された分割方法。</returns>
+	KernelConfiguration Tune(size_t rows, size_t columns)
+	{
+		auto& table = KernelTuningTable::Global();
+		HiddenLayerCollection<TValue> layers(89677, columns);
+		layers.Set(0, rows);
+		auto& layer = layers[0];
+		DataSet<TValue> images;
+		images.Allocate(samples, 1, static_cast<unsigned int>(columns), 1);
+		std::vector<TValue> input(columns * batch), output;
+		std::valarray<TValue> sample(columns), target(static_cast<TValue>(0), rows);
+		std::mt19937 rng(89677);
+		std::uniform_real_distribution<TValue> uniform(0, 1);
+		for (auto& image : images.Images())
+		{
+			for (auto& value : image)
+				value = uniform(rng);
+		}
+		for (auto& value : input)
+			value = uniform(rng);
+		for (auto& value : sample)
+			value = uniform(rng);
+		DataSetView<TValue> dataset(images);
+
+		// 3 つの項目を 1 つずつ順に探索し、探索する候補の数を項目ごとの候補の数の和に抑える
+		KernelConfiguration best;
+		auto search = [&](const std::vector<KernelConfiguration>& candidates, const std::function<void()>& kernel)
+		{
+			auto bestTime = std::numeric_limits<double>::infinity();
+			for (auto& candidate : candidates)
+			{
+				table.Set(rows, columns, candidate);
+				auto time = Measure(kernel);
+				if (time < bestTime * (1 - RequiredImprovement))
+				{
+					bestTime = time;
+					best = candidate;
+				}
+			}
+		};
+		auto forward = [&] { layer.Compute(input, batch, output); };
+		std::vector<KernelConfiguration> candidates;
+		for (auto tasks : TaskCandidates())
+			candidates.emplace_back(tasks, 0, best.TrainTasks);
+		search(candidates, forward);
+		candidates.clear();
+		for (size_t block : { static_cast<size_t>(0), static_cast<size_t>(64), static_cast<size_t>(256), static_cast<size_t>(1024) })
+		{
+			if (block < columns)
+				candidates.emplace_back(best.ForwardTasks, block, best.TrainTasks);
+		}
+		search(candidates, forward);
+		candidates.clear();
+		for (auto tasks : TaskCandidates())
+			candidates.emplace_back(best.ForwardTasks, best.ColumnBlock, tasks);
+		auto activation = layer.Compute(sample);
+		search(candidates, [&]
+		{
+			layer.Train(dataset, static_cast<TValue>(0), static_cast<TValue>(0));
+			for (size_t n = 0; n < samples; n++)
+				LearnLayer(layer, sample, activation, target, static_cast<TValue>(0));
+		});
+
+		table.Set(rows, columns, best);
+		return best;
+	}
+
+private:
+	size_t batch;
+	size_t samples;
+	std::chrono::milliseconds budget;
+
+	// 既定の分割方法 (0)、スレッド数以下の 2 の冪とスレッド数
+	static std::vector<unsigned int> TaskCandidates()
+	{
+		auto threads = ThreadPool::Current().Threads();
+		std::vector<unsigned int> candidates { 0 };
+		for (unsigned int tasks = 1; tasks < threads; tasks *= 2)
+			candidates.push_back(tasks);
+		candidates.push_back(threads);
+		return candidates;
+	}
+
+	// 計測時間が予算に達するまで繰り返し、1 回あたりの平均時間を秒単位で返す (最初の 1 回はキャッシュを温めるために除く)
+	double Measure(const std::function<void()>& kernel) const
+	{
+		kernel();
+		size_t repetitions = 0;
+		auto start = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::duration elapsed;
+		do
+		{
+			kernel();
+			repetitions++;
+			elapsed = std::chrono::steady_clock::now() - start;
+		} while (elapsed < budget);
+		return std::chrono::duration<double>(elapsed).count() / repetitions;
+	}
+};
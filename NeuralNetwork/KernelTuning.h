@@ -0,0 +1,133 @@
+﻿#pragma once
+
+#include "Platform.h"
+#include "ThreadPool.h"
+
+/// <summary>結合重みの形状ごとに選択されたカーネルの分割方法を表します。0 の項目は既定の分割方法を使用することを示します。</summary>
+struct KernelConfiguration final
+{
+	KernelConfiguration() : ForwardTasks(0), ColumnBlock(0), TrainTasks(0) { }
+	KernelConfiguration(unsigned int forwardTasks, size_t columnBlock, unsigned int trainTasks) : ForwardTasks(forwardTasks), ColumnBlock(columnBlock), TrainTasks(trainTasks) { }
+
+	/// <summary>順伝播で行を分割するタスクの数を示します。列に並べられた複数の入力に対する計算と、1 つの入力に対する計算の両方に使用されます。</summary>
+	unsigned int ForwardTasks;
+	/// <summary>列に並べられた複数の入力に対する順伝播で、入力をキャッシュに保持するために列を分割するブロックの大きさを示します。</summary>
+	size_t ColumnBlock;
+	/// <summary>雑音除去自己符号化器の訓練とファインチューニングの <see cref="LearnLayer"/> で、結合重みの行を分割するタスクの数を示します。</summary>
+	unsigned int TrainTasks;
+
+	/// <summary>分割方法が選択されていない場合の、雑音除去自己符号化器の訓練で行を分割する最小区間長を示します。</summary>
+	static constexpr size_t DefaultTrainGrain = 4;
+
+	/// <summary>指定された長さの範囲を指定された数のタスクに分割するための <see cref="ParallelFor"/> の最小区間長を返します。</summary>
+	/// <param name="length">分割する範囲の長さを指定します。</param>
+	/// <param name="tasks">タスクの数を指定します。0 の場合は <paramref name="defaultGrain"/> を返します。</param>
+	/// <param name="defaultGrain">既定の最小区間長を指定します。</param>
+	static size_t Grain(size_t length, unsigned int tasks, size_t defaultGrain) { return tasks > 0 ? (std::max)((length + tasks - 1) / tasks, static_cast<size_t>(1)) : defaultGrain; }
+};
+
+/// <summary>
+/// 結合重みの形状ごとに選択されたカーネルの分割方法を保持します。
+/// 最適な分割方法はプロセッサとスレッド数に依存するため、キャッシュファイルの各項目はプロセッサの製品名とスレッド数を含むホストのキーに関連付けられます。
+/// </summary>
+class KernelTuningTable final : private boost::noncopyable
+{
+public:
+	/// <summary>プロセス全体で共有される表を取得します。</summary>
+	static KernelTuningTable& Global()
+	{
+		static KernelTuningTable table;
+		return table;
+	}
+
+	/// <summary>現在のプロセッサと、呼び出し元のスレッドで使用されるスレッドプールのスレッド数を表すキーを返します。</summary>
+	static std::string HostKey() { return Platform::ProcessorName() + " / " + std::to_string(ThreadPool::Current().Threads()) + " threads"; }
+
+	/// <summary>指定された形状に対して選択された分割方法を返します。選択されていない場合は既定の分割方法を返します。</summary>
+	/// <param name="rows">結合重みの行数を指定します。</param>
+	/// <param name="columns">結合重みの列数を指定します。</param>
+	KernelConfiguration Find(size_t rows, size_t columns) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = entries.find(std::make_pair(rows, columns));
+		return found != entries.end() ? found->second : KernelConfiguration();
+	}
+
+	/// <summary>指定された形状に対して分割方法が選択されているかどうかを返します。</summary>
+	bool Contains(size_t rows, size_t columns) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.find(std::make_pair(rows, columns)) != entries.end();
+	}
+
+	/// <summary>指定された形状に対する分割方法を設定します。</summary>
+	void Set(size_t rows, size_t columns, const KernelConfiguration& configuration)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		entries[std::make_pair(rows, columns)] = configuration;
+	}
+
+	/// <summary>指定された形状に対する分割方法を削除し、既定の分割方法に戻します。</summary>
+	void Remove(size_t rows, size_t columns)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		entries.erase(std::make_pair(rows, columns));
+	}
+
+	/// <summary>キャッシュファイルから現在のホストに対する項目を読み込みます。他のホストの項目は <see cref="Save"/> で書き戻すために保持されます。</summary>
+	/// <remarks>ホストのキーはスレッドプールのスレッド数を含むため、<see cref="ThreadPool::Configure"/> の後に呼び出す必要があります。</remarks>
+	/// <param name="path">キャッシュファイルのパスを指定します。ファイルが存在しない場合は何も読み込みません。</param>
+	/// <returns>読み込まれた現在のホストに対する項目の数。</returns>
+	size_t Load(const std::string& path)
+	{
+		std::ifstream stream(path);
+		auto host = HostKey();
+		size_t loaded = 0;
+		std::string line;
+		std::lock_guard<std::mutex> lock(mutex);
+		others.clear();
+		while (std::getline(stream, line))
+		{
+			// 各行はタブで区切られたホストのキー、行数、列数、順伝播のタスク数、列のブロックの大きさ、訓練のタスク数からなる
+			auto tab = line.find('\t');
+			if (tab == std::string::npos)
+				continue;
+			if (line.compare(0, tab, host) != 0)
+			{
+				others.push_back(line);
+				continue;
+			}
+			std::istringstream fields(line.substr(tab + 1));
+			size_t rows, columns;
+			KernelConfiguration configuration;
+			if (fields >> rows >> columns >> configuration.ForwardTasks >> configuration.ColumnBlock >> configuration.TrainTasks)
+			{
+				entries[std::make_pair(rows, columns)] = configuration;
+				loaded++;
+			}
+		}
+		return loaded;
+	}
+
+	/// <summary>読み込まれた他のホストの項目とともに、現在のホストに対するすべての項目をキャッシュファイルに書き出します。</summary>
+	/// <param name="path">キャッシュファイルのパスを指定します。</param>
+	void Save(const std::string& path) const
+	{
+		auto host = HostKey();
+		std::ofstream stream(path, std::ios::trunc);
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& line : others)
+			stream << line << "\n";
+		for (auto& entry : entries)
+			stream << host << "\t" << entry.first.first << "\t" << entry.first.second << "\t" << entry.second.ForwardTasks << "\t" << entry.second.ColumnBlock << "\t" << entry.second.TrainTasks << "\n";
+		if (!stream)
+			throw std::runtime_error("failed to write " + path);
+	}
+
+private:
+	KernelTuningTable() { }
+
+	mutable std::mutex mutex;
+	std::map<std::pair<size_t, size_t>, KernelConfiguration> entries;
+	std::vector<std::string> others;
+};
@@ -0,0 +1,203 @@
+﻿#pragma once
+
+#include "LearningSet.h"
+#include "Matrix.h"
+
+/// <summary>値の内容から 64 ビットの FNV-1a ハッシュ値を計算します。</summary>
+class ContentHash final
+{
+public:
+	/// <summary>空の内容に対する <see cref="ContentHash"/> クラスの新しいインスタンスを初期化します。</summary>
+	ContentHash() : value(14695981039346656037ull) { }
+
+	/// <summary>指定されたバイト列を内容に加えます。</summary>
+	ContentHash& AddBytes(const void* data, size_t size)
+	{
+		auto bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++)
+			value = (value ^ bytes[i]) * 1099511628211ull;
+		return *this;
+	}
+
+	/// <summary>指定された数値または列挙値を内容に加えます。</summary>
+	template <class T> typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value, ContentHash&>::type Add(T item) { return AddBytes(&item, sizeof(item)); }
+
+	/// <summary>指定された文字列を長さとともに内容に加えます。</summary>
+	ContentHash& Add(const std::string& item) { return Add(item.size()).AddBytes(item.data(), item.size()); }
+
+	/// <summary>指定された配列を長さとともに内容に加えます。</summary>
+	template <class T> ContentHash& Add(const std::valarray<T>& item) { return item.size() > 0 ? Add(item.size()).AddBytes(&item[0], item.size() * sizeof(T)) : Add(item.size()); }
+
+	/// <summary>指定された行列を形状とともに内容に加えます。</summary>
+	template <class T> ContentHash& Add(const Matrix<T>& item) { return Add(item.Row()).Add(item.Column()).AddBytes(item.Data(), item.Row() * item.Column() * sizeof(T)); }
+
+	/// <summary>指定されたデータセットの画像の形状、すべてのラベルおよび画像を内容に加えます。</summary>
+	template <class T> ContentHash& Add(const DataSetView<T>& item)
+	{
+		Add(item.Count()).Add(item.Row()).Add(item.Column()).Add(item.ComponentsPerPixel());
+		for (size_t i = 0; i < item.Count(); i++)
+			Add(item.Label(i)).Add(item.Image(i));
+		return *this;
+	}
+
+	/// <summary>ハッシュ値を返します。</summary>
+	uint64_t Value() const { return value; }
+
+	/// <summary>ハッシュ値を 16 桁の 16 進数で表した文字列を返します。</summary>
+	std::string ToString() const { return (boost::format("%016x") % value).str(); }
+
+private:
+	uint64_t value;
+};
+
+/// <summary>
+/// 事前学習の結果を、その結果を決めるすべての値から計算したキーによってディスクに保存し、再利用します。
+/// キーには候補のニューロン数で学習したときの検証コストの推移を保存するものと、事前学習を終えた層のパラメータを保存するものがあります。
+/// 書き込みは一時ファイルへの書き込みと名前の変更によって行われるため、中断された書き込みが読み込まれることはありません。
+/// </summary>
+class PretrainedLayerCache final : private boost::noncopyable
+{
+public:
+	/// <summary>指定されたディレクトリにエントリを保存する <see cref="PretrainedLayerCache"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="directory">エントリを保存するディレクトリを指定します。存在しない場合は作成されます。</param>
+	explicit PretrainedLayerCache(const std::string& directory) : directory(directory), hits(0), misses(0) { Platform::MakeDirectory(directory); }
+
+	/// <summary>指定されたキーに対して保存されたコストの推移を読み込みます。</summary>
+	/// <param name="key">エントリのキーを指定します。</param>
+	/// <param name="costs">読み込んだコストを格納する配列を指定します。</param>
+	/// <returns>エントリが見つかった場合は true。</returns>
+	template <class TValue> bool LoadCosts(const ContentHash& key, std::vector<TValue>& costs)
+	{
+		std::ifstream stream(PathOf(key, ".costs"), std::ios::binary);
+		uint32_t header[2];
+		if (!stream.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != CostsSignature || header[1] != sizeof(TValue))
+			return Miss();
+		uint64_t count = 0;
+		if (!stream.read(reinterpret_cast<char*>(&count), sizeof(count)))
+			return Miss();
+		std::vector<TValue> values(static_cast<size_t>(count));
+		if (count > 0 && !stream.read(reinterpret_cast<char*>(&values[0]), static_cast<std::streamsize>(count * sizeof(TValue))))
+			return Miss();
+		costs = std::move(values);
+		return Hit();
+	}
+
+	/// <summary>指定されたキーに対してコストの推移を保存します。</summary>
+	/// <param name="key">エントリのキーを指定します。</param>
+	/// <param name="costs">保存するコストを指定します。</param>
+	template <class TValue> void SaveCosts(const ContentHash& key, const std::vector<TValue>& costs)
+	{
+		Write(PathOf(key, ".costs"), [&](std::ostream& stream)
+		{
+			uint32_t header[] { CostsSignature, sizeof(TValue) };
+			uint64_t count = costs.size();
+			stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+			stream.write(reinterpret_cast<const char*>(&count), sizeof(count));
+			if (!costs.empty())
+				stream.write(reinterpret_cast<const char*>(&costs[0]), static_cast<std::streamsize>(costs.size() * sizeof(TValue)));
+		});
+	}
+
+	/// <summary>指定されたキーに対して保存された層のパラメータを、同じ形状の層に読み込みます。</summary>
+	/// <param name="key">エントリのキーを指定します。</param>
+	/// <param name="layer">パラメータを読み込む層を指定します。結合重み、バイアスおよび可視層のバイアスが上書きされます。</param>
+	/// <returns>エントリが見つかり、その形状が層と一致した場合は true。</returns>
+	template <class TValue, class TLayer> bool LoadLayer(const ContentHash& key, TLayer& layer)
+	{
+		std::ifstream stream(PathOf(key, ".layer"), std::ios::binary);
+		uint64_t header[4];
+		if (!stream.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != LayerSignature || header[1] != sizeof(TValue) ||
+			header[2] != layer.Weight.Row() || header[3] != layer.Weight.Column())
+			return Miss();
+		auto weightBytes = layer.Weight.Row() * layer.Weight.Column() * sizeof(TValue);
+		std::valarray<TValue> bias(layer.Bias.size());
+		std::valarray<TValue> visibleBias(layer.VisibleBias.size());
+		auto readBiases = [&] { return stream.read(reinterpret_cast<char*>(&bias[0]), static_cast<std::streamsize>(bias.size() * sizeof(TValue))) &&
+			stream.read(reinterpret_cast<char*>(&visibleBias[0]), static_cast<std::streamsize>(visibleBias.size() * sizeof(TValue))); };
+		// 途中で読み込みに失敗しても層が壊れないように、結合重みは作業領域に読み込んでから複写する
+		// 作業領域がメモリ予算に収まらない場合は、エントリの長さを確かめてバイアスを先に読み込んでから、結合重みを層に直接読み込む
+		if (!MemoryAccountant::Global().Fits(weightBytes))
+		{
+			auto begin = stream.tellg();
+			stream.seekg(0, std::ios::end);
+			auto remaining = static_cast<uint64_t>(stream.tellg() - begin);
+			if (!stream || remaining != weightBytes + (bias.size() + visibleBias.size()) * sizeof(TValue))
+				return Miss();
+			stream.seekg(begin + static_cast<std::streamoff>(weightBytes));
+			if (!readBiases())
+				return Miss();
+			stream.seekg(begin);
+			if (!stream.read(reinterpret_cast<char*>(layer.Weight.Data()), static_cast<std::streamsize>(weightBytes)))
+				return Miss();
+		}
+		else
+		{
+			MemoryReservation reservation(MemoryCategory::Workspaces, weightBytes);
+			Matrix<TValue> weight(layer.Weight.Row(), layer.Weight.Column());
+			if (!stream.read(reinterpret_cast<char*>(weight.Data()), static_cast<std::streamsize>(weightBytes)) || !readBiases())
+				return Miss();
+			std::copy(weight.Data(), weight.Data() + weight.Row() * weight.Column(), layer.Weight.Data());
+		}
+		layer.Bias = bias;
+		layer.VisibleBias = visibleBias;
+		return Hit();
+	}
+
+	/// <summary>指定されたキーに対して層のパラメータを保存します。</summary>
+	/// <param name="key">エントリのキーを指定します。</param>
+	/// <param name="layer">パラメータを保存する層を指定します。</param>
+	template <class TValue, class TLayer> void SaveLayer(const ContentHash& key, const TLayer& layer)
+	{
+		Write(PathOf(key, ".layer"), [&](std::ostream& stream)
+		{
+			uint64_t header[] { LayerSignature, sizeof(TValue), layer.Weight.Row(), layer.Weight.Column() };
+			stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+			stream.write(reinterpret_cast<const char*>(layer.Weight.Data()), static_cast<std::streamsize>(layer.Weight.Row() * layer.Weight.Column() * sizeof(TValue)));
+			stream.write(reinterpret_cast<const char*>(&layer.Bias[0]), static_cast<std::streamsize>(layer.Bias.size() * sizeof(TValue)));
+			stream.write(reinterpret_cast<const char*>(&layer.VisibleBias[0]), static_cast<std::streamsize>(layer.VisibleBias.size() * sizeof(TValue)));
+		});
+	}
+
+	/// <summary>見つかったエントリの数を取得します。</summary>
+	size_t Hits() const { return hits; }
+
+	/// <summary>見つからなかったエントリの数を取得します。</summary>
+	size_t Misses() const { return misses; }
+
+private:
+	// ファイルの先頭に置かれる "COST" および "LAYR"
+	static const uint32_t CostsSignature = 0x54534f43;
+	static const uint64_t LayerSignature = 0x5259414c;
+
+	std::string directory;
+	size_t hits;
+	size_t misses;
+
+	std::string PathOf(const ContentHash& key, const char* extension) const { return directory + "/" + key.ToString() + extension; }
+
+	bool Hit()
+	{
+		hits++;
+		return true;
+	}
+
+	bool Miss()
+	{
+		misses++;
+		return false;
+	}
+
+	template <class TWrite> static void Write(const std::string& path, TWrite write)
+	{
+		auto temporary = path + ".tmp";
+		{
+			std::ofstream stream(temporary, std::ios::binary | std::ios::trunc);
+			write(stream);
+			if (!stream)
+				throw std::runtime_error("failed to write " + temporary);
+		}
+		std::remove(path.c_str());
+		if (std::rename(temporary.c_str(), path.c_str()) != 0)
+			throw std::runtime_error("failed to rename " + temporary);
+	}
+};
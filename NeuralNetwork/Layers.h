@@ -3,6 +3,9 @@
 #include "Matrix.h"
 #include "Functions.h"
 #include "LearningSet.h"
+#include "Optimizers.h"
+#include "Profiler.h"
+#include "KernelTuning.h"
 
 template <class T> class ReferableVector final
 {
@@ -26,8 +29,8 @@ public:
 	}
 	ReferableVector& operator=(ReferableVector&& right)
 	{
-		reference_target_ = right.reference_target;
-		target_ = std::move(right.target);
+		reference_target_ = right.reference_target_;
+		target_ = std::move(right.target_);
 		return *this;
 	}
 
@@ -40,6 +43,29 @@ private:
 	std::valarray<T> target_;
 };
 
+/// <summary>層の入出力を画像と同じ高さ、幅、画素あたりの成分数を持つ特徴マップとして見た場合の形状を表します。</summary>
+/// <remarks>特徴マップの成分は画素ごとに並べられ、位置 (y, x) の成分 c は (y * Width + x) * Channels + c に格納されます。</remarks>
+struct FeatureShape final
+{
+	FeatureShape(size_t height, size_t width, size_t channels) : Height(height), Width(width), Channels(channels) { }
+
+	/// <summary>高さを示します。</summary>
+	size_t Height;
+	/// <summary>幅を示します。</summary>
+	size_t Width;
+	/// <summary>画素あたりの成分数 (チャネル数) を示します。</summary>
+	size_t Channels;
+
+	/// <summary>すべての成分の数を返します。</summary>
+	size_t Size() const { return Height * Width * Channels; }
+
+	/// <summary>空間的な構造を持たない指定された次元数のベクトルの形状を返します。</summary>
+	static FeatureShape Vector(size_t size) { return FeatureShape(1, 1, size); }
+
+	/// <summary>指定されたデータセットの画像の形状を返します。</summary>
+	template <class TDataSet> static FeatureShape Of(const TDataSet& dataset) { return FeatureShape(dataset.Row(), dataset.Column(), dataset.ComponentsPerPixel()); }
+};
+
 /// <summary>指定された層の学習を行い、下位層の学習に必要な情報を返します。</summary>
 /// <param name="layer">学習を行う層を指定します。</param>
 /// <param name="input"><paramref name="layer"/> への入力を示すベクトルを指定します。</param>
@@ -47,32 +73,83 @@ private:
 /// <param name="upperInfo">上位層から得られた学習に必要な情報を指定します。<paramref name="layer"/> が出力層の場合、これは教師信号になります。</param>
 /// <param name="learningRate">結合重みとバイアスをどれほど更新するかを示す値を指定します。</param>
 /// <returns>下位層の学習に必要な情報。</returns>
+/// <remarks>
+/// 結合重みとバイアスは <paramref name="layer"/> のオプティマイザによって更新されます。
+/// 行と列は <see cref="KernelTuningTable::Global"/> に結合重みの形状に対して設定された訓練のタスク数で分割し、設定されていない場合は分割しません。
+/// </remarks>
 template <class TLayer, class TUpperInfo, class TValue> std::valarray<TValue> LearnLayer(TLayer& layer, const std::valarray<TValue>& input, const std::valarray<TValue>& output, const TUpperInfo& upperInfo, TValue learningRate)
 {
-	std::valarray<TValue> lowerInfo(static_cast<TValue>(0), layer.Weight.Column());
-	for (size_t i = 0; i < layer.Weight.Row(); i++)
+	auto& optimizer = layer.Optimizer();
+	auto rows = layer.Weight.Row(), columns = layer.Weight.Column();
+	auto tasks = KernelTuningTable::Global().Find(rows, columns).TrainTasks;
+	std::valarray<TValue> delta(rows);
+	for (size_t i = 0; i < rows; i++)
+		delta[i] = TLayer::GetDelta(output[i], upperInfo[i]);
+	// 下位層の学習に必要な情報は更新前の結合重みから求めるため、行の更新より先に列を分割して計算する
+	std::valarray<TValue> lowerInfo(static_cast<TValue>(0), columns);
+	ParallelFor(columns, KernelConfiguration::Grain(columns, tasks, columns), [&](size_t begin, size_t end)
 	{
-		auto deltaI = TLayer::GetDelta(output[i], upperInfo[i]);
-		for (size_t j = 0; j < layer.Weight.Column(); j++)
+		for (size_t i = 0; i < rows; i++)
 		{
-			lowerInfo[j] += layer.Weight(i, j) * deltaI;
-			layer.Weight(i, j) -= learningRate * (deltaI * input[j]);
+			auto w = &layer.Weight(i, 0);
+			for (auto j = begin; j < end; j++)
+				lowerInfo[j] += w[j] * delta[i];
 		}
-		layer.Bias[i] -= learningRate * deltaI;
-	}
+	});
+	ParallelFor(rows, KernelConfiguration::Grain(rows, tasks, rows), [&](size_t begin, size_t end)
+	{
+		std::valarray<TValue> gradient(columns);
+		for (auto i = begin; i < end; i++)
+		{
+			for (size_t j = 0; j < columns; j++)
+				gradient[j] = delta[i] * input[j];
+			MaskGradients(layer.WeightMask, &gradient[0], i * columns, columns);
+			optimizer.Weight->Update(layer.Weight.Data(), &gradient[0], i * columns, columns, learningRate);
+		}
+	});
+	optimizer.Bias->Update(&layer.Bias[0], &delta[0], 0, layer.Bias.size(), learningRate);
+	optimizer.Step();
+	NN_PROFILE_COUNT(0, 4 * layer.Weight.Row() * layer.Weight.Column(), 2 * layer.Weight.Row() * layer.Weight.Column() * sizeof(TValue), 3);
 	return std::move(lowerInfo);
 }
 
-template <class TMatrix, class TVector> class NeuronComputer final : private boost::noncopyable
+/// <summary>よく使用される入力の次元数を表します。これらの次元数に対する積和演算はコンパイル時に次元数が確定した形で展開されます。</summary>
+namespace FixedDimension
+{
+	/// <summary>MNIST および Caltech 101 Silhouettes の画像 (28 × 28) の次元数を示します。</summary>
+	constexpr size_t Image28x28 = 28 * 28;
+	/// <summary>Cifar-10 のグレースケール画像 (32 × 32) の次元数を示します。</summary>
+	constexpr size_t Image32x32 = 32 * 32;
+	/// <summary>Cifar-10 のカラー画像 (32 × 32 × 3) の次元数を示します。</summary>
+	constexpr size_t Image32x32x3 = 32 * 32 * 3;
+};
+
+/// <summary>ニューロンの線形計算 (重み付き和とバイアスの和) を要素ごとに遅延評価するベクトルを表します。</summary>
+/// <remarks><typeparamref name="NInput"/> に 0 以外を指定した場合、入力の次元数はその値に固定されます。0 を指定した場合、<see cref="FixedDimension"/> のいずれかに一致する入力は固定次元の計算に振り分けられます。</remarks>
+template <class TMatrix, class TVector, size_t NInput = 0> class NeuronComputer final : private boost::noncopyable
 {
 public:
-	NeuronComputer(const TMatrix& weight, const TVector& bias, const TVector& input) : weight(&weight), bias(&bias), input(&input) { }
+	NeuronComputer(const TMatrix& weight, const TVector& bias, const TVector& input) : weight(&weight), bias(&bias), input(&input)
+	{
+		// 固定次元の計算は入力の大きさを確認せずに NInput 個の要素を読み込む
+		assert((NInput == 0 || input.size() == NInput) && "input size must match NInput");
+		assert(input.size() == weight.Column() && "input size must match the number of weight columns");
+	}
 	typename TVector::value_type operator[](size_t index) const
 	{
-		auto ret = (*bias)[index];
-		for (size_t k = 0; k < input->size(); k++)
-			ret += (*input)[k] * (*weight)(index, k);
-		return ret;
+		if (NInput > 0)
+			return Compute<NInput>(index);
+		switch (input->size())
+		{
+		case FixedDimension::Image28x28:
+			return Compute<FixedDimension::Image28x28>(index);
+		case FixedDimension::Image32x32:
+			return Compute<FixedDimension::Image32x32>(index);
+		case FixedDimension::Image32x32x3:
+			return Compute<FixedDimension::Image32x32x3>(index);
+		default:
+			return Compute<0>(index);
+		}
 	}
 	size_t size() const { return weight->Row(); }
 
@@ -80,12 +157,38 @@ private:
 	const TMatrix* weight;
 	const TVector* bias;
 	const TVector* input;
+
+	template <size_t N> typename TVector::value_type Compute(size_t index) const
+	{
+		auto ret = (*bias)[index];
+		const size_t length = N > 0 ? N : input->size();
+		for (size_t k = 0; k < length; k++)
+			ret += (*input)[k] * (*weight)(index, k);
+		return ret;
+	}
 };
 
-template <class TValue> class HiddenLayer;
+/// <summary>列に並べられた複数の入力に対して、結合重みとバイアスによる線形計算と活性化関数をまとめて適用します。</summary>
+/// <param name="input">第 k 成分が input[k * batch + j] に格納された <paramref name="batch"/> 個の入力を指定します。</param>
+/// <param name="output">第 i 成分が output[i * batch + j] に格納される出力を指定します。</param>
+/// <remarks>行と列の分割方法は <see cref="KernelTuningTable::Global"/> に結合重みの形状に対して設定されたものを使用します。</remarks>
+template <class TActivation, class TValue> void ComputeColumns(const Matrix<TValue>& weight, const std::valarray<TValue>& bias, const std::vector<TValue>& input, size_t batch, std::vector<TValue>& output)
+{
+	NN_PROFILE_COUNT(0, 2 * weight.Row() * weight.Column() * batch, weight.Row() * weight.Column() * sizeof(TValue), 1);
+	auto tuning = KernelTuningTable::Global().Find(weight.Row(), weight.Column());
+	output.resize(weight.Row() * batch);
+	ParallelFor(weight.Row(), KernelConfiguration::Grain(weight.Row(), tuning.ForwardTasks, ActivationFunction::ParallelGrain), [&](size_t begin, size_t end)
+	{
+		for (auto i = begin; i < end; i++)
+			std::fill_n(&output[i * batch], batch, bias[i]);
+		MultiplyAdd(weight, input.data(), batch, output.data(), begin, end, tuning.ColumnBlock);
+	});
+	ActivationFunction::ActivateColumns<TActivation>(output.data(), weight.Row(), batch);
+}
 
 /// <summary>隠れ層のコレクションに対する基本クラスを表します。</summary>
-template <class TValue> class HiddenLayerCollectionBase
+/// <typeparam name="TLayer">コレクションに含まれる隠れ層の型を指定します。</typeparam>
+template <class TValue, class TLayer> class HiddenLayerCollectionBase
 {
 public:
 	/// <summary>指定された範囲で一様な乱数を返します。</summary>
@@ -94,16 +197,25 @@ public:
 	/// <returns><paramref name="min"/> 以上 <paramref name="max"/> 未満の一様乱数。</returns>
 	template <class T> T GenerateUniformRandomNumber(T min, T max) { return std::uniform_real_distribution<T>(min, max)(rng); }
 
+	/// <summary>重みの初期化と雑音生成に使用される乱数生成器を指定されたシード値で初期化し直します。</summary>
+	/// <param name="rngSeed">乱数生成器のシード値を指定します。</param>
+	void Reseed(std::mt19937::result_type rngSeed) { rng.seed(rngSeed); }
+
 	/// <summary>指定された層の入力ベクトルを計算します。層が指定されない場合、このメソッドは出力層の入力ベクトルを計算します。</summary>
 	/// <param name="input">最初の隠れ層に与える入力を指定します。</param>
 	/// <param name="stopLayer">入力ベクトルを計算する層を指定します。この引数は省略可能です。</param>
 	/// <returns>指定された層の入力ベクトル。層が指定されなかった場合は出力層の入力ベクトルを返します。</returns>
-	virtual ReferableVector<TValue> Compute(const std::valarray<TValue>& input, const HiddenLayer<TValue>* stopLayer) const = 0;
+	virtual ReferableVector<TValue> Compute(const std::valarray<TValue>& input, const TLayer* stopLayer) const = 0;
+
+	/// <summary>隠れ層のパラメータの更新方法を取得します。</summary>
+	const OptimizerParameters& Optimizer() const { return optimizer; }
 
 protected:
 	HiddenLayerCollectionBase(std::mt19937::result_type rngSeed) : rng(rngSeed) { }
 	virtual ~HiddenLayerCollectionBase() { }
 
+	OptimizerParameters optimizer;
+
 private:
 	std::mt19937 rng;
 };
@@ -124,15 +236,22 @@ private:
 ///		y = s(W ¥tilde{x} + b)                                           (2)
 ///		x = s(W' y  + b')                                                (3)
 ///		L(x,z) = -sum_{k=1}^d [x_k ¥log z_k + (1-x_k) ¥log(1-z_k)]       (4)
+/// 
+/// 活性化関数 s、コスト関数 L および勾配ベクトルの計算方法はそれぞれ <typeparamref name="TActivation"/>、<typeparamref name="TCost"/>、<typeparamref name="TDelta"/> によってコンパイル時に指定されます。
+/// ただし再構築 (3) には常にロジスティックシグモイド関数が使用されるため、<typeparamref name="TCost"/> には 2 クラス交差エントロピーを指定する必要があります。
 /// </remarks>
-template <class TValue> class HiddenLayer final : private boost::noncopyable
+/// <typeparam name="TActivation">隠れ素子の活性化関数のポリシーを指定します。</typeparam>
+/// <typeparam name="TCost">再構築誤差を計算するコスト関数のポリシーを指定します。</typeparam>
+/// <typeparam name="TDelta">ファインチューニング時に勾配ベクトル (Delta) を計算するポリシーを指定します。</typeparam>
+template <class TValue, class TActivation = ActivationFunction::LogisticSigmoidPolicy, class TCost = CostFunction::BiClassCrossEntropyPolicy, class TDelta = DeltaFunction::BackPropagationPolicy<TActivation>> class HiddenLayer final : private boost::noncopyable
 {
 public:
 	/// <summary><see cref="HiddenLayer"/> クラスを入出力の次元数、活性化関数および下層を使用して初期化します。</summary>
 	/// <param name="nIn">入力の次元数を指定します。</param>
 	/// <param name="nOut">隠れ素子の数を指定します。</param>
 	/// <param name="hiddenLayers">この隠れ層が所属している Stacked Denoising Auto-Encoder のすべての隠れ層を表すリストを指定します。</param>
-	HiddenLayer(size_t nIn, size_t nOut, HiddenLayerCollectionBase<TValue>* hiddenLayers) : Weight(nOut, nIn), Bias(static_cast<TValue>(0), nOut), VisibleBias(static_cast<TValue>(0), nIn), hiddenLayers(hiddenLayers)
+	HiddenLayer(size_t nIn, size_t nOut, HiddenLayerCollectionBase<TValue, HiddenLayer>* hiddenLayers) :
+		Weight(nOut, nIn, ForwardGrain(nOut, nIn)), Bias(static_cast<TValue>(0), nOut), VisibleBias(static_cast<TValue>(0), nIn), hiddenLayers(hiddenLayers), memory(MemoryCategory::Weights, (nOut * nIn + nOut + nIn) * sizeof(TValue))
 	{
 		if (!hiddenLayers)
 			throw std::invalid_argument("hiddenLayers must not be null pointer");
@@ -141,52 +260,95 @@ public:
 		{
 			for (unsigned int i = 0; i < nIn; i++)
 			{
-				Weight(j, i) = (2 * hiddenLayers->GenerateUniformRandomNumber<TValue>(0, randMax) - 1) * sqrt(static_cast<TValue>(6.0) / (nIn + nOut));
+				Weight(j, i) = (2 * hiddenLayers->template GenerateUniformRandomNumber<TValue>(0, randMax) - 1) * sqrt(static_cast<TValue>(6.0) / (nIn + nOut));
 				Weight(j, i) *= 4;
 			}
 		}
 	}
 
+	/// <summary><see cref="HiddenLayer"/> クラスを入力の形状と隠れ素子の数を使用して初期化します。入力の空間的な構造は使用されません。</summary>
+	HiddenLayer(const FeatureShape& input, size_t nOut, HiddenLayerCollectionBase<TValue, HiddenLayer>* hiddenLayers) : HiddenLayer(input.Size(), nOut, hiddenLayers) { }
+
+	/// <summary>指定された入力の形状と隠れ素子の数で作成される層のパラメータの要素数を返します。</summary>
+	static size_t ParameterCount(const FeatureShape& input, size_t nOut) { return input.Size() * nOut + nOut + input.Size(); }
+
+	/// <summary>この層の活性化関数のポリシーを表します。</summary>
+	typedef TActivation ActivationPolicy;
+
 	/// <summary>この層の結合重みを示します。</summary>
 	Matrix<TValue> Weight;
 	/// <summary>この層のバイアスを示します。</summary>
 	std::valarray<TValue> Bias;
 	/// <summary>この層から構成された Denoising Auto-Encoder の出力層のバイアスを示します。</summary>
 	std::valarray<TValue> VisibleBias;
+	/// <summary>枝刈りの後に残っている結合重みを 1、枝刈りされた結合重みを 0 で示します。空の場合はすべての結合重みが残っています。枝刈りされた結合重みは学習によって更新されません。</summary>
+	std::valarray<TValue> WeightMask;
 
 	/// <summary>この層の入力に対する出力を計算します。</summary>
 	/// <param name="input">層に入力するベクトルを指定します。</param>
 	/// <returns>この層の出力を示すベクトル。</returns>
-	std::valarray<TValue> Compute(const std::valarray<TValue>& input) const { return std::move(ActivationFunction::LogisticSigmoid(NeuronComputer<Matrix<TValue>, std::valarray<TValue>>(Weight, Bias, input))); }
+	/// <remarks>行の分割方法は <see cref="KernelTuningTable::Global"/> に結合重みの形状に対して設定された順伝播のタスク数を使用します。</remarks>
+	std::valarray<TValue> Compute(const std::valarray<TValue>& input) const
+	{
+		NN_PROFILE_COUNT(0, 2 * Weight.Row() * Weight.Column(), Weight.Row() * Weight.Column() * sizeof(TValue), 1);
+		return std::move(TActivation::Activate(NeuronComputer<Matrix<TValue>, std::valarray<TValue>>(Weight, Bias, input), ForwardGrain()));
+	}
+
+	/// <summary>列に並べられた複数の入力に対するこの層の出力をまとめて計算します。</summary>
+	/// <param name="input">第 k 成分が input[k * batch + j] に格納された <paramref name="batch"/> 個の入力を指定します。</param>
+	/// <param name="batch">入力の数を指定します。</param>
+	/// <param name="output">第 i 成分が output[i * batch + j] に格納される出力を指定します。</param>
+	void Compute(const std::vector<TValue>& input, size_t batch, std::vector<TValue>& output) const { ComputeColumns<TActivation>(Weight, Bias, input, batch, output); }
+
+	/// <summary>この層の出力の形状を返します。</summary>
+	FeatureShape OutputShape() const { return FeatureShape::Vector(Weight.Row()); }
+
+	/// <summary>この層のパラメータを更新するオプティマイザを取得します。オプティマイザは最初の呼び出し時に所属するコレクションの設定から作成されます。</summary>
+	LayerOptimizer<TValue>& Optimizer()
+	{
+		if (!optimizer)
+			optimizer = std::unique_ptr<LayerOptimizer<TValue>>(new LayerOptimizer<TValue>(hiddenLayers->Optimizer(), Weight.Row() * Weight.Column(), Bias.size(), VisibleBias.size()));
+		return *optimizer;
+	}
+
+	/// <summary>オプティマイザの状態を破棄します。次の更新では所属するコレクションの設定から新しいオプティマイザが作成されます。</summary>
+	void ResetOptimizer() { optimizer.reset(); }
 
 	/// <summary>この層から雑音除去自己符号化器を構成し、指定されたデータセットを使用して訓練した結果のコストを返します。</summary>
 	/// <param name="dataset">訓練に使用するデータセットを指定します。</param>
 	/// <param name="learningRate">学習率を指定します。</param>
 	/// <param name="noise">構成された雑音除去自己符号化器の入力を生成する際のデータの欠損率を指定します。</param>
 	/// <returns>構成された雑音除去自己符号化器の入力に対するコスト。</returns>
-	template <class TNoise> TValue Train(const DataSet<TValue>& dataset, TValue learningRate, TNoise noise)
+	/// <remarks>行の分割方法は <see cref="KernelTuningTable::Global"/> に結合重みの形状に対して設定されたものを使用します。</remarks>
+	template <class TNoise> TValue Train(const DataSetView<TValue>& dataset, TValue learningRate, TNoise noise)
 	{
+		auto grain = KernelConfiguration::Grain(Weight.Row(), KernelTuningTable::Global().Find(Weight.Row(), Weight.Column()).TrainTasks, KernelConfiguration::DefaultTrainGrain);
 		return ComputeCost(dataset, noise, [&](const std::valarray<TValue>& image, const std::valarray<TValue>& corrupted, const std::valarray<TValue>& latent, const std::valarray<TValue>& reconstructed)
 		{
+			auto& optimizer = Optimizer();
+			std::valarray<TValue> visibleDelta = reconstructed - image;
 			std::valarray<TValue> delta(Weight.Row());
 
-#pragma omp parallel for
-			for (int i = 0; i < static_cast<int>(Bias.size()); i++)
-			{
-				delta[static_cast<size_t>(i)] = 0;
-				for (size_t j = 0; j < Weight.Column(); j++)
-					delta[static_cast<size_t>(i)] += (reconstructed[j] - image[j]) * Weight(static_cast<size_t>(i), j);
-				delta[static_cast<size_t>(i)] *= ActivationFunction::LogisticSigmoidDifferentiated(latent[static_cast<size_t>(i)]);
-				Bias[static_cast<size_t>(i)] -= learningRate * delta[static_cast<size_t>(i)];
-			}
-
-#pragma omp parallel for
-			for (int j = 0; j < static_cast<int>(VisibleBias.size()); j++)
+			// 各行の Delta はその行の結合重みのみに依存するため、Delta の計算と結合重みの更新を行ごとにまとめて行う
+			ParallelFor(Weight.Row(), grain, [&](size_t begin, size_t end)
 			{
-				for (size_t i = 0; i < delta.size(); i++)
-					Weight(i, static_cast<size_t>(j)) -= learningRate * ((reconstructed[static_cast<size_t>(j)] - image[static_cast<size_t>(j)]) * latent[i] + delta[i] * corrupted[static_cast<size_t>(j)]);
-				VisibleBias[static_cast<size_t>(j)] -= learningRate * (reconstructed[static_cast<size_t>(j)] - image[static_cast<size_t>(j)]);
-			}
+				std::valarray<TValue> gradient(Weight.Column());
+				for (size_t row = begin; row < end; row++)
+				{
+					TValue sum = 0;
+					for (size_t j = 0; j < Weight.Column(); j++)
+						sum += visibleDelta[j] * Weight(row, j);
+					delta[row] = sum * TActivation::Differentiate(latent[row]);
+					for (size_t j = 0; j < Weight.Column(); j++)
+						gradient[j] = visibleDelta[j] * latent[row] + delta[row] * corrupted[j];
+					MaskGradients(WeightMask, &gradient[0], row * Weight.Column(), Weight.Column());
+					optimizer.Weight->Update(Weight.Data(), &gradient[0], row * Weight.Column(), Weight.Column(), learningRate);
+				}
+			});
+			optimizer.Bias->Update(&Bias[0], &delta[0], 0, Bias.size(), learningRate);
+			optimizer.VisibleBias->Update(&VisibleBias[0], &visibleDelta[0], 0, VisibleBias.size(), learningRate);
+			optimizer.Step();
+			NN_PROFILE_COUNT(0, 8 * Weight.Row() * Weight.Column(), 3 * Weight.Row() * Weight.Column() * sizeof(TValue), 3);
 		});
 	}
 
@@ -194,49 +356,68 @@ public:
 	/// <param name="dataset">コストを計算するデータセットを指定します。</param>
 	/// <param name="noise">構成された雑音除去自己符号化器の入力を生成する際のデータの欠損率を指定します。</param>
 	/// <returns>構成された雑音除去自己符号化器の入力に対するコスト。</returns>
-	template <class TNoise> TValue ComputeCost(const DataSet<TValue>& dataset, TNoise noise) const { return ComputeCost(dataset, noise, [](const std::valarray<TValue>&, const std::valarray<TValue>&, const std::valarray<TValue>&, const std::valarray<TValue>&) { }); }
+	template <class TNoise> TValue ComputeCost(const DataSetView<TValue>& dataset, TNoise noise) const { return ComputeCost(dataset, noise, [](const std::valarray<TValue>&, const std::valarray<TValue>&, const std::valarray<TValue>&, const std::valarray<TValue>&) { }); }
 
 	/// <summary>この層の線形計算の結果に対するニューラルネットワークのコストの勾配ベクトル (Delta) の要素を計算します。</summary>
 	/// <param name="output">この層からの出力を示すベクトルの要素を指定します。</param>
 	/// <param name="upperInfo">上位層から得られた勾配計算に必要な情報を指定します。この層が出力層の場合、これは教師信号になります。</param>
 	/// <returns>勾配ベクトルの要素。</returns>
-	static TValue GetDelta(TValue output, TValue upperInfo) { return upperInfo * ActivationFunction::LogisticSigmoidDifferentiated(output); }
+	static TValue GetDelta(TValue output, TValue upperInfo) { return TDelta::Compute(output, upperInfo); }
 
 private:
-	HiddenLayerCollectionBase<TValue>* const hiddenLayers;
+	HiddenLayerCollectionBase<TValue, HiddenLayer>* const hiddenLayers;
+	std::unique_ptr<LayerOptimizer<TValue>> optimizer;
+	MemoryReservation memory;
+
+	// 1 つの入力に対する順伝播で行を分割する最小区間長
+	// 結合重みも同じ区間長で各ワーカーが初期化するため、順伝播で各ワーカーが読む行はそのワーカーのノードのメモリに置かれる
+	static size_t ForwardGrain(size_t rows, size_t columns) { return KernelConfiguration::Grain(rows, KernelTuningTable::Global().Find(rows, columns).ForwardTasks, ActivationFunction::ParallelGrain); }
+
+	size_t ForwardGrain() const { return ForwardGrain(Weight.Row(), Weight.Column()); }
 
-	template <class T, class TNoise> TValue ComputeCost(const DataSet<TValue>& dataset, TNoise noise, T update) const
+	template <class T, class TNoise> TValue ComputeCost(const DataSetView<TValue>& dataset, TNoise noise, T update) const
 	{
+		auto grain = ForwardGrain();
 		TValue cost = 0;
-		for (size_t n = 0; n < dataset.Images().size(); n++)
+		for (size_t n = 0; n < dataset.Count(); n++)
 		{
-			auto image = hiddenLayers->Compute(dataset.Images()[n], this);
+			auto image = hiddenLayers->Compute(dataset.Image(n), this);
 			std::valarray<TValue> corrupted(Weight.Column());
 			for (size_t i = 0; i < Weight.Column(); i++)
-				corrupted[i] = hiddenLayers->GenerateUniformRandomNumber<TNoise>(0, 1) < noise ? 0 : image[i];
-			auto latent = ActivationFunction::LogisticSigmoid(NeuronComputer<Matrix<TValue>, std::valarray<TValue>>(Weight, Bias, corrupted));
+				corrupted[i] = hiddenLayers->template GenerateUniformRandomNumber<TNoise>(0, 1) < noise ? 0 : image[i];
+			auto latent = TActivation::Activate(NeuronComputer<Matrix<TValue>, std::valarray<TValue>>(Weight, Bias, corrupted), grain);
 			auto reconstructed = ActivationFunction::LogisticSigmoid(NeuronComputer<TransposedMatrixView<TValue>, std::valarray<TValue>>(TransposedMatrixView<TValue>::From(Weight), VisibleBias, latent));
 			update(image, corrupted, latent, reconstructed);
-			cost += CostFunction::BiClassCrossEntropy(image.target(), reconstructed);
+			cost += TCost::Compute(image.target(), reconstructed);
 		}
-		return cost / dataset.Images().size();
+		NN_PROFILE_COUNT(dataset.Count(), 4 * dataset.Count() * Weight.Row() * Weight.Column(), 2 * dataset.Count() * Weight.Row() * Weight.Column() * sizeof(TValue), 3 * dataset.Count());
+		return cost / dataset.Count();
 	}
 };
 
 /// <summary>隠れ層のコレクションを表します。</summary>
-template <class TValue> class HiddenLayerCollection final : public HiddenLayerCollectionBase<TValue>, private boost::noncopyable
+/// <typeparam name="TLayer">コレクションに含まれる隠れ層の型を指定します。活性化関数などのポリシーはこの型を通じて指定されます。</typeparam>
+template <class TValue, class TLayer = HiddenLayer<TValue>> class HiddenLayerCollection final : public HiddenLayerCollectionBase<TValue, TLayer>, private boost::noncopyable
 {
 public:
+	/// <summary>このコレクションに含まれる隠れ層の型を表します。</summary>
+	typedef TLayer LayerType;
+
 	/// <summary>乱数生成器のシード値と入力層のユニット数を指定して、<see cref="HiddenLayerCollection"/> クラスの新しいインスタンスを初期化します。</summary>
 	/// <param name="rngSeed">隠れ層の計算に使用される乱数生成器のシード値を指定します。</param>
 	/// <param name="nIn">入力層のユニット数を指定します。</param>
-	HiddenLayerCollection(std::mt19937::result_type rngSeed, size_t nIn) : HiddenLayerCollectionBase(rngSeed), nIn(nIn), frozen(false) { }
+	HiddenLayerCollection(std::mt19937::result_type rngSeed, size_t nIn) : HiddenLayerCollection(rngSeed, FeatureShape::Vector(nIn)) { }
+
+	/// <summary>乱数生成器のシード値と入力の形状を指定して、<see cref="HiddenLayerCollection"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="rngSeed">隠れ層の計算に使用される乱数生成器のシード値を指定します。</param>
+	/// <param name="input">最初の隠れ層に与える入力の形状を指定します。</param>
+	HiddenLayerCollection(std::mt19937::result_type rngSeed, const FeatureShape& input) : HiddenLayerCollectionBase<TValue, TLayer>(rngSeed), frozen(false), input(input) { }
 
 	/// <summary>指定された層の入力ベクトルを計算します。層が指定されない場合、このメソッドは出力層の入力ベクトルを計算します。</summary>
 	/// <param name="input">最初の隠れ層に与える入力を指定します。</param>
 	/// <param name="stopLayer">入力ベクトルを計算する層を指定します。この引数は省略可能です。</param>
 	/// <returns>指定された層の入力ベクトル。層が指定されなかった場合は出力層の入力ベクトルを返します。</returns>
-	ReferableVector<TValue> Compute(const std::valarray<TValue>& input, const HiddenLayer<TValue>* stopLayer) const
+	ReferableVector<TValue> Compute(const std::valarray<TValue>& input, const LayerType* stopLayer) const
 	{
 		ReferableVector<TValue> result(input);
 		for (size_t i = 0; i < items.size() && items[i].get() != stopLayer; i++)
@@ -247,7 +428,12 @@ public:
 	/// <summary>指定されたインデックスに追加される層の入力ニューロン数を計算します。</summary>
 	/// <param name="index">入力ニューロン数を計算する層のインデックスを指定します。</param>
 	/// <returns>追加される層の入力ニューロン数。</returns>
-	size_t InputNeuronCount(size_t index) const { return index <= 0 ? nIn : items[index - 1]->Weight.Row(); }
+	size_t InputNeuronCount(size_t index) const { return InputShape(index).Size(); }
+
+	/// <summary>指定されたインデックスに追加される層の入力の形状を返します。</summary>
+	/// <param name="index">入力の形状を取得する層のインデックスを指定します。</param>
+	/// <returns>追加される層の入力の形状。</returns>
+	FeatureShape InputShape(size_t index) const { return index <= 0 ? input : items[index - 1]->OutputShape(); }
 
 	/// <summary>指定されたインデックスの隠れ層のニューロン数を変更します。このメソッドは隠れ層を追加することもできます。</summary>
 	/// <param name="index">ニューロン数を変更する隠れ層のインデックスを指定します。</param>
@@ -258,20 +444,40 @@ public:
 			throw std::domain_error("freezed collection cannot be changed");
 		if (index > items.size())
 			throw std::out_of_range("index less than or equal to Count()");
-		if (index == items.size())
-			items.push_back(std::unique_ptr<HiddenLayer<TValue>>());
-		items[index] = std::unique_ptr<HiddenLayer<TValue>>(new HiddenLayer<TValue>(InputNeuronCount(index), neurons, this));
+		// 畳み込み層は入力が小さすぎる場合に例外を送出するため、コレクションを変更する前に層を作成する
+		std::unique_ptr<LayerType> layer(new LayerType(InputShape(index), neurons, this));
+		std::unique_ptr<LayerType> next;
 		if (index + 1 < items.size())
-			items[index + 1] = std::unique_ptr<HiddenLayer<TValue>>(new HiddenLayer<TValue>(neurons, items[index + 1]->Weight.Column(), this));
+			next = std::unique_ptr<LayerType>(new LayerType(layer->OutputShape(), items[index + 1]->Weight.Row(), this));
+		if (index == items.size())
+			items.push_back(std::move(layer));
+		else
+			items[index] = std::move(layer);
+		if (next)
+			items[index + 1] = std::move(next);
 	}
 
 	/// <summary>このコレクションを固定して変更不可能にします。</summary>
 	void Freeze() { frozen = true; }
 
+	/// <summary>隠れ層のパラメータの更新方法を設定します。すべての隠れ層のオプティマイザの状態は破棄されます。</summary>
+	/// <param name="parameters">更新方法とハイパーパラメータを指定します。</param>
+	void SetOptimizer(const OptimizerParameters& parameters)
+	{
+		this->optimizer = parameters;
+		for (auto& item : items)
+			item->ResetOptimizer();
+	}
+
 	/// <summary>このコレクション内の指定されたインデックスにある隠れ層への参照を取得します。</summary>
 	/// <param name="index">隠れ層を取得するインデックスを指定します。</param>
 	/// <returns>取得された隠れ層への参照。これは変更可能な参照です。</returns>
-	HiddenLayer<TValue>& operator[](size_t index) { return *items[index]; }
+	LayerType& operator[](size_t index) { return *items[index]; }
+
+	/// <summary>このコレクション内の指定されたインデックスにある隠れ層への参照を取得します。</summary>
+	/// <param name="index">隠れ層を取得するインデックスを指定します。</param>
+	/// <returns>取得された隠れ層への読み取り専用の参照。</returns>
+	const LayerType& operator[](size_t index) const { return *items[index]; }
 
 	/// <summary>このコレクション内に含まれている隠れ層の個数を指定します。</summary>
 	/// <returns>コレクションに含まれている隠れ層の個数。</returns>
@@ -279,8 +485,8 @@ public:
 
 private:
 	bool frozen;
-	size_t nIn;
-	std::vector<std::unique_ptr<HiddenLayer<TValue>>> items;
+	FeatureShape input;
+	std::vector<std::unique_ptr<LayerType>> items;
 };
 
 /// <summary>
@@ -288,42 +494,96 @@ private:
 /// ロジスティック回帰は重み行列 W とバイアスベクトル b によって完全に記述されます。
 /// 分類はデータ点を超平面へ投影することによってなされます。
 /// </summary>
-template <class TValue> class LogisticRegressionLayer final : private boost::noncopyable
+/// <typeparam name="TActivation">出力素子の活性化関数のポリシーを指定します。</typeparam>
+/// <typeparam name="TCost">この層の出力に対するコスト関数のポリシーを指定します。</typeparam>
+/// <typeparam name="TDelta">勾配ベクトル (Delta) を計算するポリシーを指定します。</typeparam>
+template <class TValue, class TActivation = ActivationFunction::SoftMaxPolicy, class TCost = CostFunction::MultiClassCrossEntropyPolicy, class TDelta = DeltaFunction::CanonicalLinkPolicy> class LogisticRegressionLayer final : private boost::noncopyable
 {
 public:
 	/// <summary>ロジスティック回帰のパラメータを初期化します。</summary>
 	/// <param name="nIn">入力素子の数 (データ点が存在する空間の次元) を指定します。</param>
 	/// <param name="nOut">出力素子の数 (ラベルが存在する空間の次元) を指定します。</param>
-	LogisticRegressionLayer(size_t nIn, size_t nOut) : Weight(nOut, nIn), Bias(static_cast<TValue>(0), nOut) { }
+	/// <param name="optimizerParameters">パラメータの更新方法を指定します。</param>
+	LogisticRegressionLayer(size_t nIn, size_t nOut, const OptimizerParameters& optimizerParameters = OptimizerParameters()) :
+		Weight(nOut, nIn), Bias(static_cast<TValue>(0), nOut), optimizerParameters(optimizerParameters), memory(MemoryCategory::Weights, (nOut * nIn + nOut) * sizeof(TValue)) { }
+
+	/// <summary>この層の活性化関数のポリシーを表します。</summary>
+	typedef TActivation ActivationPolicy;
 
 	/// <summary>この層の結合重みを示します。</summary>
 	Matrix<TValue> Weight;
 	/// <summary>この層のバイアスを示します。</summary>
 	std::valarray<TValue> Bias;
+	/// <summary>枝刈りの後に残っている結合重みを 1、枝刈りされた結合重みを 0 で示します。空の場合はすべての結合重みが残っています。枝刈りされた結合重みは学習によって更新されません。</summary>
+	std::valarray<TValue> WeightMask;
 
 	/// <summary>この層の入力に対する出力を計算します。</summary>
 	/// <param name="input">層に入力するベクトルを指定します。</param>
 	/// <returns>この層の出力を示すベクトル。</returns>
-	std::valarray<TValue> Compute(const std::valarray<TValue>& input) const { return std::move(ActivationFunction::SoftMax(NeuronComputer<Matrix<TValue>, std::valarray<TValue>>(Weight, Bias, input))); }
+	std::valarray<TValue> Compute(const std::valarray<TValue>& input) const
+	{
+		NN_PROFILE_COUNT(0, 2 * Weight.Row() * Weight.Column(), Weight.Row() * Weight.Column() * sizeof(TValue), 1);
+		return std::move(TActivation::Activate(NeuronComputer<Matrix<TValue>, std::valarray<TValue>>(Weight, Bias, input)));
+	}
+
+	/// <summary>列に並べられた複数の入力に対するこの層の出力をまとめて計算します。</summary>
+	/// <param name="input">第 k 成分が input[k * batch + j] に格納された <paramref name="batch"/> 個の入力を指定します。</param>
+	/// <param name="batch">入力の数を指定します。</param>
+	/// <param name="output">第 i 成分が output[i * batch + j] に格納される出力を指定します。</param>
+	void Compute(const std::vector<TValue>& input, size_t batch, std::vector<TValue>& output) const { ComputeColumns<TActivation>(Weight, Bias, input, batch, output); }
 
 	/// <summary>確率が最大となるクラスを推定します。</summary>
 	/// <param name="input">層に入力するベクトルを指定します。</param>
 	/// <returns>推定された確率最大のクラスのインデックス。</returns>
-	unsigned int Predict(const std::valarray<TValue>& input) const
+	unsigned int Predict(const std::valarray<TValue>& input) const { return Classify(Compute(input)); }
+
+	/// <summary>この層の出力から確率が最大となるクラスを返します。</summary>
+	/// <param name="output">この層の出力を示すベクトルを指定します。</param>
+	/// <returns>確率最大のクラスのインデックス。</returns>
+	static unsigned int Classify(const std::valarray<TValue>& output)
 	{
-		auto computed = Compute(input);
 		unsigned int maxIndex = 0;
-		for (unsigned int i = 1; i < Weight.Row(); i++)
+		for (unsigned int i = 1; i < output.size(); i++)
 		{
-			if (computed[i] > computed[maxIndex])
+			if (output[i] > output[maxIndex])
 				maxIndex = i;
 		}
 		return maxIndex;
 	}
 
+	/// <summary>この層の出力と教師信号に対するコストを計算します。</summary>
+	/// <param name="output">この層の出力を示すベクトルを指定します。</param>
+	/// <param name="target">教師信号を示すベクトルを指定します。</param>
+	/// <returns>計算されたコスト。</returns>
+	static TValue ComputeCost(const std::valarray<TValue>& output, const std::valarray<TValue>& target) { return TCost::Compute(output, target); }
+
 	/// <summary>この層の線形計算の結果に対するニューラルネットワークのコストの勾配ベクトル (Delta) の要素を計算します。</summary>
 	/// <param name="output">この層からの出力を示すベクトルの要素を指定します。</param>
 	/// <param name="upperInfo">上位層から得られた勾配計算に必要な情報を指定します。この層が出力層の場合、これは教師信号になります。</param>
 	/// <returns>勾配ベクトルの要素。</returns>
-	static TValue GetDelta(TValue output, TValue upperInfo) { return output - upperInfo; }
+	static TValue GetDelta(TValue output, TValue upperInfo) { return TDelta::Compute(output, upperInfo); }
+
+	/// <summary>この層のパラメータを更新するオプティマイザを取得します。</summary>
+	LayerOptimizer<TValue>& Optimizer()
+	{
+		if (!optimizer)
+			optimizer = std::unique_ptr<LayerOptimizer<TValue>>(new LayerOptimizer<TValue>(optimizerParameters, Weight.Row() * Weight.Column(), Bias.size(), 0));
+		return *optimizer;
+	}
+
+	/// <summary>パラメータの更新方法を設定します。オプティマイザの状態は破棄されます。</summary>
+	/// <param name="parameters">更新方法とハイパーパラメータを指定します。</param>
+	void SetOptimizer(const OptimizerParameters& parameters)
+	{
+		optimizerParameters = parameters;
+		optimizer.reset();
+	}
+
+	/// <summary>オプティマイザの状態を破棄します。次の更新では設定された更新方法から新しいオプティマイザが作成されます。</summary>
+	void ResetOptimizer() { optimizer.reset(); }
+
+private:
+	OptimizerParameters optimizerParameters;
+	std::unique_ptr<LayerOptimizer<TValue>> optimizer;
+	MemoryReservation memory;
 };
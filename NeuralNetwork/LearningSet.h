@@ -1,5 +1,9 @@
 ﻿#pragma once
 
+#include "Profiler.h"
+#include "MemoryAccounting.h"
+#include "ThreadPool.h"
+
 /// <summary>学習および識別に使用されるデータセットを表します。</summary>
 template <class TValue> class DataSet final
 {
@@ -97,14 +101,21 @@ public:
 	/// <param name="newRow">画像の垂直方向の長さを指定します。</param>
 	/// <param name="newColumn">画像の水平方向の長さを指定します。</param>
 	/// <param name="newComponents">画像の 1 画素を示すのに必要な要素の数を指定します。</param>
-	void Allocate(size_t length, unsigned int newRow, unsigned int newColumn, unsigned int newComponents)
+	/// <param name="grain">
+	/// 画像を確保する <see cref="ParallelFor"/> の最小区間長を指定します。0 の場合は呼び出し元のスレッドですべて確保します。
+	/// 画像を書き込む処理と同じ区間長を指定すると、各画像はそれを書き込むワーカーによって確保および初期化され、そのワーカーのノードのメモリに置かれます。
+	/// </param>
+	void Allocate(size_t length, unsigned int newRow, unsigned int newColumn, unsigned int newComponents, size_t grain = 0)
 	{
 		if (newRow <= 0 || newColumn <= 0)
 			throw std::invalid_argument("newRow and newColumn must not be 0");
 		labels.resize(length);
 		images.resize(length);
-		for (size_t i = 0; i < length; i++)
-			images[i].resize(newRow * newColumn * newComponents);
+		ParallelFor(length, grain > 0 ? grain : (std::max)(length, static_cast<size_t>(1)), [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+				images[i].resize(newRow * newColumn * newComponents);
+		});
 		row = newRow;
 		column = newColumn;
 		components = newComponents;
@@ -156,6 +167,137 @@ private:
 	std::vector<std::valarray<TValue>> images;
 };
 
+/// <summary>
+/// 共有された <see cref="DataSet"/> の一部を、範囲または並べ替えによって参照するビューを表します。
+/// ビューの作成、部分集合の取り出しおよび並べ替えでは画像やラベルはコピーされません。
+/// </summary>
+template <class TValue> class DataSetView final
+{
+public:
+	/// <summary>空の <see cref="DataSetView"/> クラスの新しいインスタンスを初期化します。</summary>
+	DataSetView() : offset(0), count(0) { }
+
+	/// <summary>指定されたデータセット全体を参照する <see cref="DataSetView"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="dataset">参照するデータセットを指定します。このビューはデータセットを所有しないため、データセットはビューより長く存続する必要があります。</param>
+	DataSetView(const DataSet<TValue>& dataset) : storage(&dataset, [](const DataSet<TValue>*) { }), offset(0), count(dataset.Labels().size()) { }
+
+	/// <summary>指定されたデータセットを移動して所有し、その全体を参照する <see cref="DataSetView"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="dataset">移動元のデータセットを指定します。</param>
+	/// <remarks>所有するデータセットのバイト数は <see cref="MemoryCategory::DataSets"/> に登録され、データセットが解放されると登録が解除されます。</remarks>
+	DataSetView(DataSet<TValue>&& dataset) : storage(Own(std::move(dataset))), offset(0), count(storage->Labels().size()) { }
+
+	/// <summary>このビューに含まれるデータ点の数を取得します。</summary>
+	size_t Count() const { return count; }
+
+	/// <summary>基になるデータセットに含まれるデータ点の数を取得します。</summary>
+	size_t StorageCount() const { return storage ? storage->Labels().size() : 0; }
+
+	/// <summary>このビューの指定された位置にあるデータ点の基になるデータセット内での位置を返します。</summary>
+	/// <param name="index">このビュー内での位置を指定します。</param>
+	size_t StorageIndex(size_t index) const { return indices ? (*indices)[offset + index] : offset + index; }
+
+	/// <summary>このビューの指定された位置にある画像を返します。</summary>
+	/// <param name="index">このビュー内での位置を指定します。</param>
+	const std::valarray<TValue>& Image(size_t index) const { return storage->Images()[StorageIndex(index)]; }
+
+	/// <summary>このビューの指定された位置にあるラベルを返します。</summary>
+	/// <param name="index">このビュー内での位置を指定します。</param>
+	unsigned int Label(size_t index) const { return storage->Labels()[StorageIndex(index)]; }
+
+	/// <summary>画像の垂直方向の長さを取得します。</summary>
+	unsigned int Row() const { return storage ? storage->Row() : 0; }
+
+	/// <summary>画像の水平方向の長さを取得します。</summary>
+	unsigned int Column() const { return storage ? storage->Column() : 0; }
+
+	/// <summary>画像の 1 画素を示すの必要な要素の数を取得します。</summary>
+	unsigned int ComponentsPerPixel() const { return storage ? storage->ComponentsPerPixel() : 0; }
+
+	/// <summary>画像全体の画素数を取得します。</summary>
+	unsigned int Pixels() const { return storage ? storage->Pixels() : 0; }
+
+	/// <summary>画像全体を表現するのに必要な要素の数を取得します。</summary>
+	unsigned int AllComponents() const { return storage ? storage->AllComponents() : 0; }
+
+	/// <summary>このビューの連続した一部を参照するビューを返します。</summary>
+	/// <param name="index">このビュー内の開始位置を指定します。</param>
+	/// <param name="length">新しいビューに含まれるデータ点の数を指定します。</param>
+	DataSetView Slice(size_t index, size_t length) const
+	{
+		if (index > count || length > count - index)
+			throw std::invalid_argument("index and length must specify a range in [0, Count()]");
+		DataSetView view(*this);
+		view.offset = offset + index;
+		view.count = length;
+		return view;
+	}
+
+	/// <summary>このビューのデータ点を指定された順序で参照するビューを返します。</summary>
+	/// <param name="order">このビュー内での位置を新しいビューでの順番に並べたものを指定します。</param>
+	DataSetView Permute(const std::vector<size_t>& order) const
+	{
+		auto newIndices = std::make_shared<std::vector<size_t>>(order.size());
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			if (order[i] >= count)
+				throw std::out_of_range("order contains an index outside of this view");
+			(*newIndices)[i] = StorageIndex(order[i]);
+		}
+		DataSetView view;
+		view.storage = storage;
+		view.indices = std::move(newIndices);
+		view.count = order.size();
+		return view;
+	}
+
+	/// <summary>このビューを <paramref name="folds"/> 個にほぼ等分したうちの 1 つを返します。</summary>
+	/// <param name="fold">取り出す分割の番号を 0 から <paramref name="folds"/> - 1 の範囲で指定します。</param>
+	/// <param name="folds">分割数を指定します。</param>
+	DataSetView Fold(size_t fold, size_t folds) const
+	{
+		if (fold >= folds)
+			throw std::invalid_argument("fold must be less than folds");
+		return Slice(FoldBegin(fold, folds), FoldBegin(fold + 1, folds) - FoldBegin(fold, folds));
+	}
+
+	/// <summary>このビューを <paramref name="folds"/> 個にほぼ等分したうち、指定された 1 つを除いた残りを返します。</summary>
+	/// <param name="fold">除外する分割の番号を 0 から <paramref name="folds"/> - 1 の範囲で指定します。</param>
+	/// <param name="folds">分割数を指定します。</param>
+	DataSetView ExceptFold(size_t fold, size_t folds) const
+	{
+		if (fold >= folds)
+			throw std::invalid_argument("fold must be less than folds");
+		std::vector<size_t> order;
+		order.reserve(count - (FoldBegin(fold + 1, folds) - FoldBegin(fold, folds)));
+		for (size_t i = 0; i < FoldBegin(fold, folds); i++)
+			order.push_back(i);
+		for (size_t i = FoldBegin(fold + 1, folds); i < count; i++)
+			order.push_back(i);
+		return Permute(order);
+	}
+
+private:
+	std::shared_ptr<const DataSet<TValue>> storage;
+	std::shared_ptr<const std::vector<size_t>> indices;
+	size_t offset;
+	size_t count;
+
+	size_t FoldBegin(size_t fold, size_t folds) const { return count * fold / folds; }
+
+	// データセットとそのバイト数の登録を 1 つのオブジェクトにまとめ、データセットへのポインタとして共有する
+	static std::shared_ptr<const DataSet<TValue>> Own(DataSet<TValue>&& dataset)
+	{
+		struct Owner
+		{
+			DataSet<TValue> Data;
+			MemoryReservation Memory;
+		};
+		auto bytes = dataset.Images().size() * (dataset.AllComponents() * sizeof(TValue) + sizeof(std::valarray<TValue>)) + dataset.Labels().size() * sizeof(unsigned int);
+		auto owner = std::make_shared<Owner>(Owner { std::move(dataset), MemoryReservation(MemoryCategory::DataSets, bytes) });
+		return std::shared_ptr<const DataSet<TValue>>(owner, &owner->Data);
+	}
+};
+
 /// <summary>学習データおよび識別データを格納するセットを表します。</summary>
 template <class TValue> class LearningSet final
 {
@@ -199,30 +341,118 @@ public:
 	}
 
 	/// <summary>学習データを取得します。</summary>
-	DataSet<TValue>& TrainingData() { return trainingData; }
+	DataSetView<TValue>& TrainingData() { return trainingData; }
 
 	/// <summary>学習データを取得します。</summary>
-	const DataSet<TValue>& TrainingData() const { return trainingData; }
+	const DataSetView<TValue>& TrainingData() const { return trainingData; }
 
 	/// <summary>検証データを取得します。</summary>
-	DataSet<TValue>& ValidationData() { return validationData; }
+	DataSetView<TValue>& ValidationData() { return validationData; }
 	
 	/// <summary>検証データを取得します。</summary>
-	const DataSet<TValue>& ValidationData() const { return validationData; }
+	const DataSetView<TValue>& ValidationData() const { return validationData; }
 
 	/// <summary>テストデータを取得します。</summary>
-	DataSet<TValue>& TestData() { return testData; }
+	DataSetView<TValue>& TestData() { return testData; }
 
 	/// <summary>テストデータを取得します。</summary>
-	const DataSet<TValue>& TestData() const { return testData; }
+	const DataSetView<TValue>& TestData() const { return testData; }
 
 	/// <summary>このセットに格納されているパターンのクラス数を示します。</summary>
 	unsigned int ClassCount;
 
 private:
-	DataSet<TValue> trainingData;
-	DataSet<TValue> validationData;
-	DataSet<TValue> testData;
+	DataSetView<TValue> trainingData;
+	DataSetView<TValue> validationData;
+	DataSetView<TValue> testData;
+};
+
+/// <summary>学習セットを構成するデータセットファイルの種類を表します。</summary>
+enum class DataSetFile
+{
+	/// <summary>学習データのファイルを示します。</summary>
+	Training,
+	/// <summary>検証データのファイルを示します。存在しない形式では空のデータセットになります。</summary>
+	Validation,
+	/// <summary>テストデータのファイルを示します。</summary>
+	Test,
+};
+
+/// <summary>データセットファイルから読み込むデータ点を、連続した範囲または位置の一覧によって表します。</summary>
+class RecordSelection final
+{
+public:
+	/// <summary>指定されたファイルのすべてのデータ点を読み込む <see cref="RecordSelection"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="file">読み込むファイルを指定します。</param>
+	RecordSelection(DataSetFile file) : file(file), index(0), count(AllRecords) { }
+
+	/// <summary>指定されたファイルの連続したデータ点を読み込む選択を返します。</summary>
+	/// <param name="file">読み込むファイルを指定します。</param>
+	/// <param name="index">ファイル内の最初のデータ点の位置を指定します。</param>
+	/// <param name="count">読み込むデータ点の数を指定します。</param>
+	static RecordSelection Range(DataSetFile file, size_t index, size_t count)
+	{
+		RecordSelection selection(file);
+		selection.index = index;
+		selection.count = count;
+		return selection;
+	}
+
+	/// <summary>指定されたファイルの指定された位置にあるデータ点を、その順序で読み込む選択を返します。</summary>
+	/// <param name="file">読み込むファイルを指定します。</param>
+	/// <param name="indices">ファイル内でのデータ点の位置を読み込む順に並べたものを指定します。</param>
+	static RecordSelection Of(DataSetFile file, std::vector<size_t> indices)
+	{
+		RecordSelection selection(file);
+		selection.indices = std::make_shared<const std::vector<size_t>>(std::move(indices));
+		return selection;
+	}
+
+	/// <summary>読み込むファイルを取得します。</summary>
+	DataSetFile File() const { return file; }
+
+	/// <summary>指定された数のデータ点を含むファイルから読み込むデータ点の位置を、読み込む順に返します。</summary>
+	/// <param name="length">ファイルに含まれるデータ点の数を指定します。</param>
+	std::vector<size_t> Resolve(size_t length) const
+	{
+		if (indices)
+		{
+			for (auto i : *indices)
+			{
+				if (i >= length)
+					throw std::out_of_range("the selection contains an index outside of the file");
+			}
+			return *indices;
+		}
+		auto selected = count == AllRecords && index <= length ? length - index : count;
+		if (index > length || selected > length - index)
+			throw std::out_of_range("the selected range exceeds the records in the file");
+		std::vector<size_t> result(selected);
+		for (size_t i = 0; i < selected; i++)
+			result[i] = index + i;
+		return result;
+	}
+
+private:
+	static const size_t AllRecords = static_cast<size_t>(-1);
+
+	DataSetFile file;
+	size_t index;
+	size_t count;
+	std::shared_ptr<const std::vector<size_t>> indices;
+};
+
+/// <summary>学習セットの各データをどのファイルのどのデータ点から読み込むかを表します。既定ではそれぞれのファイルのすべてのデータ点を読み込みます。</summary>
+struct LearningSetSelection final
+{
+	LearningSetSelection() : Training(DataSetFile::Training), Validation(DataSetFile::Validation), Test(DataSetFile::Test) { }
+
+	/// <summary>学習データとして読み込むデータ点を示します。</summary>
+	RecordSelection Training;
+	/// <summary>検証データとして読み込むデータ点を示します。</summary>
+	RecordSelection Validation;
+	/// <summary>テストデータとして読み込むデータ点を示します。</summary>
+	RecordSelection Test;
 };
 
 template <class T> inline T* pointer_cast(void* pointer) { return static_cast<T*>(pointer); }
@@ -231,34 +461,127 @@ template <class T> inline T* pointer_cast(void* pointer) { return static_cast<T*
 template <class TValue> class LearningSetLoader
 {
 public:
+	LearningSetLoader() : droppedRecords(0) { }
+
 	virtual ~LearningSetLoader() { }
 
 	/// <summary>学習セットをロードします。</summary>
 	/// <param name="directoryName">データが存在するディレクトリの場所を指定します。</param>
-	LearningSet<TValue> Load(const std::string& path)
+	LearningSet<TValue> Load(const std::string& path) { return Load(path, LearningSetSelection()); }
+
+	/// <summary>学習セットの選択されたデータ点のみをロードします。選択されていないデータ点はデコードされません。</summary>
+	/// <param name="directoryName">データが存在するディレクトリの場所を指定します。</param>
+	/// <param name="selection">学習データ、検証データおよびテストデータとして読み込むデータ点を指定します。</param>
+	/// <remarks>
+	/// メモリ予算が設定されている場合、各データの選択は予算の残りに収まる数まで先頭から切り詰められ、それを超えるデータ点は読み込まれません。
+	/// 評価の結果を比較できるように、テストデータ、検証データ、学習データの順に読み込み、学習データから先に切り詰めます。
+	/// </remarks>
+	LearningSet<TValue> Load(const std::string& path, const LearningSetSelection& selection)
 	{
 		LearningSet<TValue> set;
-		LoadDataSet(set.TrainingData(), GetTrainingPath(path));
-		LoadDataSet(set.TestData(), GetTestPath(path));
-		auto validationPath = GetValidationPath(path);
-		if (!validationPath.empty())
-			LoadDataSet(set.ValidationData(), validationPath);
+		set.TestData() = LoadView(path, selection.Test);
+		set.ValidationData() = LoadView(path, selection.Validation);
+		set.TrainingData() = LoadView(path, selection.Training);
 		set.ClassCount = ClassCount();
+		auto samples = set.TrainingData().Count() + set.ValidationData().Count() + set.TestData().Count();
+		NN_PROFILE_COUNT(samples, 0, samples * set.TrainingData().AllComponents() * sizeof(TValue), samples);
 		return set;
 	}
 
+	/// <summary>メモリ予算に収まらなかったために読み込まれなかった、選択されたデータ点の数を取得します。</summary>
+	size_t DroppedRecords() const { return droppedRecords; }
+
 protected:
-	virtual void LoadDataSet(DataSet<TValue>& dataset, const std::string& path) = 0;
+	virtual void LoadDataSet(DataSet<TValue>& dataset, const std::string& path, const RecordSelection& selection) = 0;
+
 	virtual std::string GetTrainingPath(const std::string& path) = 0;
 	virtual std::string GetValidationPath(const std::string&) { return ""; }
 	virtual std::string GetTestPath(const std::string& path) = 0;
 	virtual unsigned int ClassCount() { return 10; }
+
+	/// <summary>固定長のデータ点が並ぶファイルから選択されたデータ点を読み込みます。</summary>
+	/// <param name="path">読み込むファイルのパスを指定します。</param>
+	/// <param name="header">最初のデータ点より前にあるヘッダーのバイト数を指定します。</param>
+	/// <param name="recordSize">1 つのデータ点のバイト数を指定します。</param>
+	/// <param name="indices">読み込むデータ点の位置を読み込む順に指定します。</param>
+	/// <param name="decode">データセット内での位置とデータ点のバイト列を受け取る関数を指定します。異なるスレッドから同時に呼び出されます。</param>
+	template <class TDecode> static void ReadRecords(const std::string& path, std::streamoff header, size_t recordSize, const std::vector<size_t>& indices, const TDecode& decode)
+	{
+		ReadRecords(std::vector<std::string>(1, path), std::vector<size_t> { 0, static_cast<size_t>(-1) }, header, recordSize, indices, decode);
+	}
+
+	/// <summary>
+	/// 連結された 1 つのファイルとして扱われる複数の分割されたファイルから、選択されたデータ点を読み込みます。
+	/// 選択はスレッドプールのタスクに分割され、各タスクはファイルを個別に開いて連続していないデータ点の前でのみシークし、データセットの重ならない位置にデコードします。
+	/// </summary>
+	/// <param name="paths">分割されたファイルのパスを順に指定します。</param>
+	/// <param name="starts">各ファイルの先頭のデータ点の連結されたファイル内での位置を指定します。最後の要素は全体のデータ点の数です。</param>
+	/// <param name="header">各ファイルで最初のデータ点より前にあるヘッダーのバイト数を指定します。</param>
+	/// <param name="recordSize">1 つのデータ点のバイト数を指定します。</param>
+	/// <param name="indices">読み込むデータ点の連結されたファイル内での位置を読み込む順に指定します。</param>
+	/// <param name="decode">データセット内での位置とデータ点のバイト列を受け取る関数を指定します。異なるスレッドから同時に呼び出されます。</param>
+	template <class TDecode> static void ReadRecords(const std::vector<std::string>& paths, const std::vector<size_t>& starts, std::streamoff header, size_t recordSize, const std::vector<size_t>& indices, const TDecode& decode)
+	{
+		ParallelFor(indices.size(), RecordGrain(recordSize), [&](size_t begin, size_t end)
+		{
+			std::vector<std::unique_ptr<std::ifstream>> streams(paths.size());
+			std::vector<size_t> next(paths.size(), static_cast<size_t>(-1));
+			std::vector<char> record(recordSize);
+			for (size_t i = begin; i < end; i++)
+			{
+				auto file = static_cast<size_t>(std::upper_bound(starts.begin(), starts.end(), indices[i]) - starts.begin()) - 1;
+				auto local = indices[i] - starts[file];
+				if (!streams[file])
+					streams[file].reset(new std::ifstream(paths[file], std::ios::binary | std::ios::in));
+				if (local != next[file])
+					streams[file]->seekg(header + static_cast<std::streamoff>(local * recordSize));
+				if (!streams[file]->read(record.data(), recordSize))
+					throw std::runtime_error("unexpected end of " + paths[file]);
+				decode(i, reinterpret_cast<const uint8_t*>(record.data()));
+				next[file] = local + 1;
+			}
+		});
+	}
+
+	/// <summary>選択されたデータ点の位置を、読み込んだ画像とラベルがメモリ予算の残りに収まる数まで先頭から切り詰めて返します。</summary>
+	/// <param name="indices">読み込むデータ点の位置を読み込む順に指定します。</param>
+	/// <param name="components">1 つの画像の要素の数を指定します。</param>
+	std::vector<size_t> FitToBudget(std::vector<size_t> indices, size_t components)
+	{
+		auto recordBytes = components * sizeof(TValue) + sizeof(std::valarray<TValue>) + sizeof(unsigned int);
+		auto records = MemoryAccountant::Global().Available() / recordBytes;
+		if (indices.size() > records)
+		{
+			droppedRecords += indices.size() - records;
+			indices.resize(records);
+		}
+		return indices;
+	}
+
+	/// <summary><see cref="ReadRecords"/> が指定されたバイト数のデータ点を分割する <see cref="ParallelFor"/> の最小区間長を返します。</summary>
+	static size_t RecordGrain(size_t recordSize) { return (std::max)(ReadGrainBytes / recordSize, static_cast<size_t>(1)); }
+
+private:
+	// 1 つのタスクが読み込む最小のバイト数
+	static const size_t ReadGrainBytes = 1 << 20;
+
+	size_t droppedRecords;
+
+	DataSetView<TValue> LoadView(const std::string& path, const RecordSelection& selection)
+	{
+		auto filePath = selection.File() == DataSetFile::Training ? GetTrainingPath(path) : selection.File() == DataSetFile::Validation ? GetValidationPath(path) : GetTestPath(path);
+		if (filePath.empty())
+			return DataSetView<TValue>();
+		DataSet<TValue> dataset;
+		LoadDataSet(dataset, filePath, selection);
+		return DataSetView<TValue>(std::move(dataset));
+	}
 };
 
 template <class TValue> class MnistLoader final : public LearningSetLoader<TValue>
 {
 protected:
-	virtual void LoadDataSet(DataSet<TValue>& dataset, const std::string& path)
+	virtual void LoadDataSet(DataSet<TValue>& dataset, const std::string& path, const RecordSelection& selection)
 	{
 		std::ifstream labelFile(path + "-labels.idx1-ubyte", std::ios::binary | std::ios::in);
 		std::ifstream imageFile(path + "-images.idx3-ubyte", std::ios::binary | std::ios::in);
@@ -272,13 +595,14 @@ protected:
 		auto row = ReadInt32BigEndian(imageFile);
 		auto column = ReadInt32BigEndian(imageFile);
 		auto imageLength = row * column;
-		dataset.Allocate(length, row, column, 1);
-		for (uint32_t i = 0; i < length; i++)
+		auto indices = this->FitToBudget(selection.Resolve(length), imageLength);
+		dataset.Allocate(indices.size(), row, column, 1, this->RecordGrain(imageLength));
+		this->ReadRecords(path + "-labels.idx1-ubyte", 8, 1, indices, [&](size_t i, const uint8_t* record) { dataset.Labels()[i] = record[0]; });
+		this->ReadRecords(path + "-images.idx3-ubyte", 16, imageLength, indices, [&](size_t i, const uint8_t* record)
 		{
-			dataset.Labels()[i] = ReadByte(labelFile);
 			for (uint32_t j = 0; j < imageLength; j++)
-				dataset.Images()[i][j] = static_cast<TValue>(ReadByte(imageFile)) / (std::numeric_limits<unsigned char>::max)();
-		}
+				dataset.Images()[i][j] = static_cast<TValue>(record[j]) / (std::numeric_limits<unsigned char>::max)();
+		});
 	}
 
 	virtual std::string GetTrainingPath(const std::string& path) { return path + "/train"; }
@@ -296,13 +620,6 @@ private:
 			(temp & 0x00FF0000) >> 8 |
 			(temp & 0xFF000000) >> 24;
 	}
-
-	uint8_t ReadByte(std::ifstream& stream)
-	{
-		uint8_t temp;
-		stream.read(pointer_cast<char>(&temp), sizeof(temp));
-		return temp;
-	}
 };
 
 template <class TValue> class Cifar10Loader final : public LearningSetLoader<TValue>
@@ -312,70 +629,67 @@ public:
 	Cifar10Loader(bool glayscale) : glayscale(glayscale) { }
 
 protected:
-	virtual void LoadDataSet(DataSet<TValue>& dataset, const std::string& path)
+	virtual void LoadDataSet(DataSet<TValue>& dataset, const std::string& path, const RecordSelection& selection)
 	{
-		if (!LoadSingleFile(dataset, path))
+		// 分割されたファイルは連結された 1 つのファイルとして扱い、各ファイルの先頭のデータ点の位置を記録する
+		std::vector<std::string> files;
+		std::vector<size_t> starts(1, 0);
+		auto addFile = [&](const std::string& name)
+		{
+			std::ifstream file(name, std::ios::binary | std::ios::in | std::ios::ate);
+			if (!file)
+				return false;
+			files.push_back(name);
+			starts.push_back(starts.back() + static_cast<size_t>(file.tellg()) / RecordSize);
+			return true;
+		};
+		if (!addFile(path + ".bin"))
 		{
 			unsigned int i = 1;
-			while (LoadSingleFile(dataset, path + "_" + std::to_string(i)))
+			while (addFile(path + "_" + std::to_string(i) + ".bin"))
 				i++;
 		}
-		dataset.Images().shrink_to_fit();
-		dataset.Labels().shrink_to_fit();
-	}
-
-	virtual std::string GetTrainingPath(const std::string& path) { return path + "/data_batch"; }
-
-	virtual std::string GetTestPath(const std::string& path) { return path + "/test_batch"; }
-
-private:
-	bool glayscale;
-
-	bool LoadSingleFile(DataSet<TValue>& dataset, const std::string& path)
-	{
-		std::ifstream file(path + ".bin", std::ios::binary | std::ios::in);
-		if (!file)
-			return false;
-		dataset.SetDimension(32u, 32u, glayscale ? 1u : 3u);
-		for (size_t i = 0; i < 10000; i++)
+		if (files.empty())
+			return;
+		auto indices = this->FitToBudget(selection.Resolve(starts.back()), 32 * 32 * (glayscale ? 1 : 3));
+		dataset.Allocate(indices.size(), 32u, 32u, glayscale ? 1u : 3u, this->RecordGrain(RecordSize));
+		auto decode = [&](size_t i, const uint8_t* record)
 		{
-			dataset.Labels().push_back(ReadByte(file));
-			std::valarray<uint8_t> reds(dataset.Pixels());
-			for (size_t j = 0; j < reds.size(); j++)
-				reds[j] = ReadByte(file);
-			std::valarray<uint8_t> greens(dataset.Pixels());
-			for (size_t j = 0; j < greens.size(); j++)
-				greens[j] = ReadByte(file);
-			std::valarray<TValue> image(dataset.AllComponents());
+			dataset.Labels()[i] = record[0];
+			auto reds = record + 1;
+			auto greens = reds + dataset.Pixels();
+			auto blues = greens + dataset.Pixels();
+			auto& image = dataset.Images()[i];
 			for (size_t j = 0; j < dataset.Pixels(); j++)
 			{
-				auto blue = ReadByte(file);
 				if (glayscale)
-					image[j] = static_cast<TValue>(0.299 * reds[j] + 0.587 * greens[j] + 0.114 * blue) / (std::numeric_limits<uint8_t>::max)();
+					image[j] = static_cast<TValue>(0.299 * reds[j] + 0.587 * greens[j] + 0.114 * blues[j]) / (std::numeric_limits<uint8_t>::max)();
 				else
 				{
 					image[j * 3 + 0] = static_cast<TValue>(reds[j]) / std::numeric_limits<uint8_t>::max();
 					image[j * 3 + 1] = static_cast<TValue>(greens[j]) / std::numeric_limits<uint8_t>::max();
-					image[j * 3 + 2] = static_cast<TValue>(blue) / std::numeric_limits<uint8_t>::max();
+					image[j * 3 + 2] = static_cast<TValue>(blues[j]) / std::numeric_limits<uint8_t>::max();
 				}
 			}
-			dataset.Images().push_back(std::move(image));
-		}
-		return true;
+		};
+		this->ReadRecords(files, starts, 0, RecordSize, indices, decode);
 	}
 
-	uint8_t ReadByte(std::ifstream& stream)
-	{
-		uint8_t temp;
-		stream.read(pointer_cast<char>(&temp), sizeof(temp));
-		return temp;
-	}
+	virtual std::string GetTrainingPath(const std::string& path) { return path + "/data_batch"; }
+
+	virtual std::string GetTestPath(const std::string& path) { return path + "/test_batch"; }
+
+private:
+	// ラベル 1 バイトと 32x32 画素の赤、緑、青の各平面
+	static const size_t RecordSize = 1 + 32 * 32 * 3;
+
+	bool glayscale;
 };
 
 template <class TValue> class Caltech101SilhouettesLoader final : public LearningSetLoader<TValue>
 {
 protected:
-	virtual void LoadDataSet(DataSet<TValue>& dataset, const std::string& path)
+	virtual void LoadDataSet(DataSet<TValue>& dataset, const std::string& path, const RecordSelection& selection)
 	{
 		std::ifstream labelFile(path + "_labels.bin", std::ios::binary | std::ios::in);
 		std::ifstream imageFile(path + "_images.bin", std::ios::binary | std::ios::in);
@@ -384,13 +698,14 @@ protected:
 			return;
 		auto imageLength = ReadInt32(imageFile);
 		auto oneSide = static_cast<unsigned int>(sqrt(imageLength));
-		dataset.Allocate(length, oneSide, oneSide, 1);
-		for (uint32_t i = 0; i < length; i++)
+		auto indices = this->FitToBudget(selection.Resolve(length), oneSide * oneSide);
+		dataset.Allocate(indices.size(), oneSide, oneSide, 1, this->RecordGrain(imageLength));
+		this->ReadRecords(path + "_labels.bin", 4, 1, indices, [&](size_t i, const uint8_t* record) { dataset.Labels()[i] = static_cast<unsigned int>(record[0] - 1); });
+		this->ReadRecords(path + "_images.bin", 8, imageLength, indices, [&](size_t i, const uint8_t* record)
 		{
-			dataset.Labels()[i] = static_cast<unsigned int>(ReadByte(labelFile) - 1);
 			for (uint32_t j = 0; j < imageLength; j++)
-				dataset.Images()[i][j] = static_cast<TValue>(ReadByte(imageFile)); // value is either 0 or 1
-		}
+				dataset.Images()[i][j] = static_cast<TValue>(record[j]); // value is either 0 or 1
+		});
 	}
 
 	virtual std::string GetTrainingPath(const std::string& path) { return path + "/train"; }
@@ -408,41 +723,44 @@ private:
 		stream.read(pointer_cast<char>(&temp), sizeof(temp));
 		return temp;
 	}
-
-	uint8_t ReadByte(std::ifstream& stream)
-	{
-		uint8_t temp;
-		stream.read(pointer_cast<char>(&temp), sizeof(temp));
-		return temp;
-	}
 };
 
 template <class TValue> class PatternRecognitionLoader final : public LearningSetLoader<TValue>
 {
 protected:
-	virtual void LoadDataSet(DataSet<TValue>& dataset, const std::string& path)
+	// テキスト形式のデータ点は可変長のため、すべての行を読み込んでから選択された行のみを並列に解析する
+	virtual void LoadDataSet(DataSet<TValue>& dataset, const std::string& path, const RecordSelection& selection)
 	{
-		dataset.SetDimension(7, 5, 1);
 		std::ifstream file(path, std::ios::in);
+		std::vector<std::string> lines;
 		std::string line;
 		while (std::getline(file, line))
 		{
-			std::istringstream ss(line);
-			std::string item;
-			if (!std::getline(ss, item, ','))
-				continue;
-			dataset.Labels().push_back(static_cast<unsigned int>(std::stoul(item)));
-			std::valarray<TValue> image(dataset.AllComponents());
-			size_t i = 0;
-			while (std::getline(ss, item, ','))
-				image[i++] = std::stod(item);
-			dataset.Images().push_back(image);
+			if (!line.empty())
+				lines.push_back(std::move(line));
 		}
-		dataset.Images().shrink_to_fit();
-		dataset.Labels().shrink_to_fit();
+		auto indices = this->FitToBudget(selection.Resolve(lines.size()), 7 * 5);
+		dataset.Allocate(indices.size(), 7, 5, 1, ParseGrain);
+		ParallelFor(indices.size(), ParseGrain, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				std::istringstream ss(lines[indices[i]]);
+				std::string item;
+				std::getline(ss, item, ',');
+				dataset.Labels()[i] = static_cast<unsigned int>(std::stoul(item));
+				size_t j = 0;
+				while (std::getline(ss, item, ','))
+					dataset.Images()[i][j++] = std::stod(item);
+			}
+		});
 	}
 
 	virtual std::string GetTrainingPath(const std::string& path) { return path + "/pattern2learn.dat"; }
 
 	virtual std::string GetTestPath(const std::string& path) { return path + "/pattern2recog.dat"; }
+
+private:
+	// 1 つのタスクが解析する最小の行数
+	static const size_t ParseGrain = 64;
 };
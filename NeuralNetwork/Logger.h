@@ -0,0 +1,422 @@
+﻿#pragma once
+
+/// <summary>ログに記録される事象の種類を表します。</summary>
+enum class LogEvent : unsigned int
+{
+	Message,
+	SweepStarted,
+	NeuronCandidate,
+	PreTrainingCost,
+	PredictedCost,
+	PreTrainingConverged,
+	CostDifference,
+	DecidedNeurons,
+	FineTuningStarted,
+	FineTuningError,
+	TrainingError,
+	BestError,
+	PruningRound,
+	SparseInference,
+	ElapsedTime,
+	ProgressiveCost,
+	Distillation,
+};
+
+/// <summary>構造化されたログの 1 レコードを表します。使用されない数値項目は負の値または NaN になります。</summary>
+struct LogRecord final
+{
+	LogRecord() : LogRecord(LogEvent::Message) { }
+	explicit LogRecord(LogEvent event) : Event(event), Time(0), Layer(-1), Neurons(-1), Epoch(-1), Patience(-1), Cost(std::numeric_limits<double>::quiet_NaN()), ErrorRate(std::numeric_limits<double>::quiet_NaN()), Seconds(std::numeric_limits<double>::quiet_NaN()), Sparsity(std::numeric_limits<double>::quiet_NaN()), Samples(-1), Interval(std::numeric_limits<double>::quiet_NaN()) { }
+
+	/// <summary>事象の種類を示します。</summary>
+	LogEvent Event;
+	/// <summary>ロガーの開始からの経過時間 (秒) を示します。</summary>
+	double Time;
+	long long Layer;
+	long long Neurons;
+	long long Epoch;
+	long long Patience;
+	double Cost;
+	double ErrorRate;
+	double Seconds;
+	/// <summary>結合重みのうち 0 である要素の割合を示します。</summary>
+	double Sparsity;
+	/// <summary>推定に使用したデータ点の数を示します。</summary>
+	long long Samples;
+	/// <summary>推定されたコストの信頼区間の半幅を示します。</summary>
+	double Interval;
+	/// <summary>自由形式のメッセージを示します。</summary>
+	std::string Text;
+
+	LogRecord& SetLayer(long long value) { Layer = value; return *this; }
+	LogRecord& SetNeurons(long long value) { Neurons = value; return *this; }
+	LogRecord& SetEpoch(long long value) { Epoch = value; return *this; }
+	LogRecord& SetPatience(long long value) { Patience = value; return *this; }
+	LogRecord& SetCost(double value) { Cost = value; return *this; }
+	LogRecord& SetErrorRate(double value) { ErrorRate = value; return *this; }
+	LogRecord& SetSeconds(double value) { Seconds = value; return *this; }
+	LogRecord& SetSparsity(double value) { Sparsity = value; return *this; }
+	LogRecord& SetSamples(long long value) { Samples = value; return *this; }
+	LogRecord& SetInterval(double value) { Interval = value; return *this; }
+	LogRecord& SetText(std::string value) { Text = std::move(value); return *this; }
+
+	/// <summary>指定された事象の種類の名前を返します。</summary>
+	static const char* EventName(LogEvent event)
+	{
+		static const char* names[] { "message", "sweep_started", "neuron_candidate", "pretraining_cost", "predicted_cost", "pretraining_converged", "cost_difference", "decided_neurons", "finetuning_started", "finetuning_error", "training_error", "best_error", "pruning_round", "sparse_inference", "elapsed_time", "progressive_cost", "distillation" };
+		return names[static_cast<size_t>(event)];
+	}
+};
+
+/// <summary>
+/// 複数の生産者と単一の消費者から使用できる、固定長のロックフリーなリングバッファを表します。
+/// 各セルのシーケンス番号によって生産者間の競合を解決します (Vyukov による有界キュー)。
+/// </summary>
+template <class T> class RingBuffer final : private boost::noncopyable
+{
+public:
+	/// <summary>指定された容量で <see cref="RingBuffer"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="capacity">バッファの容量を指定します。2 の累乗でなければなりません。</param>
+	explicit RingBuffer(size_t capacity) : cells(new Cell[capacity]), mask(capacity - 1), enqueuePosition(0), dequeuePosition(0)
+	{
+		if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+			throw std::invalid_argument("capacity must be a power of 2");
+		for (size_t i = 0; i < capacity; i++)
+			cells[i].Sequence.store(i, std::memory_order_relaxed);
+	}
+
+	/// <summary>要素の追加を試みます。バッファが満杯の場合は何もせずに false を返します。</summary>
+	bool TryPush(T&& item)
+	{
+		auto position = enqueuePosition.load(std::memory_order_relaxed);
+		while (true)
+		{
+			auto& cell = cells[position & mask];
+			auto difference = static_cast<ptrdiff_t>(cell.Sequence.load(std::memory_order_acquire)) - static_cast<ptrdiff_t>(position);
+			if (difference == 0)
+			{
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					cell.Data = std::move(item);
+					cell.Sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+				return false;
+			else
+				position = enqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	/// <summary>要素の取り出しを試みます。バッファが空の場合は false を返します。このメソッドは単一の消費者からのみ呼び出せます。</summary>
+	bool TryPop(T& item)
+	{
+		auto position = dequeuePosition.load(std::memory_order_relaxed);
+		auto& cell = cells[position & mask];
+		if (static_cast<ptrdiff_t>(cell.Sequence.load(std::memory_order_acquire)) - static_cast<ptrdiff_t>(position + 1) < 0)
+			return false;
+		dequeuePosition.store(position + 1, std::memory_order_relaxed);
+		item = std::move(cell.Data);
+		cell.Sequence.store(position + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> Sequence;
+		T Data;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	const size_t mask;
+	std::atomic<size_t> enqueuePosition;
+	std::atomic<size_t> dequeuePosition;
+};
+
+/// <summary>ログレコードの出力先を表します。</summary>
+class LogSink
+{
+public:
+	virtual ~LogSink() { }
+	virtual void Write(const LogRecord& record) = 0;
+	virtual void Flush() = 0;
+};
+
+/// <summary>ログレコードを 1 行 1 レコードの JSON (JSON Lines) として出力します。</summary>
+class JsonLinesLogSink final : public LogSink
+{
+public:
+	explicit JsonLinesLogSink(const std::string& fileName) : stream(fileName) { }
+
+	virtual void Write(const LogRecord& record)
+	{
+		stream << "{\"time\":" << record.Time << ",\"event\":\"" << LogRecord::EventName(record.Event) << "\"";
+		WriteInteger("layer", record.Layer);
+		WriteInteger("neurons", record.Neurons);
+		WriteInteger("epoch", record.Epoch);
+		WriteInteger("patience", record.Patience);
+		WriteReal("cost", record.Cost);
+		WriteReal("error_rate", record.ErrorRate);
+		WriteReal("seconds", record.Seconds);
+		WriteReal("sparsity", record.Sparsity);
+		WriteInteger("samples", record.Samples);
+		WriteReal("interval", record.Interval);
+		if (!record.Text.empty())
+			stream << ",\"text\":\"" << Escape(record.Text) << "\"";
+		stream << "}\n";
+	}
+
+	virtual void Flush() { stream.flush(); }
+
+private:
+	std::ofstream stream;
+
+	void WriteInteger(const char* name, long long value)
+	{
+		if (value >= 0)
+			stream << ",\"" << name << "\":" << value;
+	}
+
+	// NaN は値が設定されていないことを示すため出力せず、JSON で表現できない無限大は null として出力する
+	void WriteReal(const char* name, double value)
+	{
+		if (std::isnan(value))
+			return;
+		stream << ",\"" << name << "\":";
+		if (std::isinf(value))
+			stream << "null";
+		else
+			stream << std::setprecision(std::numeric_limits<double>::max_digits10) << value << std::setprecision(6);
+	}
+
+	static std::string Escape(const std::string& text)
+	{
+		std::string result;
+		for (auto c : text)
+		{
+			auto code = static_cast<unsigned char>(c);
+			if (c == '"' || c == '\\')
+				(result += '\\') += c;
+			else if (c == '\n')
+				result += "\\n";
+			else if (c == '\r')
+				result += "\\r";
+			else if (c == '\t')
+				result += "\\t";
+			else if (code < 0x20)
+				result += (boost::format("\\u%04x") % static_cast<unsigned int>(code)).str();
+			else
+				result += c;
+		}
+		return result;
+	}
+};
+
+/// <summary>ログレコードを CSV として出力します。</summary>
+class CsvLogSink final : public LogSink
+{
+public:
+	explicit CsvLogSink(const std::string& fileName) : stream(fileName) { stream << "time,event,layer,neurons,epoch,patience,samples,cost,error_rate,seconds,sparsity,interval\n"; }
+
+	virtual void Write(const LogRecord& record)
+	{
+		if (record.Event == LogEvent::Message)
+			return;
+		stream << record.Time << "," << LogRecord::EventName(record.Event);
+		for (auto value : { record.Layer, record.Neurons, record.Epoch, record.Patience, record.Samples })
+		{
+			stream << ",";
+			if (value >= 0)
+				stream << value;
+		}
+		for (auto value : { record.Cost, record.ErrorRate, record.Seconds, record.Sparsity, record.Interval })
+		{
+			stream << ",";
+			if (!std::isnan(value))
+				stream << std::setprecision(std::numeric_limits<double>::max_digits10) << value << std::setprecision(6);
+		}
+		stream << "\n";
+	}
+
+	virtual void Flush() { stream.flush(); }
+
+private:
+	std::ofstream stream;
+};
+
+/// <summary>ログレコードを人間が読みやすい形式で指定されたストリームに出力します。</summary>
+class TextLogSink final : public LogSink
+{
+public:
+	/// <summary>指定されたストリームに出力する <see cref="TextLogSink"/> クラスの新しいインスタンスを初期化します。ストリームの所有権は移動しません。</summary>
+	explicit TextLogSink(std::ostream& stream) : stream(&stream) { }
+
+	/// <summary>指定されたファイルに出力する <see cref="TextLogSink"/> クラスの新しいインスタンスを初期化します。</summary>
+	explicit TextLogSink(const std::string& fileName) : file(new std::ofstream(fileName)), stream(file.get()) { }
+
+	virtual void Write(const LogRecord& record)
+	{
+		auto& s = *stream;
+		switch (record.Event)
+		{
+		case LogEvent::Message:
+			s << record.Text << "\n";
+			break;
+		case LogEvent::SweepStarted:
+			s << "Current Number of Neuron Increase: " << record.Neurons << "\n";
+			break;
+		case LogEvent::NeuronCandidate:
+			s << "Number of Neurons of Hidden Layer " << record.Layer << ": " << record.Neurons << "\n";
+			break;
+		case LogEvent::PreTrainingCost:
+			s << record.Epoch << " " << record.Cost << "\n";
+			break;
+		case LogEvent::PredictedCost:
+			s << record.Epoch << " Predicted: " << record.Cost << "\n";
+			break;
+		case LogEvent::PreTrainingConverged:
+			s << "Pre-Training Converged at Epoch " << record.Epoch << " (Predicted Final Cost: " << record.Cost << ")" << "\n";
+			break;
+		case LogEvent::CostDifference:
+			s << "Cost Difference per Neuron: " << record.Cost << "\n";
+			break;
+		case LogEvent::DecidedNeurons:
+			if (record.Layer == 0)
+				s << "Decided Number of Neurons: " << "\n";
+			s << "    Number of Neurons of Hidden Layer " << record.Layer << ": " << record.Neurons << "\n";
+			break;
+		case LogEvent::FineTuningStarted:
+			s << "Fine-Tuning..." << "\n";
+			break;
+		case LogEvent::FineTuningError:
+			s << record.Epoch << " " << record.ErrorRate * 100.0 << "% Patience: " << record.Patience << "\n";
+			break;
+		case LogEvent::TrainingError:
+			s << record.Epoch << " Training Score: " << record.ErrorRate * 100.0 << "%" << "\n";
+			break;
+		case LogEvent::BestError:
+			s << "Best Test Score of Fine-Tuning: " << record.ErrorRate * 100.0 << "%" << "\n";
+			break;
+		case LogEvent::PruningRound:
+			s << "Pruning Round " << record.Epoch << ": Sparsity " << record.Sparsity * 100.0 << "% Test Score: " << record.ErrorRate * 100.0 << "%" << "\n";
+			break;
+		case LogEvent::SparseInference:
+			s << "Sparse Inference: Sparsity " << record.Sparsity * 100.0 << "% Test Score: " << record.ErrorRate * 100.0 << "% (Seconds: " << record.Seconds << ")" << "\n";
+			break;
+		case LogEvent::ElapsedTime:
+			s << "Elapsed Time (Seconds): " << record.Seconds << "\n";
+			break;
+		case LogEvent::ProgressiveCost:
+			s << "Estimated Cost: " << record.Cost << " +/- " << record.Interval << " (Samples: " << record.Samples << ")" << "\n";
+			break;
+		case LogEvent::Distillation:
+			s << "Distillation: Student Test Score: " << record.ErrorRate * 100.0 << "% (Latency: " << record.Seconds << " s)" << "\n";
+			break;
+		}
+	}
+
+	virtual void Flush() { stream->flush(); }
+
+private:
+	std::unique_ptr<std::ofstream> file;
+	std::ostream* stream;
+};
+
+/// <summary>
+/// ログレコードをリングバッファに格納し、バックグラウンドスレッドから各出力先に書き出すロガーを表します。
+/// 記録を行うスレッドは入出力を待機しません。バッファが満杯の場合にのみ、空きができるまで譲歩を繰り返します。
+/// 開始前または停止後にバッファが満杯になった場合、書き出すスレッドが存在しないため、そのレコードは破棄されます。
+/// </summary>
+class AsyncLogger final : private boost::noncopyable
+{
+public:
+	/// <summary>指定された容量のバッファを使用して <see cref="AsyncLogger"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="capacity">リングバッファの容量を指定します。2 の累乗でなければなりません。</param>
+	explicit AsyncLogger(size_t capacity = 4096) : buffer(capacity), running(false), dropped(0), start(std::chrono::steady_clock::now()) { }
+
+	~AsyncLogger() { Stop(); }
+
+	/// <summary>出力先を追加します。このメソッドは <see cref="Start"/> の前に呼び出す必要があります。</summary>
+	void AddSink(std::unique_ptr<LogSink> sink)
+	{
+		if (running)
+			throw std::logic_error("sinks cannot be added after the logger has started");
+		sinks.push_back(std::move(sink));
+	}
+
+	/// <summary>バックグラウンドスレッドを開始します。</summary>
+	void Start()
+	{
+		if (running.exchange(true))
+			return;
+		worker = std::thread([this] { Drain(); });
+	}
+
+	/// <summary>残っているレコードをすべて書き出してからバックグラウンドスレッドを停止します。</summary>
+	void Stop()
+	{
+		if (!running.exchange(false))
+			return;
+		worker.join();
+		if (Dropped() > 0)
+			std::cerr << "warning: " << Dropped() << " log records were dropped while the logger was not running" << std::endl;
+	}
+
+	/// <summary>レコードを記録します。</summary>
+	void Log(LogRecord record)
+	{
+		record.Time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		while (!buffer.TryPush(std::move(record)))
+		{
+			if (!running.load(std::memory_order_acquire))
+			{
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			std::this_thread::yield();
+		}
+	}
+
+	/// <summary>バックグラウンドスレッドが動作していなかったために破棄されたレコードの数を取得します。</summary>
+	size_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+	/// <summary>自由形式のメッセージを記録します。</summary>
+	void Message(std::string text) { Log(LogRecord(LogEvent::Message).SetText(std::move(text))); }
+
+private:
+	RingBuffer<LogRecord> buffer;
+	std::vector<std::unique_ptr<LogSink>> sinks;
+	std::atomic<bool> running;
+	std::atomic<size_t> dropped;
+	std::thread worker;
+	const std::chrono::steady_clock::time_point start;
+
+	void Drain()
+	{
+		auto wait = std::chrono::microseconds(100);
+		LogRecord record;
+		while (true)
+		{
+			auto stopping = !running.load(std::memory_order_acquire);
+			size_t written = 0;
+			while (buffer.TryPop(record))
+			{
+				for (auto& sink : sinks)
+					sink->Write(record);
+				written++;
+			}
+			if (written > 0)
+			{
+				for (auto& sink : sinks)
+					sink->Flush();
+				wait = std::chrono::microseconds(100);
+			}
+			if (stopping)
+				break;
+			std::this_thread::sleep_for(wait);
+			wait = (std::min)(wait * 2, std::chrono::microseconds(20000));
+		}
+	}
+};
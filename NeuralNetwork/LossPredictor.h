@@ -0,0 +1,132 @@
+﻿#pragma once
+
+#include "ShiftRegister.h"
+
+/// <summary>
+/// 直近のエポックにおけるコストから、コストの推移を冪乗則 a * x ^ b + c で近似して将来のコストを予測します。
+/// 指数 b は黄金分割探索で、係数 a および定数 c は線形最小二乗法で決定するため、反復回数は常に有限です。
+/// </summary>
+/// <typeparam name="T">コストの型を指定します。</typeparam>
+/// <typeparam name="N">近似に使用するエポック数の上限を指定します。</typeparam>
+template <class T, size_t N> class LossPredictor final
+{
+public:
+	/// <summary>近似に必要な最小のエポック数を示します。</summary>
+	static const size_t MinimumPoints = 3;
+	/// <summary>指数 b の探索範囲の下限を示します。</summary>
+	static constexpr double MinimumExponent = -4.0;
+	/// <summary>指数 b の探索範囲の上限を示します。</summary>
+	static constexpr double MaximumExponent = -0.01;
+	/// <summary>黄金分割探索の反復回数を示します。</summary>
+	static const unsigned int SearchIterations = 64;
+
+	static_assert(N >= MinimumPoints, "LossPredictor requires at least 3 points");
+
+	LossPredictor() : a(), b(), c(), fitted(false) { }
+
+	/// <summary>指定されたエポックにおけるコストを追加します。<see cref="N"/> 個を超えた古いコストは破棄されます。</summary>
+	void PushLoss(unsigned int epoch, const T& loss) { points.Push(std::make_pair(static_cast<double>(epoch), static_cast<double>(loss))); }
+	/// <summary>追加されたコストと近似結果をすべて破棄します。</summary>
+	void Clear()
+	{
+		points.Clear();
+		a = b = c = T();
+		fitted = false;
+	}
+	/// <summary>追加されたコストに曲線を当てはめます。点が不足している場合やコストが有限でない場合は false を返します。</summary>
+	bool Setup()
+	{
+		fitted = false;
+		if (points.Count() < MinimumPoints)
+			return false;
+		for (size_t i = 0; i < points.Count(); i++)
+		{
+			if (!std::isfinite(points[i].second))
+				return false;
+		}
+		// 残差平方和は b のみの関数として評価できるので、b について 1 次元の探索を行う
+		const double ratio = (std::sqrt(5.0) - 1) / 2;
+		double lower = MinimumExponent, upper = MaximumExponent;
+		double x1 = upper - ratio * (upper - lower), x2 = lower + ratio * (upper - lower);
+		double f1 = Fit(x1).Residual, f2 = Fit(x2).Residual;
+		for (unsigned int i = 0; i < SearchIterations; i++)
+		{
+			if (f1 <= f2)
+			{
+				upper = x2;
+				x2 = x1;
+				f2 = f1;
+				x1 = upper - ratio * (upper - lower);
+				f1 = Fit(x1).Residual;
+			}
+			else
+			{
+				lower = x1;
+				x1 = x2;
+				f1 = f2;
+				x2 = lower + ratio * (upper - lower);
+				f2 = Fit(x2).Residual;
+			}
+		}
+		auto result = Fit((lower + upper) / 2);
+		if (!std::isfinite(result.A) || !std::isfinite(result.C))
+			return false;
+		a = static_cast<T>(result.A);
+		b = static_cast<T>(result.B);
+		c = static_cast<T>(result.C);
+		fitted = true;
+		return true;
+	}
+	/// <summary>曲線が当てはめられているかどうかを示す値を返します。</summary>
+	bool Fitted() const { return fitted; }
+	/// <summary>指定されたエポックにおけるコストの予測値を返します。</summary>
+	T operator()(unsigned int epoch) const { return static_cast<T>(a * std::pow(static_cast<double>(epoch), b) + c); }
+	/// <summary>指定されたエポックから最終エポックまでに予測されるコストの減少量を返します。</summary>
+	T RemainingImprovement(unsigned int currentEpoch, unsigned int finalEpoch) const { return (*this)(currentEpoch) - (*this)(finalEpoch); }
+	std::string GetExpression() const
+	{
+		std::stringstream ss;
+		ss << boost::format("%lf * x ** %lf + %lf") % a % b % c;
+		return ss.str();
+	}
+
+private:
+	struct FitResult
+	{
+		double A, B, C, Residual;
+	};
+
+	T a, b, c;
+	bool fitted;
+	ShiftRegister<std::pair<double, double>, N> points;
+
+	// b を固定すると u = x ^ b に関する線形回帰 y = a * u + c になる
+	FitResult Fit(double exponent) const
+	{
+		auto count = static_cast<double>(points.Count());
+		double meanU = 0, meanY = 0;
+		for (size_t i = 0; i < points.Count(); i++)
+		{
+			meanU += std::pow(points[i].first, exponent);
+			meanY += points[i].second;
+		}
+		meanU /= count;
+		meanY /= count;
+		double covariance = 0, variance = 0;
+		for (size_t i = 0; i < points.Count(); i++)
+		{
+			auto du = std::pow(points[i].first, exponent) - meanU;
+			covariance += du * (points[i].second - meanY);
+			variance += du * du;
+		}
+		// u がほとんど変化しない場合は定数で近似する
+		auto slope = variance > std::numeric_limits<double>::epsilon() * meanU * meanU ? covariance / variance : 0.0;
+		FitResult result { slope, exponent, meanY - slope * meanU, 0 };
+		for (size_t i = 0; i < points.Count(); i++)
+		{
+			auto error = result.A * std::pow(points[i].first, exponent) + result.C - points[i].second;
+			result.Residual += error * error;
+		}
+		return result;
+	}
+};
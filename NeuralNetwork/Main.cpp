@@ -1,5 +1,18 @@
-﻿#include "StackedDenoisingAutoEncoder.h"
-#include "ShiftRegister.h"
+﻿#include "SparseInferenceNetwork.h"
+#include "ConvolutionalLayer.h"
+#include "KernelAutoTuner.h"
+#include "MemoryAccounting.h"
+#include "Sampler.h"
+#include "Augmentation.h"
+#include "LayerCache.h"
+#include "ProgressiveEvaluation.h"
+#include "WidthSearch.h"
+#include "SnapshotEvaluator.h"
+#include "Distillation.h"
+#include "PredictionServer.h"
+#include "LossPredictor.h"
+#include "Platform.h"
+#include "Logger.h"
 
 enum class DataSetKind
 {
@@ -18,13 +31,23 @@ const char* DataSetNames[]
 
 template <class TValue> LearningSet<TValue> LoadLearningSet(DataSetKind kind);
 template <class TValue> void TestSdA(const LearningSet<TValue>& datasets);
+int Serve(const PredictionServerOptions& options);
+int GenerateLoad(const LoadGeneratorOptions& options);
+int Distill(const std::string& teacherPath);
 
 typedef double Floating;
+// 隠れ層の種類 (ConvolutionalHiddenLayer<TValue> を指定すると画像の空間的な構造を使用する畳み込み層になり、ニューロン数はフィルタ数を表す)
+template <class TValue> using HiddenLayerType = HiddenLayer<TValue>;
 
 // Pre-Training Parameters
 
 const int PreTrainingEpochs = 15;
 const double PreTrainingLearningRate = 0.001;
+const OptimizerParameters PreTrainingOptimizer(OptimizerKind::StochasticGradientDescent);
+const LearningRateSchedule PreTrainingSchedule(LearningRateScheduleKind::Constant);
+const bool PreTrainingEarlyStopping = false; // コストの予測に基づいて事前学習を打ち切る (既定では常に PreTrainingEpochs まで学習する)
+const double PreTrainingConvergenceThreshold = 0.001; // 残りのエポックで予測されるコストの相対的な減少量がこれ以下になると打ち切る
+const size_t PreTrainingPredictorWindow = 5; // コストの予測に使用する直近のエポック数
 
 const std::vector<Floating> DaNoises
 {
@@ -37,9 +60,28 @@ const std::vector<Floating> DaNoises
 
 const unsigned int FineTuningEpochs = 1000;
 const double FineTuningLearningRate = 0.01;
+const OptimizerParameters FineTuningOptimizer(OptimizerKind::StochasticGradientDescent);
+const LearningRateSchedule FineTuningSchedule(LearningRateScheduleKind::Constant);
 const unsigned int DefaultPatience = 10;
 const double ImprovementThreshold = 1;//0.995;
 const unsigned int PatienceIncrease = 2;
+const bool PipelineFineTuning = false;
+const PipelineOptions FineTuningPipeline(0, 1, 0); // ステージ数 (0 は層ごと), マイクロバッチの大きさ, 許容する遅延
+const bool AsynchronousEvaluation = false; // 各エポックのスナップショットを次のエポックの訓練と並行して評価する (早期終了の判定が 1 エポック遅れ、最大 1 エポック余分に訓練する)
+const unsigned int EvaluationThreads = 1; // スナップショットの評価に使用するスレッド数
+
+// Pruning Parameters
+
+const std::vector<double> PruningSparsities { }; // 段階的に引き上げる枝刈りの割合 (空の場合は枝刈りしない。例: { 0.5, 0.75, 0.9 })
+const unsigned int PruningFineTuningEpochs = 2; // 各段階の枝刈りの後に行うファインチューニングのエポック数
+
+// Distillation Parameters (distill <教師のモデル> で実行する)
+
+const std::vector<unsigned int> StudentNeurons { 100 }; // 生徒の隠れ層ごとのニューロン数
+const DistillationOptions StudentDistillation(4.0, 0.9); // 学習中に教師と生徒の出力を和らげる温度, 損失における和らげられた教師の出力の項の重み
+const unsigned int StudentPreTrainingEpochs = 5; // 生徒の各隠れ層を雑音除去自己符号化器として事前学習するエポック数
+const unsigned int DistillationEpochs = 200;
+const size_t InferenceBenchmarkBatch = 64; // スループットの計測でまとめて処理するデータ点の数
 
 // Number of Neuron Automatic Decision Parameters
 
@@ -47,113 +89,381 @@ const unsigned int MinNeurons = 1;
 const double NeuronIncease = 4.0 / 3.0;
 const unsigned int CostCheckEpoch = 1;
 const double ConvergeConstant = 0.1;
+const double WidthSearchGrowth = 2.0; // 屈曲点を挟むまでニューロン数を何倍ずつ大きくするか (その後は区間を二分して絞り込む)
+const unsigned int MaxNeurons = 100000; // 探索するニューロン数の上限 (メモリ予算によってさらに制限される)
+const unsigned int WidthSearchConcurrency = 1; // 同時に事前学習する候補の数 (キャッシュおよび分散学習では 1 として扱う)
+const bool ProgressiveCostCheck = false; // 判定に使用するコストを検証データの無作為な部分集合で推定し、判定が確定した時点で打ち切る
+const ProgressiveEvaluationOptions CostCheckEvaluation(100, 2, 0.01); // 最初のデータ点の数, 段階ごとの倍率, すべての段階を通じて判定を誤る確率の上限
 
-// Using Data Set
-const DataSetKind UsingDataSet = DataSetKind::Caltech101Silhouettes;
+// Pretrained Layer Cache Parameters
 
-class teed_out
-{
-public:
-	teed_out() { }
-	~teed_out() { close(); }
+const bool CachePretrainedLayers = false; // 同じ条件で事前学習された層をディスクから再利用する (分散学習では使用しない)
+const char* const PretrainedLayerCacheDirectory = "Outputs/LayerCache";
+const std::mt19937::result_type PretrainedLayerCacheSeed = 89677; // キャッシュを使用する場合は実行ごとの乱数の代わりにこのシード値を使用する
 
-	void open(const std::string& outFileName)
-	{
-		outfile.open(outFileName);
-		s.open(boost::iostreams::tee_device<std::ostream, std::ofstream>(std::cout, outfile));
-	}
-	void close()
-	{
-		s.close();
-		outfile.flush();
-		outfile.close();
-	}
-	
-	boost::iostreams::stream<boost::iostreams::tee_device<std::ostream, std::ofstream>> s;
+// Sampling Parameters
 
-private:
-	std::ofstream outfile;
-};
+const bool ShuffleTrainingData = false; // エポックごとにブロック単位で訓練データの順序を入れ替える (既定では従来どおり格納順に処理する)
+const size_t ShuffleBlockSize = 256;
+const AugmentationOptions TrainingAugmentation(false, 0, 0.0); // 左右反転, 最大の平行移動量 (画素), 加える正規雑音の標準偏差 (すべて無効の場合は拡張しない)
+const bool ImportanceSampling = false; // ファインチューニングのデータ点を直前の損失に比例する確率で抽出する (拡張およびパイプライン並列とは併用しない)
+const ImportanceSamplingOptions FineTuningSampling(0.3, 0.2, 5); // 1 エポックで抽出する割合, 一様分布の割合, 全体を処理するエポックの間隔
+
+// Parallel Execution Parameters
+
+const unsigned int WorkerThreads = 0; // 0 の場合は論理プロセッサ数
+const ThreadAffinity WorkerAffinity = ThreadAffinity::None;
+const bool AutoTuneKernels = false; // 初めて現れた全結合の隠れ層の形状に対してカーネルの分割方法を計測して選択し、KernelTuningCache に保存する
+const char* const KernelTuningCache = "Outputs/KernelTuning.tsv"; // 選択された分割方法をホストと形状ごとに保存するファイル
+
+// Memory Parameters
+
+const size_t MemoryBudget = 0; // バイト単位のメモリ予算 (0 は無制限)。データセットの選択を予算内に切り詰め、教師の出力のキャッシュを省き、ニューロン数の探索を予算内で打ち切る
 
-teed_out tout;
+// Using Data Set
+const DataSetKind UsingDataSet = DataSetKind::Caltech101Silhouettes;
+
+// Log Outputs
+const bool ConsoleOutput = true;
+const bool CsvOutput = false;
+const bool SaveModel = false; // ファインチューニング後のネットワークを推論サーバー用に "<出力名> <幅>.model" に保存する
+
+AsyncLogger logger;
+std::ofstream profileOut;
+DistributedOptions distributed;
+std::unique_ptr<Communicator> communicator;
+std::string outputBaseName;
 
 void ShowParameters()
 {
+	std::ostringstream out;
 	if (!DaNoises.empty())
 	{
-		tout.s << "Pre-Training: " << std::endl;
-		tout.s << "    Epochs: " << PreTrainingEpochs << std::endl;
-		tout.s << "    Learning Rate: " << PreTrainingLearningRate << std::endl;
-		tout.s << "    Noise Rate: " << std::endl;
+		out << "Pre-Training: " << std::endl;
+		out << "    Epochs: " << PreTrainingEpochs << std::endl;
+		out << "    Learning Rate: " << PreTrainingLearningRate << std::endl;
+		out << "    Optimizer: " << PreTrainingOptimizer.Name() << std::endl;
+		if (PreTrainingEarlyStopping)
+			out << "    Convergence Threshold: " << PreTrainingConvergenceThreshold << " (Window: " << PreTrainingPredictorWindow << ")" << std::endl;
+		out << "    Noise Rate: " << std::endl;
 		for (size_t i = 0; i < DaNoises.size(); i++)
-			tout.s << "        HL " << i << ": " << DaNoises[i] << std::endl;
+			out << "        HL " << i << ": " << DaNoises[i] << std::endl;
+	}
+	out << "Fine-Tuning: " << std::endl;
+	out << "    Max Epochs: " << FineTuningEpochs << std::endl;
+	out << "    Learning Rate: " << FineTuningLearningRate << std::endl;
+	out << "    Optimizer: " << FineTuningOptimizer.Name() << std::endl;
+	out << "    Early Stopping Parameters: " << std::endl;
+	out << "        Default Patience: " << DefaultPatience << std::endl;
+	out << "        Improvement Threshold: " << ImprovementThreshold << std::endl;
+	out << "        Patience Increase: " << PatienceIncrease;
+	if (AsynchronousEvaluation)
+		out << std::endl << "    Asynchronous Evaluation Threads: " << EvaluationThreads;
+	if (ImportanceSampling)
+		out << std::endl << "    Importance Sampling: " << FineTuningSampling.Fraction << " of Samples (Uniform Mix: " << FineTuningSampling.UniformMix << ", Full Pass Interval: " << FineTuningSampling.FullPassInterval << ")";
+	if (PipelineFineTuning)
+	{
+		out << std::endl << "    Pipeline: " << std::endl;
+		out << "        Stages: " << FineTuningPipeline.Stages << std::endl;
+		out << "        Micro-Batch Size: " << FineTuningPipeline.MicroBatchSize << std::endl;
+		out << "        Staleness: " << FineTuningPipeline.Staleness;
+	}
+	if (!PruningSparsities.empty())
+	{
+		out << std::endl << "Pruning: " << std::endl;
+		out << "    Sparsities:";
+		for (auto sparsity : PruningSparsities)
+			out << " " << sparsity;
+		out << std::endl << "    Fine-Tuning Epochs per Round: " << PruningFineTuningEpochs;
 	}
-	tout.s << "Fine-Tuning: " << std::endl;
-	tout.s << "    Max Epochs: " << FineTuningEpochs << std::endl;
-	tout.s << "    Learning Rate: " << FineTuningLearningRate << std::endl;
-	tout.s << "    Early Stopping Parameters: " << std::endl;
-	tout.s << "        Default Patience: " << DefaultPatience << std::endl;
-	tout.s << "        Improvement Threshold: " << ImprovementThreshold << std::endl;
-	tout.s << "        Patience Increase: " << PatienceIncrease << std::endl;
 	if (!DaNoises.empty())
 	{
-		tout.s << "Number of Neuron Automatic Decision Parameters: " << std::endl;
-		//tout.s << "    Minimum Number of Neurons: " << MinNeurons << std::endl;
-		//tout.s << "    Number of Neuron Increase: " << NeuronIncease << std::endl;
-		tout.s << "    Converge Constant: " << ConvergeConstant << std::endl;
+		out << std::endl << "Number of Neuron Automatic Decision Parameters: " << std::endl;
+		//out << "    Minimum Number of Neurons: " << MinNeurons << std::endl;
+		//out << "    Number of Neuron Increase: " << NeuronIncease << std::endl;
+		out << "    Converge Constant: " << ConvergeConstant << std::endl;
+		out << "    Width Search: Growth " << WidthSearchGrowth << ", Max Neurons " << MaxNeurons << ", Concurrency " << WidthSearchConcurrency;
+		if (ProgressiveCostCheck)
+			out << std::endl << "    Progressive Cost Check: " << CostCheckEvaluation.InitialSamples << " Samples x " << CostCheckEvaluation.Growth << " (alpha = " << CostCheckEvaluation.Alpha << ")";
+	}
+	if (TrainingAugmentation.Enabled())
+	{
+		out << std::endl << "Augmentation: " << std::endl;
+		out << "    Horizontal Flip: " << std::boolalpha << TrainingAugmentation.HorizontalFlip << std::endl;
+		out << "    Max Shift: " << TrainingAugmentation.MaxShift << std::endl;
+		out << "    Noise Deviation: " << TrainingAugmentation.NoiseDeviation << std::endl;
+		out << "    Chunk Size: " << TrainingAugmentation.ChunkSize << " (Prefetch: " << TrainingAugmentation.Prefetch << ", Workers: " << TrainingAugmentation.Workers << ")";
 	}
+	out << std::endl << "Worker Threads: " << ThreadPool::Global().Threads();
+	if (distributed.Enabled())
+	{
+		out << std::endl << "Distributed Training: " << std::endl;
+		out << "    Rank: " << distributed.Rank << " / " << distributed.WorldSize << std::endl;
+		out << "    Address: " << distributed.Address << std::endl;
+		out << "    Compression: " << distributed.CompressionName() << std::endl;
+		out << "    Sync Interval: " << distributed.SyncInterval;
+	}
+	logger.Message(out.str());
+}
+
+void ReportProfile(const std::string& label)
+{
+#ifdef NN_ENABLE_PROFILING
+	std::ostringstream table;
+	NN_PROFILE_REPORT(table, profileOut, label);
+	auto text = table.str();
+	text.pop_back();
+	logger.Message(std::move(text));
+#else
+	(void)label;
+#endif
 }
 
-int main()
+// 前回の報告からのメモリ使用量の最大値を用途ごとに記録し、次のフェーズを開始する
+void ReportMemory(const std::string& label)
 {
+	logger.Message("Memory (" + label + "): " + MemoryAccountant::Global().Report());
+	MemoryAccountant::Global().BeginPhase();
+}
+
+// 計測時間などの比を文字列にする。どちらかが計測できなかった (0 以下の) 場合は "n/a" を返す
+std::string FormatRatio(double numerator, double denominator)
+{
+	return numerator > 0 && denominator > 0 ? std::to_string(numerator / denominator) : std::string("n/a");
+}
+
+// 分割方法が選択されていない隠れ層の形状であれば計測して選択し、キャッシュファイルに保存する
+// 計測は隠れ層のカーネルで行うため、出力層の形状には使用しない
+void TuneKernels(size_t rows, size_t columns)
+{
+	auto& table = KernelTuningTable::Global();
+	if (!AutoTuneKernels || table.Contains(rows, columns))
+		return;
+	auto configuration = KernelAutoTuner<Floating>().Tune(rows, columns);
+	logger.Message((boost::format("Kernel Tuning: %1% x %2% -> Forward Tasks: %3%, Column Block: %4%, Train Tasks: %5%") % rows % columns % configuration.ForwardTasks % configuration.ColumnBlock % configuration.TrainTasks).str());
+	// 分散学習では同じホストの複数のプロセスが同時に書き込まないように、ランク 0 のみが保存する
+	if (distributed.Rank == 0)
+		table.Save(KernelTuningCache);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && std::string(argv[1]) == "serve")
+		return Serve(PredictionServerOptions::Parse(argc, argv, 2));
+	if (argc > 1 && std::string(argv[1]) == "load")
+		return GenerateLoad(LoadGeneratorOptions::Parse(argc, argv, 2));
+	if (argc > 2 && std::string(argv[1]) == "distill")
+		return Distill(argv[2]);
+	distributed = DistributedOptions::Parse(argc, argv);
+	MemoryAccountant::Global().SetBudget(MemoryBudget);
+	ThreadPool::Configure(ThreadPoolOptions(WorkerThreads, WorkerAffinity));
 	std::time_t time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-	std::tm tm;
-	localtime_s(&tm, &time);
+	auto tm = Platform::LocalTime(time);
 	std::ostringstream sout;
 	sout << "Outputs/";
+	Platform::MakeDirectory(sout.str());
 	sout << DataSetNames[static_cast<size_t>(UsingDataSet)] << "/";
-	_mkdir(sout.str().c_str());
+	Platform::MakeDirectory(sout.str());
 	sout << std::setfill('0') << std::setw(4) << tm.tm_year + 1900 << "-"
 		<< std::setfill('0') << std::setw(2) << tm.tm_mon + 1 << "-"
 		<< std::setfill('0') << std::setw(2) << tm.tm_mday << " "
 		<< std::setfill('0') << std::setw(2) << tm.tm_hour << "-"
-		<< std::setfill('0') << std::setw(2) << tm.tm_min << ".log";
-	tout.open(sout.str());
+		<< std::setfill('0') << std::setw(2) << tm.tm_min;
+	outputBaseName = sout.str();
+	if (distributed.Enabled())
+		sout << " rank" << distributed.Rank;
+	sout << ".log";
+	if (ConsoleOutput && distributed.Rank == 0)
+		logger.AddSink(std::unique_ptr<LogSink>(new TextLogSink(std::cout)));
+	logger.AddSink(std::unique_ptr<LogSink>(new TextLogSink(sout.str())));
+	logger.AddSink(std::unique_ptr<LogSink>(new JsonLinesLogSink(sout.str() + ".jsonl")));
+	if (CsvOutput)
+		logger.AddSink(std::unique_ptr<LogSink>(new CsvLogSink(sout.str() + ".csv")));
+	logger.Start();
+#ifdef NN_ENABLE_PROFILING
+	profileOut.open(sout.str() + ".profile.jsonl");
+#endif
 	ShowParameters();
-	auto ls = LoadLearningSet<Floating>(UsingDataSet);
+	logger.Message("Kernel Tuning: " + std::to_string(KernelTuningTable::Global().Load(KernelTuningCache)) + " cached shapes for " + KernelTuningTable::HostKey());
+	if (distributed.Enabled())
+		communicator = std::unique_ptr<Communicator>(new Communicator(distributed));
+	auto ls = [] { NN_PROFILE_SCOPE(Loading, -1); return LoadLearningSet<Floating>(UsingDataSet); }();
+	ReportMemory("Loading");
+	if (MemoryAccountant::Global().OverBudget())
+		logger.Message("Memory Budget: the selected data sets alone exceed the budget");
 	auto start = std::chrono::system_clock::now();
 	TestSdA(ls);
 	auto end = std::chrono::system_clock::now();
-	tout.s << "Elapsed Time (Seconds): " << std::chrono::duration_cast<std::chrono::seconds>(end - start).count() << std::endl;
+	logger.Log(LogRecord(LogEvent::ElapsedTime).SetSeconds(static_cast<double>(std::chrono::duration_cast<std::chrono::seconds>(end - start).count())));
+	if (communicator)
+		logger.Message("Communication: " + std::to_string(communicator->BytesSent()) + " bytes sent, " + std::to_string(communicator->BytesReceived()) + " bytes received");
+	logger.Stop();
+	communicator.reset();
+	return 0;
+}
+
+int Serve(const PredictionServerOptions& options)
+{
+	ThreadPool::Configure(ThreadPoolOptions(WorkerThreads, WorkerAffinity));
+	logger.AddSink(std::unique_ptr<LogSink>(new TextLogSink(std::cout)));
+	logger.Start();
+	std::ifstream stream(options.Model, std::ios::binary);
+	if (!stream)
+		throw std::runtime_error("failed to open " + options.Model);
+	auto model = StackedDenoisingAutoEncoder<Floating, HiddenLayerType<Floating>>::Load(stream);
+	// 推論に使用する隠れ層の形状を起動時に調整しておく
+	Platform::MakeDirectory("Outputs/");
+	KernelTuningTable::Global().Load(KernelTuningCache);
+	if (std::is_same<HiddenLayerType<Floating>, HiddenLayer<Floating>>::value)
+	{
+		for (size_t i = 0; i < model->HiddenLayers.Count(); i++)
+			TuneKernels(model->HiddenLayers[i].Weight.Row(), model->HiddenLayers[i].Weight.Column());
+	}
+	logger.Message("Serving " + options.Model + " on " + options.Address + " (Max Batch Size: " + std::to_string(options.MaxBatchSize) + ", Max Delay: " + std::to_string(options.MaxDelay.count()) + " us)");
+	PredictionServer<Floating, HiddenLayerType<Floating>> server(*model, options);
+	server.Run();
+	logger.Message("Server: " + server.Statistics().ToString());
+	logger.Stop();
 	return 0;
 }
 
+int GenerateLoad(const LoadGeneratorOptions& options)
+{
+	logger.AddSink(std::unique_ptr<LogSink>(new TextLogSink(std::cout)));
+	logger.Start();
+	LoadGenerator generator(options);
+	logger.Message("Client: " + generator.Run().ToString());
+	logger.Message("Server: " + generator.ServerStatistics().ToString());
+	if (options.Shutdown)
+		generator.ShutdownServer();
+	logger.Stop();
+	return 0;
+}
+
+// 保存された教師から生徒を蒸留し、教師と並べて誤り率と推論の実行時間を報告する
+template <class TValue> std::unique_ptr<StackedDenoisingAutoEncoder<TValue, HiddenLayerType<TValue>>> DistillStudent(StackedDenoisingAutoEncoder<TValue, HiddenLayerType<TValue>>& teacher, const LearningSet<TValue>& datasets)
+{
+	std::random_device random;
+	std::unique_ptr<StackedDenoisingAutoEncoder<TValue, HiddenLayerType<TValue>>> student(new StackedDenoisingAutoEncoder<TValue, HiddenLayerType<TValue>>(random(), teacher.HiddenLayers.InputShape(0)));
+	student->HiddenLayers.SetOptimizer(PreTrainingOptimizer);
+	EpochSampler<TValue> sampler(datasets.TrainingData(), datasets.TrainingData().Count(), ShuffleBlockSize, random());
+	auto trainingData = [&] { return ShuffleTrainingData ? sampler.NextEpoch() : datasets.TrainingData(); };
+	for (unsigned int i = 0; i < StudentNeurons.size(); i++)
+	{
+		student->HiddenLayers.Set(i, StudentNeurons[i]);
+		if (std::is_same<HiddenLayerType<TValue>, HiddenLayer<TValue>>::value)
+			TuneKernels(student->HiddenLayers[i].Weight.Row(), student->HiddenLayers[i].Weight.Column());
+		auto noise = DaNoises.empty() ? static_cast<TValue>(0) : DaNoises[(std::min)(static_cast<size_t>(i), DaNoises.size() - 1)];
+		for (unsigned int epoch = 1; epoch <= StudentPreTrainingEpochs; epoch++)
+		{
+			NN_PROFILE_SCOPE(PreTraining, i);
+			student->HiddenLayers[i].Train(trainingData(), static_cast<TValue>(PreTrainingSchedule(PreTrainingLearningRate, epoch)), noise);
+		}
+	}
+	student->SetLogisticRegressionLayer(datasets.ClassCount, FineTuningOptimizer);
+	// 教師の順伝播は最初に 1 回だけ行い、すべてのエポックで同じ目標の分布を使用する (メモリ予算に収まらない場合は毎回計算する)
+	SoftTargetCache<TValue> targets(teacher, datasets.TrainingData(), StudentDistillation);
+	if (!targets.Cached())
+		logger.Message("Memory Budget: teacher outputs are recomputed every epoch instead of being cached");
+	ReportMemory("Teacher Outputs");
+
+	auto& selectionData = datasets.ValidationData().Count() > 0 ? datasets.ValidationData() : datasets.TestData();
+	auto bestScore = std::numeric_limits<Floating>::infinity();
+	std::valarray<TValue> bestParameters;
+	unsigned int patience = DefaultPatience;
+	logger.Log(LogRecord(LogEvent::FineTuningStarted));
+	for (unsigned int epoch = 1; epoch <= DistillationEpochs && epoch <= patience; epoch++)
+	{
+		{
+			NN_PROFILE_SCOPE(FineTuning, -1);
+			auto data = trainingData();
+			student->FineTune(data, static_cast<TValue>(FineTuningSchedule(FineTuningLearningRate, epoch)), [&](size_t d) -> const std::valarray<TValue>& { return targets.Target(data, d); },
+				StudentDistillation.Temperature, StudentDistillation.SoftTargetWeight);
+		}
+		auto score = [&] { NN_PROFILE_SCOPE(ErrorRateEvaluation, -1); return student->template ComputeErrorRates<Floating>(selectionData); }();
+		logger.Log(LogRecord(LogEvent::FineTuningError).SetEpoch(epoch).SetErrorRate(score).SetPatience(patience));
+		if (score < bestScore)
+		{
+			if (score < bestScore * ImprovementThreshold)
+				patience = std::max(patience, epoch * PatienceIncrease);
+			bestScore = score;
+			bestParameters = student->ExportParameters();
+		}
+	}
+	if (bestParameters.size() > 0)
+		student->ImportParameters(bestParameters);
+
+	auto teacherScore = teacher.template ComputeErrorRates<Floating>(datasets.TestData());
+	auto studentScore = student->template ComputeErrorRates<Floating>(datasets.TestData());
+	auto teacherTiming = MeasureInference(teacher, datasets.TestData(), InferenceBenchmarkBatch);
+	auto studentTiming = MeasureInference(*student, datasets.TestData(), InferenceBenchmarkBatch);
+	logger.Log(LogRecord(LogEvent::Distillation).SetErrorRate(studentScore).SetSeconds(studentTiming.Latency));
+	logger.Message((boost::format("Teacher Test Score: %1%%% (Latency: %2% s), Accuracy Gap: %3% points, Latency Speedup: %4%, Throughput Gain: %5% (%6% / %7% samples/s), Parameters: %8% / %9%")
+		% (teacherScore * 100.0) % teacherTiming.Latency % ((studentScore - teacherScore) * 100.0) % FormatRatio(teacherTiming.Latency, studentTiming.Latency)
+		% FormatRatio(studentTiming.Throughput, teacherTiming.Throughput) % studentTiming.Throughput % teacherTiming.Throughput % student->ExportParameters().size() % teacher.ExportParameters().size()).str());
+	ReportProfile("Distillation");
+	return student;
+}
+
+int Distill(const std::string& teacherPath)
+{
+	ThreadPool::Configure(ThreadPoolOptions(WorkerThreads, WorkerAffinity));
+	logger.AddSink(std::unique_ptr<LogSink>(new TextLogSink(std::cout)));
+	logger.Start();
+	std::ifstream stream(teacherPath, std::ios::binary);
+	if (!stream)
+		throw std::runtime_error("failed to open " + teacherPath);
+	auto teacher = StackedDenoisingAutoEncoder<Floating, HiddenLayerType<Floating>>::Load(stream);
+	Platform::MakeDirectory("Outputs/");
+	KernelTuningTable::Global().Load(KernelTuningCache);
+	std::ostringstream students;
+	for (auto neurons : StudentNeurons)
+		students << " " << neurons;
+	logger.Message("Distilling " + teacherPath + " into" + students.str() + " neurons (Temperature: " + std::to_string(StudentDistillation.Temperature) + ", Soft Target Weight: " + std::to_string(StudentDistillation.SoftTargetWeight) + ")");
+	auto ls = [] { NN_PROFILE_SCOPE(Loading, -1); return LoadLearningSet<Floating>(UsingDataSet); }();
+	ReportMemory("Loading");
+	auto student = DistillStudent(*teacher, ls);
+	auto extension = teacherPath.rfind(".model");
+	auto studentPath = (extension != std::string::npos && extension + 6 == teacherPath.size() ? teacherPath.substr(0, extension) : teacherPath) + " student.model";
+	std::ofstream output(studentPath, std::ios::binary);
+	student->Save(output);
+	logger.Message("Distillation: saved the student to " + studentPath);
+	logger.Stop();
+	return 0;
+}
+
+// メモリ予算に収まらずに読み込まれなかったデータ点があれば、その数と実際に読み込まれたデータ点の数を報告する
+template <class TValue> LearningSet<TValue> LoadWithinBudget(LearningSetLoader<TValue>&& loader, const std::string& path, const LearningSetSelection& selection = LearningSetSelection())
+{
+	auto set = loader.Load(path, selection);
+	if (loader.DroppedRecords() > 0)
+		logger.Message("Memory Budget: " + std::to_string(loader.DroppedRecords()) + " selected records were not loaded (Training: " + std::to_string(set.TrainingData().Count()) +
+			", Validation: " + std::to_string(set.ValidationData().Count()) + ", Test: " + std::to_string(set.TestData().Count()) + ")");
+	return set;
+}
+
 template <class TValue> LearningSet<TValue> LoadLearningSet(DataSetKind kind)
 {
 	if (kind == DataSetKind::MNIST)
 	{
-		auto ls = MnistLoader<TValue>().Load("MNIST");
-		LearningSet<TValue> newLs;
-		newLs.ClassCount = ls.ClassCount;
-		newLs.TrainingData().From(std::move(ls.TrainingData()), 0, 5000);
-		newLs.ValidationData().From(std::move(ls.TrainingData()), 50000, 1000);
-		newLs.TestData().From(std::move(ls.TestData()), 0, 1000);
-		return std::move(newLs);
+		LearningSetSelection selection;
+		selection.Training = RecordSelection::Range(DataSetFile::Training, 0, 5000);
+		selection.Validation = RecordSelection::Range(DataSetFile::Training, 50000, 1000);
+		selection.Test = RecordSelection::Range(DataSetFile::Test, 0, 1000);
+		return LoadWithinBudget(MnistLoader<TValue>(), "MNIST", selection);
 	}
 	else if (kind == DataSetKind::Cifar10)
 	{
-		auto ls = Cifar10Loader<TValue>().Load("cifar-10-batches-bin");
-		LearningSet<TValue> newLs;
-		newLs.ClassCount = ls.ClassCount;
-		newLs.TrainingData().From(std::move(ls.TrainingData()), 0, 40000);
-		newLs.ValidationData().From(std::move(ls.TrainingData()), 40000, 10000);
-		newLs.TestData().From(std::move(ls.TestData()), 0, 10000);
-		return std::move(newLs);
+		LearningSetSelection selection;
+		selection.Training = RecordSelection::Range(DataSetFile::Training, 0, 40000);
+		selection.Validation = RecordSelection::Range(DataSetFile::Training, 40000, 10000);
+		selection.Test = RecordSelection::Range(DataSetFile::Test, 0, 10000);
+		return LoadWithinBudget(Cifar10Loader<TValue>(), "cifar-10-batches-bin", selection);
 	}
 	else if (kind == DataSetKind::Caltech101Silhouettes)
-		return std::move(Caltech101SilhouettesLoader<TValue>().Load("Caltech101Silhouettes"));
+		return LoadWithinBudget(Caltech101SilhouettesLoader<TValue>(), "Caltech101Silhouettes");
 	else if (kind == DataSetKind::PR)
-		return std::move(PatternRecognitionLoader<TValue>().Load("PR"));
+		return LoadWithinBudget(PatternRecognitionLoader<TValue>(), "PR");
 	else
 		return std::move(LearningSet<TValue>());
 }
@@ -163,147 +473,460 @@ template <class TValue> LearningSet<TValue> LoadLearningSet(DataSetKind kind)
 // 最終エポックでのテストコスト予測はもちろん、ニューロン数ごとの最終テストコストも予測することで
 // チェックすべきニューロン数の組み合わせを減少させる。
 
-template <class T, size_t N> class LossPredictor final
+// 枝刈りされた SDA を疎行列による推論ネットワークに変換し、密な推論と誤り率および実行時間を比較する
+template <class TValue, class TCombine> void ReportSparseInference(StackedDenoisingAutoEncoder<TValue, HiddenLayer<TValue>>& sda, const DataSetView<TValue>& testData, TCombine combine)
 {
-public:
-	LossPredictor() : a(), b(), c() { }
-	LossPredictor(const LossPredictor& src) : a(src.a), b(src.b), c(src.c) { }
-	LossPredictor& operator=(const LossPredictor& src)
+	auto measure = [](std::function<Floating()> evaluate, Floating& errorRate)
 	{
-		a = src.a;
-		b = src.b;
-		c = src.c;
-		return *this;
-	}
-	void PushLoss(const T& loss) { losses.Push(loss); }
-	void PushLoss(T&& loss) { losses.Push(std::move(loss)); }
-	void Setup(unsigned int currentEpoch)
-	{
-		T sources[N];
-		for (size_t i = 0; i < N; i++)
-			sources[i] = currentEpoch - N + i + 1;
-		Setup(sources, losses);
-	}
-	double operator()(unsigned int epoch) const { return a * pow(epoch, b) + c; }
-	std::string GetExpression() const
-	{
-		std::stringstream ss;
-		ss << boost::format("%lf * x ** %lf + %lf") % a % b % c;
-		return std::move(ss.str());
-	}
+		NN_PROFILE_SCOPE(ErrorRateEvaluation, -1);
+		auto start = std::chrono::steady_clock::now();
+		errorRate = evaluate();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	};
+	SparseInferenceNetwork<TValue> network(sda);
+	Floating denseTestScore, sparseTestScore;
+	auto denseSeconds = measure([&] { return sda.template ComputeErrorRates<Floating>(testData); }, denseTestScore);
+	auto sparseSeconds = measure([&] { return network.template ComputeErrorRates<Floating>(testData); }, sparseTestScore);
+	logger.Log(LogRecord(LogEvent::SparseInference).SetSparsity(network.Sparsity()).SetErrorRate(combine(sparseTestScore)).SetSeconds(sparseSeconds));
+	logger.Message("Dense Inference: " + std::to_string(denseSeconds) + " s (Test Score: " + std::to_string(combine(denseTestScore) * 100.0) + "%), Speedup: " + FormatRatio(denseSeconds, sparseSeconds));
+	ReportProfile("Sparse Inference");
+}
 
-private:
-	T a, b, c;
-	ShiftRegister<T, N> losses;
+// 畳み込み層の結合重みはフィルタごとに共有されているため、全結合層を前提とする疎行列の推論は行わない
+template <class TValue, class THiddenLayer, class TCombine> void ReportSparseInference(StackedDenoisingAutoEncoder<TValue, THiddenLayer>&, const DataSetView<TValue>&, TCombine)
+{
+	logger.Message("Sparse Inference: not supported for this hidden layer type");
+}
 
-	template <class Vector1, class Vector2> void Setup(const Vector1& sources, const Vector2& targets)
-	{
-		auto constant = (targets[2] - targets[1]) / (targets[1] - targets[0]);
-		auto f = [&](const T& b) { return (pow(sources[2], b) - pow(sources[1], b)) / (pow(sources[1], b) - pow(sources[0], b)) - constant; };
-		auto df = [&](const T& b)
-		{
-			T denomi = pow(sources[1], b) - pow(sources[0], b);
-			T sum = 0;
-			for (unsigned int i = 0; i < 3; i++)
-			{
-				const T& x_i1 = sources[(i + 1) % 3];
-				sum += pow(sources[i], b) * pow(x_i1, b) * log(x_i1 / sources[i]);
-			}
-			return sum / denomi / denomi;
-		};
-		auto d2f = [&](const T& b)
-		{
-			T denomi = pow(sources[1], b) - pow(sources[0], b);
-			T res = 2 * (pow(sources[1], b) * log(sources[1]) - pow(sources[0], b) * log(sources[0]));
-			T sum = 0;
-			for (unsigned int i = 0; i < 3; i++)
-			{
-				const T& x_i1 = sources[(i + 1) % 3];
-				sum += (res - denomi * log(sources[i] * x_i1)) * pow(sources[i], b) * pow(x_i1, b) * log(x_i1 / sources[i]);
-			}
-			return sum / denomi / denomi / denomi;
-		};
-		T b_hat = -1;
-		while (true)
-		{
-			auto y = f(b_hat);
-			auto dy = df(b_hat);
-			auto delta = 2 * dy * y / (2 * dy * dy - y * d2f(b_hat));
-			b_hat -= delta;
-			if (abs(delta) <= 1e-10)
-				break;
-		}
-		a = (targets[1] - targets[0]) / (pow(sources[1], b_hat) - pow(sources[0], b_hat));
-		b = b_hat;
-		c = targets[0] - a * pow(sources[0], b_hat);
-	}
-};
+// 隠れ層 index の事前学習の結果を決める値のうち、ニューロン数とエポック数以外のものからキャッシュのキーを計算する
+template <class TValue, class THiddenLayer> ContentHash PreTrainingKey(const ContentHash& datasetKey, const StackedDenoisingAutoEncoder<TValue, THiddenLayer>& sda, unsigned int index)
+{
+	auto key = ContentHash(datasetKey).Add(std::string(typeid(THiddenLayer).name())).Add(sizeof(TValue)).Add(index).Add(DaNoises[index]);
+	key.Add(PreTrainingLearningRate).Add(PreTrainingSchedule.Kind).Add(PreTrainingSchedule.Gamma).Add(PreTrainingSchedule.StepSize);
+	key.Add(PreTrainingOptimizer.Kind).Add(PreTrainingOptimizer.Momentum).Add(PreTrainingOptimizer.Decay).Add(PreTrainingOptimizer.Beta1).Add(PreTrainingOptimizer.Beta2).Add(PreTrainingOptimizer.Epsilon);
+	key.Add(ProgressiveCostCheck).Add(CostCheckEvaluation.InitialSamples).Add(CostCheckEvaluation.Growth).Add(CostCheckEvaluation.Alpha).Add(ConvergeConstant).Add(WidthSearchGrowth);
+	key.Add(ShuffleTrainingData).Add(ShuffleBlockSize).Add(TrainingAugmentation.HorizontalFlip).Add(TrainingAugmentation.MaxShift).Add(TrainingAugmentation.NoiseDeviation).Add(TrainingAugmentation.ChunkSize);
+	// 下位の層は入力を決める
+	for (unsigned int i = 0; i < index; i++)
+		key.Add(sda.HiddenLayers[i].Weight).Add(sda.HiddenLayers[i].Bias);
+	return key;
+}
 
 template <class TValue> void TestSdA(const LearningSet<TValue>& datasets)
 {
+	std::unique_ptr<PretrainedLayerCache> layerCache(CachePretrainedLayers && !communicator ? new PretrainedLayerCache(PretrainedLayerCacheDirectory) : nullptr);
+	auto datasetKey = layerCache ? ContentHash().Add(PretrainedLayerCacheSeed).Add(datasets.TrainingData()).Add(datasets.ValidationData()) : ContentHash();
 	for (unsigned int neuronIncrease = 25; neuronIncrease <= 1000; neuronIncrease += 25)
 	{
-		tout.s << "Current Number of Neuron Increase: " << neuronIncrease << std::endl;
+		logger.Log(LogRecord(LogEvent::SweepStarted).SetNeurons(neuronIncrease));
 
 		// seed: 89677
+		// 分散学習ではすべてのプロセスが同じ初期値から始め、学習データの互いに素な部分を学習する
 		std::random_device random;
-		StackedDenoisingAutoEncoder<TValue> sda(random(), datasets.TrainingData().AllComponents());
+		auto seed = layerCache ? PretrainedLayerCacheSeed : communicator ? communicator->Broadcast(random()) : random();
+		StackedDenoisingAutoEncoder<TValue, HiddenLayerType<TValue>> sda(seed, FeatureShape::Of(datasets.TrainingData()));
+		sda.HiddenLayers.SetOptimizer(PreTrainingOptimizer);
+		auto shard = communicator ? datasets.TrainingData().Fold(communicator->Rank(), communicator->WorldSize()) : datasets.TrainingData();
+		// テストデータも互いに素な部分に分けて評価し、誤り率はデータ点の数で重み付けして全体の値に戻す
+		auto testShard = communicator ? datasets.TestData().Fold(communicator->Rank(), communicator->WorldSize()) : datasets.TestData();
+		EpochSampler<TValue> sampler(shard, shard.Count(), ShuffleBlockSize, random());
+		std::mt19937 augmentationRng(seed);
+		std::mt19937 validationRng(seed);
+		// 候補の評価に使用するネットワーク、サンプラーおよび乱数生成器の組。同時に評価される候補はそれぞれの複製を使用する
+		struct CandidateContext
+		{
+			StackedDenoisingAutoEncoder<TValue, HiddenLayerType<TValue>>& Network;
+			EpochSampler<TValue>& Sampler;
+			std::mt19937& AugmentationRng;
+			std::mt19937& ValidationRng;
+		};
+		CandidateContext mainContext { sda, sampler, augmentationRng, validationRng };
+		// 拡張が有効な場合は、背景のスレッドで拡張されたチャンクを 1 エポック分順に渡す
+		auto forEachChunkOf = [&](CandidateContext& context, const std::function<void(const DataSetView<TValue>&)>& body)
+		{
+			auto data = ShuffleTrainingData ? context.Sampler.NextEpoch() : shard;
+			if (TrainingAugmentation.Enabled())
+				ForEachAugmentedChunk(data, TrainingAugmentation, context.AugmentationRng(), body);
+			else
+				body(data);
+		};
+		auto forEachTrainingChunk = [&](const std::function<void(const DataSetView<TValue>&)>& body) { forEachChunkOf(mainContext, body); };
+		// 候補ごとに乱数生成器をキーから初期化し、学習の結果が評価に使用されたネットワークや評価の順序によらずキーのみで決まるようにする
+		auto reseed = [&](CandidateContext& context, const ContentHash& key)
+		{
+			context.Network.HiddenLayers.Reseed(static_cast<std::mt19937::result_type>(ContentHash(key).Add(0).Value()));
+			context.Sampler.Reseed(static_cast<std::mt19937::result_type>(ContentHash(key).Add(1).Value()));
+			context.AugmentationRng.seed(static_cast<std::mt19937::result_type>(ContentHash(key).Add(2).Value()));
+			context.ValidationRng.seed(static_cast<std::mt19937::result_type>(ContentHash(key).Add(3).Value()));
+		};
+
+		// 判定に使用する値はすべてのプロセスで平均し、すべてのプロセスが同じ判定を下すようにする
+		std::unique_ptr<ParameterAverager<TValue>> averager(communicator ? new ParameterAverager<TValue>(*communicator, distributed.Compression, distributed.TopKRatio) : nullptr);
+		auto synchronize = [&](unsigned int epoch)
+		{
+			if (!averager || epoch % distributed.SyncInterval != 0)
+				return;
+			NN_PROFILE_SCOPE(Synchronization, -1);
+			auto parameters = sda.ExportParameters();
+			averager->Synchronize(parameters);
+			sda.ImportParameters(parameters);
+		};
+		auto average = [&](TValue value) { return communicator ? static_cast<TValue>(communicator->Average(value)) : value; };
+		auto combineTestScore = [&](Floating score) { return communicator ? static_cast<Floating>(communicator->Sum(static_cast<double>(score) * testShard.Count()) / datasets.TestData().Count()) : score; };
+		auto combineStatistics = [&](FineTuningStatistics<TValue> statistics)
+		{
+			if (communicator)
+			{
+				statistics.Samples = static_cast<size_t>(communicator->Sum(static_cast<double>(statistics.Samples)) + 0.5);
+				statistics.Misclassifications = static_cast<size_t>(communicator->Sum(static_cast<double>(statistics.Misclassifications)) + 0.5);
+				statistics.Loss = static_cast<TValue>(communicator->Sum(static_cast<double>(statistics.Loss)));
+			}
+			return statistics;
+		};
 
 		for (unsigned int i = 0; i < DaNoises.size(); i++)
 		{
-			auto lastNeuronCost = std::numeric_limits<TValue>::infinity();
-			for (unsigned int neurons = neuronIncrease, prevNeurons = 0; ; )
+			// 平均されたコストのみを与えるので、分散学習でもすべてのプロセスが同じエポックで打ち切る
+			LossPredictor<TValue, PreTrainingPredictorWindow> predictor;
+			// キャッシュのキーには、ニューロン数とエポック数以外で層 i の事前学習の結果を決めるすべての値を含める
+			// キャッシュを使用しない場合も、実行ごとのシード値から候補ごとの乱数を決める
+			auto layerKey = layerCache ? PreTrainingKey(datasetKey, sda, i) : ContentHash().Add(seed).Add(i);
+			auto candidateKey = [&](unsigned int neurons) { return ContentHash(layerKey).Add(std::string("Candidate")).Add(neurons).Add(CostCheckEpoch); };
+			// コストの評価が消費した乱数が学習に影響しないように、エポックごとに雑音の乱数生成器を初期化する
+			auto pretrainEpoch = [&](CandidateContext& context, unsigned int epoch)
 			{
-				sda.HiddenLayers.Set(i, neurons);
-				tout.s << "Number of Neurons of Hidden Layer " << i << ": " << neurons << std::endl;
-				auto currentTestCost = static_cast<TValue>(0);
+				auto& layers = context.Network.HiddenLayers;
+				layers.Reseed(static_cast<std::mt19937::result_type>(ContentHash(candidateKey(layers[i].Weight.Row())).Add(epoch).Value()));
+				{
+					NN_PROFILE_SCOPE(PreTraining, i);
+					forEachChunkOf(context, [&](const DataSetView<TValue>& chunk) { layers[i].Train(chunk, static_cast<TValue>(PreTrainingSchedule(PreTrainingLearningRate, epoch)), DaNoises[i]); });
+				}
+				synchronize(epoch);
+			};
+			auto validationCost = [&](CandidateContext& context)
+			{
+				auto cost = static_cast<TValue>(0);
+				{
+					NN_PROFILE_SCOPE(CostEvaluation, i);
+					cost = context.Network.HiddenLayers[i].ComputeCost(datasets.ValidationData(), DaNoises[i]);
+				}
+				return average(cost);
+			};
+			// 収束の判定は比較する候補のコストを中心とする幅 ConvergeConstant * (ニューロン数の差) の区間にコストが含まれるかどうかと同じ
+			// 比較する候補のコストがまだ得られていない場合は検証データ全体で評価する
+			// いずれかのプロセスで全体を評価する前に打ち切った場合、exact は false になる
+			auto checkCost = [&](CandidateContext& context, const WidthCandidate<TValue>& candidate, bool& exact)
+			{
+				exact = true;
+				if (!ProgressiveCostCheck || std::isnan(candidate.ReferenceCost))
+					return validationCost(context);
+				auto band = static_cast<TValue>(ConvergeConstant * std::abs(static_cast<double>(candidate.Neurons) - candidate.ReferenceNeurons));
+				ProgressiveEstimate<TValue> estimate;
+				{
+					NN_PROFILE_SCOPE(CostEvaluation, i);
+					estimate = EstimateProgressively(datasets.ValidationData(), candidate.ReferenceCost - band, candidate.ReferenceCost + band, CostCheckEvaluation, context.ValidationRng,
+						[&](const DataSetView<TValue>& sample) { return context.Network.HiddenLayers[i].ComputeCost(sample, DaNoises[i]); });
+				}
+				logger.Log(LogRecord(LogEvent::ProgressiveCost).SetLayer(i).SetNeurons(candidate.Neurons).SetCost(estimate.Mean).SetInterval(estimate.HalfWidth).SetSamples(estimate.Samples));
+				exact = average(static_cast<TValue>(estimate.Settled ? 1 : 0)) == 0;
+				return average(estimate.Mean);
+			};
+			// 候補を CostCheckEpoch エポックだけ事前学習し、エポックごとのコストを返す
+			// 学習をキャッシュされたコストによって省略した場合、層は初期化された状態のままになる
+			// 最後のコストが部分集合からの推定であれば exact を false にする。推定値は比較する候補に依存するため、キャッシュには保存しない
+			auto evaluateCandidate = [&](CandidateContext& context, const WidthCandidate<TValue>& candidate, bool& skipped, bool& exact)
+			{
+				exact = true;
+				reseed(context, candidateKey(candidate.Neurons));
+				context.Network.HiddenLayers.Set(i, candidate.Neurons);
+				if (averager)
+					averager->Reset();
+				logger.Log(LogRecord(LogEvent::NeuronCandidate).SetLayer(i).SetNeurons(candidate.Neurons));
+				std::vector<TValue> costs;
+				skipped = layerCache && layerCache->LoadCosts(candidateKey(candidate.Neurons), costs) && costs.size() == CostCheckEpoch;
 				for (unsigned int epoch = 1; epoch <= CostCheckEpoch; epoch++)
 				{
-					sda.HiddenLayers[i].Train(datasets.TrainingData(), static_cast<TValue>(PreTrainingLearningRate), DaNoises[i]);
-					currentTestCost = sda.HiddenLayers[i].ComputeCost(datasets.ValidationData(), DaNoises[i]);
-					tout.s << epoch << " " << currentTestCost << std::endl;
+					if (!skipped)
+					{
+						pretrainEpoch(context, epoch);
+						costs.push_back(epoch == CostCheckEpoch ? checkCost(context, candidate, exact) : validationCost(context));
+					}
+					logger.Log(LogRecord(LogEvent::PreTrainingCost).SetLayer(i).SetNeurons(candidate.Neurons).SetEpoch(epoch).SetCost(costs[epoch - 1]));
 				}
-				auto costDifference = (currentTestCost - lastNeuronCost) / (neurons - prevNeurons);
-				tout.s << "Cost Difference per Neuron: " << costDifference << std::endl;
-				if (abs(costDifference) <= ConvergeConstant)
-					break;
-				auto newNeurons = neurons + neuronIncrease;
-				prevNeurons = neurons;
-				neurons = newNeurons;
-				lastNeuronCost = currentTestCost;
+				if (layerCache && !skipped && exact)
+					layerCache->SaveCosts(candidateKey(candidate.Neurons), costs);
+				return costs;
+			};
+
+			// 同時に評価する候補はそれぞれ下位の層を複製したネットワークで学習し、層 i の状態は sda に残さない
+			// キャッシュの読み書きは同時に行わず、分散学習は集団通信の順序を揃える必要があるため、いずれの場合も 1 つずつ評価する
+			auto concurrency = layerCache || communicator ? 1u : (std::max)(WidthSearchConcurrency, 1u);
+			std::map<unsigned int, std::vector<TValue>> candidateCosts;
+			std::map<unsigned int, bool> candidateExact;
+			unsigned int trainedNeurons = 0;
+			auto evaluateCandidates = [&](const std::vector<WidthCandidate<TValue>>& candidates)
+			{
+				// カーネルの計測は他の候補の学習と重ならないように先に行う
+				if (std::is_same<HiddenLayerType<TValue>, HiddenLayer<TValue>>::value)
+				{
+					for (auto& candidate : candidates)
+						TuneKernels(candidate.Neurons, sda.HiddenLayers.InputNeuronCount(i));
+				}
+				std::vector<std::vector<TValue>> results(candidates.size());
+				std::vector<char> exacts(candidates.size());
+				if (candidates.size() == 1)
+				{
+					bool skipped, exact;
+					results[0] = evaluateCandidate(mainContext, candidates[0], skipped, exact);
+					exacts[0] = exact;
+					trainedNeurons = skipped ? 0 : candidates[0].Neurons;
+				}
+				else
+				{
+					auto threadsPerCandidate = (std::max)(ThreadPool::Global().Threads() / static_cast<unsigned int>(candidates.size()), 1u);
+					std::vector<std::exception_ptr> errors(candidates.size());
+					std::vector<std::thread> threads;
+					for (size_t c = 0; c < candidates.size(); c++)
+					{
+						threads.emplace_back([&, c]
+						{
+							try
+							{
+								ThreadPool pool(ThreadPoolOptions(threadsPerCandidate, ThreadAffinity::None));
+								ThreadPool::Scope scope(pool);
+								StackedDenoisingAutoEncoder<TValue, HiddenLayerType<TValue>> replica(seed, FeatureShape::Of(datasets.TrainingData()));
+								replica.HiddenLayers.SetOptimizer(PreTrainingOptimizer);
+								for (unsigned int k = 0; k < i; k++)
+								{
+									auto& source = sda.HiddenLayers[k];
+									replica.HiddenLayers.Set(k, source.Weight.Row());
+									auto& copy = replica.HiddenLayers[k];
+									std::copy(source.Weight.Data(), source.Weight.Data() + source.Weight.Row() * source.Weight.Column(), copy.Weight.Data());
+									copy.Bias = source.Bias;
+									copy.VisibleBias = source.VisibleBias;
+								}
+								// 乱数生成器は evaluateCandidate が候補のキーから初期化し直す
+								EpochSampler<TValue> replicaSampler(shard, shard.Count(), ShuffleBlockSize, seed);
+								std::mt19937 replicaAugmentationRng(seed);
+								std::mt19937 replicaValidationRng(seed);
+								CandidateContext context { replica, replicaSampler, replicaAugmentationRng, replicaValidationRng };
+								bool skipped, exact;
+								results[c] = evaluateCandidate(context, candidates[c], skipped, exact);
+								exacts[c] = exact;
+							}
+							catch (...)
+							{
+								errors[c] = std::current_exception();
+							}
+						});
+					}
+					for (auto& thread : threads)
+						thread.join();
+					for (auto& error : errors)
+					{
+						if (error)
+							std::rethrow_exception(error);
+					}
+				}
+				std::vector<TValue> finalCosts;
+				std::ostringstream label;
+				for (size_t c = 0; c < candidates.size(); c++)
+				{
+					candidateCosts[candidates[c].Neurons] = results[c];
+					candidateExact[candidates[c].Neurons] = exacts[c] != 0;
+					finalCosts.push_back(results[c].back());
+					label << " " << candidates[c].Neurons;
+				}
+				for (auto& candidate : candidates)
+				{
+					if (candidate.ReferenceNeurons > 0)
+					{
+						auto costDifference = (candidateCosts[candidate.Neurons].back() - candidateCosts[candidate.ReferenceNeurons].back()) / (static_cast<TValue>(candidate.Neurons) - candidate.ReferenceNeurons);
+						logger.Log(LogRecord(LogEvent::CostDifference).SetLayer(i).SetNeurons(candidate.Neurons).SetCost(costDifference));
+					}
+				}
+				ReportProfile("PreTraining HL " + std::to_string(i) + " Neurons" + label.str());
+				return finalCosts;
+			};
+
+			// 予算に収まるニューロン数までを探索する。1 ニューロンあたりの大きさは次の 2 つの段階の大きい方とする
+			// 事前学習: 同時に評価する数の候補の層の結合重みと事前学習のオプティマイザの状態
+			// ファインチューニング: この層と上の層のこの層に接続する結合重み、およびファインチューニングのオプティマイザの状態
+			// 上の層が隠れ層の場合、その幅はまだ決まっていないため最小のニューロン数で見積もる
+			sda.HiddenLayers.Set(i, MinNeurons);
+			auto inputs = sda.HiddenLayers[i].Weight.Column();
+			auto consumers = i + 1 < DaNoises.size() ? static_cast<size_t>(MinNeurons) : static_cast<size_t>(datasets.ClassCount);
+			auto preTrainingBytes = (inputs + 1) * (1 + PreTrainingOptimizer.StateCount()) * concurrency;
+			auto fineTuningBytes = (inputs + 1 + consumers) * (1 + FineTuningOptimizer.StateCount());
+			auto bytesPerNeuron = (std::max)(preTrainingBytes, fineTuningBytes) * sizeof(TValue);
+			auto maxNeurons = static_cast<unsigned int>((std::min)(MemoryAccountant::Global().Available() / bytesPerNeuron, static_cast<size_t>(MaxNeurons)));
+			if (maxNeurons < MaxNeurons)
+				logger.Message("Memory Budget: HL " + std::to_string(i) + " is limited to " + std::to_string(maxNeurons) + " neurons (" + MemoryAccountant::ToMebibytes(bytesPerNeuron) + " per neuron)");
+			WidthSearch<TValue> search(WidthSearchOptions(neuronIncrease, WidthSearchGrowth, neuronIncrease, maxNeurons, concurrency), static_cast<TValue>(ConvergeConstant), evaluateCandidates);
+			auto neurons = search.Run();
+			logger.Message("Width Search: HL " + std::to_string(i) + " -> " + std::to_string(neurons) + " neurons (" + std::to_string(search.Evaluations()) + " candidates)");
+			// 部分集合から推定されたコストは当てはめに使用せず、続きの学習の開始状態で検証データ全体のコストを求め直す
+			auto exact = candidateExact[neurons];
+			for (unsigned int epoch = 1; epoch <= CostCheckEpoch; epoch++)
+			{
+				if (epoch < CostCheckEpoch || exact)
+					predictor.PushLoss(epoch, candidateCosts[neurons][epoch - 1]);
 			}
+
+			auto finalKey = ContentHash(layerKey).Add(std::string("Final")).Add(neurons).Add(CostCheckEpoch).Add(PreTrainingEpochs)
+				.Add(PreTrainingEarlyStopping).Add(PreTrainingConvergenceThreshold).Add(PreTrainingPredictorWindow);
+			// 決定された候補が sda で最後に学習された候補でない場合は、候補のキーから乱数生成器を初期化し直して学習し、続きの学習の開始状態を再現する
+			auto replay = trainedNeurons != neurons;
+			if (replay)
+			{
+				reseed(mainContext, candidateKey(neurons));
+				sda.HiddenLayers.Set(i, neurons);
+			}
+			if (layerCache && layerCache->template LoadLayer<TValue>(finalKey, sda.HiddenLayers[i]))
+			{
+				logger.Message("Layer Cache: HL " + std::to_string(i) + " with " + std::to_string(neurons) + " neurons restored");
+				continue;
+			}
+			if (replay)
+			{
+				for (unsigned int epoch = 1; epoch <= CostCheckEpoch; epoch++)
+					pretrainEpoch(mainContext, epoch);
+			}
+			if (!exact)
+				predictor.PushLoss(CostCheckEpoch, validationCost(mainContext));
+			if (layerCache)
+				reseed(mainContext, finalKey);
 			for (unsigned int epoch = CostCheckEpoch + 1; epoch <= PreTrainingEpochs; epoch++)
 			{
-				sda.HiddenLayers[i].Train(datasets.TrainingData(), static_cast<TValue>(PreTrainingLearningRate), DaNoises[i]);
-				auto currentTestCost = sda.HiddenLayers[i].ComputeCost(datasets.ValidationData(), DaNoises[i]);
-				tout.s << epoch << " " << currentTestCost << std::endl;
+				pretrainEpoch(mainContext, epoch);
+				auto currentTestCost = validationCost(mainContext);
+				// 予測の精度を後から検証できるように、前のエポックまでの当てはめによる予測値を実測値と並べて記録する
+				if (predictor.Fitted())
+					logger.Log(LogRecord(LogEvent::PredictedCost).SetLayer(i).SetNeurons(neurons).SetEpoch(epoch).SetCost(predictor(epoch)));
+				logger.Log(LogRecord(LogEvent::PreTrainingCost).SetLayer(i).SetNeurons(neurons).SetEpoch(epoch).SetCost(currentTestCost));
+				ReportProfile("PreTraining HL " + std::to_string(i) + " Epoch " + std::to_string(epoch));
+				predictor.PushLoss(epoch, currentTestCost);
+				if (epoch < PreTrainingEpochs && predictor.Setup() && PreTrainingEarlyStopping &&
+					predictor.RemainingImprovement(epoch, PreTrainingEpochs) <= PreTrainingConvergenceThreshold * std::abs(currentTestCost))
+				{
+					logger.Log(LogRecord(LogEvent::PreTrainingConverged).SetLayer(i).SetNeurons(neurons).SetEpoch(epoch).SetCost(predictor(PreTrainingEpochs)));
+					break;
+				}
 			}
+			if (layerCache)
+				layerCache->template SaveLayer<TValue>(finalKey, sda.HiddenLayers[i]);
 		}
 
-		if (!DaNoises.empty())
+		for (unsigned int i = 0; i < sda.HiddenLayers.Count(); i++)
+			logger.Log(LogRecord(LogEvent::DecidedNeurons).SetLayer(i).SetNeurons(sda.HiddenLayers[i].Weight.Row()));
+		ReportMemory("PreTraining");
+		if (layerCache)
+			logger.Message("Layer Cache: " + std::to_string(layerCache->Hits()) + " hits, " + std::to_string(layerCache->Misses()) + " misses");
+
+		auto bestScore = std::numeric_limits<Floating>::infinity();
+		sda.SetLogisticRegressionLayer(datasets.ClassCount, FineTuningOptimizer);
+		if (averager)
+			averager->Reset();
+		logger.Log(LogRecord(LogEvent::FineTuningStarted));
+		// 評価は専用のスレッドで複製に対して行い、最も良いスナップショットを保存と枝刈りのために残す
+		// スナップショットは検証データで選択し、テストデータは選択されたスナップショットの報告にのみ使用する (検証データがない場合はテストデータで選択する)
+		// 分散学習の集団通信は訓練と同じスレッドで同じ順序に行う必要があるため、評価のスレッドでは平均しない
+		auto& selectionData = datasets.ValidationData().Count() > 0 ? datasets.ValidationData() : datasets.TestData();
+		auto selectionShard = communicator ? selectionData.Fold(communicator->Rank(), communicator->WorldSize()) : selectionData;
+		auto combineSelectionScore = [&](Floating score) { return communicator ? static_cast<Floating>(communicator->Sum(static_cast<double>(score) * selectionShard.Count()) / selectionData.Count()) : score; };
+		SnapshotEvaluator<TValue, HiddenLayerType<TValue>> evaluator(sda, [&](StackedDenoisingAutoEncoder<TValue, HiddenLayerType<TValue>>& snapshot)
+		{
+			NN_PROFILE_SCOPE(ErrorRateEvaluation, -1);
+			return snapshot.template ComputeErrorRates<Floating>(selectionShard);
+		}, ThreadPoolOptions(EvaluationThreads));
+		std::vector<FineTuningStatistics<TValue>> epochStatistics;
+		// 重要度サンプリングでは、訓練データの統計は抽出されたデータ点に対するものになる
+		std::unique_ptr<ImportanceSampler<TValue>> importanceSampler(ImportanceSampling && !TrainingAugmentation.Enabled() && !PipelineFineTuning ? new ImportanceSampler<TValue>(shard, FineTuningSampling, random()) : nullptr);
+		unsigned int patience = DefaultPatience;
+		auto receive = [&]
+		{
+			auto result = evaluator.Take();
+			auto thisScore = combineSelectionScore(result.Score);
+			logger.Log(LogRecord(LogEvent::FineTuningError).SetEpoch(result.Epoch).SetErrorRate(thisScore).SetPatience(patience));
+			if (thisScore < bestScore)
+			{
+				auto& trainingStatistics = epochStatistics[result.Epoch - 1];
+				logger.Log(LogRecord(LogEvent::TrainingError).SetEpoch(result.Epoch).SetErrorRate(trainingStatistics.template ErrorRate<Floating>()).SetCost(trainingStatistics.AverageLoss()));
+				if (thisScore < bestScore * ImprovementThreshold)
+					patience = std::max(patience, result.Epoch * PatienceIncrease);
+				bestScore = thisScore;
+				evaluator.KeepLast();
+			}
+		};
+		for (unsigned int epoch = 1; epoch <= FineTuningEpochs && epoch <= patience; epoch++)
+		{
+			epochStatistics.push_back([&]
+			{
+				NN_PROFILE_SCOPE(FineTuning, -1);
+				auto learningRate = static_cast<TValue>(FineTuningSchedule(FineTuningLearningRate, epoch));
+				FineTuningStatistics<TValue> statistics;
+				if (importanceSampler)
+				{
+					std::valarray<TValue> losses;
+					auto epochData = importanceSampler->NextEpoch();
+					statistics = sda.FineTune(epochData, learningRate, importanceSampler->Weights(), losses);
+					importanceSampler->Update(losses);
+				}
+				else
+					forEachTrainingChunk([&](const DataSetView<TValue>& chunk) { statistics += PipelineFineTuning ? sda.FineTune(chunk, learningRate, FineTuningPipeline) : sda.FineTune(chunk, learningRate); });
+				return combineStatistics(statistics);
+			}());
+			synchronize(epoch);
+			evaluator.Submit(sda, epoch);
+			// 非同期の場合は、このエポックの訓練と並行して評価された前のエポックの結果を受け取る
+			if (evaluator.Pending() > (AsynchronousEvaluation ? 1u : 0u))
+				receive();
+			ReportProfile("FineTuning Epoch " + std::to_string(epoch));
+		}
+		while (evaluator.Pending() > 0)
+			receive();
+		// 戻したパラメータに最後のエポックのモーメントなどが適用されないように、オプティマイザの状態を破棄する
+		if (evaluator.HasBest())
 		{
-			tout.s << "Decided Number of Neurons: " << std::endl;
-			for (unsigned int i = 0; i < sda.HiddenLayers.Count(); i++)
-				tout.s << "    Number of Neurons of Hidden Layer " << i << ": " << sda.HiddenLayers[i].Weight.Row() << std::endl;
+			evaluator.RestoreBest(sda);
+			sda.ResetOptimizers();
+			logger.Message("Fine-Tuning: restored the snapshot of epoch " + std::to_string(evaluator.BestEpoch()));
 		}
-
-		auto bestTestScore = std::numeric_limits<Floating>::infinity();
-		sda.SetLogisticRegressionLayer(datasets.ClassCount);
-		tout.s << "Fine-Tuning..." << std::endl;
-		for (unsigned int epoch = 1, patience = DefaultPatience; epoch <= FineTuningEpochs && epoch <= patience; epoch++)
+		auto bestTestScore = [&] { NN_PROFILE_SCOPE(ErrorRateEvaluation, -1); return sda.template ComputeErrorRates<Floating>(testShard); }();
+		logger.Log(LogRecord(LogEvent::BestError).SetErrorRate(combineTestScore(bestTestScore)));
+		ReportMemory("FineTuning");
+		if (SaveModel && (!communicator || communicator->Rank() == 0))
 		{
-			sda.FineTune(datasets.TrainingData(), static_cast<TValue>(FineTuningLearningRate));
-			auto thisTestScore = sda.ComputeErrorRates<Floating>(datasets.TestData());
-			tout.s << epoch << " " << thisTestScore * 100.0 << "% Patience: " << patience << std::endl;
+			std::ofstream stream(outputBaseName + " " + std::to_string(neuronIncrease) + ".model", std::ios::binary);
+			sda.Save(stream);
+		}
 
-			if (thisTestScore < bestTestScore)
+		// 枝刈りは段階的に行い、各段階で短いファインチューニングによって精度を回復させる
+		// 枝刈りされた結合重みはマスクによって 0 のまま保たれる。学習率の変化はファインチューニングのエポック数から数え続ける
+		auto pruningEpoch = static_cast<unsigned int>(epochStatistics.size());
+		for (size_t round = 0; round < PruningSparsities.size(); round++)
+		{
+			auto sparsity = sda.Prune(PruningSparsities[round]);
+			for (unsigned int epoch = 1; epoch <= PruningFineTuningEpochs; epoch++)
 			{
-				tout.s << epoch << " Training Score: " << sda.ComputeErrorRates<Floating>(datasets.TrainingData()) * 100.0 << "%" << std::endl;
-				if (thisTestScore < bestTestScore * ImprovementThreshold)
-					patience = std::max(patience, epoch * PatienceIncrease);
-				bestTestScore = thisTestScore;
+				pruningEpoch++;
+				{
+					NN_PROFILE_SCOPE(FineTuning, -1);
+					forEachTrainingChunk([&](const DataSetView<TValue>& chunk) { sda.FineTune(chunk, static_cast<TValue>(FineTuningSchedule(FineTuningLearningRate, pruningEpoch))); });
+				}
+				synchronize(pruningEpoch);
+				// プロセスごとにマスクが異なる場合があるため、平均によって 0 から戻った結合重みを枝刈りし直す
+				if (averager)
+					sparsity = sda.Prune(PruningSparsities[round]);
 			}
+			auto prunedTestScore = [&] { NN_PROFILE_SCOPE(ErrorRateEvaluation, -1); return sda.template ComputeErrorRates<Floating>(testShard); }();
+			logger.Log(LogRecord(LogEvent::PruningRound).SetEpoch(round + 1).SetSparsity(sparsity).SetErrorRate(combineTestScore(prunedTestScore)));
+			ReportProfile("Pruning Round " + std::to_string(round + 1));
+		}
+		if (!PruningSparsities.empty())
+		{
+			ReportSparseInference(sda, testShard, combineTestScore);
+			ReportMemory("Pruning");
 		}
-		tout.s << "Best Test Score of Fine-Tuning: " << bestTestScore * 100.0 << "%" << std::endl;
 	}
 }
\ No newline at end of file
@@ -1,13 +1,19 @@
 #pragma once
 
+#include "ThreadPool.h"
+
 template <class T> class Matrix final
 {
 public:
-	Matrix(size_t row, size_t column) : row_(row), column_(column)
+	Matrix(size_t row, size_t column) : data_(Allocate(row, column)), row_(row), column_(column) { std::fill(data_.get(), data_.get() + row * column, static_cast<T>(0)); }
+
+	/// <summary>
+	/// 各行を、その行を指定された最小区間長の <see cref="ParallelFor"/> で処理するワーカーで 0 に初期化して、新しい行列を作成します。
+	/// ページは最初に書き込んだスレッドのノードに置かれるため、行を処理するカーネルと同じ区間長を指定すると、各ワーカーが処理する行はそのワーカーのノードのメモリに置かれます。
+	/// </summary>
+	Matrix(size_t row, size_t column, size_t grain) : data_(Allocate(row, column)), row_(row), column_(column)
 	{
-		if (row <= 0 || column <= 0)
-			throw std::invalid_argument("rows and columns must not be 0");
-		data_ = std::valarray<T>(static_cast<T>(0), row * column);
+		ParallelFor(row, grain, [&](size_t begin, size_t end) { std::fill(data_.get() + begin * column, data_.get() + end * column, static_cast<T>(0)); });
 	}
 
 	Matrix(const Matrix& source) : row_(0), column_(0) { *this = source; }
@@ -18,9 +24,10 @@ public:
 	{
 		if (this != &source)
 		{
+			data_.reset(source.data_ ? new T[source.row_ * source.column_] : nullptr);
 			row_ = source.row_;
-			column = source.column_;
-			data_ = source.data_;
+			column_ = source.column_;
+			std::copy(source.data_.get(), source.data_.get() + row_ * column_, data_.get());
 		}
 		return *this;
 	}
@@ -57,10 +64,22 @@ public:
 
 	const T& operator()(size_t rowIndex, size_t columnIndex) const { return Element(rowIndex, columnIndex); }
 
+	T* Data() { return data_.get(); }
+
+	const T* Data() const { return data_.get(); }
+
 private:
-	std::valarray<T> data_;
+	std::unique_ptr<T[]> data_;
 	size_t row_;
 	size_t column_;
+
+	// 要素を初期化せずに確保し、ページへの最初の書き込みを呼び出し元に任せる
+	static T* Allocate(size_t row, size_t column)
+	{
+		if (row <= 0 || column <= 0)
+			throw std::invalid_argument("rows and columns must not be 0");
+		return new T[row * column];
+	}
 };
 
 template <class T> class TransposedMatrixView final
@@ -94,4 +113,30 @@ private:
 	TransposedMatrixView(Matrix<T>& base) : base(&base) { }
 
 	Matrix<T>* base;
-};
\ No newline at end of file
+};
+
+/// <summary>指定された範囲の行について、列優先で並べられた複数のベクトルとの積を出力に加算します。</summary>
+/// <param name="input">第 k 成分が input[k * batch + j] に格納された <paramref name="batch"/> 個のベクトルを指定します。</param>
+/// <param name="output">第 i 成分が output[i * batch + j] に格納される出力を指定します。</param>
+/// <param name="columnBlock">一度に処理する列の数を指定します。0 の場合は列を分割しません。</param>
+template <class T> void MultiplyAdd(const Matrix<T>& matrix, const T* input, size_t batch, T* output, size_t firstRow, size_t lastRow, size_t columnBlock = 0)
+{
+	// 結合重みの各要素をバッチ全体で再利用し、最内ループは連続したメモリを走査する
+	// 列を分割すると、ブロック内の入力をすべての行で再利用する間キャッシュに保持できる (加算の順序は変わらない)
+	auto block = columnBlock > 0 ? columnBlock : matrix.Column();
+	for (size_t first = 0; first < matrix.Column(); first += block)
+	{
+		auto last = (std::min)(first + block, matrix.Column());
+		for (auto i = firstRow; i < lastRow; i++)
+		{
+			auto out = output + i * batch;
+			for (auto k = first; k < last; k++)
+			{
+				auto value = matrix(i, k);
+				auto in = input + k * batch;
+				for (size_t j = 0; j < batch; j++)
+					out[j] += value * in[j];
+			}
+		}
+	}
+}
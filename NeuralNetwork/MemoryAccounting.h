@@ -0,0 +1,187 @@
+﻿#pragma once
+
+#include "Platform.h"
+
+/// <summary>メモリ使用量を集計する用途の分類を表します。</summary>
+enum class MemoryCategory
+{
+	/// <summary>読み込まれたデータセットの画像とラベルを示します。</summary>
+	DataSets,
+	/// <summary>各層の結合重みとバイアスを示します。</summary>
+	Weights,
+	/// <summary>オプティマイザの状態など、学習中にのみ必要な作業領域を示します。</summary>
+	Workspaces,
+	/// <summary>再計算を避けるために保持される中間結果を示します。</summary>
+	Caches,
+};
+
+/// <summary>
+/// 用途ごとに確保されているバイト数と、その最大値を集計します。
+/// 最大値は全体を通したものと、<see cref="BeginPhase"/> で始まるフェーズごとのものを保持します。
+/// メモリ予算が設定されている場合、データセットの読み込みは選択を切り詰め、教師の出力と事前学習の層のキャッシュは保持や作業領域を省き、ニューロン数の探索は上限を下げて、予算に収まるように動作を変更します。
+/// </summary>
+class MemoryAccountant final : private boost::noncopyable
+{
+public:
+	/// <summary>分類の数を示します。</summary>
+	static const size_t CategoryCount = static_cast<size_t>(MemoryCategory::Caches) + 1;
+
+	/// <summary>プロセス全体で共有される集計を取得します。</summary>
+	static MemoryAccountant& Global()
+	{
+		static MemoryAccountant accountant;
+		return accountant;
+	}
+
+	/// <summary>指定された分類の名前を返します。</summary>
+	static const char* CategoryName(MemoryCategory category)
+	{
+		static const char* names[] { "DataSets", "Weights", "Workspaces", "Caches" };
+		return names[static_cast<size_t>(category)];
+	}
+
+	/// <summary>指定された分類で確保されたバイト数を加算します。</summary>
+	void Add(MemoryCategory category, size_t bytes)
+	{
+		auto index = static_cast<size_t>(category);
+		auto current = current_[index].fetch_add(bytes) + bytes;
+		auto total = total_.fetch_add(bytes) + bytes;
+		UpdateMaximum(phasePeaks_[index], current);
+		UpdateMaximum(phaseTotalPeak_, total);
+		UpdateMaximum(peak_, total);
+	}
+
+	/// <summary>指定された分類で解放されたバイト数を減算します。</summary>
+	void Subtract(MemoryCategory category, size_t bytes)
+	{
+		current_[static_cast<size_t>(category)].fetch_sub(bytes);
+		total_.fetch_sub(bytes);
+	}
+
+	/// <summary>指定された分類で現在確保されているバイト数を返します。</summary>
+	size_t Current(MemoryCategory category) const { return current_[static_cast<size_t>(category)].load(); }
+
+	/// <summary>すべての分類で現在確保されているバイト数の合計を返します。</summary>
+	size_t Current() const { return total_.load(); }
+
+	/// <summary>現在のフェーズにおける指定された分類のバイト数の最大値を返します。</summary>
+	size_t PhasePeak(MemoryCategory category) const { return phasePeaks_[static_cast<size_t>(category)].load(); }
+
+	/// <summary>現在のフェーズにおける合計のバイト数の最大値を返します。</summary>
+	size_t PhasePeak() const { return phaseTotalPeak_.load(); }
+
+	/// <summary>プロセスの開始からの合計のバイト数の最大値を返します。</summary>
+	size_t Peak() const { return peak_.load(); }
+
+	/// <summary>新しいフェーズを開始し、フェーズごとの最大値を現在の値に戻します。</summary>
+	void BeginPhase()
+	{
+		for (size_t i = 0; i < CategoryCount; i++)
+			phasePeaks_[i] = current_[i].load();
+		phaseTotalPeak_ = total_.load();
+	}
+
+	/// <summary>メモリ予算をバイト単位で設定します。0 は予算を設けないことを示します。</summary>
+	void SetBudget(size_t bytes) { budget_ = bytes; }
+
+	/// <summary>メモリ予算をバイト単位で返します。予算が設けられていない場合は 0 を返します。</summary>
+	size_t Budget() const { return budget_.load(); }
+
+	/// <summary>予算の範囲内でさらに確保できるバイト数を返します。予算が設けられていない場合は最大値を返します。</summary>
+	size_t Available() const
+	{
+		auto budget = Budget();
+		auto current = Current();
+		return budget == 0 ? (std::numeric_limits<size_t>::max)() : budget > current ? budget - current : 0;
+	}
+
+	/// <summary>現在確保されているバイト数が予算を超えているかどうかを返します。</summary>
+	bool OverBudget() const { return Budget() > 0 && Current() > Budget(); }
+
+	/// <summary>指定されたバイト数を追加で確保しても予算に収まるかどうかを返します。</summary>
+	bool Fits(size_t bytes) const { return bytes <= Available(); }
+
+	/// <summary>現在のフェーズにおける分類ごとの最大値と、プロセスの常駐セットサイズを表す文字列を返します。</summary>
+	std::string Report() const
+	{
+		std::ostringstream out;
+		for (size_t i = 0; i < CategoryCount; i++)
+			out << CategoryName(static_cast<MemoryCategory>(i)) << ": " << ToMebibytes(PhasePeak(static_cast<MemoryCategory>(i))) << ", ";
+		out << "Total: " << ToMebibytes(PhasePeak());
+		if (Budget() > 0)
+			out << " / " << ToMebibytes(Budget());
+		out << ", RSS: " << ToMebibytes(Platform::ResidentSetSize()) << " (Peak: " << ToMebibytes(Platform::PeakResidentSetSize()) << ")";
+		return out.str();
+	}
+
+	/// <summary>バイト数を MiB 単位の文字列に変換します。</summary>
+	static std::string ToMebibytes(size_t bytes) { return (boost::format("%.1f MiB") % (bytes / 1048576.0)).str(); }
+
+private:
+	MemoryAccountant() : total_(0), phaseTotalPeak_(0), peak_(0), budget_(0)
+	{
+		for (size_t i = 0; i < CategoryCount; i++)
+		{
+			current_[i] = 0;
+			phasePeaks_[i] = 0;
+		}
+	}
+
+	std::atomic<size_t> current_[CategoryCount];
+	std::atomic<size_t> phasePeaks_[CategoryCount];
+	std::atomic<size_t> total_;
+	std::atomic<size_t> phaseTotalPeak_;
+	std::atomic<size_t> peak_;
+	std::atomic<size_t> budget_;
+
+	static void UpdateMaximum(std::atomic<size_t>& maximum, size_t value)
+	{
+		auto observed = maximum.load();
+		while (observed < value && !maximum.compare_exchange_weak(observed, value)) { }
+	}
+};
+
+/// <summary>確保されたバイト数を <see cref="MemoryAccountant::Global"/> に登録し、破棄されるときに登録を解除します。</summary>
+class MemoryReservation final
+{
+public:
+	/// <summary>何も登録しない <see cref="MemoryReservation"/> クラスの新しいインスタンスを初期化します。</summary>
+	MemoryReservation() : category(MemoryCategory::Workspaces), bytes(0) { }
+
+	/// <summary>指定された分類とバイト数を登録して、<see cref="MemoryReservation"/> クラスの新しいインスタンスを初期化します。</summary>
+	MemoryReservation(MemoryCategory category, size_t bytes) : category(category), bytes(bytes) { MemoryAccountant::Global().Add(category, bytes); }
+
+	MemoryReservation(MemoryReservation&& right) : category(right.category), bytes(right.bytes) { right.bytes = 0; }
+
+	MemoryReservation& operator=(MemoryReservation&& right)
+	{
+		if (this != &right)
+		{
+			Release();
+			category = right.category;
+			bytes = right.bytes;
+			right.bytes = 0;
+		}
+		return *this;
+	}
+
+	MemoryReservation(const MemoryReservation&) = delete;
+	MemoryReservation& operator=(const MemoryReservation&) = delete;
+
+	~MemoryReservation() { Release(); }
+
+	/// <summary>登録されているバイト数を返します。</summary>
+	size_t Bytes() const { return bytes; }
+
+	/// <summary>登録を解除します。</summary>
+	void Release()
+	{
+		if (bytes > 0)
+			MemoryAccountant::Global().Subtract(category, bytes);
+		bytes = 0;
+	}
+
+private:
+	MemoryCategory category;
+	size_t bytes;
+};
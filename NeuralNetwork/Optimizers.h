@@ -0,0 +1,322 @@
+﻿#pragma once
+
+#include "MemoryAccounting.h"
+
+/// <summary>パラメータの更新方法の種類を表します。</summary>
+enum class OptimizerKind
+{
+	StochasticGradientDescent,
+	Momentum,
+	Nesterov,
+	AdaGrad,
+	RMSProp,
+	Adam,
+};
+
+/// <summary>パラメータの更新方法とそのハイパーパラメータを表します。</summary>
+struct OptimizerParameters final
+{
+	/// <summary>指定された更新方法と既定のハイパーパラメータで <see cref="OptimizerParameters"/> クラスの新しいインスタンスを初期化します。</summary>
+	OptimizerParameters(OptimizerKind kind = OptimizerKind::StochasticGradientDescent) : Kind(kind), Momentum(0.9), Decay(0.9), Beta1(0.9), Beta2(0.999), Epsilon(1e-8) { }
+
+	/// <summary>更新方法を示します。</summary>
+	OptimizerKind Kind;
+	/// <summary>Momentum および Nesterov の慣性係数を示します。</summary>
+	double Momentum;
+	/// <summary>RMSProp の二乗勾配の減衰率を示します。</summary>
+	double Decay;
+	/// <summary>Adam の 1 次モーメントの減衰率を示します。</summary>
+	double Beta1;
+	/// <summary>Adam の 2 次モーメントの減衰率を示します。</summary>
+	double Beta2;
+	/// <summary>AdaGrad、RMSProp および Adam で 0 除算を避けるための値を示します。</summary>
+	double Epsilon;
+
+	/// <summary>パラメータの要素ごとにオプティマイザが保持する状態の数を返します。</summary>
+	size_t StateCount() const
+	{
+		switch (Kind)
+		{
+		case OptimizerKind::Momentum:
+		case OptimizerKind::Nesterov:
+		case OptimizerKind::AdaGrad:
+		case OptimizerKind::RMSProp:
+			return 1;
+		case OptimizerKind::Adam:
+			return 2;
+		default:
+			return 0;
+		}
+	}
+
+	/// <summary>更新方法の名前を返します。</summary>
+	const char* Name() const
+	{
+		static const char* names[] { "SGD", "Momentum", "Nesterov", "AdaGrad", "RMSProp", "Adam" };
+		return names[static_cast<size_t>(Kind)];
+	}
+};
+
+/// <summary>1 つのパラメータ (重み行列やバイアスベクトル) の更新と、それに必要な要素ごとの状態を管理する基本クラスを表します。</summary>
+/// <remarks>異なる範囲に対する <see cref="Update"/> は複数のスレッドから同時に呼び出すことができます。</remarks>
+template <class TValue> class ParameterOptimizer
+{
+public:
+	virtual ~ParameterOptimizer() { }
+
+	/// <summary>パラメータの指定された範囲を勾配に従って更新します。</summary>
+	/// <param name="parameters">パラメータ全体の先頭を指定します。</param>
+	/// <param name="gradients">更新する範囲の勾配の先頭を指定します。</param>
+	/// <param name="offset">更新する範囲のパラメータ内での開始位置を指定します。</param>
+	/// <param name="count">更新する要素数を指定します。</param>
+	/// <param name="learningRate">学習率を指定します。</param>
+	virtual void Update(TValue* parameters, const TValue* gradients, size_t offset, size_t count, TValue learningRate) = 0;
+
+	/// <summary>1 回の更新ステップ (1 データ点の処理) の終了を通知します。</summary>
+	virtual void Step() { }
+
+	/// <summary>枝刈りされた要素の状態を破棄します。</summary>
+	/// <param name="mask">パラメータ全体に対して、残っている要素を 1、枝刈りされた要素を 0 で示すマスクを指定します。</param>
+	virtual void Discard(const std::valarray<TValue>& /*mask*/) { }
+};
+
+/// <summary>枝刈りのマスクが 0 である要素の勾配を 0 にします。マスクが空の場合は何もしません。</summary>
+/// <param name="mask">パラメータ全体に対して、残っている要素を 1、枝刈りされた要素を 0 で示すマスクを指定します。</param>
+/// <param name="gradients">更新する範囲の勾配の先頭を指定します。</param>
+/// <param name="offset">更新する範囲のパラメータ内での開始位置を指定します。</param>
+/// <param name="count">更新する要素数を指定します。</param>
+template <class TValue> void MaskGradients(const std::valarray<TValue>& mask, TValue* gradients, size_t offset, size_t count)
+{
+	if (mask.size() == 0)
+		return;
+	for (size_t k = 0; k < count; k++)
+		gradients[k] *= mask[offset + k];
+}
+
+/// <summary>確率的勾配降下法によってパラメータを更新します。</summary>
+template <class TValue> class StochasticGradientDescentOptimizer final : public ParameterOptimizer<TValue>
+{
+public:
+	virtual void Update(TValue* parameters, const TValue* gradients, size_t offset, size_t count, TValue learningRate)
+	{
+		auto p = parameters + offset;
+		for (size_t k = 0; k < count; k++)
+			p[k] -= learningRate * gradients[k];
+	}
+};
+
+/// <summary>慣性項付きの勾配降下法 (Momentum または Nesterov の加速勾配法) によってパラメータを更新します。</summary>
+template <class TValue> class MomentumOptimizer final : public ParameterOptimizer<TValue>
+{
+public:
+	MomentumOptimizer(size_t size, TValue momentum, bool nesterov) : velocity(static_cast<TValue>(0), size), momentum(momentum), nesterov(nesterov) { }
+
+	virtual void Update(TValue* parameters, const TValue* gradients, size_t offset, size_t count, TValue learningRate)
+	{
+		auto p = parameters + offset;
+		auto v = &velocity[offset];
+		for (size_t k = 0; k < count; k++)
+		{
+			v[k] = momentum * v[k] - learningRate * gradients[k];
+			p[k] += nesterov ? momentum * v[k] - learningRate * gradients[k] : v[k];
+		}
+	}
+
+	virtual void Discard(const std::valarray<TValue>& mask) { velocity *= mask; }
+
+private:
+	std::valarray<TValue> velocity;
+	const TValue momentum;
+	const bool nesterov;
+};
+
+/// <summary>AdaGrad によってパラメータを更新します。</summary>
+template <class TValue> class AdaGradOptimizer final : public ParameterOptimizer<TValue>
+{
+public:
+	AdaGradOptimizer(size_t size, TValue epsilon) : accumulation(static_cast<TValue>(0), size), epsilon(epsilon) { }
+
+	virtual void Update(TValue* parameters, const TValue* gradients, size_t offset, size_t count, TValue learningRate)
+	{
+		auto p = parameters + offset;
+		auto a = &accumulation[offset];
+		for (size_t k = 0; k < count; k++)
+		{
+			a[k] += gradients[k] * gradients[k];
+			p[k] -= learningRate * gradients[k] / (sqrt(a[k]) + epsilon);
+		}
+	}
+
+	virtual void Discard(const std::valarray<TValue>& mask) { accumulation *= mask; }
+
+private:
+	std::valarray<TValue> accumulation;
+	const TValue epsilon;
+};
+
+/// <summary>RMSProp によってパラメータを更新します。</summary>
+template <class TValue> class RMSPropOptimizer final : public ParameterOptimizer<TValue>
+{
+public:
+	RMSPropOptimizer(size_t size, TValue decay, TValue epsilon) : meanSquare(static_cast<TValue>(0), size), decay(decay), epsilon(epsilon) { }
+
+	virtual void Update(TValue* parameters, const TValue* gradients, size_t offset, size_t count, TValue learningRate)
+	{
+		auto p = parameters + offset;
+		auto m = &meanSquare[offset];
+		for (size_t k = 0; k < count; k++)
+		{
+			m[k] = decay * m[k] + (1 - decay) * gradients[k] * gradients[k];
+			p[k] -= learningRate * gradients[k] / (sqrt(m[k]) + epsilon);
+		}
+	}
+
+	virtual void Discard(const std::valarray<TValue>& mask) { meanSquare *= mask; }
+
+private:
+	std::valarray<TValue> meanSquare;
+	const TValue decay;
+	const TValue epsilon;
+};
+
+/// <summary>Adam によってパラメータを更新します。</summary>
+template <class TValue> class AdamOptimizer final : public ParameterOptimizer<TValue>
+{
+public:
+	AdamOptimizer(size_t size, TValue beta1, TValue beta2, TValue epsilon) : first(static_cast<TValue>(0), size), second(static_cast<TValue>(0), size), beta1(beta1), beta2(beta2), epsilon(epsilon), beta1Power(beta1), beta2Power(beta2) { }
+
+	virtual void Update(TValue* parameters, const TValue* gradients, size_t offset, size_t count, TValue learningRate)
+	{
+		auto p = parameters + offset;
+		auto m = &first[offset];
+		auto v = &second[offset];
+		auto stepSize = learningRate * sqrt(1 - beta2Power) / (1 - beta1Power);
+		for (size_t k = 0; k < count; k++)
+		{
+			m[k] = beta1 * m[k] + (1 - beta1) * gradients[k];
+			v[k] = beta2 * v[k] + (1 - beta2) * gradients[k] * gradients[k];
+			p[k] -= stepSize * m[k] / (sqrt(v[k]) + epsilon);
+		}
+	}
+
+	virtual void Step()
+	{
+		beta1Power *= beta1;
+		beta2Power *= beta2;
+	}
+
+	virtual void Discard(const std::valarray<TValue>& mask)
+	{
+		first *= mask;
+		second *= mask;
+	}
+
+private:
+	std::valarray<TValue> first;
+	std::valarray<TValue> second;
+	const TValue beta1;
+	const TValue beta2;
+	const TValue epsilon;
+	TValue beta1Power;
+	TValue beta2Power;
+};
+
+/// <summary>指定された更新方法でパラメータを更新するオプティマイザを作成します。</summary>
+/// <param name="parameters">更新方法とハイパーパラメータを指定します。</param>
+/// <param name="size">更新するパラメータの要素数を指定します。</param>
+/// <returns>作成されたオプティマイザ。</returns>
+template <class TValue> std::unique_ptr<ParameterOptimizer<TValue>> CreateOptimizer(const OptimizerParameters& parameters, size_t size)
+{
+	switch (parameters.Kind)
+	{
+	case OptimizerKind::Momentum:
+	case OptimizerKind::Nesterov:
+		return std::unique_ptr<ParameterOptimizer<TValue>>(new MomentumOptimizer<TValue>(size, static_cast<TValue>(parameters.Momentum), parameters.Kind == OptimizerKind::Nesterov));
+	case OptimizerKind::AdaGrad:
+		return std::unique_ptr<ParameterOptimizer<TValue>>(new AdaGradOptimizer<TValue>(size, static_cast<TValue>(parameters.Epsilon)));
+	case OptimizerKind::RMSProp:
+		return std::unique_ptr<ParameterOptimizer<TValue>>(new RMSPropOptimizer<TValue>(size, static_cast<TValue>(parameters.Decay), static_cast<TValue>(parameters.Epsilon)));
+	case OptimizerKind::Adam:
+		return std::unique_ptr<ParameterOptimizer<TValue>>(new AdamOptimizer<TValue>(size, static_cast<TValue>(parameters.Beta1), static_cast<TValue>(parameters.Beta2), static_cast<TValue>(parameters.Epsilon)));
+	default:
+		return std::unique_ptr<ParameterOptimizer<TValue>>(new StochasticGradientDescentOptimizer<TValue>());
+	}
+}
+
+/// <summary>層の各パラメータに対するオプティマイザをまとめて保持します。</summary>
+template <class TValue> class LayerOptimizer final : private boost::noncopyable
+{
+public:
+	/// <summary>指定された要素数のパラメータに対するオプティマイザを作成して、<see cref="LayerOptimizer"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="parameters">更新方法とハイパーパラメータを指定します。</param>
+	/// <param name="weightSize">結合重みの要素数を指定します。</param>
+	/// <param name="biasSize">バイアスの要素数を指定します。</param>
+	/// <param name="visibleBiasSize">雑音除去自己符号化器の出力層のバイアスの要素数を指定します。存在しない場合は 0 を指定します。</param>
+	LayerOptimizer(const OptimizerParameters& parameters, size_t weightSize, size_t biasSize, size_t visibleBiasSize) :
+		Weight(CreateOptimizer<TValue>(parameters, weightSize)),
+		Bias(CreateOptimizer<TValue>(parameters, biasSize)),
+		VisibleBias(visibleBiasSize > 0 ? CreateOptimizer<TValue>(parameters, visibleBiasSize) : nullptr),
+		memory(MemoryCategory::Workspaces, parameters.StateCount() * (weightSize + biasSize + visibleBiasSize) * sizeof(TValue)) { }
+
+	/// <summary>結合重みのオプティマイザを示します。</summary>
+	const std::unique_ptr<ParameterOptimizer<TValue>> Weight;
+	/// <summary>バイアスのオプティマイザを示します。</summary>
+	const std::unique_ptr<ParameterOptimizer<TValue>> Bias;
+	/// <summary>雑音除去自己符号化器の出力層のバイアスのオプティマイザを示します。</summary>
+	const std::unique_ptr<ParameterOptimizer<TValue>> VisibleBias;
+
+	/// <summary>1 回の更新ステップの終了をすべてのオプティマイザに通知します。</summary>
+	void Step()
+	{
+		Weight->Step();
+		Bias->Step();
+		if (VisibleBias)
+			VisibleBias->Step();
+	}
+
+private:
+	MemoryReservation memory;
+};
+
+/// <summary>エポックに応じた学習率の変化の種類を表します。</summary>
+enum class LearningRateScheduleKind
+{
+	Constant,
+	StepDecay,
+	ExponentialDecay,
+	InverseTimeDecay,
+};
+
+/// <summary>エポックに応じて学習率を変化させる規則を表します。</summary>
+struct LearningRateSchedule final
+{
+	/// <summary>指定された規則で <see cref="LearningRateSchedule"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="kind">学習率の変化の種類を指定します。</param>
+	/// <param name="gamma">減衰の強さを指定します。StepDecay と ExponentialDecay では乗数、InverseTimeDecay では減衰率になります。</param>
+	/// <param name="stepSize">StepDecay で学習率を減衰させる間隔のエポック数を指定します。</param>
+	LearningRateSchedule(LearningRateScheduleKind kind = LearningRateScheduleKind::Constant, double gamma = 1, unsigned int stepSize = 1) : Kind(kind), Gamma(gamma), StepSize(stepSize) { }
+
+	LearningRateScheduleKind Kind;
+	double Gamma;
+	unsigned int StepSize;
+
+	/// <summary>指定されたエポックの学習率を計算します。</summary>
+	/// <param name="baseRate">最初のエポックの学習率を指定します。</param>
+	/// <param name="epoch">1 から始まるエポック番号を指定します。</param>
+	/// <returns>指定されたエポックの学習率。</returns>
+	double operator()(double baseRate, unsigned int epoch) const
+	{
+		auto elapsed = epoch > 0 ? epoch - 1 : 0;
+		switch (Kind)
+		{
+		case LearningRateScheduleKind::StepDecay:
+			return baseRate * pow(Gamma, elapsed / (std::max)(StepSize, 1u));
+		case LearningRateScheduleKind::ExponentialDecay:
+			return baseRate * pow(Gamma, elapsed);
+		case LearningRateScheduleKind::InverseTimeDecay:
+			return baseRate / (1 + Gamma * elapsed);
+		default:
+			return baseRate;
+		}
+	}
+};
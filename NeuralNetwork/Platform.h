@@ -0,0 +1,126 @@
+﻿#pragma once
+
+/// <summary>プラットフォームに依存する処理を提供します。</summary>
+namespace Platform
+{
+#ifndef _WIN32
+	// /proc/self/status の指定された項目 (kB 単位) をバイト数で返す
+	inline size_t ReadProcessStatus(const std::string& key)
+	{
+		std::ifstream file("/proc/self/status");
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (line.compare(0, key.size(), key) == 0)
+				return static_cast<size_t>(std::stoull(line.substr(key.size()))) * 1024;
+		}
+		return 0;
+	}
+#endif
+
+	/// <summary>指定されたパスにディレクトリを作成します。ディレクトリがすでに存在する場合は何もしません。</summary>
+	/// <param name="path">作成するディレクトリのパスを指定します。</param>
+	inline void MakeDirectory(const std::string& path)
+	{
+#ifdef _WIN32
+		_mkdir(path.c_str());
+#else
+		mkdir(path.c_str(), 0777);
+#endif
+	}
+
+	/// <summary>指定された時刻を地方時に変換します。</summary>
+	/// <param name="time">変換する時刻を指定します。</param>
+	/// <returns>地方時で表された時刻。</returns>
+	inline std::tm LocalTime(std::time_t time)
+	{
+		std::tm tm;
+#ifdef _WIN32
+		localtime_s(&tm, &time);
+#else
+		localtime_r(&time, &tm);
+#endif
+		return tm;
+	}
+
+	/// <summary>このシステムで使用可能な論理プロセッサの数を返します。</summary>
+	inline unsigned int ProcessorCount()
+	{
+		auto count = std::thread::hardware_concurrency();
+		return count > 0 ? count : 1;
+	}
+
+	/// <summary>このプロセスの現在の常駐セットサイズ (物理メモリ上にあるバイト数) を返します。取得できない場合は 0 を返します。</summary>
+	inline size_t ResidentSetSize()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+#else
+		return ReadProcessStatus("VmRSS:");
+#endif
+	}
+
+	/// <summary>このプロセスの常駐セットサイズの最大値を返します。取得できない場合は 0 を返します。</summary>
+	inline size_t PeakResidentSetSize()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+		return ReadProcessStatus("VmHWM:");
+#endif
+	}
+
+	/// <summary>このシステムのプロセッサの製品名を返します。取得できない場合は "unknown" を返します。</summary>
+	inline std::string ProcessorName()
+	{
+#ifdef _WIN32
+		char name[256] = { };
+		DWORD size = sizeof(name);
+		if (RegGetValueA(HKEY_LOCAL_MACHINE, "HARDWARE\\DESCRIPTION\\System\\CentralProcessor\\0", "ProcessorNameString", RRF_RT_REG_SZ, nullptr, name, &size) == ERROR_SUCCESS)
+			return name;
+#else
+		std::ifstream file("/proc/cpuinfo");
+		std::string line;
+		while (std::getline(file, line))
+		{
+			auto colon = line.find(':');
+			if (colon != std::string::npos && line.compare(0, 10, "model name") == 0 && colon + 2 <= line.size())
+				return line.substr(colon + 2);
+		}
+#endif
+		return "unknown";
+	}
+
+	/// <summary>指定された論理プロセッサが属する物理パッケージ (ソケット) の番号を返します。取得できない場合は 0 を返します。</summary>
+	/// <param name="processor">論理プロセッサの番号を指定します。</param>
+	inline unsigned int ProcessorPackage(unsigned int processor)
+	{
+#ifdef _WIN32
+		(void)processor;
+		return 0;
+#else
+		std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(processor) + "/topology/physical_package_id");
+		unsigned int package = 0;
+		return file >> package ? package : 0;
+#endif
+	}
+
+	/// <summary>呼び出し元のスレッドを指定された論理プロセッサでのみ実行されるように固定します。</summary>
+	/// <param name="processor">論理プロセッサの番号を指定します。</param>
+	/// <returns>固定に成功した場合は true。</returns>
+	inline bool PinCurrentThread(unsigned int processor)
+	{
+#ifdef _WIN32
+		if (processor >= sizeof(DWORD_PTR) * 8)
+			return false;
+		return SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << processor) != 0;
+#else
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(processor, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+	}
+};
@@ -0,0 +1,564 @@
+﻿#pragma once
+
+#include "StackedDenoisingAutoEncoder.h"
+#include "Distributed.h"
+
+/// <summary>推論サーバーと負荷生成クライアントの間で送受信されるメッセージの種類を表します。</summary>
+/// <remarks>
+/// すべてのメッセージは <see cref="SocketConnection::SendMessage"/> によって長さを前置して送信され、先頭の 1 バイトが種類を示します。
+/// 接続直後にサーバーは入力の次元数とクラス数 (uint32_t × 2) を送信します。
+/// 分類要求には単精度浮動小数点数で表された入力が続き、応答はクラス番号 (uint32_t) と各クラスの確率 (float) からなります。
+/// 空のメッセージを含む不正な要求と、計算に失敗した要求に対する応答は空になります。
+/// </remarks>
+enum class PredictionMessage : uint8_t
+{
+	/// <summary>入力を分類します。</summary>
+	Classify,
+	/// <summary>サーバーの統計情報を取得します。</summary>
+	Statistics,
+	/// <summary>サーバーを停止します。</summary>
+	Shutdown,
+};
+
+/// <summary>推論要求の遅延と処理量の統計情報を表します。</summary>
+struct ServingStatistics final
+{
+	ServingStatistics() : Requests(0), Batches(0), Seconds(0), Median(0), Percentile99(0) { }
+
+	/// <summary>処理された要求の数を示します。</summary>
+	uint64_t Requests;
+	/// <summary>要求をまとめて処理した回数を示します。</summary>
+	uint64_t Batches;
+	/// <summary>計測期間の長さ (秒) を示します。</summary>
+	double Seconds;
+	/// <summary>要求ごとの遅延 (秒) の中央値を示します。</summary>
+	double Median;
+	/// <summary>要求ごとの遅延 (秒) の 99 パーセンタイルを示します。</summary>
+	double Percentile99;
+
+	/// <summary>1 秒あたりに処理された要求の数を返します。</summary>
+	double Throughput() const { return Seconds > 0 ? Requests / Seconds : 0; }
+
+	/// <summary>1 回のバッチ処理に含まれる要求の数の平均を返します。</summary>
+	double AverageBatchSize() const { return Batches > 0 ? static_cast<double>(Requests) / Batches : 0; }
+
+	/// <summary>指定された遅延の集合から統計情報を計算します。</summary>
+	static ServingStatistics FromLatencies(std::vector<double> latencies, uint64_t batches, double seconds)
+	{
+		ServingStatistics statistics;
+		statistics.Requests = latencies.size();
+		statistics.Batches = batches;
+		statistics.Seconds = seconds;
+		if (!latencies.empty())
+		{
+			std::sort(latencies.begin(), latencies.end());
+			statistics.Median = latencies[(latencies.size() - 1) / 2];
+			statistics.Percentile99 = latencies[static_cast<size_t>(std::ceil(0.99 * latencies.size())) - 1];
+		}
+		return statistics;
+	}
+
+	std::string ToString() const
+	{
+		std::ostringstream out;
+		out << Requests << " requests in " << Seconds << " s, " << Throughput() << " requests/s, p50 " << Median * 1e3 << " ms, p99 " << Percentile99 * 1e3 << " ms";
+		if (Batches > 0)
+			out << ", " << AverageBatchSize() << " requests/batch";
+		return out.str();
+	}
+};
+
+/// <summary>推論サーバーの構成を表します。</summary>
+struct PredictionServerOptions final
+{
+	PredictionServerOptions() : Address("unix:/tmp/NeuralNetworkServer.sock"), MaxBatchSize(32), MaxDelay(1000) { }
+
+	/// <summary>読み込むネットワークのファイル名を示します。</summary>
+	std::string Model;
+	/// <summary>待ち受けるアドレスを示します。"unix:パス" または "tcp:ホスト:ポート" の形式で指定します。</summary>
+	std::string Address;
+	/// <summary>1 回にまとめて処理する要求の最大数を示します。</summary>
+	size_t MaxBatchSize;
+	/// <summary>バッチの最初の要求が到着してから処理を開始するまで待機する最大の時間を示します。</summary>
+	std::chrono::microseconds MaxDelay;
+
+	/// <summary>コマンドライン引数から構成を読み取ります。</summary>
+	/// <param name="first">読み取りを開始する引数の位置を指定します。</param>
+	static PredictionServerOptions Parse(int argc, char* argv[], int first)
+	{
+		PredictionServerOptions options;
+		for (int i = first; i < argc; i++)
+		{
+			std::string name = argv[i];
+			auto value = [&]() -> std::string
+			{
+				if (i + 1 >= argc)
+					throw std::invalid_argument(name + " requires a value");
+				return argv[++i];
+			};
+			if (name == "--model")
+				options.Model = value();
+			else if (name == "--address")
+				options.Address = value();
+			else if (name == "--max-batch")
+				options.MaxBatchSize = (std::max)(static_cast<size_t>(std::stoul(value())), static_cast<size_t>(1));
+			else if (name == "--max-delay-us")
+				options.MaxDelay = std::chrono::microseconds(std::stoul(value()));
+			else
+				throw std::invalid_argument("unknown option: " + name);
+		}
+		if (options.Model.empty())
+			throw std::invalid_argument("--model is required");
+		return options;
+	}
+};
+
+/// <summary>
+/// 学習済みの SDA を読み込み、ソケット経由の分類要求に応答する推論サーバーを表します。
+/// 接続ごとのスレッドが受信した要求は 1 つのキューに集められ、最大数に達するか最初の要求の待機時間が上限に達した時点でまとめて計算されます。
+/// </summary>
+template <class TValue, class THiddenLayer = HiddenLayer<TValue>, class TOutputLayer = LogisticRegressionLayer<TValue>> class PredictionServer final : private boost::noncopyable
+{
+public:
+	typedef StackedDenoisingAutoEncoder<TValue, THiddenLayer, TOutputLayer> ModelType;
+
+	/// <summary>指定されたネットワークと構成で <see cref="PredictionServer"/> クラスの新しいインスタンスを初期化します。ネットワークの所有権は移動しません。</summary>
+	PredictionServer(const ModelType& model, const PredictionServerOptions& options) : model(&model), options(options), stopping(false), requests(0), batches(0) { }
+
+	/// <summary>接続の待ち受けを開始し、<see cref="Stop"/> が呼び出されるか停止要求を受信するまで要求を処理します。</summary>
+	void Run()
+	{
+		{
+			std::lock_guard<std::mutex> lock(clientsMutex);
+			listener = std::unique_ptr<SocketConnection>(new SocketConnection(SocketConnection::Listen(options.Address)));
+		}
+		started = std::chrono::steady_clock::now();
+		std::thread batcher([&] { ProcessBatches(); });
+		std::vector<Reader> readers;
+		std::exception_ptr error;
+		while (!stopping)
+		{
+			std::shared_ptr<Client> client;
+			try
+			{
+				client = std::make_shared<Client>(SocketConnection::Accept(*listener));
+			}
+			catch (const std::runtime_error&)
+			{
+				if (!stopping)
+					error = std::current_exception();
+				break;
+			}
+			// 終了した接続のスレッドを回収し、破棄されたクライアントを一覧から取り除く
+			readers.erase(std::remove_if(readers.begin(), readers.end(), [](Reader& reader)
+			{
+				if (!reader.Source->Finished)
+					return false;
+				reader.Thread.join();
+				return true;
+			}), readers.end());
+			{
+				std::lock_guard<std::mutex> lock(clientsMutex);
+				clients.erase(std::remove_if(clients.begin(), clients.end(), [](const std::weak_ptr<Client>& item) { return item.expired(); }), clients.end());
+				clients.push_back(client);
+				// 登録の直前に停止した場合は Stop から起こされないため、ここで切断する
+				if (stopping)
+					client->Socket.Shutdown();
+			}
+			readers.push_back(Reader { client, std::thread([this, client] { Serve(client); }) });
+		}
+		Stop();
+		batcher.join();
+		for (auto& reader : readers)
+			reader.Thread.join();
+		{
+			std::lock_guard<std::mutex> lock(clientsMutex);
+			listener.reset();
+		}
+#ifndef _WIN32
+		if (options.Address.compare(0, 5, "unix:") == 0)
+			unlink(options.Address.substr(5).c_str());
+#endif
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	/// <summary>サーバーを停止します。受信済みの要求は停止前に処理されます。</summary>
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		arrived.notify_all();
+		std::lock_guard<std::mutex> lock(clientsMutex);
+		// 待ち受けと受信で待機しているスレッドを起こす
+		if (listener)
+			listener->Shutdown();
+		for (auto& item : clients)
+		{
+			if (auto client = item.lock())
+				client->Socket.Shutdown();
+		}
+	}
+
+	/// <summary>開始からの要求の遅延と処理量の統計情報を返します。遅延は要求の受信から応答の送信までの時間です。</summary>
+	/// <remarks>遅延の分位点は、最大 <see cref="LatencySamples"/> 個の要求を一様に抽出した標本から計算されます。</remarks>
+	ServingStatistics Statistics() const
+	{
+		std::lock_guard<std::mutex> lock(statisticsMutex);
+		auto statistics = ServingStatistics::FromLatencies(latencies, batches, std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+		statistics.Requests = requests;
+		return statistics;
+	}
+
+	/// <summary>遅延の分位点の計算のために保持する要求の数の上限を示します。</summary>
+	static const size_t LatencySamples = 1 << 16;
+
+private:
+	struct Client final
+	{
+		explicit Client(SocketConnection::Handle handle) : Socket(handle), Finished(false) { }
+		SocketConnection Socket;
+		std::mutex SendMutex;
+		// 受信スレッドが終了したかどうか
+		std::atomic<bool> Finished;
+
+		void Send(const std::vector<char>& message)
+		{
+			std::lock_guard<std::mutex> lock(SendMutex);
+			Socket.SendMessage(message);
+		}
+	};
+
+	struct Request final
+	{
+		std::shared_ptr<Client> Source;
+		std::valarray<TValue> Input;
+		std::chrono::steady_clock::time_point Arrival;
+	};
+
+	struct Reader final
+	{
+		std::shared_ptr<Client> Source;
+		std::thread Thread;
+	};
+
+	SocketLibrary library;
+	const ModelType* model;
+	PredictionServerOptions options;
+	std::atomic<bool> stopping;
+	std::unique_ptr<SocketConnection> listener;
+	std::mutex clientsMutex;
+	std::vector<std::weak_ptr<Client>> clients;
+	std::mutex queueMutex;
+	std::condition_variable arrived;
+	std::deque<Request> queue;
+	mutable std::mutex statisticsMutex;
+	// 応答した要求の遅延のリザーバ標本
+	std::vector<double> latencies;
+	std::mt19937_64 sampler;
+	uint64_t requests;
+	uint64_t batches;
+	std::chrono::steady_clock::time_point started;
+
+	// 1 つの接続から要求を受信し、分類要求をキューに追加する
+	void Serve(std::shared_ptr<Client> client)
+	{
+		auto dimension = model->HiddenLayers.InputNeuronCount(0);
+		try
+		{
+			std::vector<char> handshake;
+			Append(handshake, static_cast<uint32_t>(dimension));
+			Append(handshake, static_cast<uint32_t>(model->OutputLayer().Weight.Row()));
+			client->Send(handshake);
+			while (!stopping)
+			{
+				// 最も長い要求は分類要求であり、それより長いメッセージは受信前に拒否する
+				auto message = client->Socket.ReceiveMessage(1 + dimension * sizeof(float));
+				if (message.empty())
+				{
+					client->Send(std::vector<char>());
+					continue;
+				}
+				auto kind = static_cast<PredictionMessage>(message[0]);
+				if (kind == PredictionMessage::Classify && message.size() == 1 + dimension * sizeof(float))
+				{
+					Request request { client, std::valarray<TValue>(dimension), std::chrono::steady_clock::now() };
+					size_t position = 1;
+					for (size_t k = 0; k < dimension; k++)
+						request.Input[k] = static_cast<TValue>(Read<float>(message, position));
+					{
+						std::lock_guard<std::mutex> lock(queueMutex);
+						queue.push_back(std::move(request));
+					}
+					arrived.notify_one();
+				}
+				else if (kind == PredictionMessage::Statistics && message.size() == 1)
+				{
+					auto statistics = Statistics();
+					std::vector<char> response;
+					Append(response, statistics.Requests);
+					Append(response, statistics.Batches);
+					Append(response, statistics.Seconds);
+					Append(response, statistics.Median);
+					Append(response, statistics.Percentile99);
+					client->Send(response);
+				}
+				else if (kind == PredictionMessage::Shutdown && message.size() == 1)
+				{
+					client->Send(std::vector<char>());
+					Stop();
+				}
+				else
+					client->Send(std::vector<char>());
+			}
+		}
+		catch (const std::runtime_error&)
+		{
+			// 接続が閉じられた
+		}
+		client->Finished = true;
+	}
+
+	// キューから要求をまとめて取り出して計算し、応答を送信する
+	void ProcessBatches()
+	{
+		std::vector<Request> batch;
+		std::vector<std::valarray<TValue>> inputs;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				arrived.wait(lock, [&] { return stopping || !queue.empty(); });
+				if (queue.empty())
+					break;
+				auto deadline = queue.front().Arrival + options.MaxDelay;
+				arrived.wait_until(lock, deadline, [&] { return stopping || queue.size() >= options.MaxBatchSize; });
+				auto count = (std::min)(queue.size(), options.MaxBatchSize);
+				batch.assign(std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.begin() + static_cast<std::ptrdiff_t>(count)));
+				queue.erase(queue.begin(), queue.begin() + static_cast<std::ptrdiff_t>(count));
+			}
+			inputs.clear();
+			for (auto& request : batch)
+				inputs.push_back(std::move(request.Input));
+			std::vector<std::valarray<TValue>> outputs;
+			try
+			{
+				outputs = model->Compute(inputs);
+			}
+			catch (const std::exception& e)
+			{
+				// 計算に失敗したバッチの要求には空の応答を返し、処理を続ける
+				std::cerr << "prediction failed: " << e.what() << std::endl;
+				for (auto& request : batch)
+					TrySend(*request.Source, std::vector<char>());
+				continue;
+			}
+			std::vector<double> finished;
+			for (size_t j = 0; j < batch.size(); j++)
+			{
+				std::vector<char> response;
+				Append(response, static_cast<uint32_t>(TOutputLayer::Classify(outputs[j])));
+				for (auto probability : outputs[j])
+					Append(response, static_cast<float>(probability));
+				if (TrySend(*batch[j].Source, response))
+					finished.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - batch[j].Arrival).count());
+			}
+			std::lock_guard<std::mutex> lock(statisticsMutex);
+			for (auto latency : finished)
+			{
+				// Algorithm R によって、応答したすべての要求から一様に標本を保持する
+				if (latencies.size() < LatencySamples)
+					latencies.push_back(latency);
+				else
+				{
+					auto index = std::uniform_int_distribution<uint64_t>(0, requests)(sampler);
+					if (index < LatencySamples)
+						latencies[static_cast<size_t>(index)] = latency;
+				}
+				requests++;
+			}
+			batches++;
+		}
+	}
+
+	// 応答を送信し、応答を待たずに切断したクライアントは無視する
+	static bool TrySend(Client& client, const std::vector<char>& response)
+	{
+		try
+		{
+			client.Send(response);
+			return true;
+		}
+		catch (const std::runtime_error&)
+		{
+			return false;
+		}
+	}
+
+	template <class T> static void Append(std::vector<char>& message, T value)
+	{
+		auto position = message.size();
+		message.resize(position + sizeof(T));
+		std::memcpy(&message[position], &value, sizeof(T));
+	}
+
+	template <class T> static T Read(const std::vector<char>& message, size_t& position)
+	{
+		T value;
+		std::memcpy(&value, &message[position], sizeof(T));
+		position += sizeof(T);
+		return value;
+	}
+};
+
+/// <summary>負荷生成クライアントの構成を表します。</summary>
+struct LoadGeneratorOptions final
+{
+	LoadGeneratorOptions() : Address("unix:/tmp/NeuralNetworkServer.sock"), Connections(4), Requests(1000), Shutdown(false) { }
+
+	/// <summary>接続先のアドレスを示します。</summary>
+	std::string Address;
+	/// <summary>同時に要求を送信する接続の数を示します。</summary>
+	unsigned int Connections;
+	/// <summary>各接続が送信する要求の数を示します。</summary>
+	unsigned int Requests;
+	/// <summary>計測の終了後にサーバーを停止するかどうかを示します。</summary>
+	bool Shutdown;
+
+	/// <summary>コマンドライン引数から構成を読み取ります。</summary>
+	/// <param name="first">読み取りを開始する引数の位置を指定します。</param>
+	static LoadGeneratorOptions Parse(int argc, char* argv[], int first)
+	{
+		LoadGeneratorOptions options;
+		for (int i = first; i < argc; i++)
+		{
+			std::string name = argv[i];
+			auto value = [&]() -> std::string
+			{
+				if (i + 1 >= argc)
+					throw std::invalid_argument(name + " requires a value");
+				return argv[++i];
+			};
+			if (name == "--address")
+				options.Address = value();
+			else if (name == "--connections")
+				options.Connections = (std::max)(static_cast<unsigned int>(std::stoul(value())), 1u);
+			else if (name == "--requests")
+				options.Requests = static_cast<unsigned int>(std::stoul(value()));
+			else if (name == "--shutdown")
+				options.Shutdown = true;
+			else
+				throw std::invalid_argument("unknown option: " + name);
+		}
+		return options;
+	}
+};
+
+/// <summary>
+/// 推論サーバーに複数の接続から分類要求を送信し、クライアント側で観測される遅延と処理量を計測します。
+/// 各接続は応答を受信してから次の要求を送信します。入力は一様乱数で生成されます。
+/// </summary>
+class LoadGenerator final : private boost::noncopyable
+{
+public:
+	explicit LoadGenerator(const LoadGeneratorOptions& options) : options(options) { }
+
+	/// <summary>すべての接続から要求を送信し終えるまで計測します。</summary>
+	ServingStatistics Run()
+	{
+		std::vector<std::vector<double>> latencies(options.Connections);
+		std::vector<std::exception_ptr> errors(options.Connections);
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> threads;
+		for (unsigned int c = 0; c < options.Connections; c++)
+		{
+			threads.emplace_back([&, c]
+			{
+				try
+				{
+					SocketConnection connection(Connect());
+					auto handshake = connection.ReceiveMessage();
+					if (handshake.size() != 2 * sizeof(uint32_t))
+						throw std::runtime_error("unexpected handshake from the server");
+					uint32_t dimension;
+					std::memcpy(&dimension, handshake.data(), sizeof(dimension));
+					std::mt19937 rng(c);
+					std::uniform_real_distribution<float> distribution(0, 1);
+					std::vector<char> request(1 + dimension * sizeof(float));
+					request[0] = static_cast<char>(PredictionMessage::Classify);
+					for (unsigned int r = 0; r < options.Requests; r++)
+					{
+						for (uint32_t k = 0; k < dimension; k++)
+						{
+							auto value = distribution(rng);
+							std::memcpy(&request[1 + k * sizeof(float)], &value, sizeof(float));
+						}
+						auto sent = std::chrono::steady_clock::now();
+						connection.SendMessage(request);
+						auto response = connection.ReceiveMessage();
+						if (response.size() < sizeof(uint32_t))
+							throw std::runtime_error("the server rejected a request");
+						latencies[c].push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - sent).count());
+					}
+				}
+				catch (...)
+				{
+					errors[c] = std::current_exception();
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		for (auto& error : errors)
+		{
+			if (error)
+				std::rethrow_exception(error);
+		}
+		std::vector<double> all;
+		for (auto& items : latencies)
+			all.insert(all.end(), items.begin(), items.end());
+		return ServingStatistics::FromLatencies(std::move(all), 0, seconds);
+	}
+
+	/// <summary>サーバー側で計測された統計情報を取得します。</summary>
+	ServingStatistics ServerStatistics()
+	{
+		auto response = Query(PredictionMessage::Statistics);
+		if (response.size() != 2 * sizeof(uint64_t) + 3 * sizeof(double))
+			throw std::runtime_error("unexpected statistics from the server");
+		ServingStatistics statistics;
+		auto data = response.data();
+		std::memcpy(&statistics.Requests, data, sizeof(uint64_t));
+		std::memcpy(&statistics.Batches, data + sizeof(uint64_t), sizeof(uint64_t));
+		std::memcpy(&statistics.Seconds, data + 2 * sizeof(uint64_t), sizeof(double));
+		std::memcpy(&statistics.Median, data + 2 * sizeof(uint64_t) + sizeof(double), sizeof(double));
+		std::memcpy(&statistics.Percentile99, data + 2 * sizeof(uint64_t) + 2 * sizeof(double), sizeof(double));
+		return statistics;
+	}
+
+	/// <summary>サーバーに停止を要求します。</summary>
+	void ShutdownServer() { Query(PredictionMessage::Shutdown); }
+
+private:
+	SocketLibrary library;
+	LoadGeneratorOptions options;
+
+	SocketConnection::Handle Connect()
+	{
+		auto handle = SocketConnection::Connect(options.Address);
+		if (handle == SocketConnection::InvalidHandle())
+			throw std::runtime_error("failed to connect to " + options.Address);
+		return handle;
+	}
+
+	std::vector<char> Query(PredictionMessage kind)
+	{
+		SocketConnection connection(Connect());
+		connection.ReceiveMessage();
+		connection.SendMessage(std::vector<char>(1, static_cast<char>(kind)));
+		return connection.ReceiveMessage();
+	}
+};
@@ -0,0 +1,240 @@
+﻿#pragma once
+
+#ifdef NN_ENABLE_PROFILING
+
+/// <summary>学習の各段階に対する軽量な計測機能を提供します。<c>NN_ENABLE_PROFILING</c> が定義されていない場合、計測はすべてコンパイル時に取り除かれます。</summary>
+namespace Profiling
+{
+	/// <summary>計測の対象となる段階を表します。</summary>
+	enum class Phase : unsigned int
+	{
+		Loading,
+		PreTraining,
+		CostEvaluation,
+		FineTuning,
+		ErrorRateEvaluation,
+		Synchronization,
+	};
+
+	/// <summary>段階の数を示します。</summary>
+	constexpr size_t PhaseCount = 6;
+
+	/// <summary>層ごとに計測できる層の最大数を示します。これを超える層の計測は最後の層にまとめられます。</summary>
+	constexpr size_t MaxLayers = 15;
+
+	/// <summary>指定された段階の名前を返します。</summary>
+	inline const char* PhaseName(Phase phase)
+	{
+		static const char* names[] { "Loading", "PreTraining", "CostEvaluation", "FineTuning", "ErrorRateEvaluation", "Synchronization" };
+		return names[static_cast<size_t>(phase)];
+	}
+
+	/// <summary>1 つの段階と層の組に対するカウンタを表します。加算は所有するスレッドが行いますが、<see cref="Registry::Reset"/> と競合しても値を失わないようにアトミックに行われます。</summary>
+	struct Counters final
+	{
+		std::atomic<uint64_t> Calls{ 0 };
+		std::atomic<uint64_t> Nanoseconds{ 0 };
+		std::atomic<uint64_t> Samples{ 0 };
+		std::atomic<uint64_t> Flops{ 0 };
+		std::atomic<uint64_t> Bytes{ 0 };
+		/// <summary>カーネルが自己申告した一時バッファの確保数の見積もりです。ヒープの確保を実測したものではありません。</summary>
+		std::atomic<uint64_t> TemporaryBuffers{ 0 };
+
+		static void Add(std::atomic<uint64_t>& counter, uint64_t value) { counter.fetch_add(value, std::memory_order_relaxed); }
+	};
+
+	/// <summary>カウンタの値を集計したものを表します。</summary>
+	struct Totals final
+	{
+		uint64_t Calls = 0;
+		uint64_t Nanoseconds = 0;
+		uint64_t Samples = 0;
+		uint64_t Flops = 0;
+		uint64_t Bytes = 0;
+		uint64_t TemporaryBuffers = 0;
+
+		void Add(const Counters& counters)
+		{
+			Calls += counters.Calls.load(std::memory_order_relaxed);
+			Nanoseconds += counters.Nanoseconds.load(std::memory_order_relaxed);
+			Samples += counters.Samples.load(std::memory_order_relaxed);
+			Flops += counters.Flops.load(std::memory_order_relaxed);
+			Bytes += counters.Bytes.load(std::memory_order_relaxed);
+			TemporaryBuffers += counters.TemporaryBuffers.load(std::memory_order_relaxed);
+		}
+		bool Empty() const { return Calls == 0 && Samples == 0 && Flops == 0 && Bytes == 0 && TemporaryBuffers == 0; }
+	};
+
+	/// <summary>1 つのスレッドが所有するカウンタの表を表します。</summary>
+	struct ThreadCounters final
+	{
+		Counters Table[PhaseCount][MaxLayers + 1];
+	};
+
+	/// <summary>スレッドごとのカウンタを登録し、それらを集計して出力します。</summary>
+	class Registry final : private boost::noncopyable
+	{
+	public:
+		/// <summary>プロセス全体で共有されるインスタンスを取得します。</summary>
+		static Registry& Instance()
+		{
+			static Registry instance;
+			return instance;
+		}
+
+		/// <summary>呼び出し元スレッドのカウンタの表を取得します。初回の呼び出し時にのみロックを取得して登録します。</summary>
+		ThreadCounters& Local()
+		{
+			thread_local ThreadCounters* local = nullptr;
+			if (!local)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				threads.push_back(std::unique_ptr<ThreadCounters>(new ThreadCounters()));
+				local = threads.back().get();
+			}
+			return *local;
+		}
+
+		/// <summary>これまでの計測結果を表形式で出力します。</summary>
+		/// <param name="stream">出力先のストリームを指定します。</param>
+		void WriteTable(std::ostream& stream)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stream << boost::format("%-20s %5s %10s %12s %14s %10s %10s %12s") % "Phase" % "Layer" % "Seconds" % "Samples" % "Samples/s" % "GFLOP/s" % "GB/s" % "TempBuffers" << std::endl;
+			ForEachTotal([&](Phase phase, size_t layer, const Totals& totals, size_t)
+			{
+				auto seconds = totals.Nanoseconds * 1e-9;
+				auto rate = [&](double value) { return seconds > 0 ? value / seconds : 0.0; };
+				stream << boost::format("%-20s %5s %10.3f %12u %14.1f %10.3f %10.3f %12u")
+					% PhaseName(phase) % LayerName(layer) % seconds % totals.Samples % rate(static_cast<double>(totals.Samples))
+					% (rate(static_cast<double>(totals.Flops)) * 1e-9) % (rate(static_cast<double>(totals.Bytes)) * 1e-9) % totals.TemporaryBuffers << std::endl;
+			});
+		}
+
+		/// <summary>これまでの計測結果を 1 行の JSON として出力します。</summary>
+		/// <param name="stream">出力先のストリームを指定します。</param>
+		/// <param name="label">出力に付加するラベル (エポックなど) を指定します。</param>
+		void WriteJson(std::ostream& stream, const std::string& label)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stream << "{\"label\":\"" << label << "\",\"threads\":" << threads.size() << ",\"phases\":[";
+			bool first = true;
+			ForEachTotal([&](Phase phase, size_t layer, const Totals& totals, size_t activeThreads)
+			{
+				stream << (first ? "" : ",") << "{\"phase\":\"" << PhaseName(phase) << "\",\"layer\":" << (layer == 0 ? -1 : static_cast<long long>(layer) - 1)
+					<< ",\"calls\":" << totals.Calls << ",\"seconds\":" << totals.Nanoseconds * 1e-9 << ",\"samples\":" << totals.Samples
+					<< ",\"flops\":" << totals.Flops << ",\"bytes\":" << totals.Bytes << ",\"temporary_buffers\":" << totals.TemporaryBuffers
+					<< ",\"active_threads\":" << activeThreads << "}";
+				first = false;
+			});
+			stream << "]}" << std::endl;
+		}
+
+		/// <summary>すべてのスレッドのカウンタを 0 に戻します。</summary>
+		void Reset()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto& thread : threads)
+			{
+				for (auto& phase : thread->Table)
+				{
+					for (auto& counters : phase)
+					{
+						for (auto counter : { &counters.Calls, &counters.Nanoseconds, &counters.Samples, &counters.Flops, &counters.Bytes, &counters.TemporaryBuffers })
+							counter->store(0, std::memory_order_relaxed);
+					}
+				}
+			}
+		}
+
+	private:
+		std::mutex mutex;
+		std::vector<std::unique_ptr<ThreadCounters>> threads;
+
+		Registry() { }
+
+		static std::string LayerName(size_t layer) { return layer == 0 ? "-" : std::to_string(layer - 1); }
+
+		template <class TFunction> void ForEachTotal(TFunction function) const
+		{
+			for (size_t phase = 0; phase < PhaseCount; phase++)
+			{
+				for (size_t layer = 0; layer <= MaxLayers; layer++)
+				{
+					Totals totals;
+					size_t activeThreads = 0;
+					for (auto& thread : threads)
+					{
+						Totals local;
+						local.Add(thread->Table[phase][layer]);
+						if (!local.Empty())
+							activeThreads++;
+						totals.Add(thread->Table[phase][layer]);
+					}
+					if (!totals.Empty())
+						function(static_cast<Phase>(phase), layer, totals, activeThreads);
+				}
+			}
+		}
+	};
+
+	/// <summary>呼び出し元スレッドで現在計測中の段階と層のカウンタを示します。</summary>
+	inline Counters*& CurrentCounters()
+	{
+		thread_local Counters* current = nullptr;
+		return current;
+	}
+
+	/// <summary>スコープの実行時間を計測し、スコープ内で報告された処理量を指定された段階と層に記録します。</summary>
+	class ScopedTimer final : private boost::noncopyable
+	{
+	public:
+		/// <summary>計測を開始します。</summary>
+		/// <param name="phase">計測する段階を指定します。</param>
+		/// <param name="layer">計測する層のインデックスを指定します。層に属さない場合は負の値を指定します。</param>
+		ScopedTimer(Phase phase, long long layer) : previous(CurrentCounters()), start(std::chrono::steady_clock::now())
+		{
+			auto slot = layer < 0 ? 0 : (std::min)(static_cast<size_t>(layer) + 1, MaxLayers);
+			counters = &Registry::Instance().Local().Table[static_cast<size_t>(phase)][slot];
+			CurrentCounters() = counters;
+		}
+		~ScopedTimer()
+		{
+			auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			Counters::Add(counters->Calls, 1);
+			Counters::Add(counters->Nanoseconds, static_cast<uint64_t>(elapsed));
+			CurrentCounters() = previous;
+		}
+
+	private:
+		Counters* counters;
+		Counters* const previous;
+		const std::chrono::steady_clock::time_point start;
+	};
+
+	/// <summary>呼び出し元スレッドで計測中の段階に処理量を加算します。計測中でない場合は何もしません。</summary>
+	inline void Count(uint64_t samples, uint64_t flops, uint64_t bytes, uint64_t temporaryBuffers)
+	{
+		auto counters = CurrentCounters();
+		if (!counters)
+			return;
+		Counters::Add(counters->Samples, samples);
+		Counters::Add(counters->Flops, flops);
+		Counters::Add(counters->Bytes, bytes);
+		Counters::Add(counters->TemporaryBuffers, temporaryBuffers);
+	}
+};
+
+#define NN_PROFILE_CONCATENATE_DETAIL(x, y) x##y
+#define NN_PROFILE_CONCATENATE(x, y) NN_PROFILE_CONCATENATE_DETAIL(x, y)
+#define NN_PROFILE_SCOPE(phase, layer) Profiling::ScopedTimer NN_PROFILE_CONCATENATE(profileScope, __LINE__)(Profiling::Phase::phase, static_cast<long long>(layer))
+#define NN_PROFILE_COUNT(samples, flops, bytes, temporaryBuffers) Profiling::Count(static_cast<uint64_t>(samples), static_cast<uint64_t>(flops), static_cast<uint64_t>(bytes), static_cast<uint64_t>(temporaryBuffers))
+#define NN_PROFILE_REPORT(table, json, label) do { Profiling::Registry::Instance().WriteTable(table); Profiling::Registry::Instance().WriteJson(json, label); Profiling::Registry::Instance().Reset(); } while (false)
+
+#else
+
+#define NN_PROFILE_SCOPE(phase, layer) ((void)0)
+#define NN_PROFILE_COUNT(samples, flops, bytes, temporaryBuffers) ((void)sizeof((samples) + (flops) + (bytes) + (temporaryBuffers)))
+#define NN_PROFILE_REPORT(table, json, label) ((void)0)
+
+#endif
@@ -0,0 +1,112 @@
+﻿#pragma once
+
+#include "LearningSet.h"
+
+/// <summary>検証データの無作為な部分集合を段階的に大きくしながらコストを推定する方法を表します。</summary>
+struct ProgressiveEvaluationOptions final
+{
+	ProgressiveEvaluationOptions(size_t initialSamples = 100, double growth = 2, double alpha = 0.01) : InitialSamples(initialSamples), Growth(growth), Alpha(alpha) { }
+
+	/// <summary>最初の段階で評価するデータ点の数を示します。</summary>
+	size_t InitialSamples;
+	/// <summary>段階ごとに評価済みのデータ点の数を何倍にするかを示します。</summary>
+	double Growth;
+	/// <summary>すべての段階を通じて、いずれかの段階の信頼区間が母集団の平均を含まない確率の上限を示します。</summary>
+	/// <remarks>打ち切りを判定する段階の数を K とすると、各段階の信頼区間は Bonferroni 補正により両側 1 - Alpha / K の信頼係数で計算されます。</remarks>
+	double Alpha;
+};
+
+/// <summary>標準正規分布で両側の裾の確率が <paramref name="alpha"/> となる点を返します。</summary>
+inline double TwoSidedNormalQuantile(double alpha)
+{
+	if (!(alpha > 0 && alpha < 1))
+		throw std::invalid_argument("alpha must be between 0 and 1");
+	// erfc(z / √2) は z について単調減少するため、二分法で求める
+	double low = 0, high = 40;
+	for (int i = 0; i < 100; i++)
+	{
+		auto middle = (low + high) / 2;
+		if (std::erfc(middle / std::sqrt(2.0)) > alpha)
+			low = middle;
+		else
+			high = middle;
+	}
+	return (low + high) / 2;
+}
+
+/// <summary>部分集合から推定されたコストを表します。</summary>
+template <class TValue> struct ProgressiveEstimate final
+{
+	ProgressiveEstimate() : Mean(0), HalfWidth(0), Samples(0), Settled(false) { }
+
+	/// <summary>評価したデータ点のコストの平均を示します。</summary>
+	TValue Mean;
+	/// <summary>母集団の平均に対する信頼区間の半幅を示します。すべてのデータ点を評価した場合は 0 です。</summary>
+	TValue HalfWidth;
+	/// <summary>評価したデータ点の数を示します。</summary>
+	size_t Samples;
+	/// <summary>すべてのデータ点を評価する前に判定が確定したかどうかを示します。</summary>
+	bool Settled;
+};
+
+/// <summary>
+/// データセットを無作為に並べ替え、先頭から段階的に大きくなる部分集合でデータ点ごとのコストの平均と信頼区間を計算します。
+/// 各段階の終わりに信頼区間が指定された区間に完全に含まれるか完全に外れれば、コストが区間に含まれるかどうかの判定は確定したものとして打ち切ります。
+/// 信頼区間には非復元抽出のための有限母集団修正を適用するため、すべてのデータ点を評価すると半幅は 0 になり、結果は全体のコストと一致します。
+/// 判定は複数の段階で繰り返されるため、信頼区間の幅は <see cref="ProgressiveEvaluationOptions::Alpha"/> を段階の数で割った有意水準から求めます。
+/// </summary>
+/// <param name="dataset">コストを推定するデータセットを指定します。</param>
+/// <param name="lower">判定する区間の下限を指定します。</param>
+/// <param name="upper">判定する区間の上限を指定します。</param>
+/// <param name="options">部分集合の大きさと信頼区間の幅を指定します。</param>
+/// <param name="rng">並べ替えに使用される乱数生成器を指定します。</param>
+/// <param name="evaluate">データセットを受け取り、データ点あたりの平均コストを返す関数を指定します。</param>
+template <class TValue, class TEvaluate> ProgressiveEstimate<TValue> EstimateProgressively(const DataSetView<TValue>& dataset, TValue lower, TValue upper, const ProgressiveEvaluationOptions& options, std::mt19937& rng, TEvaluate evaluate)
+{
+	ProgressiveEstimate<TValue> estimate;
+	auto count = dataset.Count();
+	if (count == 0)
+		return estimate;
+	std::vector<size_t> order(count);
+	for (size_t i = 0; i < count; i++)
+		order[i] = i;
+	std::shuffle(order.begin(), order.end(), rng);
+	auto shuffled = dataset.Permute(order);
+
+	// 全体に達する前に打ち切りを判定する段階の数で有意水準を分ける
+	auto initial = (std::max)(options.InitialSamples, static_cast<size_t>(2));
+	auto next = [&](size_t stage) { return (std::max)(static_cast<size_t>(stage * options.Growth), stage + 1); };
+	size_t checks = 0;
+	for (auto stage = initial; stage < count; stage = next(stage))
+		checks++;
+	auto z = checks > 0 ? TwoSidedNormalQuantile(options.Alpha / checks) : 0.0;
+
+	// Welford の方法で平均と偏差平方和を更新する
+	double mean = 0, squares = 0;
+	size_t n = 0;
+	auto stage = initial;
+	while (true)
+	{
+		auto end = (std::min)(stage, count);
+		for (; n < end; n++)
+		{
+			auto cost = static_cast<double>(evaluate(shuffled.Slice(n, 1)));
+			auto delta = cost - mean;
+			mean += delta / (n + 1);
+			squares += delta * (cost - mean);
+		}
+		estimate.Mean = static_cast<TValue>(mean);
+		estimate.Samples = n;
+		estimate.HalfWidth = n < count ? static_cast<TValue>(z * std::sqrt(squares / (n - 1) / n * (count - n) / (count - 1))) : static_cast<TValue>(0);
+		if (n >= count)
+			return estimate;
+		auto inside = estimate.Mean - estimate.HalfWidth >= lower && estimate.Mean + estimate.HalfWidth <= upper;
+		auto outside = estimate.Mean + estimate.HalfWidth < lower || estimate.Mean - estimate.HalfWidth > upper;
+		if (inside || outside)
+		{
+			estimate.Settled = true;
+			return estimate;
+		}
+		stage = next(stage);
+	}
+}
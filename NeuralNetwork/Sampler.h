@@ -0,0 +1,149 @@
+﻿#pragma once
+
+#include "LearningSet.h"
+
+/// <summary>
+/// エポックごとにデータセットを並べ替え、ミニバッチに分割するサンプラーを表します。
+/// 並べ替えはデータ点を固定長のブロックに分け、ブロックの順序とブロック内の順序をそれぞれ入れ替えることで行います。
+/// 同じブロックに属するデータ点は近い順番で処理されるため、基になる保存領域へのアクセスの局所性が保たれます。
+/// </summary>
+template <class TValue> class EpochSampler final
+{
+public:
+	/// <summary><see cref="EpochSampler"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="dataset">並べ替えの対象となるデータセットを指定します。</param>
+	/// <param name="batchSize">ミニバッチに含まれるデータ点の数を指定します。</param>
+	/// <param name="blockSize">局所的に並べ替えるブロックのデータ点の数を指定します。0 を指定するとデータセット全体を並べ替えます。</param>
+	/// <param name="rngSeed">並べ替えに使用される乱数生成器のシード値を指定します。</param>
+	EpochSampler(const DataSetView<TValue>& dataset, size_t batchSize, size_t blockSize, std::mt19937::result_type rngSeed) : dataset(dataset), batchSize((std::max)(batchSize, static_cast<size_t>(1))), blockSize(blockSize), rng(rngSeed) { }
+
+	/// <summary>次のエポックで使用される、並べ替えられたデータセットを返します。画像とラベルはコピーされません。</summary>
+	DataSetView<TValue> NextEpoch()
+	{
+		auto count = dataset.Count();
+		auto block = blockSize > 0 ? blockSize : (std::max)(count, static_cast<size_t>(1));
+		std::vector<size_t> blocks((count + block - 1) / block);
+		for (size_t b = 0; b < blocks.size(); b++)
+			blocks[b] = b;
+		std::shuffle(blocks.begin(), blocks.end(), rng);
+		std::vector<size_t> order;
+		order.reserve(count);
+		for (auto b : blocks)
+		{
+			auto begin = order.size();
+			for (size_t i = b * block; i < (std::min)((b + 1) * block, count); i++)
+				order.push_back(i);
+			std::shuffle(order.begin() + begin, order.end(), rng);
+		}
+		return dataset.Permute(order);
+	}
+
+	/// <summary>並べ替えに使用される乱数生成器を指定されたシード値で初期化し直します。</summary>
+	/// <param name="rngSeed">乱数生成器のシード値を指定します。</param>
+	void Reseed(std::mt19937::result_type rngSeed) { rng.seed(rngSeed); }
+
+	/// <summary>1 エポックに含まれるミニバッチの数を取得します。</summary>
+	size_t BatchCount() const { return (dataset.Count() + batchSize - 1) / batchSize; }
+
+	/// <summary>指定されたエポックのデータセットから指定されたミニバッチを取り出します。</summary>
+	/// <param name="epoch"><see cref="NextEpoch"/> によって返されたデータセットを指定します。</param>
+	/// <param name="batch">0 から始まるミニバッチの番号を指定します。</param>
+	DataSetView<TValue> Batch(const DataSetView<TValue>& epoch, size_t batch) const
+	{
+		auto begin = (std::min)(batch * batchSize, epoch.Count());
+		return epoch.Slice(begin, (std::min)(batchSize, epoch.Count() - begin));
+	}
+
+private:
+	DataSetView<TValue> dataset;
+	size_t batchSize;
+	size_t blockSize;
+	std::mt19937 rng;
+};
+
+/// <summary>損失に基づく重要度サンプリングの方法を表します。</summary>
+struct ImportanceSamplingOptions final
+{
+	ImportanceSamplingOptions(double fraction = 0.3, double uniformMix = 0.2, unsigned int fullPassInterval = 5) : Fraction(fraction), UniformMix(uniformMix), FullPassInterval(fullPassInterval) { }
+
+	/// <summary>1 エポックで抽出するデータ点の数のデータセット全体に対する割合を示します。</summary>
+	double Fraction;
+	/// <summary>抽出確率のうち一様分布に割り当てる割合を示します。損失の小さいデータ点も時々抽出されて損失が更新され、重要度の重みは 1 / UniformMix 以下に抑えられます。</summary>
+	double UniformMix;
+	/// <summary>データセット全体を 1 回ずつ処理してすべての損失を更新するエポックの間隔を示します。0 の場合は最初のエポックのみ全体を処理します。</summary>
+	unsigned int FullPassInterval;
+};
+
+/// <summary>
+/// 直前に記録されたデータ点ごとの損失に比例する確率でエポックのデータ点を抽出するサンプラーを表します。
+/// 抽出確率 p に対して学習率を 1 / (N p) 倍にすることで、各更新の勾配の期待値をデータセット全体の平均勾配に一致させます。
+/// 最初のエポックと <see cref="ImportanceSamplingOptions::FullPassInterval"/> ごとのエポックではデータセット全体を重み 1 で処理します。
+/// </summary>
+template <class TValue> class ImportanceSampler final
+{
+public:
+	/// <summary><see cref="ImportanceSampler"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="dataset">抽出の対象となるデータセットを指定します。</param>
+	/// <param name="options">抽出するデータ点の割合、一様分布の割合および全体を処理する間隔を指定します。</param>
+	/// <param name="rngSeed">抽出に使用される乱数生成器のシード値を指定します。</param>
+	ImportanceSampler(const DataSetView<TValue>& dataset, const ImportanceSamplingOptions& options, std::mt19937::result_type rngSeed) :
+		dataset(dataset), options(options), losses(static_cast<TValue>(0), dataset.Count()), epochs(0), fullPass(false), rng(rngSeed) { }
+
+	/// <summary>次のエポックで処理するデータ点を抽出したデータセットを返します。同じデータ点が複数回含まれることがあります。画像とラベルはコピーされません。</summary>
+	DataSetView<TValue> NextEpoch()
+	{
+		auto count = dataset.Count();
+		fullPass = epochs == 0 || (options.FullPassInterval > 0 && epochs % options.FullPassInterval == 0);
+		epochs++;
+		indices.resize(count);
+		if (fullPass)
+		{
+			for (size_t i = 0; i < count; i++)
+				indices[i] = i;
+			std::shuffle(indices.begin(), indices.end(), rng);
+			weights.resize(count);
+			weights = static_cast<TValue>(1);
+			return dataset.Permute(indices);
+		}
+		auto total = losses.sum();
+		auto mix = total > 0 ? (std::min)((std::max)(options.UniformMix, 0.0), 1.0) : 1.0;
+		std::vector<double> probabilities(count);
+		for (size_t i = 0; i < count; i++)
+			probabilities[i] = mix / count + (total > 0 ? (1 - mix) * losses[i] / total : 0);
+		std::discrete_distribution<size_t> distribution(probabilities.begin(), probabilities.end());
+		indices.resize((std::max)(static_cast<size_t>(std::ceil(options.Fraction * count)), static_cast<size_t>(1)));
+		weights.resize(indices.size());
+		for (size_t j = 0; j < indices.size(); j++)
+		{
+			indices[j] = distribution(rng);
+			weights[j] = static_cast<TValue>(1 / (count * probabilities[indices[j]]));
+		}
+		return dataset.Permute(indices);
+	}
+
+	/// <summary>直前の <see cref="NextEpoch"/> で抽出された各データ点に対する学習率の重みを取得します。</summary>
+	const std::valarray<TValue>& Weights() const { return weights; }
+
+	/// <summary>直前の <see cref="NextEpoch"/> がデータセット全体を処理するエポックであったかどうかを返します。</summary>
+	bool FullPass() const { return fullPass; }
+
+	/// <summary>直前の <see cref="NextEpoch"/> で抽出された各データ点の損失を記録します。同じデータ点が複数回抽出された場合は最後の損失が残ります。</summary>
+	/// <param name="epochLosses">抽出されたデータセットの順に並べられた損失を指定します。</param>
+	void Update(const std::valarray<TValue>& epochLosses)
+	{
+		if (epochLosses.size() != indices.size())
+			throw std::invalid_argument("losses must be specified for every sampled data point");
+		for (size_t j = 0; j < indices.size(); j++)
+			losses[indices[j]] = epochLosses[j];
+	}
+
+private:
+	DataSetView<TValue> dataset;
+	ImportanceSamplingOptions options;
+	std::valarray<TValue> losses;
+	std::vector<size_t> indices;
+	std::valarray<TValue> weights;
+	unsigned int epochs;
+	bool fullPass;
+	std::mt19937 rng;
+};
@@ -26,6 +26,11 @@ public:
 	T& operator[](ptrdiff_t index) { return data[GetActualIndex(index)]; }
 	const T& operator[](ptrdiff_t index) const { return data[GetActualIndex(index)]; }
 	size_t Count() const { return count; }
+	void Clear()
+	{
+		baseIndex = 0;
+		count = 0;
+	}
 
 private:
 	T data[N] { };
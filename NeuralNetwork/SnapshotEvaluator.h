@@ -0,0 +1,183 @@
+﻿#pragma once
+
+#include "StackedDenoisingAutoEncoder.h"
+
+/// <summary>
+/// エポックの境界で取得した SDA のパラメータのスナップショットを、専用のスレッドとスレッドプールで評価します。
+/// スナップショットを格納する複製は 2 つあり、一方を評価している間にもう一方へ次のスナップショットを書き込めるため、訓練は評価の完了を待たずに次のエポックへ進めます。
+/// 最も良いと判定されたスナップショットのパラメータは、ロールバックと保存のために保持されます。
+/// </summary>
+template <class TValue, class THiddenLayer> class SnapshotEvaluator final : private boost::noncopyable
+{
+public:
+	typedef StackedDenoisingAutoEncoder<TValue, THiddenLayer> Network;
+
+	/// <summary>評価の結果を表します。</summary>
+	struct Result final
+	{
+		/// <summary>スナップショットを取得したエポックを示します。</summary>
+		unsigned int Epoch;
+		/// <summary>評価関数が返した値を示します。</summary>
+		double Score;
+	};
+
+	/// <summary><see cref="SnapshotEvaluator"/> クラスの新しいインスタンスを初期化し、評価を行うスレッドを開始します。</summary>
+	/// <param name="network">評価する SDA を指定します。出力層が設定されている必要があり、構造が同じ複製が 2 つ作成されます。</param>
+	/// <param name="evaluate">複製を受け取り、そのスコアを返す関数を指定します。評価を行うスレッドから呼び出されます。</param>
+	/// <param name="options">評価を行うスレッドが使用するスレッドプールの構成を指定します。</param>
+	SnapshotEvaluator(const Network& network, std::function<double(Network&)> evaluate, const ThreadPoolOptions& options) : evaluate(std::move(evaluate)), next(0), last(0), bestEpoch(0), stopping(false)
+	{
+		for (auto& buffer : buffers)
+		{
+			std::stringstream stream;
+			network.Save(stream);
+			buffer.Replica = Network::Load(stream);
+			buffer.State = BufferState::Free;
+		}
+		worker = std::thread([this, options] { Work(options); });
+	}
+
+	~SnapshotEvaluator()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		changed.notify_all();
+		worker.join();
+	}
+
+	/// <summary>指定された SDA のパラメータを空いている複製に書き込み、評価を依頼します。両方の複製が評価中または評価待ちの場合は、評価が終わるまで待機します。</summary>
+	/// <param name="network">スナップショットを取得する SDA を指定します。</param>
+	/// <param name="epoch">スナップショットを取得したエポックを指定します。</param>
+	void Submit(const Network& network, unsigned int epoch)
+	{
+		auto parameters = network.ExportParameters();
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this] { return buffers[next].State == BufferState::Free || buffers[next].State == BufferState::Taken; });
+		auto& buffer = buffers[next];
+		lock.unlock();
+		buffer.Replica->ImportParameters(parameters);
+		lock.lock();
+		buffer.Epoch = epoch;
+		buffer.State = BufferState::Submitted;
+		order.push_back(next);
+		next = 1 - next;
+		lock.unlock();
+		changed.notify_all();
+	}
+
+	/// <summary>評価を依頼したまま結果を受け取っていないスナップショットの数を返します。</summary>
+	size_t Pending() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return order.size();
+	}
+
+	/// <summary>最も古いスナップショットの評価が終わるのを待って、その結果を受け取ります。</summary>
+	Result Take()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (order.empty())
+			throw std::logic_error("no snapshot is pending");
+		auto& buffer = buffers[order.front()];
+		changed.wait(lock, [&] { return buffer.State == BufferState::Evaluated; });
+		if (buffer.Error)
+		{
+			auto error = buffer.Error;
+			buffer.Error = nullptr;
+			buffer.State = BufferState::Free;
+			order.pop_front();
+			changed.notify_all();
+			std::rethrow_exception(error);
+		}
+		Result result { buffer.Epoch, buffer.Score };
+		last = order.front();
+		buffer.State = BufferState::Taken;
+		order.pop_front();
+		return result;
+	}
+
+	/// <summary>直前に <see cref="Take"/> で結果を受け取ったスナップショットを最良のものとして保持します。その複製は次の <see cref="Submit"/> で上書きされるため、それより前に呼び出す必要があります。</summary>
+	void KeepLast()
+	{
+		auto& buffer = buffers[last];
+		if (buffer.State != BufferState::Taken)
+			throw std::logic_error("the last snapshot has already been overwritten");
+		best = buffer.Replica->ExportParameters();
+		bestMemory = MemoryReservation(MemoryCategory::Workspaces, best.size() * sizeof(TValue));
+		bestEpoch = buffer.Epoch;
+	}
+
+	/// <summary>最良のスナップショットが保持されているかどうかを返します。</summary>
+	bool HasBest() const { return best.size() > 0; }
+
+	/// <summary>保持されている最良のスナップショットを取得したエポックを返します。</summary>
+	unsigned int BestEpoch() const { return bestEpoch; }
+
+	/// <summary>保持されている最良のスナップショットのパラメータを指定された SDA に書き込みます。</summary>
+	/// <param name="network">パラメータを書き込む SDA を指定します。スナップショットを取得した SDA と同じ構造である必要があります。</param>
+	void RestoreBest(Network& network) const
+	{
+		if (!HasBest())
+			throw std::logic_error("no snapshot has been kept");
+		network.ImportParameters(best);
+	}
+
+private:
+	enum class BufferState { Free, Submitted, Evaluated, Taken };
+
+	struct Buffer
+	{
+		Buffer() : State(BufferState::Free), Epoch(0), Score(0) { }
+
+		std::unique_ptr<Network> Replica;
+		BufferState State;
+		unsigned int Epoch;
+		double Score;
+		std::exception_ptr Error;
+	};
+
+	std::function<double(Network&)> evaluate;
+	Buffer buffers[2];
+	size_t next;
+	size_t last;
+	std::deque<size_t> order;
+	std::valarray<TValue> best;
+	MemoryReservation bestMemory;
+	unsigned int bestEpoch;
+	bool stopping;
+	mutable std::mutex mutex;
+	std::condition_variable changed;
+	std::thread worker;
+
+	// 依頼された順に評価する
+	void Work(const ThreadPoolOptions& options)
+	{
+		ThreadPool pool(options);
+		ThreadPool::Scope scope(pool);
+		for (size_t current = 0; ; current = 1 - current)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&] { return stopping || buffers[current].State == BufferState::Submitted; });
+				if (stopping)
+					return;
+			}
+			auto& buffer = buffers[current];
+			try
+			{
+				buffer.Score = evaluate(*buffer.Replica);
+			}
+			catch (...)
+			{
+				buffer.Error = std::current_exception();
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				buffer.State = BufferState::Evaluated;
+			}
+			changed.notify_all();
+		}
+	}
+};
@@ -0,0 +1,131 @@
+﻿#pragma once
+
+#include "StackedDenoisingAutoEncoder.h"
+
+/// <summary>
+/// 枝刈りされた積層雑音除去自己符号化器の結合重みを疎行列として保持し、推論のみを行うネットワークを表します。
+/// 複数のデータ点をまとめて処理する場合は、データ点を列に並べた疎行列と密行列の積によって各層を計算します。
+/// </summary>
+/// <typeparam name="THiddenLayer">変換元の隠れ層の型を指定します。活性化関数はこの型から取得されます。</typeparam>
+/// <typeparam name="TOutputLayer">変換元の出力層の型を指定します。</typeparam>
+template <class TValue, class THiddenLayer = HiddenLayer<TValue>, class TOutputLayer = LogisticRegressionLayer<TValue>> class SparseInferenceNetwork final : private boost::noncopyable
+{
+public:
+	/// <summary>まとめて処理するデータ点の数を示します。</summary>
+	static const size_t BatchSize = 32;
+
+	/// <summary>指定された SDA の結合重みのうち 0 でない要素を取り出して <see cref="SparseInferenceNetwork"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="sda">変換元の SDA を指定します。出力層が設定されている必要があります。</param>
+	explicit SparseInferenceNetwork(const StackedDenoisingAutoEncoder<TValue, THiddenLayer, TOutputLayer>& sda)
+	{
+		for (size_t i = 0; i < sda.HiddenLayers.Count(); i++)
+		{
+			weights.emplace_back(sda.HiddenLayers[i].Weight);
+			biases.push_back(sda.HiddenLayers[i].Bias);
+		}
+		weights.emplace_back(sda.OutputLayer().Weight);
+		biases.push_back(sda.OutputLayer().Bias);
+		size_t bytes = 0;
+		for (size_t n = 0; n < weights.size(); n++)
+			bytes += weights[n].NonZeroCount() * (sizeof(TValue) + sizeof(uint32_t)) + (weights[n].Row() + 1) * sizeof(size_t) + biases[n].size() * sizeof(TValue);
+		memory = MemoryReservation(MemoryCategory::Weights, bytes);
+	}
+
+	/// <summary>すべての結合重みのうち 0 である要素の割合を返します。</summary>
+	double Sparsity() const
+	{
+		double zeros = 0, total = 0;
+		for (auto& weight : weights)
+		{
+			total += static_cast<double>(weight.Row() * weight.Column());
+			zeros += static_cast<double>(weight.Row() * weight.Column() - weight.NonZeroCount());
+		}
+		return total > 0 ? zeros / total : 0.0;
+	}
+
+	/// <summary>指定された入力に対する出力層の出力を計算します。</summary>
+	std::valarray<TValue> Compute(const std::valarray<TValue>& input) const
+	{
+		auto result = input;
+		for (size_t n = 0; n < weights.size(); n++)
+		{
+			NN_PROFILE_COUNT(0, 2 * weights[n].NonZeroCount(), weights[n].NonZeroCount() * (sizeof(TValue) + sizeof(uint32_t)), 1);
+			SparseNeuronComputer<TValue> computer(weights[n], biases[n], result);
+			result = n + 1 < weights.size() ? THiddenLayer::ActivationPolicy::Activate(computer) : TOutputLayer::ActivationPolicy::Activate(computer);
+		}
+		return result;
+	}
+
+	/// <summary>確率が最大となるクラスを推定します。</summary>
+	unsigned int Predict(const std::valarray<TValue>& input) const { return TOutputLayer::Classify(Compute(input)); }
+
+	/// <summary>指定されたデータセットに対して誤り率を計算します。</summary>
+	/// <param name="dataset">誤り率の計算対象となるデータセットを指定します。このデータセットにはデータ点とラベルが含まれます。</param>
+	/// <returns>データセット全体に対して計算された誤り率。</returns>
+	template <class TResult> TResult ComputeErrorRates(const DataSetView<TValue>& dataset) const
+	{
+		std::atomic<unsigned int> sum(0);
+		auto batches = (dataset.Count() + BatchSize - 1) / BatchSize;
+		ParallelFor(batches, 1, [&](size_t begin, size_t end)
+		{
+			unsigned int errors = 0;
+			std::vector<TValue> input, output;
+			for (auto b = begin; b < end; b++)
+			{
+				auto first = b * BatchSize;
+				auto batch = (std::min)(BatchSize, dataset.Count() - first);
+				auto labels = Predict(dataset, first, batch, input, output);
+				for (size_t j = 0; j < batch; j++)
+				{
+					if (labels[j] != dataset.Label(first + j))
+						errors++;
+				}
+			}
+			sum += errors;
+		});
+		NN_PROFILE_COUNT(dataset.Count(), 0, 0, 0);
+		return static_cast<TResult>(sum.load()) / dataset.Count();
+	}
+
+private:
+	std::vector<SparseMatrix<TValue>> weights;
+	std::vector<std::valarray<TValue>> biases;
+	MemoryReservation memory;
+
+	// データ点 [first, first + batch) を列に並べて全層を計算し、推定されたクラスを返す
+	std::vector<unsigned int> Predict(const DataSetView<TValue>& dataset, size_t first, size_t batch, std::vector<TValue>& input, std::vector<TValue>& output) const
+	{
+		input.resize(dataset.Image(first).size() * batch);
+		for (size_t j = 0; j < batch; j++)
+		{
+			auto& image = dataset.Image(first + j);
+			for (size_t k = 0; k < image.size(); k++)
+				input[k * batch + j] = image[k];
+		}
+		std::vector<unsigned int> labels(batch);
+		std::valarray<TValue> linear;
+		for (size_t n = 0; n < weights.size(); n++)
+		{
+			auto rows = weights[n].Row();
+			output.resize(rows * batch);
+			for (size_t i = 0; i < rows; i++)
+				std::fill_n(&output[i * batch], batch, biases[n][i]);
+			weights[n].MultiplyAdd(input.data(), batch, output.data(), 0, rows);
+			NN_PROFILE_COUNT(0, 2 * weights[n].NonZeroCount() * batch, weights[n].NonZeroCount() * (sizeof(TValue) + sizeof(uint32_t)), batch);
+			if (n + 1 < weights.size())
+				ActivationFunction::ActivateColumns<typename THiddenLayer::ActivationPolicy>(output.data(), rows, batch);
+			else
+			{
+				linear.resize(rows);
+				for (size_t j = 0; j < batch; j++)
+				{
+					for (size_t i = 0; i < rows; i++)
+						linear[i] = output[i * batch + j];
+					labels[j] = TOutputLayer::Classify(TOutputLayer::ActivationPolicy::Activate(linear));
+				}
+			}
+			input.swap(output);
+		}
+		return labels;
+	}
+};
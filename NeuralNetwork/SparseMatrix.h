@@ -0,0 +1,130 @@
+﻿#pragma once
+
+#include "Matrix.h"
+
+/// <summary>圧縮行格納 (CSR) 形式で格納された疎行列を表します。</summary>
+template <class T> class SparseMatrix final
+{
+public:
+	/// <summary>密行列から絶対値が指定された値を超える要素のみを取り出して <see cref="SparseMatrix"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="dense">変換元の密行列を指定します。</param>
+	/// <param name="threshold">格納する要素の絶対値の下限を指定します。この値以下の要素は 0 として扱われます。</param>
+	explicit SparseMatrix(const Matrix<T>& dense, T threshold = 0) : row_(dense.Row()), column_(dense.Column()), offsets_(dense.Row() + 1)
+	{
+		if (column_ > (std::numeric_limits<uint32_t>::max)())
+			throw std::invalid_argument("too many columns");
+		for (size_t i = 0; i < row_; i++)
+		{
+			offsets_[i] = values_.size();
+			for (size_t k = 0; k < column_; k++)
+			{
+				if (std::abs(dense(i, k)) > threshold)
+				{
+					values_.push_back(dense(i, k));
+					columns_.push_back(static_cast<uint32_t>(k));
+				}
+			}
+		}
+		offsets_[row_] = values_.size();
+	}
+
+	size_t Row() const { return row_; }
+
+	size_t Column() const { return column_; }
+
+	/// <summary>格納されている非零要素の数を返します。</summary>
+	size_t NonZeroCount() const { return values_.size(); }
+
+	/// <summary>0 である要素の割合を返します。</summary>
+	double Sparsity() const { return row_ * column_ > 0 ? 1 - static_cast<double>(values_.size()) / (row_ * column_) : 0.0; }
+
+	/// <summary>指定された行と密なベクトルの内積を計算します。</summary>
+	T RowDot(size_t rowIndex, const T* input) const
+	{
+		// 間接参照による読み込みの遅延を隠すため、4 つの独立した累積器で積和を計算する
+		auto j = offsets_[rowIndex];
+		auto end = offsets_[rowIndex + 1];
+		T s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+		for (; j + 4 <= end; j += 4)
+		{
+			s0 += values_[j] * input[columns_[j]];
+			s1 += values_[j + 1] * input[columns_[j + 1]];
+			s2 += values_[j + 2] * input[columns_[j + 2]];
+			s3 += values_[j + 3] * input[columns_[j + 3]];
+		}
+		for (; j < end; j++)
+			s0 += values_[j] * input[columns_[j]];
+		return (s0 + s1) + (s2 + s3);
+	}
+
+	/// <summary>指定された範囲の行について、列優先で並べられた複数のベクトルとの積を出力に加算します。</summary>
+	/// <param name="input">第 k 成分が input[k * batch + b] に格納された <paramref name="batch"/> 個のベクトルを指定します。</param>
+	/// <param name="batch">ベクトルの数を指定します。</param>
+	/// <param name="output">第 i 成分が output[i * batch + b] に格納される出力を指定します。</param>
+	/// <param name="firstRow">計算する最初の行を指定します。</param>
+	/// <param name="lastRow">計算する最後の行の次の行を指定します。</param>
+	void MultiplyAdd(const T* input, size_t batch, T* output, size_t firstRow, size_t lastRow) const
+	{
+		// 最内ループはベクトルの番号について連続したメモリを走査するため、コンパイラによる SIMD 化が効く
+		for (auto i = firstRow; i < lastRow; i++)
+		{
+			auto out = output + i * batch;
+			for (auto j = offsets_[i]; j < offsets_[i + 1]; j++)
+			{
+				auto value = values_[j];
+				auto in = input + columns_[j] * batch;
+				for (size_t b = 0; b < batch; b++)
+					out[b] += value * in[b];
+			}
+		}
+	}
+
+private:
+	size_t row_;
+	size_t column_;
+	std::vector<T> values_;
+	std::vector<uint32_t> columns_;
+	std::vector<size_t> offsets_;
+};
+
+/// <summary>疎な結合重みを持つニューロンの線形計算を要素ごとに遅延評価するベクトルを表します。</summary>
+template <class T> class SparseNeuronComputer final : private boost::noncopyable
+{
+public:
+	SparseNeuronComputer(const SparseMatrix<T>& weight, const std::valarray<T>& bias, const std::valarray<T>& input) : weight(&weight), bias(&bias), input(&input) { }
+	T operator[](size_t index) const { return (*bias)[index] + weight->RowDot(index, &(*input)[0]); }
+	size_t size() const { return weight->Row(); }
+
+private:
+	const SparseMatrix<T>* weight;
+	const std::valarray<T>* bias;
+	const std::valarray<T>* input;
+};
+
+/// <summary>絶対値が小さい順に指定された割合の要素を 0 にします。</summary>
+/// <param name="weight">枝刈りする行列を指定します。</param>
+/// <param name="sparsity">0 にする要素の割合を指定します。</param>
+/// <returns>枝刈りの後に 0 である要素の数。</returns>
+template <class T> size_t PruneByMagnitude(Matrix<T>& weight, double sparsity)
+{
+	auto count = weight.Row() * weight.Column();
+	auto pruned = static_cast<size_t>(sparsity * count);
+	auto data = weight.Data();
+	if (pruned > 0)
+	{
+		std::vector<T> magnitudes(count);
+		for (size_t i = 0; i < count; i++)
+			magnitudes[i] = std::abs(data[i]);
+		std::nth_element(magnitudes.begin(), magnitudes.begin() + (pruned - 1), magnitudes.end());
+		auto threshold = magnitudes[pruned - 1];
+		// しきい値と等しい要素は必要な数だけ 0 にし、割合を正確に保つ
+		auto ties = pruned - static_cast<size_t>(std::count_if(magnitudes.begin(), magnitudes.begin() + (pruned - 1), [&](T m) { return m < threshold; }));
+		for (size_t i = 0; i < count; i++)
+		{
+			auto magnitude = std::abs(data[i]);
+			if (magnitude < threshold || (magnitude == threshold && ties > 0 && ties--))
+				data[i] = 0;
+		}
+	}
+	return static_cast<size_t>(std::count(data, data + count, static_cast<T>(0)));
+}
@@ -1,6 +1,54 @@
 ﻿#pragma once
 
 #include "Layers.h"
+#include "SparseMatrix.h"
+
+/// <summary>ファインチューニングの 1 エポックの間に得られた訓練データに対する統計情報を表します。</summary>
+/// <remarks>各データ点の損失と分類結果は、そのデータ点によって重みを更新する直前の順伝播から計算されます。</remarks>
+template <class TValue> struct FineTuningStatistics final
+{
+	FineTuningStatistics() : Samples(0), Misclassifications(0), Loss(0) { }
+
+	/// <summary>処理されたデータ点の数を示します。</summary>
+	size_t Samples;
+	/// <summary>誤って分類されたデータ点の数を示します。</summary>
+	size_t Misclassifications;
+	/// <summary>出力層のコストの総和を示します。</summary>
+	TValue Loss;
+
+	/// <summary>指定された統計をこの統計に加えます。</summary>
+	FineTuningStatistics& operator+=(const FineTuningStatistics& statistics)
+	{
+		Samples += statistics.Samples;
+		Misclassifications += statistics.Misclassifications;
+		Loss += statistics.Loss;
+		return *this;
+	}
+
+	/// <summary>データ点あたりの平均損失を返します。</summary>
+	TValue AverageLoss() const { return Samples > 0 ? Loss / Samples : static_cast<TValue>(0); }
+
+	/// <summary>誤り率を返します。</summary>
+	template <class TResult> TResult ErrorRate() const { return Samples > 0 ? static_cast<TResult>(Misclassifications) / Samples : static_cast<TResult>(0); }
+};
+
+/// <summary>パイプライン並列によるファインチューニングの構成を表します。</summary>
+struct PipelineOptions final
+{
+	PipelineOptions(unsigned int stages = 0, size_t microBatchSize = 1, unsigned int staleness = 0, unsigned int threadsPerStage = 0, ThreadAffinity affinity = ThreadAffinity::None) :
+		Stages(stages), MicroBatchSize(microBatchSize), Staleness(staleness), ThreadsPerStage(threadsPerStage), Affinity(affinity) { }
+
+	/// <summary>層を分割するステージの数を示します。0 の場合は出力層を含む層ごとに 1 つのステージを使用します。</summary>
+	unsigned int Stages;
+	/// <summary>パイプラインを流れるマイクロバッチに含まれるデータ点の数を示します。</summary>
+	size_t MicroBatchSize;
+	/// <summary>順伝播が反映を待たずに先行できる逆伝播の数をマイクロバッチ単位で示します。</summary>
+	unsigned int Staleness;
+	/// <summary>各ステージが使用するスレッドの数を示します。0 の場合は論理プロセッサをステージ間で等分します。</summary>
+	unsigned int ThreadsPerStage;
+	/// <summary>各ステージのスレッドの固定方法を示します。ステージには連続したコアの組が割り当てられます。</summary>
+	ThreadAffinity Affinity;
+};
 
 /// <summary>
 /// 積層雑音除去自己符号化器を表します。
@@ -10,67 +58,604 @@
 /// 最初の層の雑音除去自己符号化器は入力として積層雑音除去自己符号化器の入力を受け取り、最後の層の雑音除去自己符号化器の隠れ層は出力を表します。
 /// 注釈: 事前学習後、積層雑音除去自己符号化器は通常の多層パーセプトロンとして扱われます。雑音除去自己符号化器は重みの初期化にのみ使用されます。
 /// </summary>
-template <class TValue> class StackedDenoisingAutoEncoder final : private boost::noncopyable
+/// <typeparam name="THiddenLayer">隠れ層の型を指定します。活性化関数などのポリシーはこの型を通じてコンパイル時に指定されます。</typeparam>
+/// <typeparam name="TOutputLayer">出力層の型を指定します。</typeparam>
+template <class TValue, class THiddenLayer = HiddenLayer<TValue>, class TOutputLayer = LogisticRegressionLayer<TValue>> class StackedDenoisingAutoEncoder final : private boost::noncopyable
 {
 public:
 	/// <summary><see cref="StackedDenoisingAutoEncoder"/> クラスを乱数生成器のシード値と入力次元数を使用して初期化します。</summary>
 	/// <param name="rng">重みの初期化と雑音除去自己符号化器の雑音生成に使用される乱数生成器のシード値を指定します。</param>
 	/// <param name="nIn">このネットワークの入力次元数を指定します。</param>
-	StackedDenoisingAutoEncoder(std::mt19937::result_type rngSeed, unsigned int nIn) : HiddenLayers(rngSeed, nIn) { }
+	StackedDenoisingAutoEncoder(std::mt19937::result_type rngSeed, unsigned int nIn) : HiddenLayers(rngSeed, nIn), stagePoolThreads(0), stagePoolAffinity(ThreadAffinity::None) { }
+
+	/// <summary><see cref="StackedDenoisingAutoEncoder"/> クラスを乱数生成器のシード値と入力の形状を使用して初期化します。畳み込み層は入力の空間的な構造を使用します。</summary>
+	/// <param name="rng">重みの初期化と雑音除去自己符号化器の雑音生成に使用される乱数生成器のシード値を指定します。</param>
+	/// <param name="input">このネットワークの入力の形状を指定します。</param>
+	StackedDenoisingAutoEncoder(std::mt19937::result_type rngSeed, const FeatureShape& input) : HiddenLayers(rngSeed, input), stagePoolThreads(0), stagePoolAffinity(ThreadAffinity::None) { }
 
 	/// <summary>隠れ層のコレクションを取得します。</summary>
-	HiddenLayerCollection<TValue> HiddenLayers;
+	HiddenLayerCollection<TValue, THiddenLayer> HiddenLayers;
 
 	/// <summary>この SDA の出力層のニューロン数を指定された値に設定します。</summary>
 	/// <param name="neurons">SDA の出力層のニューロン数を指定します。</param>
-	void SetLogisticRegressionLayer(unsigned int neurons)
+	/// <param name="optimizer">ファインチューニング段階でのパラメータの更新方法を指定します。事前学習中に蓄積された隠れ層のオプティマイザの状態は破棄されます。</param>
+	void SetLogisticRegressionLayer(unsigned int neurons, const OptimizerParameters& optimizer = OptimizerParameters())
 	{
-		outputLayer = std::unique_ptr<LogisticRegressionLayer<TValue>>(new LogisticRegressionLayer<TValue>(HiddenLayers.InputNeuronCount(HiddenLayers.Count()), neurons));
+		HiddenLayers.SetOptimizer(optimizer);
+		outputLayer = std::unique_ptr<TOutputLayer>(new TOutputLayer(HiddenLayers.InputNeuronCount(HiddenLayers.Count()), neurons, optimizer));
 		HiddenLayers.Freeze();
 	}
 
 	/// <summary>指定されたデータセットに対してファインチューニングを実行します。</summary>
 	/// <param name="dataset">ファインチューニングに使用されるデータセットを指定します。このデータにはデータ点とラベルが含まれます。</param>
 	/// <param name="learningRate">ファインチューニング段階で使用される学習率を指定します。</param>
-	void FineTune(const DataSet<TValue>& dataset, TValue learningRate)
+	/// <returns>ファインチューニング中の順伝播から得られた訓練データの損失と誤分類数。</returns>
+	FineTuningStatistics<TValue> FineTune(const DataSetView<TValue>& dataset, TValue learningRate)
 	{
-		struct equal
+		FineTuningStatistics<TValue> statistics;
+		std::valarray<TValue> target(static_cast<TValue>(0), outputLayer->Weight.Row());
+		auto inputs = std::vector<ReferableVector<TValue>>(HiddenLayers.Count() + 2);
+		for (size_t d = 0; d < dataset.Count(); d++)
 		{
-			equal(size_t constant) : constant(constant) { }
-			TValue operator[](size_t index) const { return index == constant ? static_cast<TValue>(1.0) : static_cast<TValue>(0.0); }
-		private:
-			size_t constant;
-		};
+			inputs[0] = dataset.Image(d);
+			Forward(inputs, 0, HiddenLayers.Count() + 1);
+			Record(inputs, dataset.Label(d), target, statistics);
+			Backward(inputs, equal(dataset.Label(d)), std::valarray<TValue>(), 0, HiddenLayers.Count() + 1, learningRate);
+		}
+		NN_PROFILE_COUNT(dataset.Count(), 0, 0, 0);
+		return statistics;
+	}
 
+	/// <summary>指定されたデータセットに対して、教師ネットワークの和らげられた出力と正解ラベルを組み合わせた損失でファインチューニングを実行します。知識の蒸留に使用されます。</summary>
+	/// <param name="dataset">ファインチューニングに使用されるデータセットを指定します。このデータにはデータ点とラベルが含まれます。</param>
+	/// <param name="learningRate">ファインチューニング段階で使用される学習率を指定します。</param>
+	/// <param name="softTarget">データセット内での位置を受け取り、そのデータ点に対して温度 <paramref name="temperature"/> で和らげられた教師の出力を返す関数を指定します。返された参照は次の呼び出しまで有効である必要があります。</param>
+	/// <param name="temperature">生徒の出力を和らげる温度を指定します。教師の出力と同じ温度である必要があります。</param>
+	/// <param name="softTargetWeight">損失における和らげられた教師の出力に対する項の重みを指定します。残りの重みは正解ラベルに対する項に与えられます。</param>
+	/// <returns>ファインチューニング中の順伝播から得られた訓練データの損失と誤分類数。統計は温度 1 の出力とラベルに対して計算されます。</returns>
+	/// <remarks>
+	/// 出力層はソフトマックスと正準連結関数を使用する必要があります。生徒のロジットを z、温度 T の和らげられた生徒と教師の出力を p_T と q_T とすると、損失は
+	/// (1 - w) CE(y, softmax(z)) + w T^2 CE(q_T, p_T) であり、z に対する勾配は (1 - w)(p_1 - y) + w T (p_T - q_T) になります。
+	/// T^2 の係数により、和らげられた項の勾配の大きさは温度によらずおおむね一定に保たれます。推論は温度 1 で行われます。
+	/// </remarks>
+	template <class TSoftTarget> FineTuningStatistics<TValue> FineTune(const DataSetView<TValue>& dataset, TValue learningRate, TSoftTarget softTarget, double temperature, double softTargetWeight)
+	{
+		if (!(temperature > 0))
+			throw std::invalid_argument("temperature must be positive");
+		FineTuningStatistics<TValue> statistics;
+		auto classes = outputLayer->Weight.Row();
+		std::valarray<TValue> target(static_cast<TValue>(0), classes), softened(classes), upper(classes);
+		auto inverse = static_cast<TValue>(1 / temperature);
+		auto hardWeight = static_cast<TValue>(1 - softTargetWeight), softWeight = static_cast<TValue>(softTargetWeight * temperature);
 		auto inputs = std::vector<ReferableVector<TValue>>(HiddenLayers.Count() + 2);
-		for (unsigned int d = 0; d < dataset.Labels().size(); d++)
-		{
-			inputs[0] = dataset.Images()[d];
-			size_t n = 0;
-			for (; n < HiddenLayers.Count(); n++)
-				inputs[n + 1] = HiddenLayers[n].Compute(inputs[n]);
-			inputs[n + 1] = outputLayer->Compute(inputs[n]);
-			std::valarray<TValue> lowerInfo(LearnLayer(*outputLayer, inputs[n].target(), inputs[n + 1].target(), equal(dataset.Labels()[d]), learningRate));
-			while (--n <= HiddenLayers.Count())
-				lowerInfo = LearnLayer(HiddenLayers[n], inputs[n].target(), inputs[n + 1].target(), lowerInfo, learningRate);
+		for (size_t d = 0; d < dataset.Count(); d++)
+		{
+			inputs[0] = dataset.Image(d);
+			Forward(inputs, 0, HiddenLayers.Count() + 1);
+			Record(inputs, dataset.Label(d), target, statistics);
+			// 温度 1 の出力の対数はロジットと定数の差だけ異なるので、それを温度で割ったソフトマックスが p_T になる
+			auto& output = inputs[HiddenLayers.Count() + 1].target();
+			for (size_t i = 0; i < classes; i++)
+				softened[i] = std::log((std::max)(output[i], (std::numeric_limits<TValue>::min)())) * inverse;
+			softened = std::exp(softened - softened.max());
+			softened /= softened.sum();
+			// 出力層の Delta は (出力 - 教師信号) であるため、Delta が上の勾配になる教師信号を与える
+			auto& soft = softTarget(d);
+			for (size_t i = 0; i < classes; i++)
+				upper[i] = output[i] - hardWeight * (output[i] - (i == dataset.Label(d) ? 1 : 0)) - softWeight * (softened[i] - soft[i]);
+			Backward(inputs, upper, std::valarray<TValue>(), 0, HiddenLayers.Count() + 1, learningRate);
+		}
+		NN_PROFILE_COUNT(dataset.Count(), 0, 0, 0);
+		return statistics;
+	}
+
+	/// <summary>データ点ごとに学習率の重みを指定してファインチューニングを実行し、各データ点の損失を記録します。重要度サンプリングに使用されます。</summary>
+	/// <param name="dataset">ファインチューニングに使用されるデータセットを指定します。このデータにはデータ点とラベルが含まれます。</param>
+	/// <param name="learningRate">ファインチューニング段階で使用される学習率を指定します。</param>
+	/// <param name="weights">データセットの各データ点に対する学習率の重みを指定します。</param>
+	/// <param name="losses">データセットの各データ点について、そのデータ点によって重みを更新する直前の出力層のコストが格納されます。</param>
+	/// <returns>ファインチューニング中の順伝播から得られた訓練データの損失と誤分類数。重みは統計に反映されません。</returns>
+	FineTuningStatistics<TValue> FineTune(const DataSetView<TValue>& dataset, TValue learningRate, const std::valarray<TValue>& weights, std::valarray<TValue>& losses)
+	{
+		if (weights.size() != dataset.Count())
+			throw std::invalid_argument("weights must be specified for every data point");
+		FineTuningStatistics<TValue> statistics;
+		std::valarray<TValue> target(static_cast<TValue>(0), outputLayer->Weight.Row());
+		auto inputs = std::vector<ReferableVector<TValue>>(HiddenLayers.Count() + 2);
+		losses.resize(dataset.Count());
+		for (size_t d = 0; d < dataset.Count(); d++)
+		{
+			inputs[0] = dataset.Image(d);
+			Forward(inputs, 0, HiddenLayers.Count() + 1);
+			losses[d] = Record(inputs, dataset.Label(d), target, statistics);
+			Backward(inputs, equal(dataset.Label(d)), std::valarray<TValue>(), 0, HiddenLayers.Count() + 1, learningRate * weights[d]);
+		}
+		NN_PROFILE_COUNT(dataset.Count(), 0, 0, 0);
+		return statistics;
+	}
+
+	/// <summary>
+	/// 指定されたデータセットに対して、層をステージに分けたパイプライン並列によってファインチューニングを実行します。
+	/// 各ステージは専用のスレッドとスレッドプールを持ち、マイクロバッチ単位で順伝播と逆伝播を並行して処理します。スレッドプールは構成が同じ限り呼び出しをまたいで再利用されます。
+	/// ステージはその層のマイクロバッチの逆伝播が <see cref="PipelineOptions::Staleness"/> 個以内しか遅れていない場合にのみ次の順伝播を開始します。
+	/// マイクロバッチの大きさが 1 で遅延が 0 の場合、結果は逐次的な <see cref="FineTune"/> と一致します。
+	/// いずれかのステージで例外が発生した場合は、すべてのステージを停止させてから最初の例外を再スローします。
+	/// </summary>
+	/// <param name="dataset">ファインチューニングに使用されるデータセットを指定します。このデータにはデータ点とラベルが含まれます。</param>
+	/// <param name="learningRate">ファインチューニング段階で使用される学習率を指定します。</param>
+	/// <param name="options">ステージ数、マイクロバッチの大きさ、許容する遅延およびステージごとのスレッド数を指定します。</param>
+	/// <returns>ファインチューニング中の順伝播から得られた訓練データの損失と誤分類数。</returns>
+	FineTuningStatistics<TValue> FineTune(const DataSetView<TValue>& dataset, TValue learningRate, const PipelineOptions& options)
+	{
+		auto layers = HiddenLayers.Count() + 1;
+		auto bounds = PartitionStages(options.Stages > 0 ? (std::min)(static_cast<size_t>(options.Stages), layers) : layers);
+		auto stages = bounds.size() - 1;
+		auto microBatchSize = (std::max)(options.MicroBatchSize, static_cast<size_t>(1));
+		auto batches = (dataset.Count() + microBatchSize - 1) / microBatchSize;
+		auto threadsPerStage = options.ThreadsPerStage > 0 ? options.ThreadsPerStage : (std::max)(Platform::ProcessorCount() / static_cast<unsigned int>(stages), 1u);
+
+		FineTuningStatistics<TValue> statistics;
+		std::valarray<TValue> target(static_cast<TValue>(0), outputLayer->Weight.Row());
+		std::vector<std::vector<std::vector<ReferableVector<TValue>>>> activations(batches);
+		std::vector<std::vector<std::valarray<TValue>>> lowerInfos(batches);
+		std::vector<std::unique_ptr<PipelineStage>> queues(stages);
+		for (auto& queue : queues)
+			queue = std::unique_ptr<PipelineStage>(new PipelineStage());
+		for (size_t b = 0; b < batches; b++)
+			queues[0]->Forward.push_back(b);
+		auto& pools = StagePools(stages, threadsPerStage, options.Affinity);
+		std::vector<std::exception_ptr> errors(stages);
+
+		auto run = [&](size_t s)
+		{
+			pools[s]->PinCallingThread();
+			ThreadPool::Scope scope(*pools[s]);
+			auto last = s + 1 == stages;
+			for (size_t done = 0; done < batches; )
+			{
+				bool backward;
+				size_t b;
+				if (!queues[s]->Pop(done + options.Staleness, b, backward))
+					return;
+				auto begin = b * microBatchSize;
+				auto end = (std::min)(begin + microBatchSize, dataset.Count());
+				if (!backward)
+				{
+					if (s == 0)
+					{
+						activations[b].resize(end - begin);
+						lowerInfos[b].resize(end - begin);
+						for (size_t j = 0; j < end - begin; j++)
+						{
+							activations[b][j].resize(layers + 1);
+							activations[b][j][0] = dataset.Image(begin + j);
+						}
+					}
+					for (size_t j = 0; j < end - begin; j++)
+					{
+						Forward(activations[b][j], bounds[s], bounds[s + 1]);
+						if (last)
+							Record(activations[b][j], dataset.Label(begin + j), target, statistics);
+					}
+					if (!last)
+					{
+						queues[s + 1]->Push(b, false);
+						continue;
+					}
+				}
+				for (size_t j = 0; j < end - begin; j++)
+					lowerInfos[b][j] = Backward(activations[b][j], equal(dataset.Label(begin + j)), std::move(lowerInfos[b][j]), bounds[s], bounds[s + 1], learningRate);
+				done++;
+				if (s > 0)
+					queues[s - 1]->Push(b, true);
+				else
+				{
+					activations[b].clear();
+					lowerInfos[b].clear();
+				}
+			}
+		};
+		std::vector<std::thread> threads;
+		for (size_t s = 0; s < stages; s++)
+		{
+			threads.emplace_back([&, s]
+			{
+				try
+				{
+					run(s);
+				}
+				catch (...)
+				{
+					// 他のステージは届かないマイクロバッチを待ち続けるため、すべての待ち行列を取り消して起こす
+					errors[s] = std::current_exception();
+					for (auto& queue : queues)
+						queue->Cancel();
+				}
+			});
 		}
+		for (auto& thread : threads)
+			thread.join();
+		for (auto& error : errors)
+		{
+			if (error)
+				std::rethrow_exception(error);
+		}
+		NN_PROFILE_COUNT(dataset.Count(), 0, 0, 0);
+		return statistics;
 	}
 
 	/// <summary>指定されたデータセットのバッチ全体に対して誤り率を計算します。</summary>
 	/// <param name="dataset">誤り率の計算対象となるデータセットを指定します。このデータセットにはデータ点とラベルが含まれます。</param>
 	/// <returns>データセット全体に対して計算された誤り率。</returns>
-	template <class TResult> TResult ComputeErrorRates(const DataSet<TValue>& dataset)
+	template <class TResult> TResult ComputeErrorRates(const DataSetView<TValue>& dataset)
+	{
+		// データ点ごとの判定は独立しているため、データセットを区間に分けてワーカーごとに処理する
+		std::atomic<unsigned int> sum(0);
+		ParallelFor(dataset.Count(), 16, [&](size_t begin, size_t end)
+		{
+			unsigned int errors = 0;
+			for (size_t i = begin; i < end; i++)
+			{
+				if (outputLayer->Predict(HiddenLayers.Compute(dataset.Image(i), nullptr)) != dataset.Label(i))
+					errors++;
+			}
+			sum += errors;
+		});
+		NN_PROFILE_COUNT(dataset.Count(), 0, 0, 0);
+		return static_cast<TResult>(sum.load()) / dataset.Count();
+	}
+
+	/// <summary>複数の入力に対する出力層の出力をまとめて計算します。各層の結合重みはバッチ全体で 1 回だけ読み込まれます。</summary>
+	/// <param name="inputs">入力するベクトルを指定します。すべて同じ次元でなければなりません。</param>
+	/// <returns>入力と同じ順序で並べられた出力層の出力。</returns>
+	std::vector<std::valarray<TValue>> Compute(const std::vector<std::valarray<TValue>>& inputs) const
+	{
+		std::vector<std::valarray<TValue>> outputs;
+		if (inputs.empty())
+			return outputs;
+		auto batch = inputs.size();
+		std::vector<TValue> input(inputs[0].size() * batch), output;
+		for (size_t j = 0; j < batch; j++)
+		{
+			if (inputs[j].size() != inputs[0].size())
+				throw std::invalid_argument("all inputs must have the same dimension");
+			for (size_t k = 0; k < inputs[j].size(); k++)
+				input[k * batch + j] = inputs[j][k];
+		}
+		for (size_t i = 0; i < HiddenLayers.Count(); i++)
+		{
+			HiddenLayers[i].Compute(input, batch, output);
+			input.swap(output);
+		}
+		outputLayer->Compute(input, batch, output);
+		auto classes = outputLayer->Weight.Row();
+		outputs.resize(batch, std::valarray<TValue>(classes));
+		for (size_t j = 0; j < batch; j++)
+		{
+			for (size_t i = 0; i < classes; i++)
+				outputs[j][i] = output[i * batch + j];
+		}
+		return outputs;
+	}
+
+	/// <summary>出力層を取得します。<see cref="SetLogisticRegressionLayer"/> が呼び出される前に使用することはできません。</summary>
+	const TOutputLayer& OutputLayer() const { return *outputLayer; }
+
+	/// <summary>すべての層のオプティマイザの状態を破棄します。パラメータを別の時点のものに置き換えた後に、古いモーメントなどが適用されないようにします。</summary>
+	void ResetOptimizers()
+	{
+		for (size_t i = 0; i < HiddenLayers.Count(); i++)
+			HiddenLayers[i].ResetOptimizer();
+		if (outputLayer)
+			outputLayer->ResetOptimizer();
+	}
+
+	/// <summary>隠れ層と出力層の結合重みのうち、絶対値が小さいものを層ごとに指定された割合だけ 0 にします。バイアスは枝刈りされません。</summary>
+	/// <param name="sparsity">各層で 0 にする結合重みの割合を指定します。</param>
+	/// <returns>枝刈りの後にすべての結合重みのうち 0 である要素の割合。</returns>
+	/// <remarks>0 になった結合重みは各層のマスクに記録され、以降の学習では更新されません。それらのオプティマイザの状態も破棄されます。</remarks>
+	double Prune(double sparsity)
+	{
+		size_t zeros = 0, total = 0;
+		for (size_t i = 0; i < HiddenLayers.Count(); i++)
+		{
+			zeros += PruneLayer(HiddenLayers[i], sparsity);
+			total += HiddenLayers[i].Weight.Row() * HiddenLayers[i].Weight.Column();
+		}
+		if (outputLayer)
+		{
+			zeros += PruneLayer(*outputLayer, sparsity);
+			total += outputLayer->Weight.Row() * outputLayer->Weight.Column();
+		}
+		return total > 0 ? static_cast<double>(zeros) / total : 0.0;
+	}
+
+	/// <summary>ネットワークの構造とすべてのパラメータを指定されたストリームに書き出します。出力層が設定されている必要があります。</summary>
+	void Save(std::ostream& stream) const
 	{
-		unsigned int sum = 0;
-		for (size_t i = 0; i < dataset.Labels().size(); i++)
+		auto write = [&](uint32_t value) { stream.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+		write(FileSignature);
+		write(sizeof(TValue));
+		auto input = HiddenLayers.InputShape(0);
+		write(static_cast<uint32_t>(input.Height));
+		write(static_cast<uint32_t>(input.Width));
+		write(static_cast<uint32_t>(input.Channels));
+		write(static_cast<uint32_t>(HiddenLayers.Count()));
+		for (size_t i = 0; i < HiddenLayers.Count(); i++)
+			write(static_cast<uint32_t>(HiddenLayers[i].Weight.Row()));
+		write(static_cast<uint32_t>(outputLayer->Weight.Row()));
+		auto parameters = ExportParameters();
+		stream.write(reinterpret_cast<const char*>(&parameters[0]), static_cast<std::streamsize>(parameters.size() * sizeof(TValue)));
+		if (!stream)
+			throw std::runtime_error("failed to write the network");
+	}
+
+	/// <summary><see cref="Save"/> によって書き出されたネットワークを読み込みます。読み込まれたネットワークの隠れ層は凍結されています。</summary>
+	/// <remarks>
+	/// ファイルに記録された大きさは、層を作成する前に上限およびファイルの残りの大きさと照合されます。
+	/// 入力の次元数のみを記録していた旧形式 (SDA1) のファイルは、入力を 1 行 1 チャネルの画像として読み込みます。この場合、畳み込み層を持つネットワークは読み込めません。
+	/// </remarks>
+	static std::unique_ptr<StackedDenoisingAutoEncoder> Load(std::istream& stream)
+	{
+		auto read = [&]
+		{
+			uint32_t value = 0;
+			if (!stream.read(reinterpret_cast<char*>(&value), sizeof(value)))
+				throw std::runtime_error("unexpected end of the network file");
+			return value;
+		};
+		// 壊れたファイルによって巨大な層が確保されないように、各次元とニューロン数を制限する
+		auto readSize = [&]
+		{
+			auto value = read();
+			if (value == 0 || value > MaxStoredSize)
+				throw std::runtime_error("the network file contains an invalid size");
+			return value;
+		};
+		auto signature = read();
+		if ((signature != FileSignature && signature != LegacyFileSignature) || read() != sizeof(TValue))
+			throw std::runtime_error("not a network file or the value type does not match");
+		auto height = signature == LegacyFileSignature ? 1 : readSize();
+		auto width = readSize();
+		auto channels = signature == LegacyFileSignature ? 1 : readSize();
+		if (static_cast<uint64_t>(height) * width > MaxStoredSize || static_cast<uint64_t>(height) * width * channels > MaxStoredSize)
+			throw std::runtime_error("the network file contains an invalid input shape");
+		auto layers = read();
+		if (layers > MaxStoredLayers)
+			throw std::runtime_error("the network file contains too many layers");
+		std::vector<uint32_t> neurons(layers);
+		for (auto& n : neurons)
+			n = readSize();
+		auto classes = readSize();
+
+		// 読み込み可能なストリームでは、パラメータの数が残りの大きさを超えないことを確認する
+		auto available = (std::numeric_limits<uint64_t>::max)();
+		auto start = stream.tellg();
+		if (start != std::streampos(-1) && stream.seekg(0, std::ios::end))
 		{
-			if (outputLayer->Predict(HiddenLayers.Compute(dataset.Images()[i], nullptr)) != dataset.Labels()[i])
-				sum++;
+			available = static_cast<uint64_t>(stream.tellg() - start) / sizeof(TValue);
+			stream.seekg(start);
 		}
-		return static_cast<TResult>(sum) / dataset.Labels().size();
+		stream.clear();
+		std::unique_ptr<StackedDenoisingAutoEncoder> sda(new StackedDenoisingAutoEncoder(0, FeatureShape(height, width, channels)));
+		auto reserve = [&](uint64_t count)
+		{
+			if (count > available)
+				throw std::runtime_error("the network file is truncated or its sizes are corrupted");
+			available -= count;
+		};
+		for (uint32_t i = 0; i < layers; i++)
+		{
+			reserve(THiddenLayer::ParameterCount(sda->HiddenLayers.InputShape(i), neurons[i]));
+			sda->HiddenLayers.Set(i, neurons[i]);
+		}
+		auto outputInputs = static_cast<uint64_t>(sda->HiddenLayers.InputNeuronCount(layers));
+		reserve(outputInputs * classes + classes);
+		sda->SetLogisticRegressionLayer(classes);
+		auto parameters = sda->ExportParameters();
+		if (!stream.read(reinterpret_cast<char*>(&parameters[0]), static_cast<std::streamsize>(parameters.size() * sizeof(TValue))))
+			throw std::runtime_error("unexpected end of the network file");
+		sda->ImportParameters(parameters);
+		return sda;
+	}
+
+	/// <summary>すべての層の結合重みとバイアスを 1 つの配列に書き出します。</summary>
+	/// <returns>隠れ層の順に結合重み、バイアス、可視層のバイアスを並べ、出力層が存在する場合は最後にその結合重みとバイアスを並べた配列。</returns>
+	std::valarray<TValue> ExportParameters() const
+	{
+		size_t count = 0;
+		ForEachParameterBlock(*this, [&](const TValue*, size_t length) { count += length; });
+		std::valarray<TValue> parameters(count);
+		size_t position = 0;
+		ForEachParameterBlock(*this, [&](const TValue* block, size_t length)
+		{
+			std::copy(block, block + length, &parameters[position]);
+			position += length;
+		});
+		return parameters;
+	}
+
+	/// <summary><see cref="ExportParameters"/> によって書き出された配列からすべての層の結合重みとバイアスを読み込みます。</summary>
+	/// <param name="parameters">読み込む配列を指定します。この SDA と同じ構造のネットワークから書き出されている必要があります。</param>
+	void ImportParameters(const std::valarray<TValue>& parameters)
+	{
+		size_t position = 0;
+		ForEachParameterBlock(*this, [&](TValue* block, size_t length)
+		{
+			if (position + length > parameters.size())
+				throw std::invalid_argument("parameters do not match the network structure");
+			std::copy(&parameters[position], &parameters[position] + length, block);
+			position += length;
+		});
+		if (position != parameters.size())
+			throw std::invalid_argument("parameters do not match the network structure");
 	}
 
 private:
-	std::unique_ptr<LogisticRegressionLayer<TValue>> outputLayer;
+	// ファイルの先頭に置かれる "SDA2"。入力の形状 (高さ、幅、チャネル数) を記録する
+	static const uint32_t FileSignature = 0x32414453;
+	// 入力の次元数のみを記録していた旧形式の "SDA1"
+	static const uint32_t LegacyFileSignature = 0x31414453;
+	// ファイルから読み込む次元数、ニューロン数およびクラス数の上限
+	static const uint32_t MaxStoredSize = 1 << 24;
+	// ファイルから読み込む隠れ層の数の上限
+	static const uint32_t MaxStoredLayers = 1024;
+
+	std::unique_ptr<TOutputLayer> outputLayer;
+	std::vector<std::unique_ptr<ThreadPool>> stagePools;
+	unsigned int stagePoolThreads;
+	ThreadAffinity stagePoolAffinity;
+
+	struct equal
+	{
+		equal(size_t constant) : constant(constant) { }
+		TValue operator[](size_t index) const { return index == constant ? static_cast<TValue>(1.0) : static_cast<TValue>(0.0); }
+	private:
+		size_t constant;
+	};
+
+	// パイプラインの 1 ステージに届いたマイクロバッチの待ち行列
+	struct PipelineStage final
+	{
+		PipelineStage() : Cancelled(false) { }
+
+		std::mutex Mutex;
+		std::condition_variable Arrived;
+		std::deque<size_t> Forward;
+		std::deque<size_t> Backward;
+		bool Cancelled;
+
+		void Push(size_t batch, bool backward)
+		{
+			{
+				std::lock_guard<std::mutex> lock(Mutex);
+				(backward ? Backward : Forward).push_back(batch);
+			}
+			Arrived.notify_one();
+		}
+
+		// 待機しているステージをすべて起こし、以降の取り出しを失敗させる
+		void Cancel()
+		{
+			{
+				std::lock_guard<std::mutex> lock(Mutex);
+				Cancelled = true;
+			}
+			Arrived.notify_all();
+		}
+
+		// 逆伝播を優先し、順伝播は番号が limit 以下のマイクロバッチのみ取り出す。取り消された場合は false を返す
+		bool Pop(size_t limit, size_t& batch, bool& backward)
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			Arrived.wait(lock, [&] { return Cancelled || !Backward.empty() || (!Forward.empty() && Forward.front() <= limit); });
+			if (Cancelled)
+				return false;
+			backward = !Backward.empty();
+			auto& queue = backward ? Backward : Forward;
+			batch = queue.front();
+			queue.pop_front();
+			return true;
+		}
+	};
+
+	// ステージごとのスレッドプールを返す。構成が変わった場合にのみ作り直す
+	std::vector<std::unique_ptr<ThreadPool>>& StagePools(size_t stages, unsigned int threadsPerStage, ThreadAffinity affinity)
+	{
+		if (stagePools.size() != stages || stagePoolThreads != threadsPerStage || stagePoolAffinity != affinity)
+		{
+			stagePools.clear();
+			for (size_t s = 0; s < stages; s++)
+				stagePools.push_back(std::unique_ptr<ThreadPool>(new ThreadPool(ThreadPoolOptions(threadsPerStage, affinity, static_cast<unsigned int>(s) * threadsPerStage))));
+			stagePoolThreads = threadsPerStage;
+			stagePoolAffinity = affinity;
+		}
+		return stagePools;
+	}
+
+	// 層の結合重みを枝刈りし、0 である結合重みをマスクに記録してそのオプティマイザの状態を破棄する
+	template <class TLayer> static size_t PruneLayer(TLayer& layer, double sparsity)
+	{
+		auto zeros = PruneByMagnitude(layer.Weight, sparsity);
+		auto data = layer.Weight.Data();
+		layer.WeightMask.resize(layer.Weight.Row() * layer.Weight.Column());
+		for (size_t k = 0; k < layer.WeightMask.size(); k++)
+			layer.WeightMask[k] = data[k] != 0 ? static_cast<TValue>(1) : static_cast<TValue>(0);
+		layer.Optimizer().Weight->Discard(layer.WeightMask);
+		return zeros;
+	}
+
+	// 層 [first, last) の順伝播を行う。出力層の番号は HiddenLayers.Count() とする
+	void Forward(std::vector<ReferableVector<TValue>>& inputs, size_t first, size_t last) const
+	{
+		for (auto n = first; n < last; n++)
+			inputs[n + 1] = n < HiddenLayers.Count() ? HiddenLayers[n].Compute(inputs[n]) : outputLayer->Compute(inputs[n]);
+	}
+
+	// 出力層の出力をラベルと比べて統計に加え、そのデータ点のコストを返す
+	TValue Record(const std::vector<ReferableVector<TValue>>& inputs, unsigned int label, std::valarray<TValue>& target, FineTuningStatistics<TValue>& statistics) const
+	{
+		auto& output = inputs[HiddenLayers.Count() + 1].target();
+		target[label] = 1;
+		auto loss = TOutputLayer::ComputeCost(output, target);
+		target[label] = 0;
+		statistics.Loss += loss;
+		if (TOutputLayer::Classify(output) != label)
+			statistics.Misclassifications++;
+		statistics.Samples++;
+		return loss;
+	}
+
+	// 層 [first, last) の逆伝播を上の層から順に行い、層 first の下位層の学習に必要な情報を返す
+	// 出力層の教師信号 target は添字演算子で各出力素子の目標値を返す
+	template <class TTarget> std::valarray<TValue> Backward(const std::vector<ReferableVector<TValue>>& inputs, const TTarget& target, std::valarray<TValue> lowerInfo, size_t first, size_t last, TValue learningRate)
+	{
+		for (auto n = last; n-- > first; )
+		{
+			if (n < HiddenLayers.Count())
+				lowerInfo = LearnLayer(HiddenLayers[n], inputs[n].target(), inputs[n + 1].target(), lowerInfo, learningRate);
+			else
+				lowerInfo = LearnLayer(*outputLayer, inputs[n].target(), inputs[n + 1].target(), target, learningRate);
+		}
+		return lowerInfo;
+	}
+
+	// 結合重みの要素数がほぼ均等になるように層を連続したステージに分け、各ステージの最初の層の番号と末尾を返す
+	std::vector<size_t> PartitionStages(size_t stages) const
+	{
+		auto layers = HiddenLayers.Count() + 1;
+		std::vector<double> costs(layers);
+		for (size_t n = 0; n < HiddenLayers.Count(); n++)
+			costs[n] = static_cast<double>(HiddenLayers[n].Weight.Row() * HiddenLayers[n].Weight.Column());
+		costs[layers - 1] = static_cast<double>(outputLayer->Weight.Row() * outputLayer->Weight.Column());
+		auto total = std::accumulate(costs.begin(), costs.end(), 0.0);
+		std::vector<size_t> bounds(1, 0);
+		double accumulated = 0;
+		for (size_t n = 0; n + 1 < layers; n++)
+		{
+			accumulated += costs[n];
+			if (bounds.size() < stages && (accumulated >= total * bounds.size() / stages || layers - (n + 1) == stages - bounds.size()))
+				bounds.push_back(n + 1);
+		}
+		bounds.push_back(layers);
+		return bounds;
+	}
+
+	template <class TSelf, class TFunc> static void ForEachParameterBlock(TSelf& self, TFunc func)
+	{
+		for (size_t i = 0; i < self.HiddenLayers.Count(); i++)
+		{
+			auto& layer = self.HiddenLayers[i];
+			func(layer.Weight.Data(), layer.Weight.Row() * layer.Weight.Column());
+			func(&layer.Bias[0], layer.Bias.size());
+			func(&layer.VisibleBias[0], layer.VisibleBias.size());
+		}
+		if (self.outputLayer)
+		{
+			auto& layer = *self.outputLayer;
+			func(layer.Weight.Data(), layer.Weight.Row() * layer.Weight.Column());
+			func(&layer.Bias[0], layer.Bias.size());
+		}
+	}
 };
 
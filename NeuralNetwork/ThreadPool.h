@@ -0,0 +1,268 @@
+﻿#pragma once
+
+#include "Platform.h"
+
+/// <summary>ワーカースレッドを論理プロセッサに固定する方法を表します。</summary>
+enum class ThreadAffinity
+{
+	/// <summary>固定せず、オペレーティングシステムのスケジューラに任せます。</summary>
+	None,
+	/// <summary>ワーカーを論理プロセッサの番号順に詰めて固定します。同じソケットのキャッシュを共有します。</summary>
+	Compact,
+	/// <summary>ワーカーをソケット間で交互に固定します。メモリ帯域をすべてのソケットから使用します。</summary>
+	Scatter,
+};
+
+/// <summary><see cref="ThreadPool"/> の構成を表します。</summary>
+struct ThreadPoolOptions final
+{
+	ThreadPoolOptions(unsigned int threads = 0, ThreadAffinity affinity = ThreadAffinity::None, unsigned int firstProcessor = 0, bool pinCallingThread = false) : Threads(threads), Affinity(affinity), FirstProcessor(firstProcessor), PinCallingThread(pinCallingThread) { }
+
+	/// <summary>呼び出し元のスレッドを含む並列度を示します。0 の場合は論理プロセッサ数が使用されます。</summary>
+	unsigned int Threads;
+	/// <summary>ワーカースレッドの固定方法を示します。</summary>
+	ThreadAffinity Affinity;
+	/// <summary>固定先の並びの中で最初に使用する位置を示します。複数のスレッドプールに異なるコアを割り当てる場合に使用します。</summary>
+	unsigned int FirstProcessor;
+	/// <summary>スレッドプールを作成したスレッドも固定するかどうかを示します。</summary>
+	bool PinCallingThread;
+};
+
+/// <summary>
+/// 常駐するワーカースレッドによって範囲を分割して並列に処理するスレッドプールを表します。
+/// 範囲は常に同じ方法でワーカーに静的に割り当てられるため、同じ形状の処理では各ワーカーが毎回同じ結合重みの行を処理し、そのデータはワーカーのキャッシュに留まりやすくなります。
+/// メモリは最初に書き込んだスレッドのノードに置かれるため、隠れ層の結合重みは順伝播と同じ区間長で各ワーカーが行ごとに 0 に初期化し、読み込まれた画像は書き込むワーカーが確保します。
+/// これにより、ワーカーを固定した場合は各ワーカーが順伝播で読む行とデコードする画像がそのワーカーのノードのメモリに置かれます。ノードを明示したメモリの確保は行いません。
+/// </summary>
+class ThreadPool final : private boost::noncopyable
+{
+public:
+	/// <summary>指定された構成で <see cref="ThreadPool"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="options">スレッド数と固定方法を指定します。</param>
+	explicit ThreadPool(const ThreadPoolOptions& options = ThreadPoolOptions()) : callerProcessor(-1), generation(0), remaining(0), sleepers(0), stopping(false), invoke(nullptr), context(nullptr), count(0), tasks(0)
+	{
+		auto threads = options.Threads > 0 ? options.Threads : Platform::ProcessorCount();
+		auto processors = ProcessorOrder(options.Affinity);
+		if (options.Affinity != ThreadAffinity::None)
+			callerProcessor = static_cast<int>(processors[options.FirstProcessor % processors.size()]);
+		if (options.PinCallingThread)
+			PinCallingThread();
+		for (unsigned int i = 1; i < threads; i++)
+		{
+			workers.emplace_back([this, i, &processors, &options]
+			{
+				if (options.Affinity != ThreadAffinity::None)
+					Platform::PinCurrentThread(processors[(options.FirstProcessor + i) % processors.size()]);
+				Work(i);
+			});
+		}
+		// ワーカーが固定を終えるまで processors と options を生存させる
+		tasks = 0;
+		WaitAll();
+		while (remaining.load(std::memory_order_acquire) > 0)
+			std::this_thread::yield();
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+			generation++;
+		}
+		wakeUp.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	/// <summary>呼び出し元のスレッドを含む並列度を取得します。</summary>
+	unsigned int Threads() const { return static_cast<unsigned int>(workers.size()) + 1; }
+
+	/// <summary>呼び出し元のスレッドを、このスレッドプールで呼び出し元のスレッドに割り当てられた論理プロセッサに固定します。固定しない構成の場合は何もしません。</summary>
+	void PinCallingThread() const
+	{
+		if (callerProcessor >= 0)
+			Platform::PinCurrentThread(static_cast<unsigned int>(callerProcessor));
+	}
+
+	/// <summary>
+	/// 範囲 [0, <paramref name="length"/>) を連続した区間に分割し、各区間に対して <paramref name="body"/> を並列に呼び出します。
+	/// 区間の 1 つは呼び出し元のスレッドで処理されます。範囲が小さい場合やワーカーの中から呼び出された場合は、呼び出し元のスレッドで範囲全体を処理します。
+	/// </summary>
+	/// <param name="length">処理する範囲の長さを指定します。</param>
+	/// <param name="grain">1 つの区間に含める最小の要素数を指定します。</param>
+	/// <param name="body">区間の開始位置と終了位置を受け取る関数を指定します。</param>
+	template <class TBody> void ParallelFor(size_t length, size_t grain, const TBody& body)
+	{
+		auto taskCount = (std::min)(length / (std::max)(grain, static_cast<size_t>(1)), static_cast<size_t>(Threads()));
+		if (taskCount <= 1 || InsideTask())
+		{
+			if (length > 0)
+				body(static_cast<size_t>(0), length);
+			return;
+		}
+		std::lock_guard<std::mutex> submit(submitMutex);
+		invoke = [](const void* target, size_t begin, size_t end) { (*static_cast<const TBody*>(target))(begin, end); };
+		context = &body;
+		count = length;
+		tasks = taskCount;
+		error = nullptr;
+		WaitAll();
+		RunTask(0);
+		while (remaining.load(std::memory_order_acquire) > 0)
+			std::this_thread::yield();
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	/// <summary>プロセス全体で共有されるスレッドプールを取得します。</summary>
+	static ThreadPool& Global() { return *GlobalInstance(); }
+
+	/// <summary>呼び出し元のスレッドで使用されるスレッドプールを取得します。<see cref="Scope"/> によって指定されていない場合は共有のスレッドプールを返します。</summary>
+	static ThreadPool& Current()
+	{
+		auto pool = CurrentOverride();
+		return pool ? *pool : Global();
+	}
+
+	/// <summary>存続期間中、呼び出し元のスレッドで使用されるスレッドプールを置き換えます。</summary>
+	class Scope final : private boost::noncopyable
+	{
+	public:
+		explicit Scope(ThreadPool& pool) : previous(CurrentOverride()) { CurrentOverride() = &pool; }
+		~Scope() { CurrentOverride() = previous; }
+
+	private:
+		ThreadPool* previous;
+	};
+
+	/// <summary>プロセス全体で共有されるスレッドプールを指定された構成で作り直します。並列処理の実行中に呼び出してはなりません。</summary>
+	/// <param name="options">スレッド数と固定方法を指定します。</param>
+	static void Configure(const ThreadPoolOptions& options)
+	{
+		GlobalInstance().reset();
+		GlobalInstance() = std::unique_ptr<ThreadPool>(new ThreadPool(options));
+	}
+
+private:
+	static const unsigned int SpinCount = 1 << 14;
+
+	std::vector<std::thread> workers;
+	int callerProcessor;
+	std::mutex submitMutex;
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+	std::atomic<size_t> generation;
+	std::atomic<size_t> remaining;
+	std::atomic<unsigned int> sleepers;
+	std::atomic<bool> stopping;
+	std::mutex errorMutex;
+	std::exception_ptr error;
+
+	void (*invoke)(const void*, size_t, size_t);
+	const void* context;
+	size_t count;
+	size_t tasks;
+
+	static std::unique_ptr<ThreadPool>& GlobalInstance()
+	{
+		static std::unique_ptr<ThreadPool> instance(new ThreadPool());
+		return instance;
+	}
+
+	static ThreadPool*& CurrentOverride()
+	{
+		static thread_local ThreadPool* pool = nullptr;
+		return pool;
+	}
+
+	static bool& InsideTask()
+	{
+		static thread_local bool inside = false;
+		return inside;
+	}
+
+	static std::vector<unsigned int> ProcessorOrder(ThreadAffinity affinity)
+	{
+		std::vector<unsigned int> processors(Platform::ProcessorCount());
+		for (unsigned int i = 0; i < processors.size(); i++)
+			processors[i] = i;
+		if (affinity == ThreadAffinity::Scatter)
+		{
+			// 各ソケット内での順位をキーとして並べ替えることで、ソケットを交互に巡回する
+			std::vector<unsigned int> packages(processors.size()), ranks(processors.size());
+			std::vector<unsigned int> seen;
+			for (auto p : processors)
+			{
+				packages[p] = Platform::ProcessorPackage(p);
+				ranks[p] = static_cast<unsigned int>(std::count(seen.begin(), seen.end(), packages[p]));
+				seen.push_back(packages[p]);
+			}
+			std::stable_sort(processors.begin(), processors.end(), [&](unsigned int x, unsigned int y) { return ranks[x] != ranks[y] ? ranks[x] < ranks[y] : packages[x] < packages[y]; });
+		}
+		return processors;
+	}
+
+	// すべてのワーカーに新しい世代を通知し、各ワーカーの応答を待つ準備をする
+	void WaitAll()
+	{
+		remaining.store(workers.size(), std::memory_order_relaxed);
+		generation.fetch_add(1);
+		if (sleepers.load() > 0)
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			wakeUp.notify_all();
+		}
+	}
+
+	void RunTask(size_t task)
+	{
+		if (task >= tasks)
+			return;
+		InsideTask() = true;
+		try
+		{
+			invoke(context, count * task / tasks, count * (task + 1) / tasks);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if (!error)
+				error = std::current_exception();
+		}
+		InsideTask() = false;
+	}
+
+	void Work(size_t index)
+	{
+		size_t seen = 0;
+		while (true)
+		{
+			auto current = generation.load(std::memory_order_acquire);
+			for (unsigned int spin = 0; current == seen && spin < SpinCount; spin++)
+			{
+				std::this_thread::yield();
+				current = generation.load(std::memory_order_acquire);
+			}
+			if (current == seen)
+			{
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleepers++;
+				wakeUp.wait(lock, [&] { return generation.load() != seen; });
+				sleepers--;
+				current = generation.load();
+			}
+			seen = current;
+			if (stopping)
+				return;
+			RunTask(index);
+			remaining.fetch_sub(1, std::memory_order_release);
+		}
+	}
+};
+
+/// <summary>呼び出し元のスレッドで使用されるスレッドプールを使用して範囲を並列に処理します。</summary>
+/// <param name="length">処理する範囲の長さを指定します。</param>
+/// <param name="grain">1 つの区間に含める最小の要素数を指定します。</param>
+/// <param name="body">区間の開始位置と終了位置を受け取る関数を指定します。</param>
+template <class TBody> void ParallelFor(size_t length, size_t grain, const TBody& body) { ThreadPool::Current().ParallelFor(length, grain, body); }
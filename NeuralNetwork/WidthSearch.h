@@ -0,0 +1,158 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+/// <summary>隠れ層のニューロン数の探索方法を表します。</summary>
+struct WidthSearchOptions final
+{
+	WidthSearchOptions(unsigned int initial = 25, double growth = 2, unsigned int resolution = 25, unsigned int maxWidth = 100000, unsigned int concurrency = 1) :
+		Initial(initial), Growth(growth), Resolution(resolution), MaxWidth(maxWidth), Concurrency(concurrency) { }
+
+	/// <summary>最初に評価するニューロン数を示します。</summary>
+	unsigned int Initial;
+	/// <summary>区間を探す段階でニューロン数を何倍ずつ大きくするかを示します。</summary>
+	double Growth;
+	/// <summary>区間を絞り込む段階を終える区間の幅を示します。</summary>
+	unsigned int Resolution;
+	/// <summary>評価するニューロン数の上限を示します。</summary>
+	unsigned int MaxWidth;
+	/// <summary>1 回の評価で同時に要求するニューロン数の最大数を示します。</summary>
+	unsigned int Concurrency;
+};
+
+/// <summary>評価を要求されたニューロン数を表します。</summary>
+template <class TCost> struct WidthCandidate final
+{
+	WidthCandidate(unsigned int neurons, unsigned int referenceNeurons, TCost referenceCost) : Neurons(neurons), ReferenceNeurons(referenceNeurons), ReferenceCost(referenceCost) { }
+
+	/// <summary>評価するニューロン数を示します。</summary>
+	unsigned int Neurons;
+	/// <summary>収束の判定でコストを比較する相手のニューロン数を示します。比較する相手がない場合は 0 です。</summary>
+	unsigned int ReferenceNeurons;
+	/// <summary>比較する相手のコストを示します。相手のコストが同じ要求の中で評価される場合や相手がない場合は NaN です。</summary>
+	TCost ReferenceCost;
+};
+
+/// <summary>
+/// ニューロン数あたりのコストの変化量が閾値以下になる最小のニューロン数 (コストの曲線の屈曲点) を探索します。
+/// まずニューロン数を等比的に大きくして、変化量が閾値を下回る隣り合った 2 点で屈曲点を挟みます。
+/// 次に区間を二分し、中点から区間の上端までの変化量が閾値以下であれば上端を、そうでなければ下端を中点に移して、幅が分解能以下になるまで絞り込みます。
+/// 評価の回数は等差的にニューロン数を増やす場合の O(幅 / 増分) から O(log 幅) に減り、一度評価したニューロン数のコストは再利用されます。
+/// 同時評価数が 2 以上の場合、区間を探す段階では続く複数のニューロン数を先行して要求し、絞り込む段階では区間を等分する複数の点を要求します。
+/// </summary>
+template <class TCost> class WidthSearch final : private boost::noncopyable
+{
+public:
+	/// <summary>ニューロン数の組を評価し、要求と同じ順序でコストを返す関数を表します。</summary>
+	typedef std::function<std::vector<TCost>(const std::vector<WidthCandidate<TCost>>&)> Evaluator;
+
+	/// <summary><see cref="WidthSearch"/> クラスの新しいインスタンスを初期化します。</summary>
+	/// <param name="options">探索の開始点、倍率、分解能、上限および同時評価数を指定します。</param>
+	/// <param name="threshold">収束したと判定するニューロン数あたりのコストの変化量の絶対値の上限を指定します。</param>
+	/// <param name="evaluate">ニューロン数の組を評価する関数を指定します。</param>
+	WidthSearch(const WidthSearchOptions& options, TCost threshold, Evaluator evaluate) : options(options), threshold(threshold), evaluate(std::move(evaluate)), evaluations(0) { }
+
+	/// <summary>屈曲点を探索し、選ばれたニューロン数を返します。上限まで収束しなかった場合は評価された最大のニューロン数を返します。</summary>
+	unsigned int Run()
+	{
+		auto maxWidth = (std::max)(options.MaxWidth, 1u);
+		auto concurrency = (std::max)(options.Concurrency, 1u);
+		// 等比数列の隣り合う 2 点で収束するまで、続く点を同時評価数ずつ要求する
+		std::vector<unsigned int> sequence(1, (std::min)((std::max)(options.Initial, 1u), maxWidth));
+		unsigned int lower = 0, upper = 0;
+		for (size_t next = 0; upper == 0; )
+		{
+			while (sequence.size() < next + concurrency && sequence.back() < maxWidth)
+				sequence.push_back((std::min)((std::max)(static_cast<unsigned int>(std::lround(sequence.back() * options.Growth)), sequence.back() + 1), maxWidth));
+			if (next >= sequence.size())
+				return sequence.back();
+			std::vector<WidthCandidate<TCost>> candidates;
+			for (auto n = next; n < sequence.size() && n < next + concurrency; n++)
+				candidates.push_back(Candidate(sequence[n], n > 0 ? sequence[n - 1] : 0));
+			Evaluate(candidates);
+			for (auto end = next + candidates.size(); next < end && upper == 0; next++)
+			{
+				if (next > 0 && Converged(sequence[next - 1], sequence[next]))
+				{
+					lower = sequence[next - 1];
+					upper = sequence[next];
+				}
+			}
+		}
+		// 中点から上端までの変化量が閾値以下であれば屈曲点は中点以下にあるとみなす
+		while (upper - lower > (std::max)(options.Resolution, 1u))
+		{
+			std::vector<WidthCandidate<TCost>> candidates;
+			for (unsigned int k = 1; k <= concurrency; k++)
+			{
+				auto point = lower + static_cast<unsigned int>(static_cast<unsigned long long>(upper - lower) * k / (concurrency + 1));
+				if (point > lower && point < upper && (candidates.empty() || candidates.back().Neurons != point))
+					candidates.push_back(Candidate(point, upper));
+			}
+			if (candidates.empty())
+				break;
+			Evaluate(candidates);
+			auto newUpper = upper, newLower = lower;
+			for (auto& candidate : candidates)
+			{
+				if (Converged(candidate.Neurons, upper))
+				{
+					newUpper = candidate.Neurons;
+					break;
+				}
+				newLower = candidate.Neurons;
+			}
+			lower = newLower;
+			upper = newUpper;
+		}
+		return upper;
+	}
+
+	/// <summary>評価されたニューロン数とそのコストを取得します。</summary>
+	const std::map<unsigned int, TCost>& Costs() const { return costs; }
+
+	/// <summary>評価を要求した回数を返します。</summary>
+	size_t Evaluations() const { return evaluations; }
+
+private:
+	WidthSearchOptions options;
+	TCost threshold;
+	Evaluator evaluate;
+	std::map<unsigned int, TCost> costs;
+	size_t evaluations;
+
+	WidthCandidate<TCost> Candidate(unsigned int neurons, unsigned int referenceNeurons) const
+	{
+		auto found = costs.find(referenceNeurons);
+		return WidthCandidate<TCost>(neurons, referenceNeurons, found != costs.end() ? found->second : std::numeric_limits<TCost>::quiet_NaN());
+	}
+
+	// 評価済みのニューロン数を除いて評価し、結果を記録する
+	void Evaluate(const std::vector<WidthCandidate<TCost>>& candidates)
+	{
+		std::vector<WidthCandidate<TCost>> pending;
+		for (auto& candidate : candidates)
+		{
+			if (costs.find(candidate.Neurons) == costs.end())
+				pending.push_back(candidate);
+		}
+		if (pending.empty())
+			return;
+		auto results = evaluate(pending);
+		if (results.size() != pending.size())
+			throw std::logic_error("the evaluator must return a cost for every candidate");
+		for (size_t c = 0; c < pending.size(); c++)
+			costs[pending[c].Neurons] = results[c];
+		evaluations += pending.size();
+	}
+
+	bool Converged(unsigned int lower, unsigned int upper) const { return std::abs(costs.at(upper) - costs.at(lower)) / (upper - lower) <= threshold; }
+};
@@ -1,34 +1,63 @@
-#pragma once
+﻿#pragma once
 
 // Standard C++ Libraries
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <random>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <valarray>
 #include <vector>
 
 // Standard C Libraries for C++
 
+#include <cassert>
+#include <cerrno>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 
 // Standard C Libraries
 
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <Windows.h>
+#include <Psapi.h>
 #include <direct.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 // Boost
 
 #include <boost/core/noncopyable.hpp>
-#include <boost/format.hpp>
-#include <boost/iostreams/tee.hpp>
-#include <boost/iostreams/stream.hpp>
\ No newline at end of file
+#include <boost/format.hpp>
\ No newline at end of file
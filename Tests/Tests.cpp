@@ -0,0 +1,284 @@
+﻿#include "SparseMatrix.h"
+#include "LearningSet.h"
+#include "LayerCache.h"
+#include "ProgressiveEvaluation.h"
+#include "Distillation.h"
+#include "Sampler.h"
+#include "WidthSearch.h"
+
+// 失敗した検査を数え、最後に終了コードとして返します。
+unsigned int failures = 0;
+
+void Check(bool condition, const std::string& description)
+{
+	if (condition)
+		return;
+	failures++;
+	std::cerr << "FAILED: " << description << std::endl;
+}
+
+bool Near(double actual, double expected, double tolerance) { return std::abs(actual - expected) <= tolerance * (std::max)(1.0, std::abs(expected)); }
+
+// 1 要素の画像に値を持つデータセットを作成します。
+DataSet<double> ScalarDataSet(const std::vector<double>& values)
+{
+	DataSet<double> dataset;
+	dataset.Allocate(values.size(), 1, 1, 1);
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		dataset.Images()[i][0] = values[i];
+		dataset.Labels()[i] = static_cast<unsigned int>(i % 3);
+	}
+	return dataset;
+}
+
+
+void TestSparseMatrixMultiply()
+{
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> value(-1, 1);
+	const size_t rows = 37, columns = 53, batch = 5;
+	Matrix<double> dense(rows, columns);
+	for (size_t i = 0; i < rows; i++)
+	{
+		for (size_t k = 0; k < columns; k++)
+			dense(i, k) = std::abs(value(rng)) < 0.6 ? 0 : value(rng);
+	}
+	SparseMatrix<double> sparse(dense);
+	std::vector<double> input(columns * batch), output(rows * batch, 0.5), expected(rows * batch, 0.5);
+	for (auto& x : input)
+		x = value(rng);
+	for (size_t i = 0; i < rows; i++)
+	{
+		for (size_t b = 0; b < batch; b++)
+		{
+			for (size_t k = 0; k < columns; k++)
+				expected[i * batch + b] += dense(i, k) * input[k * batch + b];
+		}
+	}
+	// 行の範囲を分けて計算しても全体と一致する
+	sparse.MultiplyAdd(input.data(), batch, output.data(), 0, 20);
+	sparse.MultiplyAdd(input.data(), batch, output.data(), 20, rows);
+	auto matches = true;
+	for (size_t j = 0; j < output.size(); j++)
+		matches = matches && Near(output[j], expected[j], 1e-12);
+	Check(matches, "SparseMatrix::MultiplyAdd matches the dense product");
+
+	std::vector<double> vector(columns);
+	for (auto& x : vector)
+		x = value(rng);
+	matches = true;
+	for (size_t i = 0; i < rows; i++)
+	{
+		double dot = 0;
+		for (size_t k = 0; k < columns; k++)
+			dot += dense(i, k) * vector[k];
+		matches = matches && Near(sparse.RowDot(i, vector.data()), dot, 1e-12);
+	}
+	Check(matches, "SparseMatrix::RowDot matches the dense product");
+
+	size_t nonZero = 0;
+	for (size_t i = 0; i < rows; i++)
+	{
+		for (size_t k = 0; k < columns; k++)
+			nonZero += dense(i, k) != 0 ? 1 : 0;
+	}
+	Check(sparse.NonZeroCount() == nonZero, "SparseMatrix keeps every non-zero element");
+	Check(Near(sparse.Sparsity(), 1 - static_cast<double>(nonZero) / (rows * columns), 1e-12), "SparseMatrix::Sparsity is the fraction of zero elements");
+}
+
+void TestRecordSelectionResolve()
+{
+	Check(RecordSelection(DataSetFile::Training).Resolve(4) == std::vector<size_t>({ 0, 1, 2, 3 }), "RecordSelection selects every record by default");
+	Check(RecordSelection(DataSetFile::Training).Resolve(0).empty(), "RecordSelection of an empty file is empty");
+	Check(RecordSelection::Range(DataSetFile::Test, 2, 3).Resolve(5) == std::vector<size_t>({ 2, 3, 4 }), "RecordSelection::Range resolves to consecutive records");
+	Check(RecordSelection::Range(DataSetFile::Test, 5, 0).Resolve(5).empty(), "RecordSelection::Range may be empty at the end of the file");
+	Check(RecordSelection::Of(DataSetFile::Validation, { 4, 0, 4 }).Resolve(5) == std::vector<size_t>({ 4, 0, 4 }), "RecordSelection::Of keeps the order and duplicates");
+	Check(RecordSelection::Of(DataSetFile::Validation, { 1 }).File() == DataSetFile::Validation, "RecordSelection keeps the file");
+
+	auto throws = [](const RecordSelection& selection, size_t length)
+	{
+		try
+		{
+			selection.Resolve(length);
+			return false;
+		}
+		catch (const std::out_of_range&)
+		{
+			return true;
+		}
+	};
+	Check(throws(RecordSelection::Range(DataSetFile::Training, 3, 3), 5), "RecordSelection::Range rejects a range past the end");
+	Check(throws(RecordSelection::Range(DataSetFile::Training, 6, 0), 5), "RecordSelection::Range rejects a start past the end");
+	Check(throws(RecordSelection::Of(DataSetFile::Training, { 0, 5 }), 5), "RecordSelection::Of rejects an index past the end");
+}
+
+void TestContentHash()
+{
+	// FNV-1a の参照値
+	Check(ContentHash().Value() == 0xcbf29ce484222325ull, "ContentHash of nothing is the FNV-1a offset basis");
+	Check(ContentHash().AddBytes("a", 1).Value() == 0xaf63dc4c8601ec8cull, "ContentHash of \"a\" matches FNV-1a");
+	Check(ContentHash().AddBytes("foobar", 6).Value() == 0x85944171f73967e8ull, "ContentHash of \"foobar\" matches FNV-1a");
+	Check(ContentHash().AddBytes("foobar", 6).ToString() == "85944171f73967e8", "ContentHash::ToString prints 16 hexadecimal digits");
+
+	Check(ContentHash().Add(std::string("ab")).Add(std::string("c")).Value() != ContentHash().Add(std::string("a")).Add(std::string("bc")).Value(), "ContentHash separates strings by their lengths");
+	Check(ContentHash().Add(1u).Add(2u).Value() != ContentHash().Add(2u).Add(1u).Value(), "ContentHash depends on the order");
+
+	auto first = ScalarDataSet({ 0.25, 0.5, 0.75 });
+	auto second = ScalarDataSet({ 0.25, 0.5, 0.75 });
+	Check(ContentHash().Add(DataSetView<double>(first)).Value() == ContentHash().Add(DataSetView<double>(second)).Value(), "ContentHash of equal datasets is equal");
+	second.Labels()[1] = 2;
+	Check(ContentHash().Add(DataSetView<double>(first)).Value() != ContentHash().Add(DataSetView<double>(second)).Value(), "ContentHash depends on the labels");
+	Matrix<double> matrix(2, 3), reshaped(3, 2);
+	std::fill(matrix.Data(), matrix.Data() + 6, 1.0);
+	std::fill(reshaped.Data(), reshaped.Data() + 6, 1.0);
+	Check(ContentHash().Add(matrix).Value() != ContentHash().Add(reshaped).Value(), "ContentHash depends on the shape of a matrix");
+}
+
+void TestProgressiveEstimate()
+{
+	std::mt19937 valueRng(2);
+	std::uniform_real_distribution<double> value(0, 10);
+	std::vector<double> values(1000);
+	for (auto& x : values)
+		x = value(valueRng);
+	auto dataset = ScalarDataSet(values);
+	auto exact = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+	auto evaluate = [](const DataSetView<double>& sample)
+	{
+		double sum = 0;
+		for (size_t i = 0; i < sample.Count(); i++)
+			sum += sample.Image(i)[0];
+		return sum / sample.Count();
+	};
+
+	// 区間の幅が 0 で信頼区間が常に区間の端を含む場合は、すべてのデータ点を評価して全体のコストと一致する
+	std::mt19937 rng(3);
+	auto estimate = EstimateProgressively(DataSetView<double>(dataset), exact, exact, ProgressiveEvaluationOptions(10, 2, 1e-12), rng, evaluate);
+	Check(!estimate.Settled && estimate.Samples == values.size(), "EstimateProgressively evaluates every data point when the decision never settles");
+	Check(Near(estimate.Mean, exact, 1e-12) && estimate.HalfWidth == 0, "EstimateProgressively equals the exact cost after a full pass");
+
+	// 最初の段階がデータセット全体を覆う場合も同じ
+	estimate = EstimateProgressively(DataSetView<double>(dataset), 0.0, 10.0, ProgressiveEvaluationOptions(values.size(), 2, 0.01), rng, evaluate);
+	Check(!estimate.Settled && estimate.Samples == values.size() && Near(estimate.Mean, exact, 1e-12), "EstimateProgressively with a single stage equals the exact cost");
+
+	// 区間から明らかに外れる場合は途中で打ち切る
+	estimate = EstimateProgressively(DataSetView<double>(dataset), 100.0, 101.0, ProgressiveEvaluationOptions(10, 2, 0.01), rng, evaluate);
+	Check(estimate.Settled && estimate.Samples < values.size(), "EstimateProgressively stops early when the cost is far outside the interval");
+
+	estimate = EstimateProgressively(DataSetView<double>(), 0.0, 1.0, ProgressiveEvaluationOptions(), rng, evaluate);
+	Check(estimate.Samples == 0 && !estimate.Settled, "EstimateProgressively of an empty dataset evaluates nothing");
+	Check(Near(TwoSidedNormalQuantile(0.05), 1.959964, 1e-5) && Near(TwoSidedNormalQuantile(0.01), 2.575829, 1e-5), "TwoSidedNormalQuantile matches the normal table");
+}
+
+void TestSoften()
+{
+	std::valarray<double> probabilities { 0.7, 0.2, 0.1 }, result(3);
+	SoftTargetCache<double>::Soften(probabilities, 1, result);
+	auto same = true;
+	for (size_t i = 0; i < 3; i++)
+		same = same && Near(result[i], probabilities[i], 1e-12);
+	Check(same, "SoftTargetCache::Soften at temperature 1 keeps the distribution");
+
+	// 温度 T では p_i^(1/T) を正規化した分布になる
+	SoftTargetCache<double>::Soften(probabilities, 2, result);
+	auto normalizer = std::sqrt(0.7) + std::sqrt(0.2) + std::sqrt(0.1);
+	auto matches = true;
+	for (size_t i = 0; i < 3; i++)
+		matches = matches && Near(result[i], std::sqrt(probabilities[i]) / normalizer, 1e-12);
+	Check(matches && Near(result.sum(), 1, 1e-12), "SoftTargetCache::Soften raises the probabilities to 1 / T and normalizes them");
+	Check(result[0] < probabilities[0] && result[2] > probabilities[2], "SoftTargetCache::Soften flattens the distribution");
+
+	// 確率が 0 の要素があっても有限の値になる
+	std::valarray<double> certain { 1, 0, 0 };
+	SoftTargetCache<double>::Soften(certain, 4, result);
+	Check(std::isfinite(result[1]) && Near(result.sum(), 1, 1e-12) && result[0] > 0.99, "SoftTargetCache::Soften handles zero probabilities");
+}
+
+void TestImportanceSamplerWeights()
+{
+	const size_t count = 200;
+	std::vector<double> values(count);
+	auto dataset = ScalarDataSet(values);
+	DataSetView<double> view(dataset);
+	// 全体を処理するのは最初のエポックのみとし、抽出するデータ点の数を全体と同じにする
+	ImportanceSampler<double> sampler(view, ImportanceSamplingOptions(1.0, 0.2, 0), 4);
+	auto sampled = sampler.NextEpoch();
+	Check(sampler.FullPass() && sampler.Weights().size() == count && sampler.Weights().min() == 1 && sampler.Weights().max() == 1, "ImportanceSampler weighs a full pass uniformly");
+
+	// 抽出確率が損失に比例するように、データ点ごとに固定された損失を記録し続ける
+	std::valarray<double> losses(count);
+	for (size_t i = 0; i < count; i++)
+		losses[i] = i < 10 ? 50.0 : 0.1 + (i % 7);
+	const unsigned int epochs = 2000;
+	double total = 0;
+	auto bounded = true;
+	for (unsigned int epoch = 0; epoch < epochs; epoch++)
+	{
+		std::valarray<double> epochLosses(sampler.Weights().size());
+		for (size_t j = 0; j < epochLosses.size(); j++)
+			epochLosses[j] = losses[sampled.StorageIndex(j)];
+		sampler.Update(epochLosses);
+		sampled = sampler.NextEpoch();
+		total += sampler.Weights().sum();
+		bounded = bounded && sampler.Weights().max() <= 1 / 0.2 + 1e-9;
+	}
+	Check(!sampler.FullPass(), "ImportanceSampler samples after the first epoch when FullPassInterval is 0");
+	Check(Near(total / epochs, static_cast<double>(count), 0.03), "ImportanceSampler weights sum to the dataset size in expectation: " + std::to_string(total / epochs));
+	Check(bounded, "ImportanceSampler weights are bounded by 1 / UniformMix");
+}
+
+void TestWidthSearch()
+{
+	// コストが 1000 / n の曲線では、変化量 1000 / (a b) が閾値 0.01 以下になるのはおよそ n = 316 以上
+	auto curve = [](unsigned int neurons) { return 1000.0 / neurons; };
+	for (unsigned int concurrency = 1; concurrency <= 3; concurrency++)
+	{
+		std::vector<unsigned int> requested;
+		WidthSearch<double> search(WidthSearchOptions(25, 2, 10, 100000, concurrency), 0.01, [&](const std::vector<WidthCandidate<double>>& candidates)
+		{
+			std::vector<double> costs;
+			for (auto& candidate : candidates)
+			{
+				requested.push_back(candidate.Neurons);
+				costs.push_back(curve(candidate.Neurons));
+			}
+			return costs;
+		});
+		auto neurons = search.Run();
+		auto suffix = " (concurrency " + std::to_string(concurrency) + ")";
+		Check(neurons >= 300 && neurons <= 460, "WidthSearch finds the knee of the curve" + suffix + ": " + std::to_string(neurons));
+		Check(search.Evaluations() == requested.size() && search.Costs().size() == requested.size(), "WidthSearch evaluates each width once" + suffix);
+		Check(search.Evaluations() < 40, "WidthSearch needs a logarithmic number of evaluations" + suffix);
+		auto lower = search.Costs().lower_bound(neurons);
+		Check(lower != search.Costs().end() && lower->first == neurons, "WidthSearch returns an evaluated width" + suffix);
+	}
+
+	// 上限まで収束しなければ上限を返す
+	WidthSearch<double> capped(WidthSearchOptions(25, 2, 10, 150, 1), 1e-9, [&](const std::vector<WidthCandidate<double>>& candidates)
+	{
+		std::vector<double> costs;
+		for (auto& candidate : candidates)
+			costs.push_back(curve(candidate.Neurons));
+		return costs;
+	});
+	Check(capped.Run() == 150, "WidthSearch stops at the maximum width");
+}
+
+int main()
+{
+	TestSparseMatrixMultiply();
+	TestRecordSelectionResolve();
+	TestContentHash();
+	TestProgressiveEstimate();
+	TestSoften();
+	TestImportanceSamplerWeights();
+	TestWidthSearch();
+	if (failures > 0)
+	{
+		std::cerr << failures << " check(s) failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All checks passed" << std::endl;
+	return 0;
+}